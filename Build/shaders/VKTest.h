@@ -3,7 +3,10 @@
 
 #define TestWidth 65
 
-#define MAX_LEVELS 6
+#define MAX_LEVELS 16 // The deepest the clipmap goes (the height map pages that are loaded decide how much detail there really is)
+#define MAX_PLANETS 64 // The most planets/moons that can be drawn in a frame
+#define MAX_PATCHES 2048 // The most clipmap patches that can be drawn in a frame (for all planets)
+#define PAGE_WIDTH 257 // The width of a height map page (2 texels per quad in a patch, plus the edge it shares with its neighbors)
 
 #define TopEdge 0
 #define RightEdge 1
@@ -18,6 +21,15 @@
 #define BackFace 5
 #define FaceCount 6
 
+// The projection used to map cube face coordinates onto the sphere (in CubeFace and CubeFacePos).
+// GnomonicProjection just normalizes the point on the cube, which makes texels near the corners of a
+// face about 5 times smaller (in area) than texels in the center. TangentProjection warps each face
+// coordinate with tan() first, which brings that down to about 1.4, so far fewer texels are wasted.
+// Only change it here, since the shaders and the C++ code both have to use the same one.
+#define GnomonicProjection 0
+#define TangentProjection 1
+#define CubeProjection GnomonicProjection
+
 // Each face has 4 neighboring faces across the TopEdge, RightEdge, BottomEdge, and LeftEdge
 const ivec4 NeighborFace[FaceCount] = {
 	{TopFace, BackFace, BottomFace, FrontFace}, // Right face
@@ -43,10 +55,16 @@ const ivec4 NeighborEdge[FaceCount] = {
 // NeighborEdge[FrontFace][LeftEdge] would be RightEdge, so
 // NeighborFace[LeftFace][RightEdge] would point back to FrontFace
 
+struct PlanetData {
+	vec4 vPosition;	// xyz = the planet's center, w = its radius
+};
+
 struct PlanetFaceData {
-	ivec4 iFace;
+	ivec4 iFace;	// x = face, y = level, z = index into the planet array
 	vec4 vCorners;
 	vec4 vHole;
+	vec4 vPage[4];	// The height map page for each of the 2x2 nodes (at this level) the patch can straddle, starting at the top-left:
+					// xy = the top-left corner of the page's node, z = 1 / its width, w = its layer (or -1 if nothing is loaded)
 };
 
 
@@ -0,0 +1,47 @@
+// main.cpp
+// A console version of "VKTest.exe -test" and "VKTest.exe -benchmark" for the planet code that doesn't need
+// a GPU (or Windows), so the patch selection can be checked and timed from a script.
+// Logging goes to log/VKContext.log under the current directory, and the exit code is 1 if any check failed.
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKGeometry.h"
+#include "../VKTest/CubeFace.h"
+#include "../VKTest/PlanetLOD.h"
+#include "../VKTest/PlanetSystem.h"
+
+namespace VK {
+// VKContext.cpp has these, but nothing else from it is needed here
+void ThrowException(const char *psz) { throw psz; }
+ThrowExceptionFunc Throw = &ThrowException;
+}
+
+int main(int argc, char *argv[]) {
+	VK::Logger logger;
+	bool benchmark = false, test = argc < 2; // With no options, it just runs the checks
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-benchmark") == 0)
+			benchmark = true;
+		else if (strcmp(argv[i], "-test") == 0)
+			test = true;
+		else {
+			printf("Usage: %s [-test] [-benchmark]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	bool passed = true;
+	if (benchmark) {
+		passed &= CubeFace::Benchmark(1 << 22);
+		PlanetLOD::Benchmark(1 << 20);
+		PlanetSystem::Benchmark(48, 1 << 12);
+	}
+	if (test) {
+		passed &= NodeKey::Test();
+		passed &= PlanetLOD::Test();
+		passed &= PlanetSystem::Test();
+		passed &= PageCache::Test();
+	}
+	printf("%s (see %s)\n", passed ? "Passed" : "Some of the checks failed", (VK::Path::Log() + "VKContext.log").c_str());
+	return passed ? 0 : 1;
+}
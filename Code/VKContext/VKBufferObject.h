@@ -4,55 +4,58 @@
 #define __VKUniformBuffer_h__
 
 #include "VKContext.h"
+#include "VKMath.h"
 
 namespace VK {
 
 class BufferObject : public Object {
 private:
 	VkBuffer buffer;
-	MemoryAllocateInfo allocInfo;
-	VkDeviceMemory mem;
+	Allocation alloc;
 	VkDeviceSize size;
 
 public:
-	BufferObject() : buffer(NULL), mem(NULL) {}
+	BufferObject() : buffer(NULL) {}
 	virtual ~BufferObject() { destroy(); }
 	virtual uint32_t getSize() const { return (uint32_t)size; }
 	virtual bool isValid() const { return buffer != NULL; }
 	virtual void destroy() {
-		if (mem) {
-			vkFreeMemory(vk, mem, NULL);
-			mem = NULL;
-		}
-		if (buffer) {
-			vkDestroyBuffer(vk, buffer, NULL);
-			buffer = NULL;
-		}
+		// The frames in flight may still be using it, so it goes once they're done
+		vk.deferDestroy(vkDestroyBuffer, buffer);
+		buffer = NULL;
+		vk.deferFree(alloc);
 	}
 
 	operator VkBuffer() const { return buffer; }
-	operator VkDeviceMemory() const { return mem; }
+	operator VkDeviceMemory() const { return alloc.mem; }
+
+	const Allocation &getAllocation() const { return alloc; }
 
-	void create(VkBufferUsageFlags usage, VkDeviceSize size, VkDescriptorPool pool = NULL, VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
+	/// Returns where the buffer is mapped (it stays mapped for its lifetime), or NULL if it isn't host-visible
+	uint8_t *getMappedData() const { return alloc.pData; }
+
+	/// Creates the buffer in memory with the specified properties. If it isn't host-visible (i.e. VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	/// update() goes through the context's Uploader.
+	void create(VkBufferUsageFlags usage, VkDeviceSize size, VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 		this->size = size;
+		if (!(props & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+			usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		BufferCreateInfo info(size, usage);
 		OBJ_CHECK(vkCreateBuffer(vk, &info, NULL, &buffer));
 		VkMemoryRequirements requirements;
 		vkGetBufferMemoryRequirements(vk, buffer, &requirements);
-		allocInfo.allocationSize = requirements.size;
-
-		bool pass = findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &allocInfo.memoryTypeIndex);
-		OBJ_CHECK(vkAllocateMemory(vk, &allocInfo, NULL, &mem));
-		OBJ_CHECK(vkBindBufferMemory(vk, buffer, mem, 0));
+		if (!vk.getAllocator().allocate(requirements, props, true, alloc))
+			VKLogException("Failed to allocate %llu bytes of memory for a buffer", (unsigned long long)requirements.size);
+		OBJ_CHECK(vkBindBufferMemory(vk, buffer, alloc.mem, alloc.offset));
 	}
 
 	void update(void *src, VkDeviceSize offset = 0, VkDeviceSize bytes = -1) {
 		if (bytes == -1)
 			bytes = size - offset;
-		void *dest = NULL;
-		OBJ_CHECK(vkMapMemory(vk, mem, offset, bytes, 0, &dest));
-		memcpy(dest, src, bytes);
-		vkUnmapMemory(vk, mem);
+		if (alloc.pData)
+			memcpy(alloc.pData + offset, src, bytes);
+		else
+			vk.getUploader().upload(buffer, offset, src, bytes);
 	}
 };
 
@@ -69,14 +72,8 @@ public:
 	virtual ~UniformBuffer() { destroy(); }
 	virtual bool isValid() const { return BufferObject::isValid() && descriptorSet != NULL; }
 	virtual void destroy() {
-		if (descriptorSet) {
-			// Descriptor pools often use reset instead of free
-			descriptorSet = NULL;
-		}
-		if (descriptorSetLayout) {
-			vkDestroyDescriptorSetLayout(vk, descriptorSetLayout, NULL);
-			descriptorSetLayout = NULL;
-		}
+		vk.deferFree(descriptorSet);
+		descriptorSetLayout = NULL; // The allocator owns it
 		BufferObject::destroy();
 	}
 
@@ -85,10 +82,11 @@ public:
 	operator VkDescriptorSetLayout() const { return descriptorSetLayout; }
 	operator VkDescriptorSet() const { return descriptorSet; }
 
-	void create(VkDeviceSize size, VkDescriptorPool pool = NULL, VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
+	/// \param flags The shader stages that read it (0 to skip creating a descriptor set for it)
+	void create(VkDeviceSize size, VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
 		BufferObject::create(usage, size);
 
-		if (pool && flags != 0) {
+		if (flags != 0) {
 			descriptorInfo.buffer = *this;
 			descriptorInfo.offset = 0;
 			descriptorInfo.range = size;
@@ -97,11 +95,8 @@ public:
 			if(usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
 				descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 			DescriptorSetLayoutBinding binding(0, descriptorType, 1, flags);
-			DescriptorSetLayoutCreateInfo layoutInfo(&binding, 1);
-			OBJ_CHECK(vkCreateDescriptorSetLayout(vk, &layoutInfo, NULL, &descriptorSetLayout));
-
-			VK::DescriptorSetAllocateInfo setInfo(pool, &descriptorSetLayout);
-			OBJ_CHECK(vkAllocateDescriptorSets(vk, &setInfo, &descriptorSet));
+			descriptorSetLayout = vk.getDescriptors().getLayout(&binding, 1);
+			descriptorSet = vk.getDescriptors().allocate(descriptorSetLayout);
 
 			WriteDescriptorSet write(descriptorSet, &descriptorInfo, descriptorType);
 			vkUpdateDescriptorSets(vk, 1, &write, 0, NULL);
@@ -109,6 +104,97 @@ public:
 	}
 };
 
+/// A host-visible buffer that stays mapped, split into a region for each frame in flight. Anything the CPU writes
+/// once per frame (uniforms, instance data) gets an aligned range of the current frame's region from allocate(),
+/// and is bound with a dynamic offset (see DynamicDescriptor). A frame's region is only reused after its fence
+/// says the GPU is done with it, so writing to it never needs a map/unmap and never races the GPU.
+class RingBuffer : public BufferObject {
+private:
+	VkDeviceSize frameSize; ///< The size of each frame's region
+	VkDeviceSize alignment; ///< What each offset is rounded up to (to work as a dynamic uniform or storage buffer offset)
+	VkDeviceSize head; ///< The end of the last range handed out in the current frame's region
+	VkDeviceSize peak; ///< The most any frame has used
+	uint64_t frame; ///< The frame number head belongs to
+	std::mutex lock; ///< So secondary command buffers can be recorded (and allocate from the ring) on several threads at once
+
+public:
+	RingBuffer() : BufferObject(), frameSize(0), alignment(1), head(0), peak(0), frame(0) {}
+	virtual ~RingBuffer() { destroy(); }
+
+	VkDeviceSize getFrameSize() const { return frameSize; }
+	VkDeviceSize getPeak() const { return peak; }
+
+	/// \param size The most that will be allocated in one frame
+	void create(VkDeviceSize size, VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+		const VkPhysicalDeviceLimits &limits = deviceProperties.limits;
+		alignment = Math::Max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+		frameSize = (size + alignment - 1) / alignment * alignment;
+		BufferObject::create(usage, frameSize * Context::FramesInFlight);
+		head = peak = 0;
+		frame = vk.getFrameNumber();
+	}
+
+	/// Hands out room for nBytes in the current frame's region, which stays valid until the frame is submitted
+	/// (it's safe to call from several threads at once)
+	/// \param nOffset (Out) Where it starts in the buffer (to pass to vkCmdBindDescriptorSets as a dynamic offset)
+	/// \return Where to write it
+	uint8_t *allocate(VkDeviceSize nBytes, uint32_t &nOffset) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (frame != vk.getFrameNumber()) {
+			frame = vk.getFrameNumber();
+			head = 0;
+		}
+		VkDeviceSize nStart = (head + alignment - 1) / alignment * alignment;
+		if (nStart + nBytes > frameSize)
+			VKLogException("RingBuffer::allocate - No room for %llu bytes (%llu of %llu used this frame)", (unsigned long long)nBytes, (unsigned long long)head, (unsigned long long)frameSize);
+		head = nStart + nBytes;
+		peak = Math::Max(peak, head);
+		nOffset = (uint32_t)(vk.getFrameIndex() * frameSize + nStart);
+		return getMappedData() + nOffset;
+	}
+
+	template <class T> T *allocate(uint32_t &nOffset, uint32_t nCount = 1) { return (T *)allocate(sizeof(T) * nCount, nOffset); }
+};
+
+/// A descriptor set for a uniform or storage buffer in a RingBuffer. It's bound with the offset allocate() returned
+/// (vkCmdBindDescriptorSets' pDynamicOffsets), so the same set works for every range in every frame.
+class DynamicDescriptor : public Object {
+private:
+	VkDescriptorType descriptorType;
+	VkDescriptorBufferInfo descriptorInfo;
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkDescriptorSet descriptorSet;
+
+public:
+	DynamicDescriptor() : descriptorSetLayout(NULL), descriptorSet(NULL) {}
+	virtual ~DynamicDescriptor() { destroy(); }
+	virtual bool isValid() const { return descriptorSet != NULL; }
+	virtual void destroy() {
+		vk.deferFree(descriptorSet);
+		descriptorSetLayout = NULL; // The allocator owns it
+	}
+
+	operator VkDescriptorSetLayout() const { return descriptorSetLayout; }
+	operator VkDescriptorSet() const { return descriptorSet; }
+
+	/// \param ring The buffer the ranges come from
+	/// \param range The size of what the shader reads at each offset
+	/// \param type VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC or VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC
+	void create(RingBuffer &ring, VkDeviceSize range, VkDescriptorType type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
+		descriptorInfo.buffer = ring;
+		descriptorInfo.offset = 0;
+		descriptorInfo.range = range;
+
+		descriptorType = type;
+		DescriptorSetLayoutBinding binding(0, descriptorType, 1, flags);
+		descriptorSetLayout = vk.getDescriptors().getLayout(&binding, 1);
+		descriptorSet = vk.getDescriptors().allocate(descriptorSetLayout);
+
+		WriteDescriptorSet write(descriptorSet, &descriptorInfo, descriptorType);
+		vkUpdateDescriptorSets(vk, 1, &write, 0, NULL);
+	}
+};
+
 } // namespace VK
 
 #endif // __VKUniformBuffer_h__
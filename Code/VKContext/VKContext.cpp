@@ -102,7 +102,7 @@ bool Context::Init() {
 		VKLogException("Failed to load global function: %s", #fun); \
 		return false; \
 	}
-#include "vulkan/VKFunctions.inl"
+#include "Vulkan/VKFunctions.inl"
 
 	// Initialize the GLSL compiler so we can compile to SPIRV in-process
 	glslang::InitializeProcess();
@@ -138,11 +138,16 @@ Context::Context()
 	, debugCallback(NULL)
 	, presentIndex(-1)
 	, graphicsIndex(-1)
-	, sigImageAvailable(NULL)
-	, sigRenderingFinished(NULL)
+	, transferIndex(-1)
+	, pipelineCache(NULL)
 	, queue(NULL)
-	, pool(NULL)
+	, frameIndex(0)
+	, frameNumber(0)
+	, flushFence(NULL)
 	, cmd(NULL)
+	, acquired(false)
+	, imageIndex(0)
+	, waitTime(0)
 	, swapchain(NULL)
 {
 	pCurrent = this; // Set this before create() is called in case VK::Object instances are declared at the same scope
@@ -202,7 +207,7 @@ bool Context::create(InstanceHandle inst, WindowHandle wnd, bool val, const char
 
 // As soon as we create the instance, we need to call vkGetInstanceProcAddr for all instance functions
 #define VK_INSTANCE_LEVEL_FUNCTION( fun ) if( !(fun = (PFN_##fun)vkGetInstanceProcAddr( instance, #fun )) ) VKLogDebug("Instance function failed to load: %s", #fun);
-#include "vulkan/VKFunctions.inl"
+#include "Vulkan/VKFunctions.inl"
 
 	if (validate)
 		VK_CHECK(vkCreateDebugReportCallbackEXT(instance, &dbgCreateInfo, NULL, &debugCallback));
@@ -272,30 +277,62 @@ bool Context::create(InstanceHandle inst, WindowHandle wnd, bool val, const char
 			graphicsIndex = n; // ...together with the first graphics queue we find
 	}
 
+	// Use a transfer-only queue family for uploads if there is one (that can copy any region of an image), otherwise
+	// just share the graphics queue
+	transferIndex = graphicsIndex;
+	for (n = 0; n < queueFamilies.size(); n++) {
+		const VkQueueFamilyProperties &family = queueFamilies[n];
+		const VkExtent3D &granularity = family.minImageTransferGranularity;
+		if ((family.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0 && (family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0 &&
+			granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+			transferIndex = n;
+			break;
+		}
+	}
+
 	std::vector<DeviceQueueCreateInfo> queueInfo = { DeviceQueueCreateInfo(graphicsIndex) };
 	if (graphicsIndex != presentIndex)
 		queueInfo.push_back(DeviceQueueCreateInfo(presentIndex));
+	if (transferIndex != graphicsIndex && transferIndex != presentIndex)
+		queueInfo.push_back(DeviceQueueCreateInfo(transferIndex));
 	DeviceCreateInfo deviceInfo(queueInfo, enabledDeviceLayers, enabledDeviceExtensions);
 	deviceInfo.pEnabledFeatures = &deviceFeatures;
 	VK_CHECK(vkCreateDevice(physicalDevice, &deviceInfo, NULL, &device));
 
 // As soon as we create the device, we need to call vkGetDeviceProcAddr for all instance functions
 #define VK_DEVICE_LEVEL_FUNCTION( fun ) if( !(fun = (PFN_##fun)vkGetDeviceProcAddr( device, #fun )) ) VKLogDebug("Device function failed to load: %s", #fun);
-#include "vulkan/VKFunctions.inl"
+#include "Vulkan/VKFunctions.inl"
+	allocator.init(device);
+	descriptors.init(device, FramesInFlight);
 
-	// Create semaphores to synchronize swapping images between the back buffer and the screen
+	// Get the graphics device queue, and create a command pool, a fence, and semaphores to synchronize swapping images
+	// between the back buffer and the screen for each frame in flight (the fences start signaled, so the first frames
+	// don't wait for anything)
+	vkGetDeviceQueue(device, graphicsIndex, 0, &queue);
 	VkSemaphoreCreateInfo semaphore_create_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,  NULL, 0 };
-	VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &sigImageAvailable));
-	VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &sigRenderingFinished));
+	VkFenceCreateInfo fence_create_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, NULL, VK_FENCE_CREATE_SIGNALED_BIT };
+	for (uint32_t n = 0; n < FramesInFlight; n++) {
+		CommandPoolCreateInfo poolInfo(graphicsIndex);
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		VK_CHECK(vkCreateCommandPool(device, &poolInfo, NULL, &frames[n].pool));
+		VK_CHECK(vkCreateFence(device, &fence_create_info, NULL, &frames[n].fence));
+		VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frames[n].sigImageAvailable));
+		VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frames[n].sigRenderingFinished));
+	}
+	fence_create_info.flags = 0;
+	VK_CHECK(vkCreateFence(device, &fence_create_info, NULL, &flushFence));
 
-	// Get the graphics device queue and create a command pool and buffer for initialization tasks
-	vkGetDeviceQueue(device, graphicsIndex, 0, &queue);
-	CommandPoolCreateInfo poolInfo(graphicsIndex);
-	VK_CHECK(vkCreateCommandPool(device, &poolInfo, NULL, &pool));
-	CommandBufferAllocateInfo bufferInfo(pool, 1);
-	CommandBufferBeginInfo cmdBeginInfo(0);
-	VK_CHECK(vkAllocateCommandBuffers(device, &bufferInfo, &cmd));
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+	VkQueue transferQueue = queue;
+	if (transferIndex != graphicsIndex)
+		vkGetDeviceQueue(device, transferIndex, 0, &transferQueue);
+	uploader.init(device, transferQueue, transferIndex, graphicsIndex, allocator);
+	loadPipelineCache();
+
+	// Start recording the first frame (for initialization tasks)
+	frameIndex = 0;
+	frameNumber = 0;
+	waitTime = 0;
+	beginFrame();
 
 	return true;
 }
@@ -307,6 +344,8 @@ void Context::destroy() {
 
 	if (device) {
 		vkDeviceWaitIdle(device);
+		for (uint32_t n = 0; n < FramesInFlight; n++)
+			runDeletions(frames[n]);
 
 		if (swapchain) {
 			vkDestroySwapchainKHR(device, swapchain, NULL);
@@ -315,22 +354,40 @@ void Context::destroy() {
 
 		if (cmd) {
 			vkEndCommandBuffer(cmd);
-			vkDeviceWaitIdle(device);
-			vkFreeCommandBuffers(device, pool, 1, &cmd);
 			cmd = NULL;
 		}
-		if (pool) {
-			vkDestroyCommandPool(device, pool, NULL);
-			pool = VK_NULL_HANDLE;
+		for (uint32_t n = 0; n < FramesInFlight; n++) {
+			Frame &f = frames[n];
+			if (f.pool)
+				vkDestroyCommandPool(device, f.pool, NULL); // Frees its command buffers too
+			for (std::map<std::thread::id, ThreadPool>::iterator it = f.threads.begin(); it != f.threads.end(); it++)
+				vkDestroyCommandPool(device, it->second.pool, NULL);
+			f.threads.clear();
+			if (f.fence)
+				vkDestroyFence(device, f.fence, NULL);
+			if (f.sigImageAvailable)
+				vkDestroySemaphore(device, f.sigImageAvailable, NULL);
+			if (f.sigRenderingFinished)
+				vkDestroySemaphore(device, f.sigRenderingFinished, NULL);
+			f.cmds.clear();
+			f.used = 0;
+			f.pool = VK_NULL_HANDLE;
+			f.fence = VK_NULL_HANDLE;
+			f.sigImageAvailable = f.sigRenderingFinished = VK_NULL_HANDLE;
 		}
+		if (flushFence)
+			vkDestroyFence(device, flushFence, NULL);
+		flushFence = VK_NULL_HANDLE;
 		queue = VK_NULL_HANDLE;
 
-		if (sigImageAvailable)
-			vkDestroySemaphore(device, sigImageAvailable, NULL);
-		sigImageAvailable = NULL;
-		if (sigRenderingFinished)
-			vkDestroySemaphore(device, sigRenderingFinished, NULL);
-		sigRenderingFinished = NULL;
+		if (pipelineCache) {
+			savePipelineCache();
+			vkDestroyPipelineCache(device, pipelineCache, NULL);
+			pipelineCache = VK_NULL_HANDLE;
+		}
+		uploader.destroy();
+		descriptors.destroy();
+		allocator.destroy();
 		vkDestroyDevice(device, NULL);
 		device = NULL;
 	}
@@ -344,13 +401,59 @@ void Context::destroy() {
 	}
 }
 
+void Context::loadPipelineCache() {
+	// Only hand the driver data from the same device and driver build (some drivers don't check it very well)
+	Path path = Path::Cache() + "pipelines.bin";
+	std::string data;
+	if (path.exists() && path.file())
+		data = path.read();
+	bool bValid = data.size() >= 16 + VK_UUID_SIZE;
+	if (bValid) {
+		const uint32_t *pHeader = (const uint32_t *)data.data();
+		bValid = pHeader[0] >= 16 + VK_UUID_SIZE && pHeader[0] <= data.size() &&
+			pHeader[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			pHeader[2] == deviceProperties.vendorID &&
+			pHeader[3] == deviceProperties.deviceID &&
+			memcmp(&pHeader[4], deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		if (!bValid)
+			VKLogInfo("Context - Discarding a pipeline cache from a different device or driver");
+	}
+	if (!bValid)
+		data.clear();
+
+	PipelineCacheCreateInfo cacheInfo(data.empty() ? NULL : data.data(), data.size());
+	VK_CHECK(vkCreatePipelineCache(device, &cacheInfo, NULL, &pipelineCache));
+	VKLogInfo("Context - Loaded %u bytes of pipeline cache", (uint32_t)data.size());
+}
+
+void Context::savePipelineCache() {
+	size_t nSize = 0;
+	if (vkGetPipelineCacheData(device, pipelineCache, &nSize, NULL) != VK_SUCCESS || nSize == 0)
+		return;
+	std::string data(nSize, '\0');
+	if (vkGetPipelineCacheData(device, pipelineCache, &nSize, &data[0]) != VK_SUCCESS)
+		return;
+
+	// Write it to a temporary file first, so a crash can't leave half a cache behind
+	Path dir = Path::Cache(), path = dir + "pipelines.bin", temp = dir + "pipelines.tmp";
+	dir.mkdir();
+	std::ofstream out((const char *)temp, std::ios::binary);
+	out.write(data.data(), nSize);
+	out.close();
+	if (!out || !path.del() || ::rename(temp, path) != 0) {
+		VKLogWarning("Context - Failed to save the pipeline cache to %s", (const char *)path);
+		temp.del();
+	}
+}
+
 bool Context::buildSwapchain(uint32_t w, uint32_t h) {
 	VkResult err = VK_SUCCESS;
 	uint32_t n = 0;
 
-	// If we're rebuilding the swapchain, destroy the image views (which will be rebuilt at the bottom)
+	// If we're rebuilding the swapchain, destroy the image views once the frames in flight let go of them
+	// (they'll be rebuilt at the bottom)
 	for (size_t n = 0; n < views.size(); n++)
-		vkDestroyImageView(device, views[n], NULL);
+		deferDestroy(vkDestroyImageView, views[n]);
 	views.clear();
 	images.clear();
 
@@ -398,66 +501,214 @@ bool Context::buildSwapchain(uint32_t w, uint32_t h) {
 	VkSwapchainKHR oldSwapchain = swapchainInfo.oldSwapchain = swapchain;
 	VK_CHECK(vkCreateSwapchainKHR(device, &swapchainInfo, NULL, &swapchain));
 
-	// If we just re-created an existing swapchain, we should destroy the old swapchain at this point.
+	// If we just re-created an existing swapchain, the old one is retired, and it can be destroyed once the frames in flight are done with its images.
 	// Note: destroying the swapchain also cleans up all its associated presentable images once the platform is done with them.
-	if (oldSwapchain != VK_NULL_HANDLE)
-		vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+	deferDestroy(vkDestroySwapchainKHR, oldSwapchain);
 
 	VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &n, NULL));
 	images.resize(n);
 	VK_CHECK(vkGetSwapchainImagesKHR(device, swapchain, &n, &images[0]));
 
+	// Initialize the swapchain images to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR (all in one barrier). The top of the
+	// "present" function needs to know what format it's in, and since the bottom of the "present" function needs
+	// to change it to this, it makes sense to start it off in that format.
 	views.resize(n);
+	std::list<Image> wrappers; // Images can't be copied
+	Barrier barrier;
 	for (size_t n = 0; n < views.size(); n++) {
-		// Initialize the swapchain image to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR. The top of the "present" function needs
-		// to know what format it's in, and since the bottom of the "present" function needs to change it to this,
-		// it makes sense to start it off in that format.
-		Image(images[n]).setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		wrappers.emplace_back(images[n]);
+		barrier.image(wrappers.back(), VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 		ImageViewCreateInfo viewInfo(images[n], surfaceFormats[0].format, VK_IMAGE_ASPECT_COLOR_BIT);
 		VK_CHECK(vkCreateImageView(device, &viewInfo, NULL, &views[n]));
 	}
+	barrier.record(cmd);
 
 	return true;
 }
 
-/// Flushes and rebuilds the primary command buffer tied to the graphics queue
-void Context::flush() {
-	vkEndCommandBuffer(cmd);
-	SubmitInfo submitInfo(&cmd);
-	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-	VK_CHECK(vkQueueWaitIdle(queue));
-
-	vkFreeCommandBuffers(device, pool, 1, &cmd);
-	CommandBufferAllocateInfo bufferInfo(pool, 1);
-	CommandBufferBeginInfo cmdBeginInfo(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
-	VK_CHECK(vkAllocateCommandBuffers(device, &bufferInfo, &cmd));
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+void Context::beginFrame() {
+	Frame &f = frames[frameIndex];
+	double t = Timer::Time();
+	VK_CHECK(vkWaitForFences(device, 1, &f.fence, VK_TRUE, UINT64_MAX));
+	waitTime += Timer::Time() - t;
+	VK_CHECK(vkResetFences(device, 1, &f.fence));
+	runDeletions(f);
+	VK_CHECK(vkResetCommandPool(device, f.pool, 0));
+	f.used = 0;
+	for (std::map<std::thread::id, ThreadPool>::iterator it = f.threads.begin(); it != f.threads.end(); it++) {
+		VK_CHECK(vkResetCommandPool(device, it->second.pool, 0));
+		it->second.used = 0;
+	}
+	uploader.update(frameNumber, FramesInFlight);
+	descriptors.beginFrame(frameIndex);
+	cmd = nextCommandBuffer();
 }
 
-bool Context::present(VkImage image) {
-	flush();
-
-	uint32_t i;
-	nLastError = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, sigImageAvailable, VK_NULL_HANDLE, &i);
-	if (nLastError != VK_SUCCESS) {
-		if (nLastError != VK_SUBOPTIMAL_KHR) {
-			// Caller needs to check last error for VK_ERROR_OUT_OF_DATE_KHR
-			return false;
+void Context::defer(const std::function<void()> &fn) {
+	if (!device) {
+		fn();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(deleteLock);
+	frames[frameIndex].deletions.push_back(fn);
+}
+
+void Context::deferFree(Allocation &a) {
+	if (a.valid()) {
+		MemoryAllocator *pAllocator = &allocator;
+		Allocation copy = a;
+		defer([pAllocator, copy]() mutable { pAllocator->free(copy); });
+	}
+	a = Allocation();
+}
+
+void Context::deferFree(VkDescriptorSet &set) {
+	if (set) {
+		DescriptorAllocator *pDescriptors = &descriptors;
+		VkDescriptorSet copy = set;
+		defer([pDescriptors, copy]() mutable { pDescriptors->free(copy); });
+	}
+	set = VK_NULL_HANDLE;
+}
+
+void Context::runDeletions(Frame &f) {
+	// Take the queue first, so anything it destroys can defer more deletions (to the frame being recorded)
+	std::vector<std::function<void()> > deletions;
+	{
+		std::lock_guard<std::mutex> lock(deleteLock);
+		deletions.swap(f.deletions);
+	}
+	for (size_t i = 0; i < deletions.size(); i++)
+		deletions[i]();
+}
+
+VkCommandBuffer Context::nextCommandBuffer() {
+	Frame &f = frames[frameIndex];
+	if (f.used == f.cmds.size()) {
+		CommandBufferAllocateInfo bufferInfo(f.pool, 1);
+		f.cmds.push_back(VK_NULL_HANDLE);
+		VK_CHECK(vkAllocateCommandBuffers(device, &bufferInfo, &f.cmds.back()));
+	}
+	VkCommandBuffer next = f.cmds[f.used++];
+	CommandBufferBeginInfo cmdBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(next, &cmdBeginInfo));
+	return next;
+}
+
+VkCommandBuffer Context::beginSecondary(VkRenderPass pass, VkFramebuffer framebuffer, uint32_t subpass) {
+	// Only this thread ever touches its own pool, but the map (and nLastError) are shared, so this holds the lock until
+	// the buffer is begun. Recording into it afterwards doesn't need the lock, and that's where the time goes.
+	std::lock_guard<std::mutex> lock(threadLock);
+	ThreadPool &t = frames[frameIndex].threads[std::this_thread::get_id()];
+	if (!t.pool) {
+		CommandPoolCreateInfo poolInfo(graphicsIndex);
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		VK_CHECK(vkCreateCommandPool(device, &poolInfo, NULL, &t.pool));
+	}
+	if (t.used == t.cmds.size()) {
+		CommandBufferAllocateInfo bufferInfo(t.pool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		t.cmds.push_back(VK_NULL_HANDLE);
+		VK_CHECK(vkAllocateCommandBuffers(device, &bufferInfo, &t.cmds.back()));
+	}
+	VkCommandBuffer next = t.cmds[t.used++];
+	CommandBufferBeginInfo cmdBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+	cmdBeginInfo.inheritance.renderPass = pass;
+	cmdBeginInfo.inheritance.subpass = subpass;
+	cmdBeginInfo.inheritance.framebuffer = framebuffer;
+	VK_CHECK(vkBeginCommandBuffer(next, &cmdBeginInfo));
+	return next;
+}
+
+void Context::submit(VkFence fence, VkSemaphore waitSemaphore, VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore) {
+	std::vector<VkCommandBuffer> cmds;
+	std::vector<VkSemaphore> waits, signals;
+	std::vector<VkPipelineStageFlags> stages;
+
+	// Anything uploaded since the last submit goes first, and this waits for it (after acquiring it from the
+	// transfer queue family in a command buffer of its own, since cmd may already use it)
+	if (uploader.isPending()) {
+		VkCommandBuffer acquire = uploader.needsAcquire() ? nextCommandBuffer() : VK_NULL_HANDLE;
+		waits.push_back(uploader.submit(frameNumber, acquire));
+		stages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		if (acquire) {
+			VK_CHECK(vkEndCommandBuffer(acquire));
+			cmds.push_back(acquire);
 		}
-		VKLogDebug("Suboptimal KHR!");
 	}
+	if (waitSemaphore) {
+		waits.push_back(waitSemaphore);
+		stages.push_back(waitStage);
+	}
+	if (signalSemaphore)
+		signals.push_back(signalSemaphore);
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+	cmds.push_back(cmd);
+	SubmitInfo submitInfo(&cmds, &waits, &signals);
+	submitInfo.pWaitDstStageMask = stages.empty() ? NULL : &stages[0];
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+}
 
-	Image nextImage(images[i]);
-	nextImage.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	ImageCopy copy_region(extent.width, extent.height);
-	vkCmdCopyImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, nextImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-	nextImage.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-	flush();
+void Context::flush(bool bWait) {
+	// The frame's fence will cover this submit too (fences wait for everything submitted to the queue before them)
+	submit(bWait ? flushFence : VK_NULL_HANDLE);
+	if (bWait) {
+		VK_CHECK(vkWaitForFences(device, 1, &flushFence, VK_TRUE, UINT64_MAX));
+		VK_CHECK(vkResetFences(device, 1, &flushFence));
+	}
+	cmd = nextCommandBuffer();
+}
 
-	std::vector<VkSemaphore> sem = { sigImageAvailable };
-	PresentInfoKHR present_info(&swapchain, &i, &sem);
-	nLastError = vkQueuePresentKHR(queue, &present_info);
-	return true;
+bool Context::acquire() {
+	if (!acquired) {
+		nLastError = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, frames[frameIndex].sigImageAvailable, VK_NULL_HANDLE, &imageIndex);
+		if (nLastError == VK_SUBOPTIMAL_KHR)
+			VKLogDebug("Suboptimal KHR!");
+		acquired = nLastError == VK_SUCCESS || nLastError == VK_SUBOPTIMAL_KHR;
+	}
+	return acquired;
+}
+
+bool Context::present() {
+	// RenderPass::createSwapchain() makes the first pass into the swapchain image wait for this stage
+	return submitFrame(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+}
+
+bool Context::present(VkImage image) {
+	if (acquire()) {
+		// The frame waits for the image to be acquired at the transfer stage, so the transition has to wait for that stage
+		Image nextImage(images[imageIndex]);
+		nextImage.setState(ImageState(VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, VK_PIPELINE_STAGE_TRANSFER_BIT));
+		nextImage.setLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		ImageCopy copy_region(extent.width, extent.height);
+		vkCmdCopyImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, nextImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+		nextImage.setLayout(VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	}
+	return submitFrame(VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
+
+bool Context::submitFrame(VkPipelineStageFlags waitStage) {
+	// Submit the whole frame at once with its fence (even if there's nothing to present, so the fence still gets signaled).
+	// Drawing to the swapchain image waits for the presentation engine to let go of it, and presenting waits for the drawing.
+	Frame &f = frames[frameIndex];
+	VkResult result = nLastError; // In case acquire() failed
+	submit(f.fence, acquired ? f.sigImageAvailable : VK_NULL_HANDLE, waitStage, acquired ? f.sigRenderingFinished : VK_NULL_HANDLE);
+	bool presented = acquired;
+	if (acquired) {
+		std::vector<VkSemaphore> sem = { f.sigRenderingFinished };
+		PresentInfoKHR present_info(&swapchain, &imageIndex, &sem);
+		result = vkQueuePresentKHR(queue, &present_info);
+		acquired = false;
+	}
+
+	// Move on to the next frame, which only waits if the GPU is still working on the last frame that used it
+	frameIndex = (frameIndex + 1) % FramesInFlight;
+	frameNumber++;
+	beginFrame();
+
+	// Caller needs to check last error for VK_ERROR_OUT_OF_DATE_KHR
+	nLastError = result;
+	return presented;
 }
 
 } // namespace VK
@@ -9,6 +9,9 @@
 #define __VKContext_h__
 
 #include "VKCore.h"
+#include "VKMemory.h"
+#include "VKUploader.h"
+#include "VKDescriptor.h"
 
 namespace VK {
 
@@ -49,7 +52,32 @@ public:
 	typedef std::map<uint32_t, Object *> ObjectMap;
 	typedef std::list<std::string> WarningList;
 
+	/// The number of frames the CPU can record while the GPU is still working on earlier ones
+	static const uint32_t FramesInFlight = 2;
+
 private:
+	/// A command pool only one thread records secondary command buffers from (a pool can't be used by two threads at once)
+	struct ThreadPool {
+		VkCommandPool pool; ///< Reset along with the frame's primary pool
+		std::vector<VkCommandBuffer> cmds; ///< Allocated from pool as they're needed, and reused after it's reset
+		uint32_t used; ///< The number of cmds begun since pool was last reset
+
+		ThreadPool() : pool(NULL), used(0) {}
+	};
+
+	/// Everything one frame in flight needs to itself, so it can be recorded while the others are still on the GPU
+	struct Frame {
+		VkCommandPool pool; ///< Reset (not freed) each time this frame comes around again
+		std::vector<VkCommandBuffer> cmds; ///< Allocated from pool as they're needed, and reused after it's reset
+		uint32_t used; ///< The number of cmds begun since pool was last reset
+		std::map<std::thread::id, ThreadPool> threads; ///< A pool for each thread that has recorded secondary command buffers for this frame
+		std::vector<std::function<void()> > deletions; ///< Run once the GPU finishes this frame (see defer())
+		VkFence fence; ///< Signaled when the GPU finishes the frame's last submit (and everything before it)
+		VkSemaphore sigImageAvailable, sigRenderingFinished;
+
+		Frame() : pool(NULL), used(0), fence(NULL), sigImageAvailable(NULL), sigRenderingFinished(NULL) {}
+	};
+
 	static uint32_t nextID; ///< The next ID for the Vulkan object map below
 	static Context *pCurrent; ///< Points to the current Vulkan context (set using makeCurrent())
 	static LibraryHandle hLib; ///< Handle to the Vulkan library
@@ -75,14 +103,25 @@ private:
 	VkSurfaceKHR surface;
 	VkDevice device;
 	VkDebugReportCallbackEXT debugCallback;
-	uint32_t presentIndex, graphicsIndex;
-	VkSemaphore sigImageAvailable, sigRenderingFinished;
+	uint32_t presentIndex, graphicsIndex, transferIndex;
+	MemoryAllocator allocator;
+	Uploader uploader;
+	DescriptorAllocator descriptors;
+	VkPipelineCache pipelineCache; ///< Saved to disk when the context is destroyed, so pipelines don't have to be compiled from scratch every run
 
 	// These are tied to the graphics queue, which only needs to be initialized once
-	// (The command buffer will get rebuilt every time commands are flushed.)
+	// (cmd is always recording, and belongs to the current frame.)
 	VkQueue queue;
-	VkCommandPool pool;
+	Frame frames[FramesInFlight];
+	uint32_t frameIndex; ///< The frame being recorded
+	uint64_t frameNumber; ///< The number of frames submitted so far
+	VkFence flushFence; ///< Signaled when a flush(true) completes
 	VkCommandBuffer cmd;
+	std::mutex threadLock; ///< Guards each frame's map of thread pools (see beginSecondary())
+	std::mutex deleteLock; ///< Guards each frame's deletion queue (see defer())
+	bool acquired; ///< Set once a swapchain image has been acquired for the current frame
+	uint32_t imageIndex; ///< The swapchain image acquired for the current frame
+	double waitTime; ///< The total time spent waiting for frames to finish on the GPU
 
 	// These are tied to the swapchain, which needs to be rebuild every time the window changes size/position
 	VkSwapchainKHR swapchain;
@@ -96,6 +135,14 @@ private:
 		const char *pLayerPrefix, const char *pMsg, void *pUserData
 	);
 
+	void beginFrame(); ///< Waits for the current frame to finish on the GPU, resets its command pool, and starts recording it again
+	void runDeletions(Frame &f); ///< Runs (and clears) what defer() queued for a frame
+	VkCommandBuffer nextCommandBuffer(); ///< Starts recording the current frame's next command buffer
+	void submit(VkFence fence, VkSemaphore waitSemaphore = VK_NULL_HANDLE, VkPipelineStageFlags waitStage = 0, VkSemaphore signalSemaphore = VK_NULL_HANDLE); ///< Submits cmd (after any pending uploads)
+	bool submitFrame(VkPipelineStageFlags waitStage); ///< Submits the current frame, presents its swapchain image (if it has one), and begins the next frame
+	void loadPipelineCache(); ///< Creates pipelineCache with the data saved by the last run (if it came from this device and driver)
+	void savePipelineCache(); ///< Writes pipelineCache's data to disk
+
 public:
 	VkResult nLastError; ///< The last error code set by a VK call
 	const char *pszLastError; ///< The last error message set by a VK call
@@ -114,8 +161,77 @@ public:
 	bool buildSwapchain(uint32_t w, uint32_t h);
 
 	void makeCurrent() { pCurrent = this; } ///< Makes this the currently active Vulkan context
-	void flush(); ///< Flushes and rebuilds the primary command buffer tied to the graphics queue
-	bool present(VkImage image); ///< Presents the specified image to the next swapchain image
+
+	/// Submits everything recorded so far in this frame and keeps recording in a new command buffer.
+	/// The GPU keeps going on its own unless bWait is set, which waits for just this submit to finish
+	/// (e.g. before freeing a staging buffer it reads from), not for the whole queue to go idle.
+	void flush(bool bWait = false);
+
+	/// Acquires the next swapchain image for the current frame to draw into (see RenderPass::createSwapchain()).
+	/// Returns false if there isn't one (check nLastError for VK_ERROR_OUT_OF_DATE_KHR), in which case skip drawing to it.
+	bool acquire();
+
+	/// Submits the frame and queues the swapchain image it drew into for presentation, then starts recording the
+	/// next frame (which waits for the GPU to finish the one that used it last)
+	bool present();
+
+	/// Like present(), but copies the specified image to the next swapchain image first (in case the frame
+	/// wasn't drawn straight into the swapchain)
+	bool present(VkImage image);
+
+	/// Starts recording a secondary command buffer for the current frame that continues subpass of pass in framebuffer.
+	/// It's safe to call from several threads at once (each thread gets a command pool of its own), so a frame's passes
+	/// can be recorded in parallel. Each thread ends its own buffers, then the pass is begun in cmd with
+	/// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS and they're run with vkCmdExecuteCommands(). Nothing is inherited
+	/// from cmd but the pass, so each buffer has to set its own viewport and scissor and bind its own pipeline and sets.
+	VkCommandBuffer beginSecondary(VkRenderPass pass, VkFramebuffer framebuffer, uint32_t subpass = 0);
+
+	/// Waits for the GPU to finish every frame in flight (e.g. before destroying something they use)
+	void waitIdle() { if (device) vkDeviceWaitIdle(device); }
+
+	/// Queues fn to run once the GPU is done with the frame being recorded (and so with every frame before it), which is
+	/// when it's safe to destroy anything those frames might use. Nothing has to wait for the GPU to go idle first, so
+	/// it's fine to use from hot reloads, resizes, and streaming. It's safe to call from any thread, and fn runs right
+	/// away if there's no device.
+	void defer(const std::function<void()> &fn);
+
+	/// Destroys a Vulkan object with its vkDestroy* function (i.e. vkDestroyBuffer) once the GPU is done with it (see defer())
+	template <class T> void deferDestroy(void (VKAPI_PTR *pfnDestroy)(VkDevice, T, const VkAllocationCallbacks *), T handle) {
+		if (handle) {
+			VkDevice d = device;
+			defer([pfnDestroy, d, handle]() { pfnDestroy(d, handle, NULL); });
+		}
+	}
+
+	/// Gives back a resource's memory once the GPU is done with it (see defer()), and clears a
+	void deferFree(Allocation &a);
+
+	/// Gives back a descriptor set from getDescriptors().allocate() once the GPU is done with it (see defer()), and clears set
+	void deferFree(VkDescriptorSet &set);
+
+	/// Returns which of the FramesInFlight frames is being recorded (for anything the CPU writes once per frame)
+	uint32_t getFrameIndex() const { return frameIndex; }
+
+	/// Returns the number of frames submitted so far (it goes up by one each time a new frame starts recording)
+	uint64_t getFrameNumber() const { return frameNumber; }
+
+	/// Returns the swapchain image acquired for the current frame (see acquire())
+	uint32_t getImageIndex() const { return imageIndex; }
+
+	/// Returns the total time (in seconds) the CPU has spent waiting for frames to finish on the GPU
+	double getWaitTime() const { return waitTime; }
+
+	/// Returns the allocator that buffers and images get their device memory from
+	MemoryAllocator &getAllocator() { return allocator; }
+
+	/// Returns the uploader that copies data into device-local buffers and images (the copies are submitted with the next flush() or present())
+	Uploader &getUploader() { return uploader; }
+
+	/// Returns the allocator that descriptor sets and set layouts come from
+	DescriptorAllocator &getDescriptors() { return descriptors; }
+
+	/// Returns the pipeline cache to create every pipeline with (it's safe to use from several threads at once)
+	VkPipelineCache getPipelineCache() const { return pipelineCache; }
 
 	/// Call to add a warning
 	void addWarning(const char *psz) { warnings.push_back(psz); }
@@ -151,7 +267,7 @@ public:
 	operator VkSurfaceKHR() const { return surface; }
 	operator VkDevice() const { return device; }
 	operator VkQueue() const { return queue; }
-	operator VkCommandPool() const { return pool; }
+	operator VkCommandPool() const { return frames[frameIndex].pool; } ///< (Reset every FramesInFlight frames)
 	operator VkCommandBuffer() const { return cmd; }
 	operator VkSwapchainKHR() const { return swapchain; }
 
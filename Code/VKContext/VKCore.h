@@ -16,12 +16,13 @@ namespace VK {
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
 
 #ifdef _WIN32
 #ifndef _CRT_SECURE_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
 #endif
-#include <stdarg.h>
 #else
 //#include <limits.h>
 //#include <sys/time.h>
@@ -44,13 +45,15 @@ namespace VK {
 
 
 // The main Vulkan header(s)
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 #define VK_NO_PROTOTYPES
 #define WIN32_LEAN_AND_MEAN 1
 #define _USE_MATH_DEFINES
-#include "vulkan/vulkan.h"
-#include "vulkan/VKFunctions.h"
-#include "vulkan/VKStruct.h"
+#include "Vulkan/vulkan.h"
+#include "Vulkan/VKFunctions.h"
+#include "Vulkan/VKStruct.h"
 
 #include "VKSingleton.h"
 #include "VKPath.h"
@@ -275,6 +275,16 @@ bool Statement::bind(int n, double dValue) {
 	return false;
 }
 
+bool Statement::bindBlob(int n, const void *pData, int nBytes) {
+	int nResult = pData ?
+		::sqlite3_bind_blob(m_pStmt, n, pData, nBytes, SQLITE_TRANSIENT) :
+		::sqlite3_bind_null(m_pStmt, n);
+	if(nResult == SQLITE_OK)
+		return true;
+	m_pConn->handleError(nResult, "Failed to bind column", m_bThrowExceptions);
+	return false;
+}
+
 int Statement::type(int n) {
 	return ::sqlite3_column_type(m_pStmt, n);
 }
@@ -307,6 +317,12 @@ const char *Statement::getText(int n, const char *pszDefault) {
 	return (const char *)sqlite3_column_text(m_pStmt, n);
 }
 
+const void *Statement::getBlob(int n, int &nBytes) {
+	const void *pData = sqlite3_column_blob(m_pStmt, n);
+	nBytes = sqlite3_column_bytes(m_pStmt, n); // Has to come after sqlite3_column_blob()
+	return pData;
+}
+
 } // namespace DB
 } // namespace VK
 
@@ -148,6 +148,7 @@ public:
 	bool bind(int n, unsigned int nValue) { return bind(n, (int64_t)nValue); }
 	bool bind(int n, uint64_t nValue) { return bind(n, (int64_t)nValue); }
 	bool bind(int n, const std::string &str) { return bind(n, str.c_str(), (int)str.length()); }
+	bool bindBlob(int n, const void *pData, int nBytes); // Copies the data (so it doesn't have to outlive the call)
 
 	bool bind_null(int n, int nValue, int nNull=-1) {
 		if(nValue == nNull) return bind(n);
@@ -169,6 +170,7 @@ public:
 	int64_t getInt64(int n, int64_t nDefault=-1);
 	double getDouble(int n, double dDefault=-1.0);
 	const char *getText(int n, const char *pszDefault=NULL);
+	const void *getBlob(int n, int &nBytes); // Valid until the next call to next() or reset()
 };
 
 } // namespace DB
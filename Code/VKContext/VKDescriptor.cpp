@@ -0,0 +1,181 @@
+// VKDescriptor.cpp
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#include "VKCore.h"
+#include "VKContext.h"
+#include <algorithm>
+
+namespace VK {
+
+// Roughly what a set needs of each descriptor type, so a pool with room for n sets gets n times these. A scene that
+// leans on one type runs a pool out of that type before it runs out of sets, but then the next pool is bigger.
+static const VkDescriptorPoolSize PoolRatios[] = {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER, 1 }
+};
+
+void DescriptorAllocator::init(VkDevice device, uint32_t nFrames) {
+	m_device = device;
+	m_frames.resize(nFrames);
+	m_nFrame = 0;
+}
+
+void DescriptorAllocator::destroy() {
+	Thread::AutoLock lock(m_lock);
+	if (!m_device)
+		return;
+
+	// Destroying a pool frees every set in it
+	for (size_t i = 0; i < m_persistent.pools.size(); i++)
+		vkDestroyDescriptorPool(m_device, m_persistent.pools[i], NULL);
+	m_persistent = Chain();
+	for (size_t n = 0; n < m_frames.size(); n++) {
+		for (size_t i = 0; i < m_frames[n].pools.size(); i++)
+			vkDestroyDescriptorPool(m_device, m_frames[n].pools[i], NULL);
+	}
+	m_frames.clear();
+	m_sets.clear();
+
+	for (std::map<std::vector<uint64_t>, VkDescriptorSetLayout>::iterator it = m_layouts.begin(); it != m_layouts.end(); it++)
+		vkDestroyDescriptorSetLayout(m_device, it->second, NULL);
+	m_layouts.clear();
+	m_device = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::beginFrame(uint32_t nFrame) {
+	Thread::AutoLock lock(m_lock);
+	m_nFrame = nFrame;
+	Chain &chain = m_frames[nFrame];
+	for (uint32_t i = 0; i < chain.pools.size() && i <= chain.nCurrent; i++) // The ones after nCurrent were never touched
+		vkResetDescriptorPool(m_device, chain.pools[i], 0);
+	chain.nCurrent = 0;
+	chain.nSets = 0;
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t nSets, bool bFree) {
+	const uint32_t nTypes = sizeof(PoolRatios) / sizeof(PoolRatios[0]);
+	VkDescriptorPoolSize sizes[nTypes];
+	for (uint32_t i = 0; i < nTypes; i++) {
+		sizes[i].type = PoolRatios[i].type;
+		sizes[i].descriptorCount = PoolRatios[i].descriptorCount * nSets;
+	}
+	DescriptorPoolCreateInfo poolInfo(sizes, nTypes);
+	poolInfo.maxSets = nSets;
+	if (bFree)
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkResult result = vkCreateDescriptorPool(m_device, &poolInfo, NULL, &pool);
+	if (result != VK_SUCCESS)
+		VKLogException("DescriptorAllocator - Failed to create a pool for %u sets (%s)", nSets, ResultString(result));
+	return pool;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(Chain &chain, VkDescriptorSetLayout layout, bool bFree, VkDescriptorPool &pool) {
+	// A pool that's out of room fails the allocation (the error depends on the driver), so move on to the next one,
+	// and add a bigger pool to the end of the chain when they're all out of room
+	DescriptorSetAllocateInfo setInfo(VK_NULL_HANDLE, &layout);
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	for (;;) {
+		bool bNew = chain.nCurrent == chain.pools.size();
+		if (bNew) {
+			uint32_t nSets = MinPoolSets;
+			for (size_t i = 0; i < chain.pools.size() && nSets < MaxPoolSets; i++)
+				nSets *= 2;
+			chain.pools.push_back(createPool(nSets, bFree));
+		}
+		setInfo.descriptorPool = chain.pools[chain.nCurrent];
+		VkResult result = vkAllocateDescriptorSets(m_device, &setInfo, &set);
+		if (result == VK_SUCCESS)
+			break;
+		if (bNew) // If it doesn't fit in an empty pool, it never will
+			VKLogException("DescriptorAllocator - Failed to allocate a set from a new pool (%s)", ResultString(result));
+		chain.nCurrent++;
+	}
+	chain.nSets++;
+	pool = setInfo.descriptorPool;
+	return set;
+}
+
+VkDescriptorSetLayout DescriptorAllocator::getLayout(const VkDescriptorSetLayoutBinding *pBindings, uint32_t nCount) {
+	// The signature is each binding (sorted by binding number) packed into a pair of words, followed by any immutable samplers
+	std::vector<const VkDescriptorSetLayoutBinding *> sorted(nCount);
+	for (uint32_t i = 0; i < nCount; i++)
+		sorted[i] = &pBindings[i];
+	std::sort(sorted.begin(), sorted.end(), [](const VkDescriptorSetLayoutBinding *a, const VkDescriptorSetLayoutBinding *b) { return a->binding < b->binding; });
+	std::vector<uint64_t> key;
+	for (uint32_t i = 0; i < nCount; i++) {
+		const VkDescriptorSetLayoutBinding &b = *sorted[i];
+		key.push_back(((uint64_t)b.binding << 32) | (uint64_t)b.descriptorType);
+		key.push_back(((uint64_t)b.descriptorCount << 32) | (uint64_t)b.stageFlags);
+		for (uint32_t j = 0; b.pImmutableSamplers && j < b.descriptorCount; j++)
+			key.push_back((uint64_t)b.pImmutableSamplers[j]);
+	}
+
+	Thread::AutoLock lock(m_lock);
+	VkDescriptorSetLayout &layout = m_layouts[key];
+	if (!layout) {
+		VkDescriptorSetLayoutCreateInfo layoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, NULL, 0, nCount, pBindings };
+		VkResult result = vkCreateDescriptorSetLayout(m_device, &layoutInfo, NULL, &layout);
+		if (result != VK_SUCCESS) {
+			m_layouts.erase(key);
+			VKLogException("DescriptorAllocator - Failed to create a layout with %u bindings (%s)", nCount, ResultString(result));
+		}
+	}
+	return layout;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+	Thread::AutoLock lock(m_lock);
+	VkDescriptorPool pool;
+	VkDescriptorSet set = allocate(m_persistent, layout, true, pool);
+	m_sets[set] = pool;
+	return set;
+}
+
+void DescriptorAllocator::free(VkDescriptorSet &set) {
+	Thread::AutoLock lock(m_lock);
+	std::map<VkDescriptorSet, VkDescriptorPool>::iterator it = m_sets.find(set);
+	if (it != m_sets.end()) { // Otherwise it was already freed by destroy()
+		vkFreeDescriptorSets(m_device, it->second, 1, &set);
+		m_persistent.nSets--;
+
+		// The pool it went back to has room again, so start looking there next time
+		for (uint32_t i = 0; i < m_persistent.nCurrent; i++) {
+			if (m_persistent.pools[i] == it->second) {
+				m_persistent.nCurrent = i;
+				break;
+			}
+		}
+		m_sets.erase(it);
+	}
+	set = VK_NULL_HANDLE;
+}
+
+VkDescriptorSet DescriptorAllocator::allocateTransient(VkDescriptorSetLayout layout) {
+	Thread::AutoLock lock(m_lock);
+	VkDescriptorPool pool;
+	return allocate(m_frames[m_nFrame], layout, false, pool);
+}
+
+void DescriptorAllocator::logStats() const {
+	Thread::AutoLock lock(m_lock);
+	uint32_t nPools = 0, nSets = 0;
+	for (size_t n = 0; n < m_frames.size(); n++) {
+		nPools += (uint32_t)m_frames[n].pools.size();
+		nSets += m_frames[n].nSets;
+	}
+	VKLogInfo("Descriptors: %u sets in %u pools, %u transient sets in %u pools, %u layouts",
+		m_persistent.nSets, (uint32_t)m_persistent.pools.size(), nSets, nPools, (uint32_t)m_layouts.size());
+}
+
+} // namespace VK
@@ -0,0 +1,84 @@
+// VKDescriptor.h
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#ifndef __VKDescriptor_h__
+#define __VKDescriptor_h__
+
+namespace VK {
+
+/// Hands out descriptor sets and set layouts, so nothing has to guess how big a descriptor pool needs to be.
+///
+/// Sets come from chains of pools. When the pool at the end of a chain runs out, another one is added (with room for
+/// twice as many sets, up to MaxPoolSets) and the set comes from that, so the number of sets is only limited by memory.
+/// There are two chains:
+/// - allocate() hands out sets that last until they're given back with free() (i.e. one for each buffer or image).
+/// - allocateTransient() hands out sets that only last for the current frame in flight. Each frame has a chain of
+///   its own that's reset (not freed) when the frame comes around again, and its pools don't keep a free list,
+///   so it's cheap enough to allocate a set for every draw.
+///
+/// Layouts are cached by their bindings (see getLayout()), so everything with the same bindings shares one layout
+/// (and can share sets). The allocator owns them, so they're destroyed with it.
+class DescriptorAllocator {
+public:
+	static const uint32_t MinPoolSets = 64; ///< The number of sets in the first pool of each chain
+	static const uint32_t MaxPoolSets = 4096; ///< The most sets a pool grows to
+
+protected:
+	/// A list of pools that are used in order (each one only gets used once the ones before it run out)
+	struct Chain {
+		std::vector<VkDescriptorPool> pools;
+		uint32_t nCurrent; ///< The first pool that might still have room
+		uint32_t nSets; ///< The number of sets handed out since it was last reset
+		Chain() : nCurrent(0), nSets(0) {}
+	};
+
+	Thread::Lock m_lock;
+	VkDevice m_device;
+	Chain m_persistent; ///< Pools created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+	std::vector<Chain> m_frames; ///< One chain for each frame in flight
+	uint32_t m_nFrame; ///< The frame in flight allocateTransient() uses
+	std::map<VkDescriptorSet, VkDescriptorPool> m_sets; ///< The pool each persistent set came from
+	std::map<std::vector<uint64_t>, VkDescriptorSetLayout> m_layouts; ///< Every layout getLayout() has created (by signature)
+
+	VkDescriptorPool createPool(uint32_t nSets, bool bFree);
+	VkDescriptorSet allocate(Chain &chain, VkDescriptorSetLayout layout, bool bFree, VkDescriptorPool &pool);
+
+public:
+	DescriptorAllocator() : m_device(VK_NULL_HANDLE), m_nFrame(0) {}
+	~DescriptorAllocator() { destroy(); }
+
+	/// Call once the device is created
+	/// \param nFrames The number of frames in flight (each gets its own chain of transient pools)
+	void init(VkDevice device, uint32_t nFrames);
+
+	/// Destroys every pool and layout (call before the device is destroyed, after the objects using them are destroyed)
+	void destroy();
+
+	/// Resets the transient pools for a frame in flight and makes it the one allocateTransient() uses
+	/// (call once the GPU is done with the last frame that used it)
+	void beginFrame(uint32_t nFrame);
+
+	/// Returns the layout for a set with the specified bindings, creating it the first time those bindings are asked for.
+	/// The order of the bindings doesn't matter. The allocator owns the layout, so don't destroy it.
+	VkDescriptorSetLayout getLayout(const VkDescriptorSetLayoutBinding *pBindings, uint32_t nCount);
+
+	/// Hands out a set that lasts until it's given back with free()
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	/// Gives back a set allocate() handed out (after the GPU is done with it), and clears set
+	void free(VkDescriptorSet &set);
+
+	/// Hands out a set that only lasts until this frame in flight comes around again (so write it and bind it this frame)
+	VkDescriptorSet allocateTransient(VkDescriptorSetLayout layout);
+
+	/// Logs how many pools, sets, and layouts there are
+	void logStats() const;
+};
+
+} // namespace VK
+
+#endif // __VKDescriptor_h__
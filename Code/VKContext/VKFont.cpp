@@ -290,9 +290,9 @@ bool Font::load(const char *pszFile) {
 		nVertex += (unsigned int)symbol.vertices.size();
 	}
 
-	vbo.create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vb.size() * sizeof(float));
+	vbo.create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vb.size() * sizeof(float), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	vbo.update(&vb[0]);
-	ibo.create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, ib.size() * sizeof(uint16_t));
+	ibo.create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, ib.size() * sizeof(uint16_t), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	ibo.update(&ib[0]);
 
 	Symbol &sym = symbols[' '];
@@ -7,57 +7,125 @@
 namespace VK {
 
 void Image::destroy() {
-	if (view) {
-		vkDestroyImageView(vk, view, NULL);
-		view = NULL;
-	}
-	if (mem) {
-		vkFreeMemory(vk, mem, NULL);
-		mem = NULL;
-		if (image)
-			vkDestroyImage(vk, image, NULL);
+	// The frames in flight may still be using it, so it goes once they're done
+	vk.deferDestroy(vkDestroyImageView, view);
+	view = NULL;
+	if (alloc.valid()) { // Otherwise the image belongs to someone else (i.e. the swapchain)
+		vk.deferDestroy(vkDestroyImage, image);
+		vk.deferFree(alloc);
 	}
 	image = NULL;
 }
 
-void Image::setLayout(VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout) {
-	VkResult err = VK_SUCCESS;
-	uint32_t srcAccessMask = 0, dstAccessMask = 0;
-	switch (oldLayout) {
-		case VK_IMAGE_LAYOUT_PREINITIALIZED:
-			srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-			break;
+ImageState ImageState::ForLayout(VkImageLayout l) {
+	switch (l) {
+		case VK_IMAGE_LAYOUT_GENERAL: // It could be used for anything, so wait for (and make it visible to) everything
+			return ImageState(l, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+			return ImageState(l, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+			return ImageState(l, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+			return ImageState(l, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: // Textures get sampled in vertex shaders here too (i.e. height maps)
+			return ImageState(l, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			break;
+			return ImageState(l, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-			srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			break;
+			return ImageState(l, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		case VK_IMAGE_LAYOUT_PREINITIALIZED:
+			return ImageState(l, VK_ACCESS_HOST_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+		case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: // The presentation engine waits for a semaphore, not a barrier
+			return ImageState(l, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		default: // VK_IMAGE_LAYOUT_UNDEFINED (there's nothing in it to wait for)
+			return ImageState(l);
 	}
-	switch (newLayout) {
-		case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-			dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-			dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-			dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-			dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-			break;
-		case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-			dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-			break;
+}
+
+VkImageAspectFlags Image::getAspect() const {
+	switch (imageInfo.format) {
+		case VK_FORMAT_D16_UNORM:
+		case VK_FORMAT_X8_D24_UNORM_PACK32:
+		case VK_FORMAT_D32_SFLOAT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT;
+		case VK_FORMAT_S8_UINT:
+			return VK_IMAGE_ASPECT_STENCIL_BIT;
+		case VK_FORMAT_D16_UNORM_S8_UINT:
+		case VK_FORMAT_D24_UNORM_S8_UINT:
+		case VK_FORMAT_D32_SFLOAT_S8_UINT:
+			return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		default:
+			return VK_IMAGE_ASPECT_COLOR_BIT;
 	}
-	ImageMemoryBarrier barrier(image, srcAccessMask, dstAccessMask, oldLayout, newLayout, aspect);
-	barrier.subresourceRange.layerCount = imageInfo.arrayLayers;
-	vkCmdPipelineBarrier(vk, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
-	layout = newLayout;
+}
+
+void Image::setLayout(VkImageLayout newLayout, VkPipelineStageFlags stages, VkAccessFlags access, uint32_t baseLayer, uint32_t layerCount) {
+	Barrier().image(*this, newLayout, stages, access, baseLayer, layerCount).record(vk);
+}
+
+void Image::setState(const ImageState &state, uint32_t baseLayer, uint32_t layerCount) {
+	if (layerCount == VK_REMAINING_ARRAY_LAYERS)
+		layerCount = imageInfo.arrayLayers - baseLayer;
+	for (uint32_t i = baseLayer * imageInfo.mipLevels; i < (baseLayer + layerCount) * imageInfo.mipLevels; i++)
+		states[i] = state;
+}
+
+Barrier &Barrier::image(Image &image, VkImageLayout layout, VkPipelineStageFlags stages, VkAccessFlags access, uint32_t baseLayer, uint32_t layerCount, uint32_t baseMip, uint32_t mipCount) {
+	ImageState next = ImageState::ForLayout(layout);
+	if (stages)
+		next.stages = stages;
+	if (access)
+		next.access = access;
+	if (!next.stages)
+		next.stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+	const ImageCreateInfo &info = image.imageInfo;
+	if (layerCount == VK_REMAINING_ARRAY_LAYERS)
+		layerCount = info.arrayLayers - baseLayer;
+	if (mipCount == VK_REMAINING_MIP_LEVELS)
+		mipCount = info.mipLevels - baseMip;
+	VkImageAspectFlags aspect = image.getAspect();
+	for (uint32_t mip = baseMip; mip < baseMip + mipCount; mip++) {
+		for (uint32_t layer = baseLayer; layer < baseLayer + layerCount; layer++) {
+			ImageState &s = image.states[layer * info.mipLevels + mip];
+			ImageState after = next;
+			if (s.layout == layout && ((s.access | next.access) & WriteAccess) == 0) {
+				// Reads don't have to wait for other reads, but the last write has to be made visible to any new
+				// readers (the barrier that made it available waited for it, so this one only has to wait for that)
+				if ((next.stages & ~s.stages) == 0 && (next.access & ~s.access) == 0)
+					continue;
+				after = ImageState(layout, s.access | next.access, s.stages | next.stages);
+			}
+			srcStages |= s.stages ? s.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			dstStages |= next.stages;
+
+			// Only writes have to be made available (waiting for the reads is enough to keep them from seeing later writes)
+			ImageMemoryBarrier barrier(image.image, s.access & WriteAccess, next.access, s.layout, layout, aspect);
+			barrier.subresourceRange = ImageSubresourceRange(aspect, mip, 1, layer, 1);
+			s = after;
+
+			// Extend the last barrier instead if it ends at the layer before this one and starts in the same state
+			if (!images.empty()) {
+				ImageMemoryBarrier &last = images.back();
+				if (last.image == barrier.image && last.subresourceRange.baseMipLevel == mip &&
+					last.subresourceRange.baseArrayLayer + last.subresourceRange.layerCount == layer &&
+					last.oldLayout == barrier.oldLayout && last.newLayout == barrier.newLayout &&
+					last.srcAccessMask == barrier.srcAccessMask && last.dstAccessMask == barrier.dstAccessMask) {
+					last.subresourceRange.layerCount++;
+					continue;
+				}
+			}
+			images.push_back(barrier);
+		}
+	}
+	return *this;
+}
+
+void Barrier::record(VkCommandBuffer cmd) {
+	if (!images.empty())
+		vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, 0, NULL, 0, NULL, (uint32_t)images.size(), &images[0]);
+	images.clear();
+	srcStages = dstStages = 0;
 }
 
 void Image::createTexture(VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkFlags requiredProps, uint32_t width, uint32_t height, uint32_t depth, VkImageLayout iLayout, uint32_t layers) {
@@ -65,15 +133,16 @@ void Image::createTexture(VkFormat format, VkImageTiling tiling, VkImageUsageFla
 	imageInfo.tiling = tiling;
 	imageInfo.initialLayout = iLayout == VK_IMAGE_LAYOUT_PREINITIALIZED ? VK_IMAGE_LAYOUT_PREINITIALIZED : VK_IMAGE_LAYOUT_UNDEFINED;
 	OBJ_CHECK(vkCreateImage(vk, &imageInfo, NULL, &image));
+	resetStates(imageInfo.initialLayout);
 
 	VkMemoryRequirements requirements;
 	vkGetImageMemoryRequirements(vk, image, &requirements);
 
-	allocInfo = MemoryAllocateInfo(requirements, requiredProps);
-	OBJ_CHECK(vkAllocateMemory(vk, &allocInfo, NULL, &mem));
-	OBJ_CHECK(vkBindImageMemory(vk, image, mem, 0));
+	if (!vk.getAllocator().allocate(requirements, requiredProps, tiling == VK_IMAGE_TILING_LINEAR, alloc))
+		VKLogException("Failed to allocate %llu bytes of memory for an image", (unsigned long long)requirements.size);
+	OBJ_CHECK(vkBindImageMemory(vk, image, alloc.mem, alloc.offset));
 	if (iLayout != VK_IMAGE_LAYOUT_PREINITIALIZED && iLayout != VK_IMAGE_LAYOUT_UNDEFINED) {
-		setLayout(VK_IMAGE_ASPECT_COLOR_BIT, imageInfo.initialLayout, iLayout);
+		setLayout(iLayout);
 	}
 
 	if ((usage & (VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) != 0) {
@@ -93,15 +162,18 @@ void Image::loadTexture(const char *path) {
 	if(!pb.load(path))
 		throw "Failed to load texture";
 
-	VkFormatProperties &props = formatProperties[VK_FORMAT_R8G8B8A8_UNORM];
-	bool direct = (props.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
-
-	VkImageSubresource subres = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-	VkSubresourceLayout sublayout;
-	createTexture(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_LINEAR, direct ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, pb.getWidth(), pb.getHeight());
-	vkGetImageSubresourceLayout(vk, image, &subres, &sublayout);
-	uint8_t *data = NULL;
-	OBJ_CHECK(vkMapMemory(vk, mem, 0, allocInfo.allocationSize, 0, (void **)&data));
+	// Create a device-local image, and have the uploader copy the pixels into it (converted to RGBA as they're staged)
+	createTexture(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pb.getWidth(), pb.getHeight(), 1, VK_IMAGE_LAYOUT_UNDEFINED);
+	VkBufferImageCopy region;
+	memset(&region, 0, sizeof(region));
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = pb.getWidth();
+	region.imageExtent.height = pb.getHeight();
+	region.imageExtent.depth = 1;
+	uint32_t rowPitch = pb.getWidth() * 4;
+	uint8_t *data = vk.getUploader().stageImage(image, region, rowPitch * pb.getHeight(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	setState(ImageState::ForLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)); // The graphics queue's acquire made it visible to shaders
 
 	uint32_t x = 0, y = 0;
 	uint8_t temp[4] = {0, 0, 0, 255};
@@ -134,47 +206,22 @@ void Image::loadTexture(const char *path) {
 				}
 				break;
 		}
-		data += sublayout.rowPitch;
+		data += rowPitch;
 	}
-	vkUnmapMemory(vk, mem);
-
-	if (direct) {
-		setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	} else {
-		// Create a staging image visible to the host to load the texture into with linear tiling
-		Image staging;
-		Math::Swap(staging.image, image);
-		Math::Swap(mem, staging.mem);
-		Math::Swap(layout, staging.layout);
-		Math::Swap(imageInfo, staging.imageInfo);
-		Math::Swap(allocInfo, staging.allocInfo);
-		staging.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-		// Now create the actual device-local image and copy into it from the staging image
-		createTexture(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, (VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pb.getWidth(), pb.getHeight());
-		setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		ImageCopy copy_region(pb.getWidth(), pb.getHeight());
-		vkCmdCopyImage(vk, staging.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-		setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-		vk.flush(); // Wait for the copy command to complete before the staging texture goes out of scope!
-	}
-
-	ImageViewCreateInfo viewInfo(image, imageInfo.format, VK_IMAGE_ASPECT_COLOR_BIT);
-	OBJ_CHECK(vkCreateImageView(vk, &viewInfo, NULL, &view));
 }
 
 void Image::createDepth(uint32_t width, uint32_t height) {
 	imageInfo = ImageCreateInfo(VK_FORMAT_D16_UNORM, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, width, height);
 	OBJ_CHECK(vkCreateImage(vk, &imageInfo, NULL, &image));
+	resetStates(imageInfo.initialLayout);
 
 	VkMemoryRequirements requirements;
 	vkGetImageMemoryRequirements(vk, image, &requirements);
 
-	allocInfo = MemoryAllocateInfo(requirements);
-	OBJ_CHECK(vkAllocateMemory(vk, &allocInfo, NULL, &mem));
-	OBJ_CHECK(vkBindImageMemory(vk, image, mem, 0));
-	setLayout(VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	if (!vk.getAllocator().allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, alloc))
+		VKLogException("Failed to allocate %llu bytes of memory for a depth buffer", (unsigned long long)requirements.size);
+	OBJ_CHECK(vkBindImageMemory(vk, image, alloc.mem, alloc.offset));
+	setLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
 	ImageViewCreateInfo viewInfo(image, imageInfo.format, VK_IMAGE_ASPECT_DEPTH_BIT);
 	OBJ_CHECK(vkCreateImageView(vk, &viewInfo, NULL, &view));
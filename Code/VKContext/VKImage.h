@@ -8,22 +8,50 @@
 
 namespace VK {
 
+/// The layout of one of an image's subresources, and how it was last accessed (the stages and access types
+/// the next barrier has to wait for). Only write access needs to be made available by the next barrier, but
+/// the reads are kept so that a write waits for all of them.
+struct ImageState {
+	VkImageLayout layout;
+	VkAccessFlags access;
+	VkPipelineStageFlags stages;
+
+	ImageState(VkImageLayout l = VK_IMAGE_LAYOUT_UNDEFINED, VkAccessFlags a = 0, VkPipelineStageFlags s = 0) : layout(l), access(a), stages(s) {}
+	bool operator==(const ImageState &s) const { return layout == s.layout && access == s.access && stages == s.stages; }
+	bool operator!=(const ImageState &s) const { return !(*this == s); }
+
+	/// Returns the way an image in layout l is usually accessed (used when the access isn't specified)
+	static ImageState ForLayout(VkImageLayout l);
+};
+
 class Image : public Object {
 private:
 	VkImage image;
 	VkImageView view;
-	VkDeviceMemory mem;
-	VkImageLayout layout;
+	Allocation alloc;
 	ImageCreateInfo imageInfo;
-	MemoryAllocateInfo allocInfo;
+	std::vector<ImageState> states; ///< One for each mip level of each array layer (layer by layer)
+
+	friend class Barrier;
+	void resetStates(VkImageLayout l) { states.assign(imageInfo.arrayLayers * imageInfo.mipLevels, ImageState(l)); }
 
 public:
-	Image(VkImage h=NULL) : image(h), view(VK_NULL_HANDLE), mem(VK_NULL_HANDLE) {}
+	Image(VkImage h=NULL) : image(h), view(VK_NULL_HANDLE), states(1) {}
 	~Image() { destroy();  }
 	virtual void destroy();
 	virtual bool isValid() const { return image != NULL; }
 
-	void setLayout(VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout);
+	/// Moves a range of layers to newLayout, to be accessed next at stages with access (both default to the usual
+	/// ones for newLayout). The old layout and what has to be waited for come from the state tracked for each
+	/// layer (see Barrier to transition several images with one barrier).
+	void setLayout(VkImageLayout newLayout, VkPipelineStageFlags stages = 0, VkAccessFlags access = 0, uint32_t baseLayer = 0, uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS);
+
+	/// Records that a range of layers is in state.layout and was accessed without going through setLayout() or
+	/// Barrier (i.e. by a render pass, by the uploader, or by the presentation engine)
+	void setState(const ImageState &state, uint32_t baseLayer = 0, uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS);
+	const ImageState &getState(uint32_t layer = 0, uint32_t mip = 0) const { return states[layer * imageInfo.mipLevels + mip]; }
+	VkImageAspectFlags getAspect() const; ///< Returns the aspects the image's format has
+
 	void createTexture(VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkFlags requiredProps, uint32_t width, uint32_t height = 1, uint32_t depth = 1, VkImageLayout iLayout = VK_IMAGE_LAYOUT_PREINITIALIZED, uint32_t layers = 1);
 	void loadTexture(const char *path);
 	void createDepth(uint32_t width, uint32_t height);
@@ -31,12 +59,39 @@ public:
 	/// Casting operators to provide easy access to any handle when you need to call a Vulkan function manually
 	operator VkImage() const { return image; }
 	operator VkImageView() const { return view; }
-	operator VkDeviceMemory() const { return mem; }
+	operator VkDeviceMemory() const { return alloc.mem; }
 	operator VkFormat() const { return imageInfo.format; }
 
-	VkImageLayout getLayout() const { return layout; }
+	VkImageLayout getLayout() const { return states[0].layout; } ///< Returns the layout of the first layer
 	const ImageCreateInfo &getImageInfo() const { return imageInfo; }
-	const MemoryAllocateInfo &getAllocationInfo() const { return allocInfo; }
+	const Allocation &getAllocation() const { return alloc; }
+};
+
+/// Collects image layout transitions, along with the execution and memory dependencies they need, into a single
+/// vkCmdPipelineBarrier() call. Each Image tracks the layout of each of its subresources and how it was last
+/// accessed, so the caller only says how it's about to access them. The barrier only waits for the stages that
+/// accessed them last, and only makes writes available. Adjacent layers that are in the same state share one
+/// VkImageMemoryBarrier. A subresource can only be added once before record() is called.
+class Barrier {
+protected:
+	VkPipelineStageFlags srcStages, dstStages;
+	std::vector<ImageMemoryBarrier> images;
+
+public:
+	static const VkAccessFlags WriteAccess = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	Barrier() : srcStages(0), dstStages(0) {}
+	bool empty() const { return images.empty(); }
+
+	/// Makes a range of an image's layers (and mip levels) ready to be accessed next at stages with access in layout
+	/// (stages and access default to the usual ones for layout). Nothing is added for subresources that are already
+	/// in layout and have already been made visible to this (read) access.
+	Barrier &image(Image &image, VkImageLayout layout, VkPipelineStageFlags stages = 0, VkAccessFlags access = 0,
+		uint32_t baseLayer = 0, uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS, uint32_t baseMip = 0, uint32_t mipCount = VK_REMAINING_MIP_LEVELS);
+
+	/// Records everything added so far in one vkCmdPipelineBarrier() call (if anything was), and clears it to be reused
+	void record(VkCommandBuffer cmd);
 };
 
 class ImageSampler : public Image {
@@ -50,18 +105,10 @@ public:
 	virtual ~ImageSampler() { destroy(); }
 	virtual bool isValid() const { return Image::isValid() && descriptorSet != NULL; }
 	virtual void destroy() {
-		if (descriptorSet) {
-			// Descriptor pools often use reset instead of free
-			descriptorSet = NULL;
-		}
-		if (descriptorSetLayout) {
-			vkDestroyDescriptorSetLayout(vk, descriptorSetLayout, NULL);
-			descriptorSetLayout = NULL;
-		}
-		if (descriptorInfo.sampler) {
-			vkDestroySampler(vk, descriptorInfo.sampler, NULL);
-			descriptorInfo.sampler = NULL;
-		}
+		vk.deferFree(descriptorSet);
+		descriptorSetLayout = NULL; // The allocator owns it
+		vk.deferDestroy(vkDestroySampler, descriptorInfo.sampler);
+		descriptorInfo.sampler = NULL;
 
 		Image::destroy();
 	}
@@ -74,18 +121,15 @@ public:
 	operator VkDescriptorSetLayout() const { return descriptorSetLayout; }
 	operator VkDescriptorSet() const { return descriptorSet; }
 
-	void createDescriptor(VkDescriptorPool pool, VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
+	void createDescriptor(VkShaderStageFlags flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT) {
 		VK::SamplerCreateInfo samplerInfo;
 		descriptorInfo.imageLayout = getLayout();
 		descriptorInfo.imageView = Image::operator VkImageView();
 		OBJ_CHECK(vkCreateSampler(vk, &samplerInfo, NULL, &descriptorInfo.sampler));
 
 		DescriptorSetLayoutBinding binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, flags);
-		DescriptorSetLayoutCreateInfo layoutInfo(&binding, 1);
-		OBJ_CHECK(vkCreateDescriptorSetLayout(vk, &layoutInfo, NULL, &descriptorSetLayout));
-
-		VK::DescriptorSetAllocateInfo setInfo(pool, &descriptorSetLayout);
-		OBJ_CHECK(vkAllocateDescriptorSets(vk, &setInfo, &descriptorSet));
+		descriptorSetLayout = vk.getDescriptors().getLayout(&binding, 1);
+		descriptorSet = vk.getDescriptors().allocate(descriptorSetLayout);
 
 		WriteDescriptorSet write(descriptorSet, &descriptorInfo);
 		vkUpdateDescriptorSets(vk, 1, &write, 0, NULL);
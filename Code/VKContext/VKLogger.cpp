@@ -54,8 +54,8 @@ bool Logger::logMessage(const char *pszFile, int nLine, Level nSeverity, const c
 	m_ofLog << "Time: " << szTime << " " << "Severity: " << m_pszSeverity[nSeverity];
 	if(pszFile && *pszFile) {
 		const char *p = strrchr(pszFile, '/');
-		if(p++ == NULL) p = strrchr(pszFile, '\\');
-		if(p++ == NULL) p = pszFile;
+		if(p == NULL) p = strrchr(pszFile, '\\');
+		p = p ? p + 1 : pszFile;
 		m_ofLog << " Location: " << p << ":" << nLine;
 	}
 	m_ofLog << std::endl << pszMessage << std::endl << std::endl;
@@ -7,6 +7,15 @@
 #ifndef __VKLogger_h__
 #define __VKLogger_h__
 
+// The math headers use this without VKCore.h, so it includes what it needs itself
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <fstream>
+#include "VKSingleton.h"
+#include "VKThread.h"
+#include "VKTimer.h"
+
 namespace VK {
 
 //#define THROW_EXCEPTION // Comment out if you don't want logException to throw the message
@@ -10,7 +10,7 @@
 
 namespace VK {
 
-void Manager::init() {
+void Manager::init(VkDeviceSize nRingSize) {
 	// Load all shader techniques for the first time
 	loadFX("GLManager.glfx"); // This FX file is required by this class
 	updateShaders();
@@ -23,37 +23,25 @@ void Manager::init() {
 	if(!loadFont("arial1"))
 		VKLogException("Failed to load arial font!");
 
-	VkDescriptorPoolSize typeCounts[] = {
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 10 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 }
-	};
-	VK::DescriptorPoolCreateInfo poolInfo(typeCounts, 5);
-	OBJ_CHECK(vkCreateDescriptorPool(vk, &poolInfo, NULL, &descriptorPool));
-
-	sceneBuffer.create(sizeof(scene), descriptorPool);
-	guiBuffer.create(sizeof(gui), descriptorPool, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_SHADER_STAGE_VERTEX_BIT);
-	textBuffer.create(sizeof(text), descriptorPool, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_SHADER_STAGE_VERTEX_BIT);
-
-	VkDescriptorSetLayout layouts[] = { sceneBuffer, guiBuffer, textBuffer };
+	// Leave room for a few scene updates a frame, a full set of gui and text elements, and the padding between them
+	ring.create(4 * sizeof(SceneData) + MAX_GUI_INSTANCES * (sizeof(GUIData) + sizeof(TextData)) + 8 * 256 + nRingSize);
+	sceneDescriptor.create(ring, sizeof(SceneData));
+	guiDescriptor.create(ring, MAX_GUI_INSTANCES * sizeof(GUIData), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
+	textDescriptor.create(ring, MAX_GUI_INSTANCES * sizeof(TextData), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
+	sceneFrame = ~0ULL;
+
+	VkDescriptorSetLayout layouts[] = { sceneDescriptor, guiDescriptor, textDescriptor };
 	VK::PipelineLayoutCreateInfo pipelineLayoutInfo(layouts, 3);
 	OBJ_CHECK(vkCreatePipelineLayout(vk, &pipelineLayoutInfo, NULL, &pipelineLayout));
 }
 
 void Manager::destroy() {
-	textBuffer.destroy();
-	guiBuffer.destroy();
-	sceneBuffer.destroy();
-	if (descriptorPool) {
-		vkDestroyDescriptorPool(vk, descriptorPool, NULL);
-		descriptorPool = NULL;
-	}
-	if (pipelineLayout) {
-		vkDestroyPipelineLayout(vk, pipelineLayout, NULL);
-		pipelineLayout = NULL;
-	}
+	textDescriptor.destroy();
+	guiDescriptor.destroy();
+	sceneDescriptor.destroy();
+	ring.destroy();
+	vk.deferDestroy(vkDestroyPipelineLayout, pipelineLayout);
+	pipelineLayout = NULL;
 
 	m_mapFonts.clear();
 	m_mapTechniques.clear();
@@ -104,10 +92,12 @@ void Manager::reinit(RenderPass &guiPass, uint16_t nWidth, uint16_t nHeight) {
 	scene.mOrtho = VK::mat4::Ortho(0, nWidth, 0, nHeight, -1.0f, 1.0f);
 
 	// We can only rebuild the Text and GUI pipelines because they're the only ones using this class's pipelineLayout.
+	std::vector<VK::ShaderTechnique *> techniques;
 	for (std::map<std::string, VK::ShaderTechnique>::iterator it = m_mapTechniques.begin(); it != m_mapTechniques.end(); it++) {
 		if(it->second.isValid() && (it->first.substr(0, 3) == "GUI" || it->first.substr(0, 4) == "Text"))
-			it->second.buildPipeline(guiPass, pipelineLayout);
+			techniques.push_back(&it->second);
 	}
+	VK::ShaderTechnique::BuildPipelines(techniques, guiPass, pipelineLayout);
 }
 
 bool Manager::updateShaders() {
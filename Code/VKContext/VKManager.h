@@ -25,6 +25,8 @@ namespace VK {
 /// Provides a simple management layer for loading Vulkan shaders and fonts.
 /// It also manages the scene, gui, and text uniform buffers and GUI rendering calls.
 /// GUI rendering can be done in its own pass or as part of another pass.
+/// The scene, gui, and text data are written into a RingBuffer each frame and bound with dynamic offsets.
+/// The app can put its own per-frame data in the same ring (see init() and getRingBuffer()).
 class Manager {
 public:
 	Context &vk; ///< The Vulkan context we want to manage
@@ -40,22 +42,26 @@ protected:
 	std::map<std::string, FXFile> m_mapGLFXFiles; ///< Map of GLFX effect files
 	std::map<std::string, Font> m_mapFonts; ///< Map of managed fonts
 
-	VkDescriptorPool descriptorPool;
 	VkPipelineLayout pipelineLayout;
-	UniformBuffer sceneBuffer, guiBuffer, textBuffer;
+	RingBuffer ring; ///< Holds every frame's scene, gui, and text data (and anything the app allocates)
+	DynamicDescriptor sceneDescriptor, guiDescriptor, textDescriptor;
+	uint32_t sceneOffset, guiOffset, textOffset; ///< Where this frame's data is in ring
+	uint64_t sceneFrame; ///< The frame scene was last written to ring in
 
 	SceneData scene;
-	GUIData gui[MAX_GUI_INSTANCES];
-	TextData text[MAX_GUI_INSTANCES];
+	GUIData *gui; ///< Points into ring (from begin() to the end of the frame)
+	TextData *text; ///< Points into ring (from begin() to the end of the frame)
 	uint32_t nGUIElements, nTextElements;
 	ShaderTechnique *pLastTechnique;
 
 public:
-	Manager() : vk(*Context::GetCurrent()), m_fFOV(45.0f), m_fNear(0.1f), m_fFar(1000.0f), descriptorPool(NULL), pipelineLayout(NULL) {} ///< Default constructor
-	Manager(Context &context) : vk(context), m_fFOV(45.0f), m_fNear(0.1f), m_fFar(1000.0f), descriptorPool(NULL), pipelineLayout(NULL) {} ///< Default constructor
+	Manager() : vk(*Context::GetCurrent()), m_fFOV(45.0f), m_fNear(0.1f), m_fFar(1000.0f), pipelineLayout(NULL), sceneOffset(0), guiOffset(0), textOffset(0), sceneFrame(~0ULL), gui(NULL), text(NULL) {} ///< Default constructor
+	Manager(Context &context) : vk(context), m_fFOV(45.0f), m_fNear(0.1f), m_fFar(1000.0f), pipelineLayout(NULL), sceneOffset(0), guiOffset(0), textOffset(0), sceneFrame(~0ULL), gui(NULL), text(NULL) {} ///< Default constructor
 	~Manager() { destroy(); } ///< Default destructor (destroys Vulkan objects and context)
 
-	void init(); ///< Creates a number of useful default managed objects
+	/// Creates a number of useful default managed objects
+	/// @param[in] nRingSize The room to leave in each frame's part of the ring buffer for the app's own data
+	void init(VkDeviceSize nRingSize = 0);
 	void destroy(); ///< Destroys all managed objects
 	bool isValid() const { return !m_mapTechniques.empty(); }
 
@@ -73,13 +79,29 @@ public:
 	void cleanup(); ///< Call before rebuilding the swapchain
 	void reinit(RenderPass &guiPass, uint16_t nWidth, uint16_t nHeight); ///< Call after rebuilding the swapchain
 
-	UniformBuffer &getSceneBuffer() { return sceneBuffer; }
-	VkDescriptorPool &getDescriptorPool() { return descriptorPool; }
+	RingBuffer &getRingBuffer() { return ring; } ///< Returns the ring buffer for data the CPU writes once per frame
+	DynamicDescriptor &getSceneDescriptor() { return sceneDescriptor; } ///< Returns the scene's descriptor set (bind it with getSceneOffset())
+
+	/// Writes the scene's data to this frame's part of the ring. setViewMatrix() calls it, but if the view doesn't
+	/// change, call it once per frame on the main thread before any command buffers that bind the scene are recorded
+	void updateScene() {
+		*ring.allocate<SceneData>(sceneOffset) = scene;
+		sceneFrame = vk.getFrameNumber();
+	}
+
+	/// Returns the dynamic offset to bind the scene's descriptor set with in this frame
+	/// (it only reads, so it's safe to call while recording on several threads at once)
+	uint32_t getSceneOffset() const {
+		if (sceneFrame != vk.getFrameNumber())
+			VKLogException("Manager::getSceneOffset - The scene hasn't been written this frame (call setViewMatrix() or updateScene() first)");
+		return sceneOffset;
+	}
+	const mat4 &getProjectionMatrix() const { return scene.mProjection; }
 
 	void setViewMatrix(VK::mat4 &m) {
 		scene.mView = m;
 		scene.mViewProj = scene.mProjection * scene.mView;
-		sceneBuffer.update(&scene);
+		updateScene();
 	}
 
 	/// @name Managed shader technique methods
@@ -130,15 +152,16 @@ public:
 		nGUIElements = nTextElements = 0;
 		pLastTechnique = NULL;
 
-		VkDescriptorSet descriptorSets[] = { sceneBuffer, guiBuffer, textBuffer };
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, 0, NULL);
+		// The elements are written straight into the ring as they're added, so reserve room for as many as there can be
+		gui = ring.allocate<GUIData>(guiOffset, MAX_GUI_INSTANCES);
+		text = ring.allocate<TextData>(textOffset, MAX_GUI_INSTANCES);
+		VkDescriptorSet descriptorSets[] = { sceneDescriptor, guiDescriptor, textDescriptor };
+		uint32_t offsets[] = { getSceneOffset(), guiOffset, textOffset };
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, 3, offsets);
 	}
 
 	void end() {
-		if(nGUIElements)
-			guiBuffer.update(&gui, 0, sizeof(GUIData)*nGUIElements);
-		if (nTextElements)
-			textBuffer.update(&text, 0, sizeof(TextData)*nTextElements);
+		// Nothing to upload (addGUIElements() and addText() wrote into the ring)
 	}
 
 	void addGUIElements(VkCommandBuffer cmd, const char *type, GUIData *data, uint32_t instances) {
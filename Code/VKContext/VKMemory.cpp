@@ -0,0 +1,344 @@
+// VKMemory.cpp
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#include "VKCore.h"
+#include "VKMath.h"
+#include "VKMemory.h"
+#include <random>
+
+namespace VK {
+
+bool MemoryBlock::allocate(VkDeviceSize nSize, VkDeviceSize nAlign, VkDeviceSize &nOffset) {
+	if (nAlign == 0)
+		nAlign = 1;
+
+	// Find the free range that would have the least left over (stopping at one that fits exactly)
+	std::map<VkDeviceSize, VkDeviceSize>::iterator best = m_free.end();
+	VkDeviceSize nBestLeft = ~(VkDeviceSize)0;
+	for (std::map<VkDeviceSize, VkDeviceSize>::iterator it = m_free.begin(); it != m_free.end(); it++) {
+		VkDeviceSize nStart = (it->first + nAlign - 1) / nAlign * nAlign;
+		if (nStart - it->first + nSize <= it->second && it->second - nSize < nBestLeft) {
+			best = it;
+			nBestLeft = it->second - nSize;
+			if (nBestLeft == 0)
+				break;
+		}
+	}
+	if (best == m_free.end())
+		return false;
+
+	// Whatever's left before the aligned start and after the end stays free
+	VkDeviceSize nRangeStart = best->first, nRangeEnd = best->first + best->second;
+	nOffset = (nRangeStart + nAlign - 1) / nAlign * nAlign;
+	m_free.erase(best);
+	if (nOffset > nRangeStart)
+		m_free[nRangeStart] = nOffset - nRangeStart;
+	if (nOffset + nSize < nRangeEnd)
+		m_free[nOffset + nSize] = nRangeEnd - (nOffset + nSize);
+	m_nFree -= nSize;
+	m_nCount++;
+	return true;
+}
+
+void MemoryBlock::free(VkDeviceSize nOffset, VkDeviceSize nSize) {
+	m_nFree += nSize;
+	m_nCount--;
+
+	// Merge it with the free ranges right before and after it
+	std::map<VkDeviceSize, VkDeviceSize>::iterator next = m_free.lower_bound(nOffset);
+	if (next != m_free.begin()) {
+		std::map<VkDeviceSize, VkDeviceSize>::iterator prev = next;
+		prev--;
+		if (prev->first + prev->second == nOffset) {
+			nOffset = prev->first;
+			nSize += prev->second;
+			m_free.erase(prev);
+		}
+	}
+	if (next != m_free.end() && nOffset + nSize == next->first) {
+		nSize += next->second;
+		m_free.erase(next);
+	}
+	m_free[nOffset] = nSize;
+}
+
+VkDeviceSize MemoryBlock::getLargestFree() const {
+	VkDeviceSize n = 0;
+	for (std::map<VkDeviceSize, VkDeviceSize>::const_iterator it = m_free.begin(); it != m_free.end(); it++)
+		n = Math::Max(n, it->second);
+	return n;
+}
+
+
+VkDeviceSize MemoryAllocator::SizeClass(VkDeviceSize n) {
+	if (n <= MinSize)
+		return MinSize;
+
+	// Between each power of 2 and the next, the classes are 1/4 of the lower one apart
+	VkDeviceSize nPow = 1;
+	while ((nPow << 1) < n)
+		nPow <<= 1;
+	VkDeviceSize nStep = nPow >> 2;
+	return (n + nStep - 1) / nStep * nStep;
+}
+
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t nType) const {
+	// Keep the blocks to 1/8 of a small heap (i.e. integrated or software devices)
+	const VkMemoryType &type = memoryProperties.memoryTypes[nType];
+	VkDeviceSize nSize = DeviceBlockSize;
+	if (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		nSize = HostBlockSize;
+	VkDeviceSize nHeap = memoryProperties.memoryHeaps[type.heapIndex].size;
+	while (nSize > (1 << 20) && nSize > nHeap / 8)
+		nSize >>= 1;
+	return nSize;
+}
+
+VkDeviceMemory MemoryAllocator::allocateMemory(VkDeviceSize nSize, uint32_t nType, uint8_t **ppData) {
+	MemoryAllocateInfo info;
+	info.allocationSize = nSize;
+	info.memoryTypeIndex = nType;
+	VkDeviceMemory mem = VK_NULL_HANDLE;
+	if (vkAllocateMemory(m_device, &info, NULL, &mem) != VK_SUCCESS)
+		return VK_NULL_HANDLE;
+
+	*ppData = NULL;
+	if ((memoryProperties.memoryTypes[nType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0 &&
+		vkMapMemory(m_device, mem, 0, VK_WHOLE_SIZE, 0, (void **)ppData) != VK_SUCCESS) {
+		vkFreeMemory(m_device, mem, NULL);
+		return VK_NULL_HANDLE;
+	}
+	return mem;
+}
+
+void MemoryAllocator::freeMemory(VkDeviceMemory mem, uint8_t *pData) {
+	if (pData)
+		vkUnmapMemory(m_device, mem);
+	vkFreeMemory(m_device, mem, NULL);
+}
+
+void MemoryAllocator::destroy() {
+	Thread::AutoLock lock(m_lock);
+	if (!m_device)
+		return;
+
+	uint32_t nLeaked = m_nDedicated;
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES * Tilings; i++) {
+		for (size_t j = 0; j < m_pools[i].size(); j++) {
+			MemoryBlock *pBlock = m_pools[i][j];
+			nLeaked += pBlock->getCount();
+			freeMemory(pBlock->mem, pBlock->pData);
+			delete pBlock;
+		}
+		m_pools[i].clear();
+	}
+	if (nLeaked)
+		VKLogWarning("MemoryAllocator::destroy - %u allocations are still in use", nLeaked);
+	m_nDedicated = 0;
+	m_nDedicatedBytes = m_nRequested = 0;
+	m_device = VK_NULL_HANDLE;
+}
+
+bool MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags props, bool bLinear, Allocation &a) {
+	a = Allocation();
+	if (props & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		props |= VK_MEMORY_PROPERTY_HOST_COHERENT_BIT; // So pData can be written without flushing
+	uint32_t nType = 0;
+	if (!findMemoryType(requirements.memoryTypeBits, props, &nType))
+		return false;
+
+	Thread::AutoLock lock(m_lock);
+	a.requested = requirements.size;
+	a.size = SizeClass(requirements.size);
+	a.nPool = nType * Tilings + (bLinear ? Linear : Optimal);
+	VkDeviceSize nBlockSize = getBlockSize(nType);
+	if (a.size > nBlockSize / 2) {
+		// It's too big to share a block
+		a.size = requirements.size;
+		if (!(a.mem = allocateMemory(a.size, nType, &a.pData)))
+			return false;
+		m_nDedicated++;
+		m_nDedicatedBytes += a.size;
+	} else {
+		std::vector<MemoryBlock *> &pool = m_pools[a.nPool];
+		for (size_t i = 0; i < pool.size() && !a.pBlock; i++) {
+			if (pool[i]->allocate(a.size, requirements.alignment, a.offset))
+				a.pBlock = pool[i];
+		}
+		if (!a.pBlock) {
+			MemoryBlock *pBlock = new MemoryBlock(nBlockSize);
+			if (!(pBlock->mem = allocateMemory(nBlockSize, nType, &pBlock->pData))) {
+				delete pBlock;
+				return false;
+			}
+			pool.push_back(pBlock);
+			pBlock->allocate(a.size, requirements.alignment, a.offset);
+			a.pBlock = pBlock;
+		}
+		a.mem = a.pBlock->mem;
+		if (a.pBlock->pData)
+			a.pData = a.pBlock->pData + a.offset;
+	}
+	m_nRequested += a.requested;
+	return true;
+}
+
+void MemoryAllocator::free(Allocation &a) {
+	if (!a.valid())
+		return;
+
+	Thread::AutoLock lock(m_lock);
+	if (m_device) { // Otherwise it was already freed by destroy()
+		m_nRequested -= a.requested;
+		if (!a.pBlock) {
+			freeMemory(a.mem, a.pData);
+			m_nDedicated--;
+			m_nDedicatedBytes -= a.size;
+		} else {
+			// Free the block once it's empty, unless it's the last one in its pool (so destroying and creating
+			// the same resource over and over doesn't allocate a new block every time)
+			a.pBlock->free(a.offset, a.size);
+			std::vector<MemoryBlock *> &pool = m_pools[a.nPool];
+			if (a.pBlock->empty() && pool.size() > 1) {
+				pool.erase(std::find(pool.begin(), pool.end(), a.pBlock));
+				freeMemory(a.pBlock->mem, a.pBlock->pData);
+				delete a.pBlock;
+			}
+		}
+	}
+	a = Allocation();
+}
+
+MemoryAllocator::Stats MemoryAllocator::getStats() const {
+	Thread::AutoLock lock(m_lock);
+	Stats s;
+	memset(&s, 0, sizeof(s));
+	s.nDeviceAllocations = m_nDedicated;
+	s.nAllocations = m_nDedicated;
+	s.nReserved = s.nUsed = m_nDedicatedBytes;
+	s.nRequested = m_nRequested;
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES * Tilings; i++) {
+		for (size_t j = 0; j < m_pools[i].size(); j++) {
+			const MemoryBlock *pBlock = m_pools[i][j];
+			s.nDeviceAllocations++;
+			s.nBlocks++;
+			s.nAllocations += pBlock->getCount();
+			s.nReserved += pBlock->getSize();
+			s.nUsed += pBlock->getSize() - pBlock->getFree();
+			s.nFree += pBlock->getFree();
+			s.nLargestFree = Math::Max(s.nLargestFree, pBlock->getLargestFree());
+			s.nFreeRanges += pBlock->getFreeRanges();
+		}
+	}
+	return s;
+}
+
+void MemoryAllocator::logStats() const {
+	Stats s = getStats();
+	VKLogInfo("GPU memory: %u allocations in %u device allocations (%u blocks), %.1f MB reserved, %.1f MB used, %.1f%% lost to rounding, %.1f%% of the free memory outside the largest range (%u ranges)",
+		s.nAllocations, s.nDeviceAllocations, s.nBlocks, s.nReserved / 1048576.0, s.nUsed / 1048576.0,
+		s.getInternalFragmentation() * 100.0f, s.getExternalFragmentation() * 100.0f, s.nFreeRanges);
+}
+
+bool MemoryAllocator::Test() {
+	int nErrors = 0;
+
+	// Every size class has to hold the size, be a class itself, waste less than 1/4, and never go down as the size goes up
+	std::mt19937 gen(1234);
+	VkDeviceSize nLast = 0;
+	for (VkDeviceSize n = 1; n < (1 << 26); n += 1 + (n >> 6) + (gen() & 15)) {
+		VkDeviceSize c = SizeClass(n);
+		if (c < n || c < MinSize || SizeClass(c) != c || (n > MinSize && (c - n) * 4 >= c) || c < nLast) {
+			if (nErrors++ < 10)
+				VKLogError("MemoryAllocator::Test: SizeClass(%llu) = %llu", (unsigned long long)n, (unsigned long long)c);
+		}
+		nLast = c;
+	}
+
+	// Allocate and free random sizes and alignments in a block, and keep a simple model of the ranges handed out
+	// to check every range against (and to check that a failed allocation really had nowhere to go)
+	const VkDeviceSize BlockSize = 1 << 20;
+	for (int nSeed = 0; nSeed < 4; nSeed++) {
+		gen.seed(nSeed);
+		MemoryBlock block(BlockSize);
+		std::map<VkDeviceSize, VkDeviceSize> live; // offset -> size
+		for (int nOp = 0; nOp < 20000; nOp++) {
+			if (!live.empty() && gen() % 100 < 45) {
+				std::map<VkDeviceSize, VkDeviceSize>::iterator it = live.begin();
+				std::advance(it, gen() % live.size());
+				block.free(it->first, it->second);
+				live.erase(it);
+			} else {
+				VkDeviceSize nSize = SizeClass(1 + gen() % (nSeed & 1 ? 4096 : 65536)), nAlign = (VkDeviceSize)1 << (gen() % 13), nOffset = 0;
+				if (block.allocate(nSize, nAlign, nOffset)) {
+					std::map<VkDeviceSize, VkDeviceSize>::iterator next = live.lower_bound(nOffset);
+					bool bOverlap = (next != live.end() && next->first < nOffset + nSize);
+					if (next != live.begin()) {
+						std::map<VkDeviceSize, VkDeviceSize>::iterator prev = next;
+						prev--;
+						bOverlap = bOverlap || prev->first + prev->second > nOffset;
+					}
+					if (bOverlap || nOffset % nAlign != 0 || nOffset + nSize > BlockSize) {
+						if (nErrors++ < 10)
+							VKLogError("MemoryAllocator::Test: Seed %d op %d put %llu bytes (align %llu) at %llu", nSeed, nOp, (unsigned long long)nSize, (unsigned long long)nAlign, (unsigned long long)nOffset);
+					}
+					live[nOffset] = nSize;
+				} else {
+					VkDeviceSize nStart = 0;
+					for (std::map<VkDeviceSize, VkDeviceSize>::iterator it = live.begin(); ; it++) {
+						VkDeviceSize nEnd = it == live.end() ? BlockSize : it->first;
+						VkDeviceSize nAligned = (nStart + nAlign - 1) / nAlign * nAlign;
+						if (nAligned + nSize <= nEnd) {
+							if (nErrors++ < 10)
+								VKLogError("MemoryAllocator::Test: Seed %d op %d found no room for %llu bytes (align %llu), but [%llu, %llu) is free", nSeed, nOp, (unsigned long long)nSize, (unsigned long long)nAlign, (unsigned long long)nStart, (unsigned long long)nEnd);
+							break;
+						}
+						if (it == live.end())
+							break;
+						nStart = it->first + it->second;
+					}
+				}
+			}
+
+			// The free ranges should be exactly the gaps between the live ranges (all merged)
+			VkDeviceSize nUsed = 0, nLargest = 0, nStart = 0;
+			uint32_t nGaps = 0;
+			for (std::map<VkDeviceSize, VkDeviceSize>::iterator it = live.begin(); ; it++) {
+				VkDeviceSize nEnd = it == live.end() ? BlockSize : it->first;
+				if (nEnd > nStart) {
+					nGaps++;
+					nLargest = Math::Max(nLargest, nEnd - nStart);
+				}
+				if (it == live.end())
+					break;
+				nUsed += it->second;
+				nStart = it->first + it->second;
+			}
+			if (block.getFree() != BlockSize - nUsed || block.getFreeRanges() != nGaps || block.getLargestFree() != nLargest || block.getCount() != live.size()) {
+				if (nErrors++ < 10)
+					VKLogError("MemoryAllocator::Test: Seed %d op %d has %llu bytes free in %u ranges (largest %llu), expected %llu in %u (largest %llu)", nSeed, nOp,
+						(unsigned long long)block.getFree(), block.getFreeRanges(), (unsigned long long)block.getLargestFree(), (unsigned long long)(BlockSize - nUsed), nGaps, (unsigned long long)nLargest);
+			}
+		}
+
+		// Freeing everything should leave one free range
+		for (std::map<VkDeviceSize, VkDeviceSize>::iterator it = live.begin(); it != live.end(); it++)
+			block.free(it->first, it->second);
+		if (!block.empty() || block.getFreeRanges() != 1 || block.getLargestFree() != BlockSize) {
+			if (nErrors++ < 10)
+				VKLogError("MemoryAllocator::Test: Seed %d left %u free ranges after freeing everything", nSeed, block.getFreeRanges());
+		}
+	}
+
+	if (nErrors)
+		VKLogError("MemoryAllocator::Test: %d errors", nErrors);
+	else
+		VKLogInfo("MemoryAllocator::Test: passed");
+	return nErrors == 0;
+}
+
+} // namespace VK
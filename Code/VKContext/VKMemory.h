@@ -0,0 +1,144 @@
+// VKMemory.h
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#ifndef __VKMemory_h__
+#define __VKMemory_h__
+
+#include "VKCore.h"
+
+namespace VK {
+
+/// Hands out ranges of one block of device memory. It keeps the free ranges sorted by offset
+/// (merging neighbors as they're freed), and picks the smallest one that fits each request.
+class MemoryBlock {
+protected:
+	VkDeviceSize m_nSize;
+	VkDeviceSize m_nFree;
+	uint32_t m_nCount; ///< The number of ranges handed out
+	std::map<VkDeviceSize, VkDeviceSize> m_free; ///< The free ranges (offset -> size)
+
+public:
+	VkDeviceMemory mem;
+	uint8_t *pData; ///< Where mem is mapped (host-visible memory only, NULL otherwise)
+
+	MemoryBlock(VkDeviceSize nSize) : m_nSize(nSize), m_nFree(nSize), m_nCount(0), mem(VK_NULL_HANDLE), pData(NULL) { m_free[0] = nSize; }
+
+	/// Finds room for nSize bytes starting on a multiple of nAlign
+	/// \return true if it fit (and sets nOffset to where it starts)
+	bool allocate(VkDeviceSize nSize, VkDeviceSize nAlign, VkDeviceSize &nOffset);
+
+	/// Gives back a range allocate() handed out
+	void free(VkDeviceSize nOffset, VkDeviceSize nSize);
+
+	VkDeviceSize getSize() const { return m_nSize; }
+	VkDeviceSize getFree() const { return m_nFree; }
+	VkDeviceSize getLargestFree() const;
+	uint32_t getFreeRanges() const { return (uint32_t)m_free.size(); }
+	uint32_t getCount() const { return m_nCount; }
+	bool empty() const { return m_nCount == 0; }
+};
+
+/// A range of device memory handed out by MemoryAllocator (bind the resource to mem at offset)
+struct Allocation {
+	VkDeviceMemory mem;
+	VkDeviceSize offset;
+	VkDeviceSize size; ///< The size it was rounded up to
+	VkDeviceSize requested; ///< The size the resource asked for
+	uint8_t *pData; ///< Where it's mapped (host-visible memory only, NULL otherwise)
+	MemoryBlock *pBlock; ///< The block it came from (NULL if it has a device allocation to itself)
+	uint32_t nPool; ///< The pool the block is in
+
+	Allocation() : mem(VK_NULL_HANDLE), offset(0), size(0), requested(0), pData(NULL), pBlock(NULL), nPool(0) {}
+	bool valid() const { return mem != VK_NULL_HANDLE; }
+};
+
+/// Sub-allocates buffers and images from large blocks of device memory, so a device allocation isn't needed for
+/// each one (there's a limit of maxMemoryAllocationCount, and each one takes time).
+///
+/// There's a pool of blocks for each memory type, so device-local and host-visible memory come from separate blocks
+/// (and heaps). Linear resources (buffers and linear images) and optimal images get separate pools too, so they
+/// never share a page and bufferImageGranularity can be ignored. Host-visible blocks are mapped once when they're
+/// created (and always coherent), so Allocation::pData can be written at any time without mapping or flushing.
+///
+/// Each request is rounded up to a size class (4 per power of 2, so no more than 1/4 is wasted) before it's placed,
+/// which makes it much more likely that a freed range can be reused by the next resource of a similar size.
+/// Anything bigger than half a block gets its own device allocation. getStats() shows how much memory is wasted
+/// inside the ranges (rounding) and between them (fragmentation).
+class MemoryAllocator {
+public:
+	static const VkDeviceSize MinSize = 256; ///< The smallest size class
+	static const VkDeviceSize DeviceBlockSize = 64 << 20; ///< The size of a block of device-local memory
+	static const VkDeviceSize HostBlockSize = 16 << 20; ///< The size of a block of host-visible memory
+
+	struct Stats {
+		uint32_t nDeviceAllocations; ///< The number of device allocations (blocks plus the ones that got their own)
+		uint32_t nBlocks; ///< The number of blocks
+		uint32_t nAllocations; ///< The number of ranges handed out
+		VkDeviceSize nReserved; ///< The bytes allocated from the device
+		VkDeviceSize nRequested; ///< The bytes the resources asked for
+		VkDeviceSize nUsed; ///< The bytes handed out (after rounding up to size classes)
+		VkDeviceSize nFree; ///< The bytes free in the blocks
+		VkDeviceSize nLargestFree; ///< The largest free range in any block
+		uint32_t nFreeRanges; ///< The number of free ranges in all the blocks
+
+		/// Returns the fraction of the bytes handed out that were wasted rounding up to size classes
+		float getInternalFragmentation() const { return nUsed ? (float)(nUsed - nRequested) / (float)nUsed : 0.0f; }
+
+		/// Returns the fraction of the free bytes that aren't in the largest free range
+		float getExternalFragmentation() const { return nFree ? 1.0f - (float)nLargestFree / (float)nFree : 0.0f; }
+	};
+
+protected:
+	enum { Linear, Optimal, Tilings };
+
+	Thread::Lock m_lock;
+	VkDevice m_device;
+	std::vector<MemoryBlock *> m_pools[VK_MAX_MEMORY_TYPES * Tilings];
+	uint32_t m_nDedicated; ///< The number of allocations that have a device allocation to themselves
+	VkDeviceSize m_nDedicatedBytes;
+	VkDeviceSize m_nRequested;
+
+	VkDeviceSize getBlockSize(uint32_t nType) const;
+	VkDeviceMemory allocateMemory(VkDeviceSize nSize, uint32_t nType, uint8_t **ppData);
+	void freeMemory(VkDeviceMemory mem, uint8_t *pData);
+
+public:
+	MemoryAllocator() : m_device(VK_NULL_HANDLE), m_nDedicated(0), m_nDedicatedBytes(0), m_nRequested(0) {}
+	~MemoryAllocator() { destroy(); }
+
+	/// Call once the device is created (and memoryProperties is filled in)
+	void init(VkDevice device) { m_device = device; }
+
+	/// Frees every block (call before the device is destroyed, after the resources using them are destroyed)
+	void destroy();
+
+	/// Returns the size class n is rounded up to
+	static VkDeviceSize SizeClass(VkDeviceSize n);
+
+	/// Finds room for a resource
+	/// \param requirements What vkGetBufferMemoryRequirements or vkGetImageMemoryRequirements returned for it
+	/// \param props The memory properties it needs (i.e. VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT or VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	/// \param bLinear Set for buffers and linear images, clear for optimal images
+	/// \param a (Out) Where to bind it
+	/// \return false if there's no memory type with those properties, or the device is out of memory
+	bool allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags props, bool bLinear, Allocation &a);
+
+	/// Gives back the memory for a resource (after it's destroyed), and clears a
+	void free(Allocation &a);
+
+	Stats getStats() const;
+	void logStats() const;
+
+	/// Checks MemoryBlock's placement, alignment, and merging, and the size classes, against a simple model.
+	/// Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+};
+
+} // namespace VK
+
+#endif // __VKMemory_h__
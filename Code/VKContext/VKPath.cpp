@@ -7,9 +7,11 @@
 
 #include "VKCore.h"
 #include "VKPath.h"
+#ifdef ANDROID
 extern "C" {
 	#include <zip.h>
 }
+#endif
 
 #ifdef _WIN32
 #else
@@ -109,6 +111,7 @@ Path Path::add(const char *pszFormat, ...) const {
 //}
 
 bool Path::exists() {
+#ifdef _WIN32
 	WIN32_FILE_ATTRIBUTE_DATA data;
 	if(::GetFileAttributesEx(m_strPath.c_str(), GetFileExInfoStandard, &data) == 0) {
 		m_nAttributes = 0;
@@ -122,6 +125,21 @@ bool Path::exists() {
 	m_dCreated = FileTimeToEpoch(data.ftCreationTime);
 	m_dLastWrite = FileTimeToEpoch(data.ftLastWriteTime);
 	m_dLastAccess = FileTimeToEpoch(data.ftLastAccessTime);
+#else
+	struct stat st;
+	if(::stat(m_strPath.c_str(), &st) != 0) {
+		m_nAttributes = 0;
+		m_nSize = (uint64_t)-1;
+		m_dCreated = m_dLastWrite = m_dLastAccess = 0.0;
+		return false;
+	}
+
+	m_nAttributes = S_ISDIR(st.st_mode) ? DirectoryType : FileType;
+	m_nSize = (uint64_t)st.st_size;
+	m_dCreated = (double)st.st_ctime; // There's no creation time, so this is the last status change
+	m_dLastWrite = (double)st.st_mtime;
+	m_dLastAccess = (double)st.st_atime;
+#endif
 	return true;
 }
 
@@ -333,7 +351,7 @@ Path::List Path::entries(const char *pszMask, PathType type) const {
 			if(*dptr->d_name == '.')
 				continue;
 			Path p(*this + dptr->d_name);
-			if(p.exists() && ((p.m_bDir && type != FileType) || (!p.m_bDir && type != DirectoryType))) {
+			if(p.exists() && ((p.directory() && type != FileType) || (!p.directory() && type != DirectoryType))) {
 				p.m_strPath = dptr->d_name;
 				list.push_back(p);
 			}
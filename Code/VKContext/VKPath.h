@@ -153,6 +153,8 @@ public:
 #ifdef _WIN32
 	static Path Module();
 	static Path Root() { return Module().dirname(); }
+#elif !defined(ANDROID)
+	static Path Root() { return Getwd(); }
 #endif
 
 #ifdef ANDROID
@@ -174,6 +176,7 @@ public:
 	static Path Shader() { return Root() + "shaders"; }
 	static Path Images() { return Root() + "images"; }
 	static Path Log() { return Root() + "log"; }
+	static Path Cache() { return Root() + "cache"; }
 };
 
 
@@ -75,7 +75,7 @@ public:
 		);
 	}
 	void operator*=(const Quaternion &q)	{ *this = *this * q; }
-	Quaternion<T> normalize() const			{ return *this / mag(); }
+	Quaternion<T> normalize() const			{ return *this / this->mag(); }
 	//@}
 
 	/// @name Advanced quaternion methods
@@ -137,7 +137,6 @@ public:
 	}
 	void from_s(const char *psz) {
 		std::sscanf(psz, "q[%f, %f, %f, %f]", &this->x, &this->y, &this->z, &this->w);
-		dir = dir.normalize();
 	}
 
 	/// Performs a sperhical LERP (linear interpolation) between two quaternions
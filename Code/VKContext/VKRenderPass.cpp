@@ -6,14 +6,14 @@
 namespace VK {
 
 void RenderPass::destroy() {
-	if (frame) {
-		vkDestroyFramebuffer(vk, frame, NULL);
-		frame = NULL;
-	}
-	if (pass) {
-		vkDestroyRenderPass(vk, pass, NULL);
-		pass = NULL;
-	}
+	// The frames in flight may still be using them, so they go once they're done
+	vk.deferDestroy(vkDestroyFramebuffer, frame);
+	frame = NULL;
+	for (size_t i = 0; i < swapchainFrames.size(); i++)
+		vk.deferDestroy(vkDestroyFramebuffer, swapchainFrames[i]);
+	swapchainFrames.clear();
+	vk.deferDestroy(vkDestroyRenderPass, pass);
+	pass = NULL;
 }
 
 void RenderPass::create(std::vector<Image*> &colorImages, Image *depth
@@ -22,31 +22,85 @@ void RenderPass::create(std::vector<Image*> &colorImages, Image *depth
 ) {
 	if (colorImages.empty() && !depth)
 		throw "A render pass needs at least one target image!";
+	build(false, false, colorImages, depth, colorLoadOp, depthLoadOp, colorStoreOp, depthStoreOp);
+}
+
+void RenderPass::createSwapchain(std::vector<Image*> &colorImages, Image *depth, bool bPresent
+	, VkAttachmentLoadOp colorLoadOp, VkAttachmentLoadOp depthLoadOp
+	, VkAttachmentStoreOp colorStoreOp, VkAttachmentStoreOp depthStoreOp
+) {
+	if (vk.getSwapchainViews().empty())
+		throw "Build the swapchain before creating a render pass for it!";
+	build(true, bPresent, colorImages, depth, colorLoadOp, depthLoadOp, colorStoreOp, depthStoreOp);
+}
+
+void RenderPass::build(bool bSwapchain, bool bPresent, std::vector<Image*> &colorImages, Image *depth
+	, VkAttachmentLoadOp colorLoadOp, VkAttachmentLoadOp depthLoadOp
+	, VkAttachmentStoreOp colorStoreOp, VkAttachmentStoreOp depthStoreOp
+) {
 	std::vector<VkImageView> views;
 	std::vector<AttachmentDescription> attachments;
 	std::vector<AttachmentReference> colorAttachments;
+	std::vector<SubpassDependency> dependencies;
+	if (bSwapchain) {
+		// The swapchain image's contents only matter if they're loaded, and the last pass hands it to the presentation engine
+		AttachmentDescription swapchain(vk.getSurfaceFormat().format, VK_SAMPLE_COUNT_1_BIT, colorLoadOp, colorStoreOp, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		if (colorLoadOp != VK_ATTACHMENT_LOAD_OP_LOAD)
+			swapchain.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (bPresent)
+			swapchain.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		views.push_back(VK_NULL_HANDLE); // Filled in with each swapchain image's view below
+		attachments.push_back(swapchain);
+		colorAttachments.push_back(AttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+	}
 	for (uint32_t i = 0; i < (uint32_t)colorImages.size(); i++) {
 		VkImageLayout layout = colorImages[i]->getLayout() == VK_IMAGE_LAYOUT_GENERAL ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		views.push_back(*colorImages[i]);
+		colorAttachments.push_back(AttachmentReference((uint32_t)attachments.size(), layout));
 		attachments.push_back(AttachmentDescription(*colorImages[i], VK_SAMPLE_COUNT_1_BIT, colorLoadOp, colorStoreOp, layout));
-		colorAttachments.push_back(AttachmentReference(i, layout));
 	}
 	AttachmentReference depthAttachment((uint32_t)colorAttachments.size(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 	if (depth) {
 		views.push_back(*depth);
 		attachments.push_back(AttachmentDescription(*depth, VK_SAMPLE_COUNT_1_BIT, depthLoadOp, depthStoreOp, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL));
 	}
+	if (bSwapchain) {
+		// Context::present() makes the frame wait for the image to be acquired at the color attachment output stage,
+		// so the layout transition at the start of the pass has to wait for that stage too. When this pass loads
+		// what an earlier pass on the same command buffer wrote, those color/depth writes have to be made available.
+		VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		VkAccessFlags srcAccess = colorLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0;
+		VkAccessFlags dstAccess = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		if (depth) {
+			stages |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			if (depthLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+				srcAccess |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			dstAccess |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		}
+		dependencies.push_back(SubpassDependency(VK_SUBPASS_EXTERNAL, 0, stages, stages, srcAccess, dstAccess));
+	}
 
 	std::vector<SubpassDescription> subpasses = { SubpassDescription(&colorAttachments, depth ? &depthAttachment : NULL) };
-	RenderPassCreateInfo renderPassInfo(&attachments, &subpasses);
+	RenderPassCreateInfo renderPassInfo(&attachments, &subpasses, &dependencies);
 	OBJ_CHECK(vkCreateRenderPass(vk, &renderPassInfo, nullptr, &pass));
 
 	FramebufferCreateInfo framebufferInfo(pass, &views);
-	const ImageCreateInfo &info = colorImages.empty() ? depth->getImageInfo() : colorImages[0]->getImageInfo();
-	framebufferInfo.width = info.extent.width;
-	framebufferInfo.height = info.extent.height;
-	framebufferInfo.layers = info.imageType == VK_IMAGE_TYPE_3D ? info.extent.depth : info.arrayLayers;
-	OBJ_CHECK(vkCreateFramebuffer(vk, &framebufferInfo, nullptr, &frame));
+	if (bSwapchain) {
+		framebufferInfo.width = vk.getExtent().width;
+		framebufferInfo.height = vk.getExtent().height;
+		const std::vector<VkImageView> &swapchainViews = vk.getSwapchainViews();
+		swapchainFrames.resize(swapchainViews.size());
+		for (size_t i = 0; i < swapchainViews.size(); i++) {
+			views[0] = swapchainViews[i];
+			OBJ_CHECK(vkCreateFramebuffer(vk, &framebufferInfo, nullptr, &swapchainFrames[i]));
+		}
+	} else {
+		const ImageCreateInfo &info = colorImages.empty() ? depth->getImageInfo() : colorImages[0]->getImageInfo();
+		framebufferInfo.width = info.extent.width;
+		framebufferInfo.height = info.extent.height;
+		framebufferInfo.layers = info.imageType == VK_IMAGE_TYPE_3D ? info.extent.depth : info.arrayLayers;
+		OBJ_CHECK(vkCreateFramebuffer(vk, &framebufferInfo, nullptr, &frame));
+	}
 }
 
 } // namespace VK
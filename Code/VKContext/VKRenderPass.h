@@ -12,11 +12,17 @@ class RenderPass : public Object {
 private:
 	VkRenderPass pass;
 	VkFramebuffer frame;
+	std::vector<VkFramebuffer> swapchainFrames; ///< One framebuffer per swapchain image (see createSwapchain())
+
+	void build(bool bSwapchain, bool bPresent, std::vector<Image*> &colorImages, Image *depth
+		, VkAttachmentLoadOp colorLoadOp, VkAttachmentLoadOp depthLoadOp
+		, VkAttachmentStoreOp colorStoreOp, VkAttachmentStoreOp depthStoreOp
+	);
 
 public:
 	RenderPass() : pass(NULL), frame(NULL) {}
 	~RenderPass() { destroy(); }
-	virtual bool isValid() const { return pass != NULL && frame != NULL; }
+	virtual bool isValid() const { return pass != NULL && (frame != NULL || !swapchainFrames.empty()); }
 
 	virtual void destroy();
 	void create(std::vector<Image*> &colorImages, Image *depth
@@ -24,9 +30,20 @@ public:
 		, VkAttachmentStoreOp colorStoreOp = VK_ATTACHMENT_STORE_OP_STORE, VkAttachmentStoreOp depthStoreOp = VK_ATTACHMENT_STORE_OP_STORE
 	);
 
+	/// Creates a render pass that draws straight into the swapchain image (as its first color attachment, followed by
+	/// colorImages and depth), with a framebuffer for each of the swapchain's images. This saves Context::present()
+	/// from copying a separate color image into the swapchain image every frame. Call Context::acquire() before
+	/// beginning the pass (so the framebuffer for the acquired image is used), and call this again whenever the
+	/// swapchain is rebuilt.
+	/// \param bPresent Set for the last pass that draws into the swapchain image, to leave it ready to present
+	void createSwapchain(std::vector<Image*> &colorImages, Image *depth, bool bPresent
+		, VkAttachmentLoadOp colorLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkAttachmentLoadOp depthLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR
+		, VkAttachmentStoreOp colorStoreOp = VK_ATTACHMENT_STORE_OP_STORE, VkAttachmentStoreOp depthStoreOp = VK_ATTACHMENT_STORE_OP_STORE
+	);
+
 	/// Casting operators to provide easy access to any handle when you need to call a Vulkan function manually
 	operator VkRenderPass() const { return pass; }
-	operator VkFramebuffer() const { return frame; }
+	operator VkFramebuffer() const { return swapchainFrames.empty() ? frame : swapchainFrames[vk.getImageIndex()]; }
 };
 
 } // namespace VK
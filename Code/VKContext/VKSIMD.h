@@ -0,0 +1,133 @@
+// VKSIMD.h
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan API easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#ifndef __VKSIMD_h__
+#define __VKSIMD_h__
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define VK_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+namespace VK {
+
+/// A namespace for writing simple SIMD loops that still read like scalar code.
+/// A kernel is written once as a template on its value type and run on
+/// 4 floats at a time using Float4, then on a single float for any
+/// left-over elements at the end of a row (see ForEach). The functions
+/// below are overloaded for both float and Float4 so the same kernel
+/// source compiles either way. Comparisons return a mask (a bool for
+/// float), which is used with Select to keep kernels branch-free.
+/// On CPUs without SSE2, Float4 falls back to 4 plain floats.
+namespace SIMD {
+
+/// Loads a value from memory (as Load<float> or Load<Float4>)
+template <class V> inline V Load(const float *p);
+
+#ifdef VK_SIMD_SSE
+
+struct Float4 {
+	__m128 v;
+	Float4() {}
+	Float4(__m128 m) : v(m) {}
+	Float4(float f) : v(_mm_set1_ps(f)) {}
+	Float4(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+	float operator[](int i) const { float f[4]; _mm_storeu_ps(f, v); return f[i]; }
+
+	Float4 operator-() const { return _mm_sub_ps(_mm_setzero_ps(), v); }
+	Float4 operator+(const Float4 &f) const { return _mm_add_ps(v, f.v); }
+	Float4 operator-(const Float4 &f) const { return _mm_sub_ps(v, f.v); }
+	Float4 operator*(const Float4 &f) const { return _mm_mul_ps(v, f.v); }
+	Float4 operator/(const Float4 &f) const { return _mm_div_ps(v, f.v); }
+	void operator+=(const Float4 &f) { v = _mm_add_ps(v, f.v); }
+	void operator-=(const Float4 &f) { v = _mm_sub_ps(v, f.v); }
+	void operator*=(const Float4 &f) { v = _mm_mul_ps(v, f.v); }
+	void operator/=(const Float4 &f) { v = _mm_div_ps(v, f.v); }
+
+	Float4 operator<(const Float4 &f) const { return _mm_cmplt_ps(v, f.v); }
+	Float4 operator<=(const Float4 &f) const { return _mm_cmple_ps(v, f.v); }
+	Float4 operator>(const Float4 &f) const { return _mm_cmpgt_ps(v, f.v); }
+	Float4 operator>=(const Float4 &f) const { return _mm_cmpge_ps(v, f.v); }
+	Float4 operator&(const Float4 &f) const { return _mm_and_ps(v, f.v); }
+	Float4 operator|(const Float4 &f) const { return _mm_or_ps(v, f.v); }
+};
+
+template <> inline Float4 Load<Float4>(const float *p) { return _mm_loadu_ps(p); }
+inline void Store(float *p, const Float4 &f)		{ _mm_storeu_ps(p, f.v); }
+inline Float4 Min(const Float4 &a, const Float4 &b)	{ return _mm_min_ps(a.v, b.v); }
+inline Float4 Max(const Float4 &a, const Float4 &b)	{ return _mm_max_ps(a.v, b.v); }
+inline Float4 Sqrt(const Float4 &f)					{ return _mm_sqrt_ps(f.v); }
+inline Float4 Abs(const Float4 &f)					{ return _mm_andnot_ps(_mm_set1_ps(-0.0f), f.v); }
+/// Returns a where the mask is set and b where it isn't
+inline Float4 Select(const Float4 &mask, const Float4 &a, const Float4 &b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+
+#else // VK_SIMD_SSE
+
+struct Float4 {
+	float v[4];
+	Float4() {}
+	Float4(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+	Float4(float x, float y, float z, float w) { v[0] = x; v[1] = y; v[2] = z; v[3] = w; }
+	float operator[](int i) const { return v[i]; }
+
+#define VK_SIMD_OP(op) Float4 operator op(const Float4 &f) const { return Float4(v[0] op f.v[0], v[1] op f.v[1], v[2] op f.v[2], v[3] op f.v[3]); }
+#define VK_SIMD_CMP(op) Float4 operator op(const Float4 &f) const { return Float4(v[0] op f.v[0] ? 1.0f : 0.0f, v[1] op f.v[1] ? 1.0f : 0.0f, v[2] op f.v[2] ? 1.0f : 0.0f, v[3] op f.v[3] ? 1.0f : 0.0f); }
+	Float4 operator-() const { return Float4(-v[0], -v[1], -v[2], -v[3]); }
+	VK_SIMD_OP(+) VK_SIMD_OP(-) VK_SIMD_OP(*) VK_SIMD_OP(/)
+	VK_SIMD_CMP(<) VK_SIMD_CMP(<=) VK_SIMD_CMP(>) VK_SIMD_CMP(>=)
+	Float4 operator&(const Float4 &f) const { return Float4(v[0] != 0 && f.v[0] != 0 ? 1.0f : 0.0f, v[1] != 0 && f.v[1] != 0 ? 1.0f : 0.0f, v[2] != 0 && f.v[2] != 0 ? 1.0f : 0.0f, v[3] != 0 && f.v[3] != 0 ? 1.0f : 0.0f); }
+	Float4 operator|(const Float4 &f) const { return Float4(v[0] != 0 || f.v[0] != 0 ? 1.0f : 0.0f, v[1] != 0 || f.v[1] != 0 ? 1.0f : 0.0f, v[2] != 0 || f.v[2] != 0 ? 1.0f : 0.0f, v[3] != 0 || f.v[3] != 0 ? 1.0f : 0.0f); }
+#undef VK_SIMD_OP
+#undef VK_SIMD_CMP
+	void operator+=(const Float4 &f) { *this = *this + f; }
+	void operator-=(const Float4 &f) { *this = *this - f; }
+	void operator*=(const Float4 &f) { *this = *this * f; }
+	void operator/=(const Float4 &f) { *this = *this / f; }
+};
+
+template <> inline Float4 Load<Float4>(const float *p) { return Float4(p[0], p[1], p[2], p[3]); }
+inline void Store(float *p, const Float4 &f)		{ p[0] = f.v[0]; p[1] = f.v[1]; p[2] = f.v[2]; p[3] = f.v[3]; }
+inline Float4 Min(const Float4 &a, const Float4 &b)	{ return Float4(a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1], a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3]); }
+inline Float4 Max(const Float4 &a, const Float4 &b)	{ return Float4(a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1], a.v[2] > b.v[2] ? a.v[2] : b.v[2], a.v[3] > b.v[3] ? a.v[3] : b.v[3]); }
+inline Float4 Sqrt(const Float4 &f)					{ return Float4(sqrtf(f.v[0]), sqrtf(f.v[1]), sqrtf(f.v[2]), sqrtf(f.v[3])); }
+inline Float4 Abs(const Float4 &f)					{ return Float4(fabsf(f.v[0]), fabsf(f.v[1]), fabsf(f.v[2]), fabsf(f.v[3])); }
+inline Float4 Select(const Float4 &mask, const Float4 &a, const Float4 &b) {
+	return Float4(mask.v[0] != 0 ? a.v[0] : b.v[0], mask.v[1] != 0 ? a.v[1] : b.v[1], mask.v[2] != 0 ? a.v[2] : b.v[2], mask.v[3] != 0 ? a.v[3] : b.v[3]);
+}
+
+#endif // VK_SIMD_SSE
+
+// Scalar versions, so the same kernel can finish off the end of a row
+template <> inline float Load<float>(const float *p) { return *p; }
+inline void Store(float *p, float f)				{ *p = f; }
+inline float Min(float a, float b)					{ return a < b ? a : b; }
+inline float Max(float a, float b)					{ return a > b ? a : b; }
+inline float Sqrt(float f)							{ return sqrtf(f); }
+inline float Abs(float f)							{ return fabsf(f); }
+inline float Select(bool mask, float a, float b)	{ return mask ? a : b; }
+
+/// The number of floats each type works on at once
+template <class V> struct Width { enum { Value = 1 }; };
+template <> struct Width<Float4> { enum { Value = 4 }; };
+
+/// Runs kernel.template apply<V>(i) on [nStart, nEnd), using Float4 on every
+/// group of 4 elements it can and float on whatever is left.
+/// A kernel applied to Float4 at i must handle elements i to i+3.
+template <class K> inline void ForEach(int nStart, int nEnd, const K &kernel) {
+	int i = nStart;
+	for(; i + 4 <= nEnd; i += 4)
+		kernel.template apply<Float4>(i);
+	for(; i < nEnd; i++)
+		kernel.template apply<float>(i);
+}
+
+} // namespace SIMD
+} // namespace VK
+
+#endif // __VKSIMD_h__
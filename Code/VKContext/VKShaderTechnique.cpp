@@ -7,6 +7,7 @@
 
 #include "VKCore.h"
 #include "VKShaderTechnique.h"
+#include <exception>
 
 namespace VK {
 
@@ -32,14 +33,7 @@ void ShaderTechnique::clear() {
 
 void ShaderTechnique::destroy() {
 	clear();
-	if (pipeline) {
-		vkDestroyPipeline(vk, pipeline, NULL);
-		pipeline = NULL;
-	}
-	if (pipelineLayout) {
-		vkDestroyPipelineLayout(vk, pipelineLayout, NULL);
-		pipelineLayout = NULL;
-	}
+	destroyPipeline();
 	ShaderProgram::destroy();
 }
 
@@ -355,10 +349,7 @@ bool ShaderTechnique::parse(String::Parser &parser, std::string &strPreparedCode
 	return compile(szName);
 }
 
-void ShaderTechnique::buildPipeline(VkRenderPass pass, VkPipelineLayout pipelineLayout) {
-	if (!ShaderProgram::isValid())
-		return;
-
+VkResult ShaderTechnique::createPipeline(VkRenderPass pass, VkPipelineLayout pipelineLayout, VkPipeline &newPipeline) {
 	std::vector<PipelineShaderStageCreateInfo> stageInfo;
 	ShaderProgram::getStages(stageInfo);
 
@@ -409,22 +400,46 @@ void ShaderTechnique::buildPipeline(VkRenderPass pass, VkPipelineLayout pipeline
 	pipelineInfo.blend.pAttachments = &attachments[0];
 	pipelineInfo.depth.depthTestEnable = depthTestEnable;
 	pipelineInfo.depth.depthWriteEnable = depthWriteEnable;
-	if (pipeline) {
-		vkDestroyPipeline(vk, pipeline, NULL);
-		pipeline = NULL;
-	}
-	OBJ_CHECK(vkCreateGraphicsPipelines(vk, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+	return vkCreateGraphicsPipelines(vk, vk.getPipelineCache(), 1, &pipelineInfo, nullptr, &newPipeline);
 }
 
-void ShaderTechnique::destroyPipeline() {
-	if (pipeline) {
-		vkDestroyPipeline(vk, pipeline, NULL);
-		pipeline = NULL;
+void ShaderTechnique::BuildPipelines(ShaderTechnique *const *pTechniques, size_t nCount, VkRenderPass pass, VkPipelineLayout pipelineLayout) {
+	// Most of the time goes into the driver compiling the shaders, and it's safe to create pipelines on several
+	// threads at once (even with the same pipeline cache), so each technique's pipeline is created on the thread pool
+	std::vector<VkPipeline> pipelines(nCount, VK_NULL_HANDLE);
+	std::vector<VkResult> results(nCount, VK_SUCCESS);
+	std::vector<std::exception_ptr> exceptions(nCount);
+	Thread::Pool::GetDefault().run((int)nCount, [&](int i) {
+		try {
+			if (pTechniques[i]->ShaderProgram::isValid())
+				results[i] = pTechniques[i]->createPipeline(pass, pipelineLayout, pipelines[i]);
+		} catch (...) {
+			exceptions[i] = std::current_exception(); // Rethrown on this thread below
+		}
+	});
+
+	// Swap in the new pipelines, then report any failures (a technique that failed keeps its old pipeline)
+	for (size_t i = 0; i < nCount; i++) {
+		ShaderTechnique &t = *pTechniques[i];
+		if (pipelines[i]) {
+			t.vk.deferDestroy(vkDestroyPipeline, t.pipeline); // The frames in flight may still be using the old one
+			t.pipeline = pipelines[i];
+		}
 	}
-	if (pipelineLayout) {
-		vkDestroyPipelineLayout(vk, pipelineLayout, NULL);
-		pipelineLayout = NULL;
+	for (size_t i = 0; i < nCount; i++) {
+		if (exceptions[i])
+			std::rethrow_exception(exceptions[i]);
+		Context &vk = pTechniques[i]->vk;
+		OBJ_CHECK(results[i]);
 	}
 }
 
+void ShaderTechnique::destroyPipeline() {
+	// The frames in flight may still be using them, so they go once they're done
+	vk.deferDestroy(vkDestroyPipeline, pipeline);
+	pipeline = NULL;
+	vk.deferDestroy(vkDestroyPipelineLayout, pipelineLayout);
+	pipelineLayout = NULL;
+}
+
 } // namespace VK
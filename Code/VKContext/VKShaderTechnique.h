@@ -63,6 +63,9 @@ protected:
 	void addOutput(const char *pszType, const char *pszName, const char *layout) { m_vOutputs.push_back(ShaderAttribute(pszType, pszName, layout)); }
 	void addUniform(const char *pszType, const char *pszName, const char *layout) { m_vUniforms.push_back(ShaderAttribute(pszType, pszName, layout)); }
 
+	/// Creates a pipeline from this technique's shaders and states (safe to call on several threads at once)
+	VkResult createPipeline(VkRenderPass pass, VkPipelineLayout pipelineLayout, VkPipeline &newPipeline);
+
 public:
 	ShaderTechnique() : pipeline(NULL), pipelineLayout(NULL) {}
 	virtual ~ShaderTechnique() { destroy(); }
@@ -106,7 +109,10 @@ public:
 		parse(p, strPreparedCode, nVersion);
 	}
 
-	void buildPipeline(VkRenderPass pass, VkPipelineLayout pipelineLayout);
+	void buildPipeline(VkRenderPass pass, VkPipelineLayout pipelineLayout) {
+		ShaderTechnique *p = this;
+		BuildPipelines(&p, 1, pass, pipelineLayout);
+	}
 	void buildPipeline(VkRenderPass pass, VkDescriptorSetLayout *layouts, uint32_t count) {
 		VK::PipelineLayoutCreateInfo pipelineLayoutInfo(layouts, count);
 		vkCreatePipelineLayout(vk, &pipelineLayoutInfo, NULL, &pipelineLayout);
@@ -114,6 +120,14 @@ public:
 	}
 	void destroyPipeline();
 
+	/// Builds (or rebuilds) the pipelines for several techniques at once, spread across the default thread pool.
+	/// Every pipeline is created with the context's pipeline cache, so it only takes long the first time.
+	static void BuildPipelines(ShaderTechnique *const *pTechniques, size_t nCount, VkRenderPass pass, VkPipelineLayout pipelineLayout);
+	static void BuildPipelines(const std::vector<ShaderTechnique *> &techniques, VkRenderPass pass, VkPipelineLayout pipelineLayout) {
+		if (!techniques.empty())
+			BuildPipelines(&techniques[0], techniques.size(), pass, pipelineLayout);
+	}
+
 	/// Call to enable the technique for rendering.
 	//void enable();
 	/// Call to disable the technique for rendering.
@@ -10,6 +10,10 @@
 
 namespace VK {
 
+// Also declared at the top of VKCore.h, but the logger includes this without it
+typedef void (*ThrowExceptionFunc)(const char *);
+extern ThrowExceptionFunc Throw;
+
 class NoCopy {
 private:
 	NoCopy(const NoCopy &copy) { throw "You can't copy this!"; }
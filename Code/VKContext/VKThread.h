@@ -8,6 +8,17 @@
 #ifndef __VKThread_h__
 #define __VKThread_h__
 
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 namespace VK {
 namespace Thread {
@@ -53,11 +64,7 @@ public:
 	}
 };
 
-#endif // _WIN32
-
-#ifdef ANDROID
-
-#include <pthread.h>
+#else // Android, Linux, and anything else with pthreads
 
 class Lock
 {
@@ -104,7 +111,7 @@ public:
 	}
 };
 
-#endif // ANDROID
+#endif // _WIN32
 
 class AutoLock
 {
@@ -131,6 +138,111 @@ public:
 	}
 };
 
+/// A persistent pool of worker threads for data-parallel loops (like the
+/// planet simulation passes). The threads are created once and sleep on a
+/// condition variable between jobs, so dispatching a job is cheap.
+/// The calling thread always works on the job too, and a job started from
+/// inside another job (nested loops) simply runs on the calling thread.
+class Pool
+{
+public:
+	typedef std::function<void(int)> Task;
+
+protected:
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex, m_run;
+	std::condition_variable m_cvWork, m_cvDone;
+	const Task *m_pTask;
+	std::atomic<int> m_nNext;
+	int m_nTasks, m_nBusy;
+	unsigned int m_nJob;
+	bool m_bQuit;
+
+	static bool &InPool() {
+		static thread_local bool bInPool = false;
+		return bInPool;
+	}
+
+	void work() {
+		for(int i = m_nNext++; i < m_nTasks; i = m_nNext++)
+			(*m_pTask)(i);
+	}
+
+	void loop() {
+		InPool() = true;
+		unsigned int nJob = 0;
+		for(;;) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cvWork.wait(lock, [&] { return m_bQuit || m_nJob != nJob; });
+				if(m_bQuit)
+					return;
+				nJob = m_nJob;
+			}
+			work();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(--m_nBusy == 0)
+				m_cvDone.notify_one();
+		}
+	}
+
+public:
+	/// @param nThreads The total number of threads to work on each job (including the caller), 0 to match the CPU
+	Pool(int nThreads=0) : m_pTask(NULL), m_nNext(0), m_nTasks(0), m_nBusy(0), m_nJob(0), m_bQuit(false) {
+		if(nThreads <= 0)
+			nThreads = (int)std::thread::hardware_concurrency();
+		for(int i = 1; i < nThreads; i++)
+			m_threads.push_back(std::thread(&Pool::loop, this));
+	}
+	~Pool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bQuit = true;
+		}
+		m_cvWork.notify_all();
+		for(size_t i = 0; i < m_threads.size(); i++)
+			m_threads[i].join();
+	}
+
+	/// Returns the number of threads that work on each job (including the caller).
+	int getThreadCount() const { return (int)m_threads.size() + 1; }
+
+	/// Calls fn(i) for each i in [0, nTasks) across the pool and returns when all of them are done.
+	/// Tasks are handed out dynamically, so uneven tasks balance themselves out.
+	void run(int nTasks, const Task &fn) {
+		if(nTasks <= 1 || m_threads.empty() || InPool()) {
+			for(int i = 0; i < nTasks; i++)
+				fn(i);
+			return;
+		}
+
+		std::lock_guard<std::mutex> run(m_run); // Only one job at a time
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pTask = &fn;
+			m_nTasks = nTasks;
+			m_nNext = 0;
+			m_nBusy = (int)m_threads.size();
+			m_nJob++;
+		}
+		m_cvWork.notify_all();
+
+		InPool() = true;
+		work();
+		InPool() = false;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvDone.wait(lock, [&] { return m_nBusy == 0; });
+		m_pTask = NULL;
+	}
+
+	/// Returns a process-wide pool sized to match the CPU (created the first time it's needed).
+	static Pool &GetDefault() {
+		static Pool pool;
+		return pool;
+	}
+};
+
 #else // VK_MULTI_THREADED
 
 inline unsigned int GetCurrentID() { return 0; }
@@ -159,8 +271,43 @@ public:
 	void lock() {}
 };
 
+class Pool
+{
+public:
+	typedef std::function<void(int)> Task;
+	Pool(int nThreads=0) {}
+	int getThreadCount() const { return 1; }
+	void run(int nTasks, const Task &fn) {
+		for(int i = 0; i < nTasks; i++)
+			fn(i);
+	}
+	static Pool &GetDefault() {
+		static Pool pool;
+		return pool;
+	}
+};
+
 #endif // VK_MULTI_THREADED
 
+/// Splits the range [nStart, nEnd) into contiguous chunks and calls fn(i) for every
+/// i in the range using the default pool. Each chunk is at least nGrain items long
+/// (0 picks a chunk size that gives each thread a few chunks to balance the load).
+template <class F> inline void ParallelFor(int nStart, int nEnd, F fn, int nGrain=0) {
+	int nCount = nEnd - nStart;
+	if(nCount <= 0)
+		return;
+	Pool &pool = Pool::GetDefault();
+	if(nGrain <= 0)
+		nGrain = nCount / (pool.getThreadCount() * 4) + 1;
+	int nTasks = (nCount + nGrain - 1) / nGrain;
+	pool.run(nTasks, [&](int nTask) {
+		int nFirst = nStart + nTask * nGrain;
+		int nLast = nFirst + nGrain < nEnd ? nFirst + nGrain : nEnd;
+		for(int i = nFirst; i < nLast; i++)
+			fn(i);
+	});
+}
+
 } // namespace Thread
 } // namespace VK
 
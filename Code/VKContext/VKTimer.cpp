@@ -2,6 +2,9 @@
 //
 
 #include "VKCore.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace VK {
 
@@ -8,6 +8,8 @@
 #ifndef __VKTimer_h__
 #define __VKTimer_h__
 
+#include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #ifndef _WIN32
 #include <sys/time.h>
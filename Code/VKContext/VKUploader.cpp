@@ -0,0 +1,252 @@
+// VKUploader.cpp
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#include "VKCore.h"
+#include "VKContext.h"
+#include "VKUploader.h"
+
+namespace VK {
+
+// Everything the graphics queue might do with an uploaded buffer or image
+static const VkAccessFlags ReadAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+	VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+static void Check(VkResult result, const char *pszCall) {
+	if (result != VK_SUCCESS)
+		VKLogException("Uploader - %s failed (%s)", pszCall, ResultString(result));
+}
+
+void Uploader::init(VkDevice device, VkQueue queue, uint32_t nFamily, uint32_t nGraphicsFamily, MemoryAllocator &allocator) {
+	m_device = device;
+	m_queue = queue;
+	m_nFamily = nFamily;
+	m_nGraphicsFamily = nGraphicsFamily;
+	m_pAllocator = &allocator;
+
+	CommandPoolCreateInfo poolInfo(nFamily);
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Each batch's command buffer is reset when it's recycled
+	Check(vkCreateCommandPool(m_device, &poolInfo, NULL, &m_pool), "vkCreateCommandPool");
+
+	BufferCreateInfo info(StagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	Check(vkCreateBuffer(m_device, &info, NULL, &m_staging), "vkCreateBuffer");
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_device, m_staging, &requirements);
+	if (!m_pAllocator->allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true, m_alloc))
+		VKLogException("Uploader - Failed to allocate the staging ring");
+	Check(vkBindBufferMemory(m_device, m_staging, m_alloc.mem, m_alloc.offset), "vkBindBufferMemory");
+	m_nHead = m_nTail = m_nUsed = 0;
+	VKLogInfo("Uploader - Using queue family %u (%s)", nFamily, isDedicated() ? "transfer only" : "shared with graphics");
+}
+
+void Uploader::destroy() {
+	Thread::AutoLock lock(m_lock);
+	if (!m_device)
+		return;
+
+	// Context waits for the device to go idle first, so every batch can be freed
+	if (m_pCurrent)
+		m_free.push_back(m_pCurrent);
+	m_pCurrent = NULL;
+	m_free.insert(m_free.end(), m_submitted.begin(), m_submitted.end());
+	m_submitted.clear();
+	for (size_t i = 0; i < m_free.size(); i++) {
+		Batch *b = m_free[i];
+		for (size_t j = 0; j < b->temp.size(); j++) {
+			vkDestroyBuffer(m_device, b->temp[j].first, NULL);
+			m_pAllocator->free(b->temp[j].second);
+		}
+		vkDestroyFence(m_device, b->fence, NULL);
+		vkDestroySemaphore(m_device, b->semaphore, NULL);
+		delete b;
+	}
+	m_free.clear();
+	vkDestroyCommandPool(m_device, m_pool, NULL); // Frees the batches' command buffers too
+	m_pool = VK_NULL_HANDLE;
+	vkDestroyBuffer(m_device, m_staging, NULL);
+	m_staging = VK_NULL_HANDLE;
+	m_pAllocator->free(m_alloc);
+	m_device = VK_NULL_HANDLE;
+}
+
+Uploader::Batch *Uploader::getBatch() {
+	if (!m_pCurrent) {
+		if (m_free.empty()) {
+			Batch *b = new Batch;
+			CommandBufferAllocateInfo bufferInfo(m_pool, 1);
+			Check(vkAllocateCommandBuffers(m_device, &bufferInfo, &b->cmd), "vkAllocateCommandBuffers");
+			VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, NULL, 0 };
+			Check(vkCreateFence(m_device, &fenceInfo, NULL, &b->fence), "vkCreateFence");
+			VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, NULL, 0 };
+			Check(vkCreateSemaphore(m_device, &semaphoreInfo, NULL, &b->semaphore), "vkCreateSemaphore");
+			m_free.push_back(b);
+		}
+		m_pCurrent = m_free.back();
+		m_free.pop_back();
+		m_pCurrent->nNumber = ++m_nBatches;
+		m_pCurrent->nFrame = 0;
+		m_pCurrent->nEnd = m_nHead;
+		m_pCurrent->nBytes = 0;
+		CommandBufferBeginInfo beginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		Check(vkBeginCommandBuffer(m_pCurrent->cmd, &beginInfo), "vkBeginCommandBuffer");
+	}
+	return m_pCurrent;
+}
+
+uint8_t *Uploader::stage(VkDeviceSize nBytes, VkBuffer &buffer, VkDeviceSize &nOffset) {
+	Batch *b = getBatch();
+	if (m_nUsed == 0)
+		m_nHead = m_nTail = 0;
+
+	// Find room in the ring, wrapping around to the start if it doesn't fit before the end
+	VkDeviceSize nStart = (m_nHead + Alignment - 1) / Alignment * Alignment;
+	bool bFit = false;
+	if (m_nUsed == 0 || m_nHead > m_nTail) {
+		if (nStart + nBytes <= StagingSize) {
+			bFit = true;
+		} else if (nBytes <= m_nTail) {
+			nStart = 0;
+			bFit = true;
+		}
+	} else if (m_nHead < m_nTail) {
+		bFit = nStart + nBytes <= m_nTail;
+	}
+
+	if (bFit) {
+		// The padding (and the end of the ring when it wraps) is freed with the batch too
+		VkDeviceSize nUsed = (nStart >= m_nHead ? nStart - m_nHead : StagingSize - m_nHead + nStart) + nBytes;
+		m_nUsed += nUsed;
+		b->nBytes += nUsed;
+		m_nHead = b->nEnd = nStart + nBytes;
+		buffer = m_staging;
+		nOffset = nStart;
+		return m_alloc.pData + nStart;
+	}
+
+	// It's too big for the ring, or the ring is full of batches the GPU isn't done with, so give it a buffer of its own
+	std::pair<VkBuffer, Allocation> temp;
+	BufferCreateInfo info(nBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	Check(vkCreateBuffer(m_device, &info, NULL, &temp.first), "vkCreateBuffer");
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_device, temp.first, &requirements);
+	if (!m_pAllocator->allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true, temp.second)) {
+		vkDestroyBuffer(m_device, temp.first, NULL);
+		VKLogException("Uploader - Failed to allocate %llu bytes of staging memory", (unsigned long long)nBytes);
+	}
+	Check(vkBindBufferMemory(m_device, temp.first, temp.second.mem, temp.second.offset), "vkBindBufferMemory");
+	b->temp.push_back(temp);
+	buffer = temp.first;
+	nOffset = 0;
+	return temp.second.pData;
+}
+
+void Uploader::upload(VkBuffer buffer, VkDeviceSize nOffset, const void *pData, VkDeviceSize nBytes) {
+	Thread::AutoLock lock(m_lock);
+	VkBuffer src;
+	VkBufferCopy copy;
+	memcpy(stage(nBytes, src, copy.srcOffset), pData, (size_t)nBytes);
+	copy.dstOffset = nOffset;
+	copy.size = nBytes;
+	vkCmdCopyBuffer(m_pCurrent->cmd, src, buffer, 1, &copy);
+
+	if (isDedicated()) {
+		// Release the range to the graphics queue family, which acquires it before its submit that waits for this batch
+		BufferMemoryBarrier barrier(buffer, VK_ACCESS_TRANSFER_WRITE_BIT, 0, nOffset, nBytes);
+		barrier.srcQueueFamilyIndex = m_nFamily;
+		barrier.dstQueueFamilyIndex = m_nGraphicsFamily;
+		vkCmdPipelineBarrier(m_pCurrent->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = ReadAccess;
+		m_pCurrent->bufferAcquires.push_back(barrier);
+	}
+}
+
+uint8_t *Uploader::stageImage(VkImage image, const VkBufferImageCopy &region, VkDeviceSize nBytes, VkImageLayout oldLayout, VkImageLayout newLayout) {
+	Thread::AutoLock lock(m_lock);
+	VkBuffer src;
+	VkBufferImageCopy copy = region;
+	uint8_t *pData = stage(nBytes, src, copy.bufferOffset);
+
+	const VkImageSubresourceLayers &layers = region.imageSubresource;
+	ImageMemoryBarrier barrier(image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layers.aspectMask);
+	barrier.subresourceRange = ImageSubresourceRange(layers.aspectMask, layers.mipLevel, 1, layers.baseArrayLayer, layers.layerCount);
+	vkCmdPipelineBarrier(m_pCurrent->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+	vkCmdCopyBufferToImage(m_pCurrent->cmd, src, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+	// Move it to newLayout (and release it to the graphics queue family if the copies run on another one)
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = newLayout;
+	if (isDedicated()) {
+		barrier.srcQueueFamilyIndex = m_nFamily;
+		barrier.dstQueueFamilyIndex = m_nGraphicsFamily;
+	}
+	vkCmdPipelineBarrier(m_pCurrent->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+	if (isDedicated()) {
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = ReadAccess;
+		m_pCurrent->imageAcquires.push_back(barrier);
+	}
+	return pData;
+}
+
+VkSemaphore Uploader::submit(uint64_t nFrame, VkCommandBuffer acquireCmd) {
+	Thread::AutoLock lock(m_lock);
+	Batch *b = m_pCurrent;
+	if (!b)
+		return VK_NULL_HANDLE;
+	m_pCurrent = NULL;
+
+	if (acquireCmd && (!b->bufferAcquires.empty() || !b->imageAcquires.empty())) {
+		vkCmdPipelineBarrier(acquireCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL,
+			(uint32_t)b->bufferAcquires.size(), b->bufferAcquires.empty() ? NULL : &b->bufferAcquires[0],
+			(uint32_t)b->imageAcquires.size(), b->imageAcquires.empty() ? NULL : &b->imageAcquires[0]);
+	}
+	b->bufferAcquires.clear();
+	b->imageAcquires.clear();
+
+	Check(vkEndCommandBuffer(b->cmd), "vkEndCommandBuffer");
+	SubmitInfo submitInfo(&b->cmd, NULL, &b->semaphore);
+	Check(vkQueueSubmit(m_queue, 1, &submitInfo, b->fence), "vkQueueSubmit");
+	b->nFrame = nFrame;
+	m_submitted.push_back(b);
+	return b->semaphore;
+}
+
+void Uploader::update(uint64_t nFrame, uint64_t nFramesInFlight) {
+	Thread::AutoLock lock(m_lock);
+	for (std::list<Batch *>::iterator it = m_submitted.begin(); it != m_submitted.end(); it++) {
+		if ((*it)->nNumber > m_nFinished) {
+			if (vkGetFenceStatus(m_device, (*it)->fence) != VK_SUCCESS)
+				break;
+			m_nFinished = (*it)->nNumber;
+		}
+	}
+
+	// Recycle them in order (so the ring's tail moves in order), once the graphics frames that waited for their
+	// semaphores are done too (a semaphore can't be signaled again until its wait has finished)
+	while (!m_submitted.empty()) {
+		Batch *b = m_submitted.front();
+		if (b->nNumber > m_nFinished || nFrame < b->nFrame + nFramesInFlight)
+			break;
+		m_submitted.pop_front();
+		if (b->nBytes) { // A batch that only used buffers of its own doesn't hold any of the ring
+			m_nUsed -= b->nBytes;
+			m_nTail = b->nEnd;
+		}
+		for (size_t i = 0; i < b->temp.size(); i++) {
+			vkDestroyBuffer(m_device, b->temp[i].first, NULL);
+			m_pAllocator->free(b->temp[i].second);
+		}
+		b->temp.clear();
+		Check(vkResetFences(m_device, 1, &b->fence), "vkResetFences");
+		Check(vkResetCommandBuffer(b->cmd, 0), "vkResetCommandBuffer");
+		m_free.push_back(b);
+	}
+}
+
+} // namespace VK
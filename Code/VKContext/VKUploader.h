@@ -0,0 +1,115 @@
+// VKUploader.h
+// This code is part of the VKContext library, an object-oriented class
+// library designed to make Vulkan easier to use with object-oriented
+// languages. It was designed and written by Sean O'Neil, who disclaims
+// any copyright to release it in the public domain.
+//
+
+#ifndef __VKUploader_h__
+#define __VKUploader_h__
+
+#include "VKMemory.h"
+
+namespace VK {
+
+/// Copies data into device-local buffers and images without stalling the graphics queue.
+///
+/// The data is written into a staging ring (a host-visible buffer that stays mapped), and the copies are recorded
+/// into a batch that's submitted all at once, on a transfer-only queue when the device has one (otherwise on the
+/// graphics queue). Context submits the batch ahead of its next graphics submit, which waits for the batch's
+/// semaphore (after acquiring ownership of everything in it from the transfer queue family). The batch's fence
+/// says when its part of the ring can be reused, so nothing ever waits for the whole queue to go idle.
+///
+/// Anything that doesn't fit in the ring gets a staging buffer of its own, which is freed with its batch.
+/// Only upload to resources the frames in flight aren't using (i.e. ones that were just created), since the
+/// copies may run on another queue while those frames are still drawing.
+class Uploader {
+public:
+	static const VkDeviceSize StagingSize = 16 << 20; ///< The size of the staging ring
+	static const VkDeviceSize Alignment = 256; ///< What each staging range is aligned to (covers every texel size and optimalBufferCopyOffsetAlignment)
+
+protected:
+	struct Batch {
+		uint64_t nNumber; ///< Counts up from 1 as batches are started
+		uint64_t nFrame; ///< The graphics frame that waits for it
+		VkCommandBuffer cmd;
+		VkFence fence; ///< Signaled when the copies finish
+		VkSemaphore semaphore; ///< Signaled for the graphics queue to wait on
+		VkDeviceSize nEnd; ///< Where its last staging range ends in the ring
+		VkDeviceSize nBytes; ///< How much of the ring it holds (including padding)
+		std::vector<std::pair<VkBuffer, Allocation> > temp; ///< Staging buffers that didn't fit in the ring
+		std::vector<VkBufferMemoryBarrier> bufferAcquires; ///< Ownership acquires the graphics queue has to do
+		std::vector<VkImageMemoryBarrier> imageAcquires;
+	};
+
+	Thread::Lock m_lock;
+	VkDevice m_device;
+	VkQueue m_queue;
+	uint32_t m_nFamily, m_nGraphicsFamily;
+	MemoryAllocator *m_pAllocator;
+	VkCommandPool m_pool;
+	VkBuffer m_staging;
+	Allocation m_alloc;
+	VkDeviceSize m_nHead, m_nTail, m_nUsed; ///< The ring is used from tail up to head (wrapping around)
+	Batch *m_pCurrent; ///< The batch being recorded (NULL until something is uploaded)
+	std::list<Batch *> m_submitted; ///< Oldest first
+	std::vector<Batch *> m_free;
+	uint64_t m_nBatches, m_nFinished;
+
+	Batch *getBatch();
+	uint8_t *stage(VkDeviceSize nBytes, VkBuffer &buffer, VkDeviceSize &nOffset);
+
+public:
+	Uploader() : m_device(VK_NULL_HANDLE), m_queue(VK_NULL_HANDLE), m_nFamily(0), m_nGraphicsFamily(0), m_pAllocator(NULL), m_pool(VK_NULL_HANDLE),
+		m_staging(VK_NULL_HANDLE), m_nHead(0), m_nTail(0), m_nUsed(0), m_pCurrent(NULL), m_nBatches(0), m_nFinished(0) {}
+	~Uploader() { destroy(); }
+
+	/// Call once the device is created
+	/// \param queue The queue to submit the copies to (from the nFamily queue family)
+	/// \param nGraphicsFamily The queue family the uploaded resources are used on
+	void init(VkDevice device, VkQueue queue, uint32_t nFamily, uint32_t nGraphicsFamily, MemoryAllocator &allocator);
+
+	/// Frees everything (call after the device is idle, before the allocator is destroyed)
+	void destroy();
+
+	bool isDedicated() const { return m_nFamily != m_nGraphicsFamily; } ///< Returns true if the copies run on a transfer-only queue family
+
+	/// Copies nBytes from pData to buffer at nOffset (the buffer needs VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+	void upload(VkBuffer buffer, VkDeviceSize nOffset, const void *pData, VkDeviceSize nBytes);
+
+	/// Returns where to write nBytes to be copied to one region of an image (the image needs VK_IMAGE_USAGE_TRANSFER_DST_BIT).
+	/// The region's bufferOffset is filled in, and the image's layers in the region go from oldLayout to newLayout
+	/// (use VK_IMAGE_LAYOUT_UNDEFINED for oldLayout unless the rest of the image has to be kept).
+	uint8_t *stageImage(VkImage image, const VkBufferImageCopy &region, VkDeviceSize nBytes, VkImageLayout oldLayout, VkImageLayout newLayout);
+
+	/// Copies nBytes from pData to one region of an image (see stageImage())
+	void upload(VkImage image, const VkBufferImageCopy &region, const void *pData, VkDeviceSize nBytes, VkImageLayout oldLayout, VkImageLayout newLayout) {
+		memcpy(stageImage(image, region, nBytes, oldLayout, newLayout), pData, (size_t)nBytes);
+	}
+
+	/// Returns the number of the batch being recorded (to pass to isComplete() after uploading something)
+	uint64_t getBatchNumber() { Thread::AutoLock lock(m_lock); return m_pCurrent ? m_pCurrent->nNumber : m_nBatches + 1; }
+
+	/// Returns true once the copies in batch nBatch have finished on the GPU
+	bool isComplete(uint64_t nBatch) const { return nBatch <= m_nFinished; }
+
+	/// @name Called by Context
+	//@{
+	bool isPending() const { return m_pCurrent != NULL; } ///< Returns true if there's a batch to submit
+	bool needsAcquire() const { return m_pCurrent && (!m_pCurrent->bufferAcquires.empty() || !m_pCurrent->imageAcquires.empty()); }
+
+	/// Submits the batch being recorded. The next graphics submit has to wait for the semaphore this returns.
+	/// \param nFrame The graphics frame that waits for it
+	/// \param acquireCmd A graphics command buffer to record the ownership acquires in, ahead of anything that uses
+	/// what was uploaded (only needed if needsAcquire())
+	VkSemaphore submit(uint64_t nFrame, VkCommandBuffer acquireCmd);
+
+	/// Checks which batches have finished, and recycles the ones the graphics frames are done with too
+	/// \param nFrame The graphics frame that's starting (the FramesInFlight frames before it are done)
+	void update(uint64_t nFrame, uint64_t nFramesInFlight);
+	//@}
+};
+
+} // namespace VK
+
+#endif // __VKUploader_h__
@@ -8,6 +8,7 @@
 #define __VKVector_h__
 
 #include "VKMath.h"
+#include "VKLogger.h" // For VKLogException
 
 #pragma warning(disable : 4127)
 #pragma warning(disable : 4146)
@@ -95,7 +96,6 @@ public:
 		float a;
 		std::sscanf(psz, "v[%f]", &a);
 		x = (T)a;
-		dir = dir.normalize();
 	}
 
 	/// @name Swizzle operators
@@ -118,7 +118,7 @@ public:
 	Vector2() : Vector1<T>() {}
 	Vector2(T a) : Vector1<T>(a) {}
 	Vector2(T a, T b) : Vector1<T>(a) { this->y = b;}
-	Vector2(T *p) { x = p[0]; y = p[1]; }
+	Vector2(T *p) { this->x = p[0]; this->y = p[1]; }
 	Vector2(const Vector1<T> &v, T b) : Vector1<T>(v) { y = b; }
 	Vector2(const Vector2<T> &v) : Vector1<T>(v) { y = v.y; }
 	//@}
@@ -182,8 +182,7 @@ public:
 	void from_s(const char *psz) {
 		float a, b;
 		std::sscanf(psz, "v[%f, %f]", &a, &b);
-		x = (T)a; y = (T)b;
-		dir = dir.normalize();
+		this->x = (T)a; this->y = (T)b;
 	}
 
 	/// @name Operator overloads for common vector operations
@@ -241,7 +240,7 @@ public:
 	Vector3(T a) : Vector2<T>(a) {}
 	Vector3(T a, T b) : Vector2<T>(a, b) {}
 	Vector3(T a, T b, T c) : Vector2<T>(a, b) { this->z = c; }
-	Vector3(T *p) { x = p[0]; y = p[1]; z = p[2]; }
+	Vector3(T *p) { this->x = p[0]; this->y = p[1]; this->z = p[2]; }
 	Vector3(const Vector1<T> &v, T b, T c) : Vector2<T>(v, b) { this->z = c; }
 	Vector3(const Vector2<T> &v, T c) : Vector2<T>(v) { this->z = c; }
 	Vector3(const Vector3<T> &v) : Vector2<T>(v) { this->z = v.z; }
@@ -307,8 +306,7 @@ public:
 	void from_s(const char *psz) {
 		float a, b, c;
 		std::sscanf(psz, "v[%f, %f, %f]", &a, &b, &c);
-		x = (T)a; y = (T)b; z = (T)c;
-		dir = dir.normalize();
+		this->x = (T)a; this->y = (T)b; this->z = (T)c;
 	}
 
 	/// @name Operator overloads for common vector operations
@@ -433,7 +431,7 @@ public:
 	Vector4(T a, T b) : Vector3<T>(a, b) {}
 	Vector4(T a, T b, T c) : Vector3<T>(a, b, c) {}
 	Vector4(T a, T b, T c, T d) : Vector3<T>(a, b, c) { this->w = d; }
-	Vector4(T *p) { x = p[0]; y = p[1]; z = p[2]; w = p[3]; }
+	Vector4(T *p) { this->x = p[0]; this->y = p[1]; this->z = p[2]; this->w = p[3]; }
 	Vector4(const Vector1<T> &v, T b, T c, T d) : Vector3<T>(v, b, c) { this->w = d; }
 	Vector4(const Vector2<T> &v, T c, T d) : Vector3<T>(v, c) { this->w = d; }
 	Vector4(const Vector3<T> &v, T d) : Vector3<T>(v) { this->w = d; }
@@ -511,8 +509,7 @@ public:
 	void from_s(const char *psz) {
 		float a, b, c, d;
 		std::sscanf(psz, "v[%f, %f, %f, %f]", &a, &b, &c, &d);
-		x = (T)a; y = (T)b; z = (T)c; w = (T)d;
-		dir = dir.normalize();
+		this->x = (T)a; this->y = (T)b; this->z = (T)c; this->w = (T)d;
 	}
 
 	/// @name Swizzle operators
@@ -114,11 +114,11 @@ struct CommandPoolCreateInfo : public VkCommandPoolCreateInfo {
 };
 
 struct CommandBufferAllocateInfo : public VkCommandBufferAllocateInfo {
-	CommandBufferAllocateInfo(VkCommandPool pool, uint32_t count = 1) {
+	CommandBufferAllocateInfo(VkCommandPool pool, uint32_t count = 1, VkCommandBufferLevel l = VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
 		sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		pNext = nullptr;
 		commandPool = pool;
-		level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		level = l;
 		commandBufferCount = count;
 	}
 };
@@ -248,6 +248,20 @@ struct ImageMemoryBarrier : public VkImageMemoryBarrier {
 	}
 };
 
+struct BufferMemoryBarrier : public VkBufferMemoryBarrier {
+	BufferMemoryBarrier(VkBuffer b, VkAccessFlags src, VkAccessFlags dest, VkDeviceSize off = 0, VkDeviceSize s = VK_WHOLE_SIZE) {
+		sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		pNext = nullptr;
+		srcAccessMask = src;
+		dstAccessMask = dest;
+		srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		buffer = b;
+		offset = off;
+		size = s;
+	}
+};
+
 struct SwapchainCreateInfoKHR : public VkSwapchainCreateInfoKHR {
 	SwapchainCreateInfoKHR(VkSurfaceKHR s, uint32_t min, VkFormat f, VkColorSpaceKHR c, uint32_t w, uint32_t h, VkSurfaceCapabilitiesKHR cap, VkPresentModeKHR present) {
 		sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -407,7 +421,15 @@ struct SubpassDescription : public VkSubpassDescription {
 };
 
 struct SubpassDependency : public VkSubpassDependency {
-	// TODO: Implement when we need one of these
+	SubpassDependency(uint32_t src, uint32_t dst, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage, VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkDependencyFlags f = 0) {
+		srcSubpass = src;
+		dstSubpass = dst;
+		srcStageMask = srcStage;
+		dstStageMask = dstStage;
+		srcAccessMask = srcAccess;
+		dstAccessMask = dstAccess;
+		dependencyFlags = f;
+	}
 };
 
 struct RenderPassCreateInfo : public VkRenderPassCreateInfo {
@@ -602,6 +624,16 @@ struct PipelineLayoutCreateInfo : public VkPipelineLayoutCreateInfo {
 	}
 };
 
+struct PipelineCacheCreateInfo : public VkPipelineCacheCreateInfo {
+	PipelineCacheCreateInfo(const void *data = NULL, size_t size = 0) {
+		sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		pNext = nullptr;
+		flags = 0;
+		initialDataSize = size;
+		pInitialData = data;
+	}
+};
+
 struct RenderPassBeginInfo : public VkRenderPassBeginInfo {
 	RenderPassBeginInfo(VkRenderPass pass, VkFramebuffer frame, Rect2D &rect, std::vector<VkClearValue> *clear = nullptr) {
 		sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
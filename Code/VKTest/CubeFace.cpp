@@ -2,7 +2,10 @@
 //
 #include "../VKContext/VKCore.h"
 #include "../VKContext/VKVector.h"
+#include "../VKContext/VKSIMD.h"
 #include "CubeFace.h"
+
+#include <random>
 //#include "PlanetaryMapCoord.h"
 
 
@@ -62,8 +65,8 @@ uint8_t CubeFace::GetFaceCoordinates(const VK::ivec3 &v, int &x, int &y)
 	}
 
 	// x and y should be approximately from MinCoord to MaxCoord
-	x = (muldiv(sc, MaxCoord, ma) + MaxCoord) >> 1;
-	y = (muldiv(tc, MaxCoord, ma) + MaxCoord) >> 1;
+	x = (Unwarp(muldiv(sc, MaxCoord, ma)) + MaxCoord) >> 1;
+	y = (Unwarp(muldiv(tc, MaxCoord, ma)) + MaxCoord) >> 1;
 	return nFace;
 }
 
@@ -129,15 +132,15 @@ void CubeFace::GetFaceCoordinates(unsigned char nFace, const VK::ivec3 &v, int &
 			break;
 	}
 
-	x = (x + MaxCoord) >> 1;
-	y = (y + MaxCoord) >> 1;
+	x = (Unwarp(x) + MaxCoord) >> 1;
+	y = (Unwarp(y) + MaxCoord) >> 1;
 }
 
 VK::ivec3 CubeFace::GetPlanetaryVector(uint8_t nFace, int x, int y, int nLength)
 {
 	int z = 0;
-	x = (x << 1) - MaxCoord;
-	y = (y << 1) - MaxCoord;
+	x = Warp((x << 1) - MaxCoord);
+	y = Warp((y << 1) - MaxCoord);
 	switch(nFace) {
 		case RightFace:
 			z = -x;
@@ -188,6 +191,214 @@ VK::ivec3 CubeFace::GetPlanetaryVector(uint8_t nFace, int x, int y, int nLength)
 		(int)(z * d + (z < 0 ? -0.5 : 0.5)));
 }
 
+namespace {
+	// Returns the face coordinate (-1 to 1) of a texel, where n goes from -w to w in steps of 2.
+	// The edges stay at exactly +/-1 so texels on a shared edge still match in both faces.
+	inline float TexelCoord(int n, int w) {
+#if CubeProjection == TangentProjection
+		if(n != w && n != -w)
+			return (float)CubeFace::Warp((double)n / w);
+#endif
+		return (float)n * (1.0f / w);
+	}
+}
+
+void CubeFace::GetDirections(uint8_t nFace, int nWidth, int y, VK::vec3 *pDirections)
+{
+	// Each component of the (unnormalized) vector is +/-1, +/-s, or +/-t, where s and t go from -1 to 1 across
+	// the face (see GetPlanetaryVector). Adding is commutative but not associative, so the length is always
+	// calculated as 1 + (s*s + t*t). That way texels on a shared edge get exactly the same floats in both faces,
+	// even when s in one face is t in the other.
+	// Each entry is 1 for 1, 2 for s, 3 for t, and negative to flip the sign.
+	static const int8_t nAxis[6][3] = {
+		{ 1, -3, -2 },		// RightFace
+		{ -1, -3, 2 },		// LeftFace
+		{ 2, 1, 3 },		// TopFace
+		{ 2, -1, -3 },		// BottomFace
+		{ 2, -3, 1 },		// FrontFace
+		{ -2, -3, -1 },		// BackFace
+	};
+	const int w = nWidth - 1;
+	const float t = TexelCoord(2 * y - w, w);
+	const int8_t *pAxis = nAxis[nFace];
+
+	int x = 0;
+	float *p = &pDirections[0].x;
+	VK::SIMD::Float4 one(1.0f), tt(t), t2(t * t);
+	for(; x + 4 <= nWidth; x += 4, p += 12) {
+		VK::SIMD::Float4 s(TexelCoord(2 * x - w, w), TexelCoord(2 * x + 2 - w, w), TexelCoord(2 * x + 4 - w, w), TexelCoord(2 * x + 6 - w, w));
+		VK::SIMD::Float4 f = one / VK::SIMD::Sqrt(one + (s * s + t2));
+		const VK::SIMD::Float4 *pValue[4] = { NULL, &one, &s, &tt };
+		float v[3][4];
+		for(int i = 0; i < 3; i++) {
+			int n = pAxis[i];
+			VK::SIMD::Store(v[i], n < 0 ? -(*pValue[-n] * f) : *pValue[n] * f);
+		}
+		for(int i = 0; i < 4; i++) {
+			p[i * 3 + 0] = v[0][i];
+			p[i * 3 + 1] = v[1][i];
+			p[i * 3 + 2] = v[2][i];
+		}
+	}
+	for(; x < nWidth; x++, p += 3) {
+		float s = TexelCoord(2 * x - w, w);
+		float f = 1.0f / sqrtf(1.0f + (s * s + t * t));
+		const float fValue[4] = { 0.0f, 1.0f, s, t };
+		for(int i = 0; i < 3; i++) {
+			int n = pAxis[i];
+			p[i] = n < 0 ? -(fValue[-n] * f) : fValue[n] * f;
+		}
+	}
+}
+
+namespace {
+	// For each face, which of (x, y, MaxCoord) goes into each component of GetPlanetaryVector (0-2), and its sign
+	const int8_t VectorAxis[6][3] = { { 2, 1, 0 }, { 2, 1, 0 }, { 0, 2, 1 }, { 0, 2, 1 }, { 0, 1, 2 }, { 0, 1, 2 } };
+	const int8_t VectorSign[6][3] = { { 1, -1, -1 }, { -1, -1, 1 }, { 1, 1, 1 }, { 1, -1, -1 }, { 1, -1, 1 }, { -1, -1, -1 } };
+
+	// For each face, which component of the vector (0-2) becomes x and y in GetFaceCoordinates, and its sign
+	const int8_t CoordAxis[6][2] = { { 2, 1 }, { 2, 1 }, { 0, 2 }, { 0, 2 }, { 0, 1 }, { 0, 1 } };
+	const int8_t CoordSign[6][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { 1, -1 }, { 1, -1 }, { -1, -1 } };
+
+	// The double math in the SIMD versions gives the same results as 64-bit ints as long as the divisor is below this
+	// (the products stay below 2^53, and rounding errors stay far enough away from .5 to never change the result).
+	const int MaxExactDivisor = 1 << 26;
+
+	// Picks the face a vector is in (the same way GetFaceCoordinates does) without branching
+	inline uint8_t SelectFace(const VK::ivec3 &v, int &ma) {
+		int ax = VK::Math::Abs(v.x), ay = VK::Math::Abs(v.y), az = VK::Math::Abs(v.z);
+		int nAxis = (ax > ay && ax > az) ? 0 : (ay > az) ? 1 : 2;
+		ma = nAxis == 0 ? ax : nAxis == 1 ? ay : az;
+		return (uint8_t)(nAxis * 2 + ((&v.x)[nAxis] <= 0));
+	}
+}
+
+void CubeFace::GetPlanetaryVectors(const VK::ivec3 *pCoords, VK::ivec3 *pVectors, int nCount, int nLength)
+{
+	int i = 0;
+#ifdef VK_SIMD_SSE
+	const __m128d half = _mm_set1_pd(0.5), sign = _mm_set1_pd(-0.0), length = _mm_set1_pd((double)nLength);
+	for(; i + 2 <= nCount; i += 2) {
+		double c[3][2];
+		for(int j = 0; j < 2; j++) {
+			const VK::ivec3 &coord = pCoords[i + j];
+			const int nValue[3] = { Warp((coord.x << 1) - MaxCoord), Warp((coord.y << 1) - MaxCoord), MaxCoord };
+			const int8_t *pAxis = VectorAxis[coord.z], *pSign = VectorSign[coord.z];
+			for(int k = 0; k < 3; k++)
+				c[k][j] = (double)(nValue[pAxis[k]] * pSign[k]);
+		}
+		__m128d x = _mm_loadu_pd(c[0]), y = _mm_loadu_pd(c[1]), z = _mm_loadu_pd(c[2]);
+		__m128d d = _mm_div_pd(length, _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z))));
+		// (int)(x * d + (x < 0 ? -0.5 : 0.5))
+		int n[3][4];
+		_mm_storeu_si128((__m128i *)n[0], _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(x, d), _mm_or_pd(half, _mm_and_pd(x, sign)))));
+		_mm_storeu_si128((__m128i *)n[1], _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(y, d), _mm_or_pd(half, _mm_and_pd(y, sign)))));
+		_mm_storeu_si128((__m128i *)n[2], _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(z, d), _mm_or_pd(half, _mm_and_pd(z, sign)))));
+		pVectors[i] = VK::ivec3(n[0][0], n[1][0], n[2][0]);
+		pVectors[i + 1] = VK::ivec3(n[0][1], n[1][1], n[2][1]);
+	}
+#endif
+	for(; i < nCount; i++)
+		pVectors[i] = GetPlanetaryVector((uint8_t)pCoords[i].z, pCoords[i].x, pCoords[i].y, nLength);
+}
+
+void CubeFace::GetPlanetaryVectors(const VK::ivec3 *pCoords, VK::dvec3 *pVectors, int nCount)
+{
+	VK::ivec3 v[256];
+	for(int i = 0; i < nCount; i += 256) {
+		int n = VK::Math::Min(256, nCount - i);
+		GetPlanetaryVectors(pCoords + i, v, n, MaxCoord);
+		for(int j = 0; j < n; j++)
+			pVectors[i + j] = to_f(v[j], MaxCoord);
+	}
+}
+
+void CubeFace::GetFaceCoordinates(const VK::ivec3 *pVectors, VK::ivec3 *pCoords, int nCount)
+{
+	int i = 0;
+#ifdef VK_SIMD_SSE
+	const __m128d half = _mm_set1_pd(0.5), sign = _mm_set1_pd(-0.0), scale = _mm_set1_pd((double)MaxCoord);
+	for(; i + 2 <= nCount; i += 2) {
+		double sc[2], tc[2], ma[2];
+		uint8_t nFace[2];
+		bool bExact = true;
+		for(int j = 0; j < 2; j++) {
+			const VK::ivec3 &v = pVectors[i + j];
+			int m;
+			nFace[j] = SelectFace(v, m);
+			sc[j] = (double)((&v.x)[CoordAxis[nFace[j]][0]] * CoordSign[nFace[j]][0]);
+			tc[j] = (double)((&v.x)[CoordAxis[nFace[j]][1]] * CoordSign[nFace[j]][1]);
+			ma[j] = (double)m;
+			bExact = bExact && m < MaxExactDivisor;
+		}
+		if(!bExact)
+			break; // Let the scalar version handle huge vectors
+		// (Unwarp(muldiv(sc, MaxCoord, ma)) + MaxCoord) >> 1
+		__m128d m = _mm_loadu_pd(ma);
+		__m128d x = _mm_div_pd(_mm_mul_pd(_mm_loadu_pd(sc), scale), m);
+		__m128d y = _mm_div_pd(_mm_mul_pd(_mm_loadu_pd(tc), scale), m);
+		int nx[4], ny[4];
+		_mm_storeu_si128((__m128i *)nx, _mm_cvttpd_epi32(_mm_add_pd(x, _mm_or_pd(half, _mm_and_pd(x, sign)))));
+		_mm_storeu_si128((__m128i *)ny, _mm_cvttpd_epi32(_mm_add_pd(y, _mm_or_pd(half, _mm_and_pd(y, sign)))));
+		pCoords[i] = VK::ivec3((Unwarp(nx[0]) + MaxCoord) >> 1, (Unwarp(ny[0]) + MaxCoord) >> 1, nFace[0]);
+		pCoords[i + 1] = VK::ivec3((Unwarp(nx[1]) + MaxCoord) >> 1, (Unwarp(ny[1]) + MaxCoord) >> 1, nFace[1]);
+	}
+#endif
+	for(; i < nCount; i++) {
+		int x, y;
+		uint8_t nFace = GetFaceCoordinates(pVectors[i], x, y);
+		pCoords[i] = VK::ivec3(x, y, nFace);
+	}
+}
+
+void CubeFace::GetFaceCoordinates(const VK::dvec3 *pVectors, VK::ivec3 *pCoords, int nCount)
+{
+	VK::ivec3 v[256];
+	for(int i = 0; i < nCount; i += 256) {
+		int n = VK::Math::Min(256, nCount - i);
+		for(int j = 0; j < n; j++)
+			v[j] = to_i(pVectors[i + j]);
+		GetFaceCoordinates(v, pCoords + i, n);
+	}
+}
+
+bool CubeFace::Benchmark(int nCount)
+{
+	std::mt19937 gen(12345);
+	std::uniform_int_distribution<int> coord(0, MaxCoord), face(0, FaceCount - 1);
+	std::vector<VK::ivec3> vCoords(nCount), vVectors(nCount), vBatch(nCount);
+	for(int i = 0; i < nCount; i++)
+		vCoords[i] = VK::ivec3(coord(gen), coord(gen), face(gen));
+
+	double t = VK::Timer::Time();
+	for(int i = 0; i < nCount; i++)
+		vVectors[i] = GetPlanetaryVector((uint8_t)vCoords[i].z, vCoords[i].x, vCoords[i].y, MaxCoord);
+	double tSingle = VK::Timer::Time() - t;
+	GetPlanetaryVectors(&vCoords[0], &vBatch[0], nCount, MaxCoord);
+	double tBatch = VK::Timer::Time() - t - tSingle;
+	int nErrors = 0;
+	for(int i = 0; i < nCount; i++)
+		nErrors += vBatch[i].x != vVectors[i].x || vBatch[i].y != vVectors[i].y || vBatch[i].z != vVectors[i].z;
+	VKLogInfo("CubeFace::Benchmark - GetPlanetaryVector: %.1lf million per second, batch: %.1lf million per second (%d mismatches)",
+		nCount / tSingle * 1e-6, nCount / tBatch * 1e-6, nErrors);
+
+	t = VK::Timer::Time();
+	for(int i = 0; i < nCount; i++) {
+		int x, y;
+		uint8_t nFace = GetFaceCoordinates(vVectors[i], x, y);
+		vCoords[i] = VK::ivec3(x, y, nFace);
+	}
+	tSingle = VK::Timer::Time() - t;
+	GetFaceCoordinates(&vVectors[0], &vBatch[0], nCount);
+	tBatch = VK::Timer::Time() - t - tSingle;
+	int nCoordErrors = 0;
+	for(int i = 0; i < nCount; i++)
+		nCoordErrors += vBatch[i].x != vCoords[i].x || vBatch[i].y != vCoords[i].y || vBatch[i].z != vCoords[i].z;
+	VKLogInfo("CubeFace::Benchmark - GetFaceCoordinates: %.1lf million per second, batch: %.1lf million per second (%d mismatches)",
+		nCount / tSingle * 1e-6, nCount / tBatch * 1e-6, nCoordErrors);
+	return nErrors == 0 && nCoordErrors == 0;
+}
+
 void CubeFace::CrossEdge(int w, uint8_t nEdge, uint8_t &nFace, int &x, int &y, int n) {
 	uint8_t nReturnEdge = NeighborEdge(nFace, nEdge);
 	nFace = NeighborFace(nFace, nEdge);
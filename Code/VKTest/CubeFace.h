@@ -19,12 +19,14 @@ namespace VK {
 class CubeFace
 {
 private:
-	/// Safely multiplies two 32-bit ints (which creates a 64-bit int) and divides by another.
+	/// Safely multiplies two 32-bit ints (which creates a 64-bit int) and divides by another, rounding to the nearest int.
 	/// It is only safe if d is does not overflow 32 bits, but various checks in this class will ensure that.
+	/// Both versions return the same results for the coordinates used in this class (|n * m| < 2^53).
 	static int muldiv(int n, int m, int d) {
-#ifdef _WIN64
-		// In 64-bit mode on my CPU, this "should" be faster (haven't tried it yet).
-		return (int)(((__int64)n * (__int64)m) / d);
+#if defined(_WIN64) || defined(__LP64__)
+		// On 64-bit targets, 64-bit ints are native (the rounding matches the double version below).
+		int64_t p = (int64_t)n * (int64_t)m, h = (d < 0 ? -(int64_t)d : (int64_t)d) >> 1;
+		return (int)((p < 0 ? p - h : p + h) / d);
 #else
 		// In 32-bit mode on my CPU, the 64-bit divide kills the performance.
 		// A double should have enough precision, and it's faster.
@@ -49,6 +51,51 @@ public:
 	/// \return The neighboring face on the specified side
 	static uint8_t NeighborEdge(uint8_t nFace, uint8_t nEdge) { return (uint8_t)VK::NeighborEdge[nFace][nEdge]; }
 
+	/// Use to find how far a neighbor's orientation is turned from this face's orientation.
+	/// Directions are numbered like edges (up, right, down, left), so direction d in the
+	/// neighboring face is direction (d + n) & 3 in the starting face.
+	/// \param nFace The starting cube face
+	/// \param nEdge The edge (or side) of the neighbor you want
+	/// \return The number of 90-degree turns (0-3)
+	static uint8_t NeighborRotation(uint8_t nFace, uint8_t nEdge) { return (uint8_t)((nEdge + 2 - NeighborEdge(nFace, nEdge)) & 3); }
+
+	/// Warps a face coordinate (from -1 to 1) before it's turned into a point on the cube, based on CubeProjection
+	/// (see VKTest.h). With TangentProjection, equal steps in face coordinates cover roughly equal areas on the sphere.
+	static double Warp(double d) {
+#if CubeProjection == TangentProjection
+		return tan(d * (VK::PI_DOUBLE / 4));
+#else
+		return d;
+#endif
+	}
+	/// The inverse of Warp (takes a point on the cube, from -1 to 1, and returns the face coordinate)
+	static double Unwarp(double d) {
+#if CubeProjection == TangentProjection
+		return atan(d) * (4 / VK::PI_DOUBLE);
+#else
+		return d;
+#endif
+	}
+	/// Integer versions of Warp and Unwarp for coordinates from -MaxCoord to MaxCoord (rounded to the nearest int,
+	/// so Unwarp(Warp(n)) is within 1 of n). Both keep +/-MaxCoord and the sign exactly, so texels on a shared edge
+	/// still match in both faces.
+	static int Warp(int n) {
+#if CubeProjection == TangentProjection
+		double d = Warp((double)n / MaxCoord) * MaxCoord;
+		return (int)(d + (d < 0 ? -0.5 : 0.5));
+#else
+		return n;
+#endif
+	}
+	static int Unwarp(int n) {
+#if CubeProjection == TangentProjection
+		double d = Unwarp((double)n / MaxCoord) * MaxCoord;
+		return (int)(d + (d < 0 ? -0.5 : 0.5));
+#else
+		return n;
+#endif
+	}
+
 	static int to_i(double f) { return (int)(f * MaxCoord + 0.5); }
 	static double to_f(int i) { return (double)i / (double)MaxCoord; }
 	static double to_f(int i, double length) { return (i*length) / (double)MaxCoord; }
@@ -87,6 +134,16 @@ public:
 		return to_f(GetPlanetaryVector(nFace, to_i(x), to_i(y), MaxCoord), MaxCoord, fLength);
 	}
 
+	/// Generates the unit vector through each texel in one row of a face (4 at a time using SIMD).
+	/// This is much cheaper than calling GetPlanetaryVector per texel, so passes that need
+	/// directions can generate them one row at a time instead of keeping a table of them.
+	/// Texels on a shared edge get exactly the same vector in both faces.
+	/// \param nFace The desired cube face
+	/// \param nWidth The number of texels on each side of the face (including the shared edges)
+	/// \param y The row (0 - nWidth-1)
+	/// \param pDirections (Out) An array of nWidth vectors to fill in
+	static void GetDirections(uint8_t nFace, int nWidth, int y, VK::vec3 *pDirections);
+
 	/// Takes a 3D vector and converts it into cube face coordinates.
 	/// This version of the function always returns coordinates in the specified face.
 	/// If the vector is not in the specified face, the nearest coordinates are returned.
@@ -125,6 +182,32 @@ public:
 		return nFace;
 	}
 
+	//************************************************************
+	// batch methods
+	//************************************************************
+
+	/// Batch versions of GetPlanetaryVector and GetFaceCoordinates for converting a lot of coordinates at once.
+	/// Face coordinates are stored as ivec3(x, y, face), like the flood fill in main.cpp. The face is picked with
+	/// table lookups and selects instead of a switch, and the math runs 2 at a time in SIMD doubles.
+	/// They return exactly the same results as calling the single versions in a loop.
+	/// \param pCoords An array of face coordinates (x and y go from 0 to MaxCoord)
+	/// \param pVectors (Out) An array of vectors to fill in
+	/// \param nCount The number of elements in each array
+	/// \param nLength The desired length, or magnitude, of the vectors
+	static void GetPlanetaryVectors(const VK::ivec3 *pCoords, VK::ivec3 *pVectors, int nCount, int nLength);
+	static void GetPlanetaryVectors(const VK::ivec3 *pCoords, VK::dvec3 *pVectors, int nCount);
+
+	/// \param pVectors An array of 3D vectors (relative to the center of the cube)
+	/// \param pCoords (Out) An array of face coordinates to fill in (as ivec3(x, y, face))
+	/// \param nCount The number of elements in each array
+	static void GetFaceCoordinates(const VK::ivec3 *pVectors, VK::ivec3 *pCoords, int nCount);
+	static void GetFaceCoordinates(const VK::dvec3 *pVectors, VK::ivec3 *pCoords, int nCount);
+
+	/// Times the batch methods against the single versions on nCount random coordinates, checks that they
+	/// match, and logs the results (i.e. "VKTest.exe -benchmark").
+	/// \return true if every result matched
+	static bool Benchmark(int nCount);
+
 	/// Takes a set of coordinates in one cube face and finds coordinates close to it in a neighboring cube face.
 	/// \param w The width of the integer coordinate system (not counting the shared edge)
 	/// \param nEdge The edge to cross over
@@ -162,11 +245,11 @@ public:
 
 	static void AdjustCoords(int w, uint8_t &nFace, int &x, int &y) {
 		if(x < 0) {
-			y = (DWORD)VK::Math::Max(0, VK::Math::Min(w, y)); // There are no diagonal neighbors
+			y = VK::Math::Max(0, VK::Math::Min(w, y)); // There are no diagonal neighbors
 			CrossEdge(w, LeftEdge, nFace, x, y, 0-x);
 		}
 		if(x > w) {
-			y = (DWORD)VK::Math::Max(0, VK::Math::Min(w, y)); // There are no diagonal neighbors
+			y = VK::Math::Max(0, VK::Math::Min(w, y)); // There are no diagonal neighbors
 			CrossEdge(w, RightEdge, nFace, x, y, x-w);
 		}
 		if(y < 0)
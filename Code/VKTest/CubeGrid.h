@@ -0,0 +1,223 @@
+// CubeGrid.h
+//
+#ifndef __CubeGrid_h__
+#define __CubeGrid_h__
+
+#include "CubeFace.h"
+
+/// Stores one channel of the six faces of a cube map, with a border (or halo) of extra texels
+/// around every face that holds copies of the texels across each edge. With the halo filled,
+/// a stencil that reads up to nHalo texels away never needs to call CubeFace::AdjustCoords, so
+/// its inner loop is a branch-free pass over contiguous rows (index +/- 1 and +/- getPitch()).
+///
+/// Like the rest of the planet maps, texels on a shared edge exist in both faces (x = 0 on one
+/// face is x = w on its neighbor). exchange() first copies each shared edge texel from the lowest
+/// face that contains it, so the faces can't drift apart, then fills each face's halo one edge at
+/// a time. Crossing an edge maps texels to the neighbor with a fixed offset and stride (the
+/// mapping in CubeFace::CrossEdge is linear), so each edge is a simple strided copy that's worked
+/// out once in create(). The corners of the halo (where only 3 faces meet) are filled from the
+/// neighbor's halo, so they hold the texels from the third face.
+///
+/// Every CubeGrid with the same width and halo has the same layout, so a stencil can use one
+/// index across several channels. Channels that hold a direction (i.e. one value per edge, like
+/// the outflow in Erosion) have to be rotated when they're copied from another face, which is
+/// what the static version of exchange() is for.
+template <class T> class CubeGrid
+{
+protected:
+	/// A strided copy that fills one band of texels in a face from the face across one of its edges
+	struct Strip {
+		int nDest, nDestAlong, nDestOut;	///< The first texel to fill and the steps along the edge and away from it
+		int nSrc, nSrcAlong, nSrcOut;		///< The matching texel in the neighbor and its steps
+		int nStart, nEnd;					///< The range of texels along the edge to copy
+		int nRows;							///< The number of rows to copy moving away from the edge
+		uint8_t nRotate;					///< The number of 90-degree turns from the neighbor's orientation
+	};
+
+	int m_nWidth;					///< The number of texels on each side of a face (including the shared edges)
+	int m_nHalo;					///< The number of extra texels on each side of a face
+	int m_nPitch;					///< The number of texels in each padded row (width + 2 * halo)
+	int m_nFaceSize;				///< The number of texels in each padded face (pitch * pitch)
+	std::vector<T> m_data;
+	std::vector<Strip> m_edges;		///< Copies shared edge texels from the face that owns them (must run in order)
+	std::vector<Strip> m_sides;		///< Fills the halo on each side of each face
+	std::vector<Strip> m_corners;	///< Fills the corners of the halo (must run after m_sides)
+
+	void initStrips() {
+		const int w = m_nWidth - 1;
+		m_edges.clear();
+		m_sides.clear();
+		m_corners.clear();
+		for(uint8_t nFace = 0; nFace < FaceCount; nFace++) {
+			for(uint8_t nEdge = 0; nEdge < 4; nEdge++) {
+				// Find where (along the edge, distance from the edge) maps to in both faces for 3 points
+				int nDest[3], nSrc[3];
+				for(int i = 0; i < 3; i++) {
+					int a = i == 1 ? 1 : 0, k = i == 2 ? 1 : 0;
+					int x = nEdge == LeftEdge ? 0 : nEdge == RightEdge ? w : a;
+					int y = nEdge == TopEdge ? 0 : nEdge == BottomEdge ? w : a;
+					uint8_t f = nFace;
+					CubeFace::CrossEdge(w, nEdge, f, x, y, k);
+					nSrc[i] = index(f, x, y);
+					x = nEdge == LeftEdge ? -k : nEdge == RightEdge ? w + k : a;
+					y = nEdge == TopEdge ? -k : nEdge == BottomEdge ? w + k : a;
+					nDest[i] = index(nFace, x, y);
+				}
+				Strip s;
+				s.nDest = nDest[0];
+				s.nDestAlong = nDest[1] - nDest[0];
+				s.nDestOut = nDest[2] - nDest[0];
+				s.nSrc = nSrc[0];
+				s.nSrcAlong = nSrc[1] - nSrc[0];
+				s.nSrcOut = nSrc[2] - nSrc[0];
+				s.nRotate = CubeFace::NeighborRotation(nFace, nEdge);
+
+				// The shared edge itself (row 0), only if the neighbor owns it
+				if(CubeFace::NeighborFace(nFace, nEdge) < nFace) {
+					s.nStart = 0;
+					s.nEnd = m_nWidth;
+					s.nRows = 1;
+					m_edges.push_back(s);
+				}
+
+				// Rows 1 to nHalo outside the edge
+				s.nDest += s.nDestOut;
+				s.nSrc += s.nSrcOut;
+				s.nRows = m_nHalo;
+				s.nStart = 0;
+				s.nEnd = m_nWidth;
+				m_sides.push_back(s);
+				if(nEdge == TopEdge || nEdge == BottomEdge) {
+					s.nStart = -m_nHalo;
+					s.nEnd = 0;
+					m_corners.push_back(s);
+					s.nStart = m_nWidth;
+					s.nEnd = m_nWidth + m_nHalo;
+					m_corners.push_back(s);
+				}
+			}
+		}
+
+		// When 3 faces share a corner texel, it has to be copied to the highest face after the middle face gets it
+		struct Owner {
+			int nSrc;
+			bool operator()(const Strip &a, const Strip &b) const { return a.nSrc / nSrc < b.nSrc / nSrc; }
+		} owner = { m_nFaceSize };
+		std::stable_sort(m_edges.begin(), m_edges.end(), owner);
+	}
+
+	static void copy(const Strip &s, T *pDest, const T *pSrc) {
+		for(int k = 0; k < s.nRows; k++) {
+			T *d = pDest + s.nDest + k * s.nDestOut + s.nStart * s.nDestAlong;
+			const T *p = pSrc + s.nSrc + k * s.nSrcOut + s.nStart * s.nSrcAlong;
+			int n = s.nEnd - s.nStart;
+			if(s.nDestAlong == 1 && s.nSrcAlong == 1) {
+				std::copy(p, p + n, d);
+			} else {
+				for(int i = 0; i < n; i++, d += s.nDestAlong, p += s.nSrcAlong)
+					*d = *p;
+			}
+		}
+	}
+
+	static void copy(const Strip &s, CubeGrid **pChannels) {
+		for(int n = 0; n < 4; n++)
+			copy(s, pChannels[n]->data(), pChannels[(n - s.nRotate) & 3]->data());
+	}
+
+public:
+	CubeGrid() : m_nWidth(0), m_nHalo(0), m_nPitch(0), m_nFaceSize(0) {}
+	CubeGrid(int nWidth, int nHalo) { create(nWidth, nHalo); }
+
+	/// Allocates the six faces (filled with 0).
+	/// \param nWidth The number of texels on each side of a face (including the shared edges)
+	/// \param nHalo The number of extra texels to store on each side of a face (up to nWidth-1)
+	void create(int nWidth, int nHalo=1) {
+		if(nWidth < 2 || nHalo < 0 || nHalo >= nWidth)
+			VKLogException("CubeGrid::create - Invalid width (%d) or halo (%d)", nWidth, nHalo);
+		m_nWidth = nWidth;
+		m_nHalo = nHalo;
+		m_nPitch = nWidth + 2 * nHalo;
+		m_nFaceSize = m_nPitch * m_nPitch;
+		m_data.assign((size_t)FaceCount * m_nFaceSize, T());
+		initStrips();
+	}
+
+	int getWidth() const { return m_nWidth; }
+	int getHalo() const { return m_nHalo; }
+	int getPitch() const { return m_nPitch; }
+	int getFaceSize() const { return m_nFaceSize; }
+	int size() const { return (int)m_data.size(); }
+
+	/// Returns the index of a texel (x and y can go up to getHalo() outside the face)
+	int index(int nFace, int x, int y) const { return nFace * m_nFaceSize + (y + m_nHalo) * m_nPitch + (x + m_nHalo); }
+
+	      T *data()										{ return &m_data[0]; }
+	const T *data() const								{ return &m_data[0]; }
+	      T &operator[](int n)							{ return m_data[n]; }
+	const T &operator[](int n) const					{ return m_data[n]; }
+	      T &operator()(int nFace, int x, int y)		{ return m_data[index(nFace, x, y)]; }
+	const T &operator()(int nFace, int x, int y) const	{ return m_data[index(nFace, x, y)]; }
+
+	void fill(const T &t) { std::fill(m_data.begin(), m_data.end(), t); }
+	void swap(CubeGrid &grid) {
+		std::swap(m_nWidth, grid.m_nWidth);
+		std::swap(m_nHalo, grid.m_nHalo);
+		std::swap(m_nPitch, grid.m_nPitch);
+		std::swap(m_nFaceSize, grid.m_nFaceSize);
+		m_data.swap(grid.m_data);
+		m_edges.swap(grid.m_edges);
+		m_sides.swap(grid.m_sides);
+		m_corners.swap(grid.m_corners);
+	}
+
+	/// Copies one channel of six face pixel buffers into the grid (and fills the halo).
+	void read(const VK::PixelBuffer<T> *pFaces, int nChannel) {
+		for(int nFace = 0; nFace < FaceCount; nFace++) {
+			const VK::PixelBuffer<T> &pb = pFaces[nFace];
+			for(int y = 0; y < m_nWidth; y++) {
+				const T *pSrc = pb(0, y) + nChannel;
+				T *pDest = &m_data[index(nFace, 0, y)];
+				for(int x = 0; x < m_nWidth; x++, pSrc += pb.getChannels())
+					pDest[x] = *pSrc;
+			}
+		}
+		exchange();
+	}
+
+	/// Copies the grid (without the halo) into one channel of six face pixel buffers.
+	void write(VK::PixelBuffer<T> *pFaces, int nChannel) const {
+		for(int nFace = 0; nFace < FaceCount; nFace++) {
+			VK::PixelBuffer<T> &pb = pFaces[nFace];
+			for(int y = 0; y < m_nWidth; y++) {
+				T *pDest = pb(0, y) + nChannel;
+				const T *pSrc = &m_data[index(nFace, 0, y)];
+				for(int x = 0; x < m_nWidth; x++, pDest += pb.getChannels())
+					*pDest = pSrc[x];
+			}
+		}
+	}
+
+	/// Makes the shared edges match and refills the halo from the neighboring faces.
+	/// Call this after anything writes to the faces and before a stencil reads across an edge.
+	void exchange() {
+		T *p = data();
+		for(size_t i = 0; i < m_edges.size(); i++)
+			copy(m_edges[i], p, p);
+		VK::Thread::ParallelFor(0, (int)m_sides.size(), [&](int i) { copy(m_sides[i], p, p); }, 1);
+		VK::Thread::ParallelFor(0, (int)m_corners.size(), [&](int i) { copy(m_corners[i], p, p); }, 1);
+	}
+
+	/// Does the same thing as exchange() for 4 channels that hold one value per direction,
+	/// in edge order (top, right, bottom, left), rotating them to match each face.
+	/// All 4 grids must have the same width and halo.
+	static void exchange(CubeGrid **pChannels) {
+		const CubeGrid &g = *pChannels[0];
+		for(size_t i = 0; i < g.m_edges.size(); i++)
+			copy(g.m_edges[i], pChannels);
+		VK::Thread::ParallelFor(0, (int)g.m_sides.size(), [&](int i) { copy(g.m_sides[i], pChannels); }, 1);
+		VK::Thread::ParallelFor(0, (int)g.m_corners.size(), [&](int i) { copy(g.m_corners[i], pChannels); }, 1);
+	}
+};
+
+#endif
@@ -0,0 +1,250 @@
+// Erosion.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "../VKContext/VKSIMD.h"
+#include "Erosion.h"
+
+using VK::SIMD::Load;
+using VK::SIMD::Store;
+using VK::SIMD::Min;
+using VK::SIMD::Max;
+using VK::SIMD::Sqrt;
+using VK::SIMD::Select;
+
+namespace {
+	// Updates the outflow through each virtual pipe based on the difference in water surface height
+	struct FluxKernel {
+		const float *b, *d;
+		float *f[4];
+		int nPitch;
+		float fPipe, fTimeStep;
+
+		template <class V> void apply(int i) const {
+			V zero(0.0f), k(fPipe * fTimeStep);
+			V h = Load<V>(b + i) + Load<V>(d + i);
+			V t = Max(zero, Load<V>(f[TopEdge] + i) + k * (h - Load<V>(b + i - nPitch) - Load<V>(d + i - nPitch)));
+			V r = Max(zero, Load<V>(f[RightEdge] + i) + k * (h - Load<V>(b + i + 1) - Load<V>(d + i + 1)));
+			V bt = Max(zero, Load<V>(f[BottomEdge] + i) + k * (h - Load<V>(b + i + nPitch) - Load<V>(d + i + nPitch)));
+			V l = Max(zero, Load<V>(f[LeftEdge] + i) + k * (h - Load<V>(b + i - 1) - Load<V>(d + i - 1)));
+			// Don't let more water flow out than there is in the texel
+			V scale = Min(V(1.0f), Load<V>(d + i) / ((t + r + bt + l) * V(fTimeStep) + V(1e-6f)));
+			Store(f[TopEdge] + i, t * scale);
+			Store(f[RightEdge] + i, r * scale);
+			Store(f[BottomEdge] + i, bt * scale);
+			Store(f[LeftEdge] + i, l * scale);
+		}
+	};
+
+	// Carries sediment through the pipes along with the water. Each texel sends out the same fraction of its
+	// sediment as of its water, so sediment is never created or lost (unlike semi-Lagrangian advection).
+	struct SedimentKernel {
+		const float *d, *s, *f[4];
+		float *sOut;
+		int nPitch;
+		float fTimeStep;
+
+		template <class V> void apply(int i) const {
+			V eps(1e-6f);
+			V in = Load<V>(f[RightEdge] + i - 1) * Load<V>(s + i - 1) / Max(eps, Load<V>(d + i - 1));
+			in += Load<V>(f[LeftEdge] + i + 1) * Load<V>(s + i + 1) / Max(eps, Load<V>(d + i + 1));
+			in += Load<V>(f[BottomEdge] + i - nPitch) * Load<V>(s + i - nPitch) / Max(eps, Load<V>(d + i - nPitch));
+			in += Load<V>(f[TopEdge] + i + nPitch) * Load<V>(s + i + nPitch) / Max(eps, Load<V>(d + i + nPitch));
+			V out = (Load<V>(f[TopEdge] + i) + Load<V>(f[RightEdge] + i) + Load<V>(f[BottomEdge] + i) + Load<V>(f[LeftEdge] + i)) * Load<V>(s + i) / Max(eps, Load<V>(d + i));
+			Store(sOut + i, Max(V(0.0f), Load<V>(s + i) + V(fTimeStep) * (in - out)));
+		}
+	};
+
+	// Moves water through the pipes, then dissolves or deposits sediment based on the water's velocity
+	struct WaterKernel {
+		const float *b, *f[4];
+		float *bOut, *d, *s;
+		int nPitch;
+		Erosion::Params p;
+
+		template <class V> void apply(int i) const {
+			V dt(p.fTimeStep), half(0.5f);
+			V fT = Load<V>(f[TopEdge] + i), fR = Load<V>(f[RightEdge] + i), fB = Load<V>(f[BottomEdge] + i), fL = Load<V>(f[LeftEdge] + i);
+			V inL = Load<V>(f[RightEdge] + i - 1), inR = Load<V>(f[LeftEdge] + i + 1);
+			V inT = Load<V>(f[BottomEdge] + i - nPitch), inB = Load<V>(f[TopEdge] + i + nPitch);
+			V d0 = Load<V>(d + i);
+			V d1 = Max(V(0.0f), d0 + dt * (inL + inR + inT + inB - fT - fR - fB - fL));
+
+			// The velocity comes from the average flow through the texel in each direction. Water can't move
+			// more than a texel in one iteration, which also keeps the carrying capacity in check.
+			// The sediment it carries is moved by SedimentKernel before this runs.
+			V depth = Max(V(1e-3f), (d0 + d1) * half);
+			V vx = (inL - fL + fR - inR) * half / depth;
+			V vy = (inT - fT + fB - inB) * half / depth;
+			V speed = Min(V(1.0f / p.fTimeStep), Sqrt(vx * vx + vy * vy));
+
+			V gx = (Load<V>(b + i + 1) - Load<V>(b + i - 1)) * half;
+			V gy = (Load<V>(b + i + nPitch) - Load<V>(b + i - nPitch)) * half;
+			V g2 = gx * gx + gy * gy;
+			V tilt = Max(V(p.fMinTilt), Sqrt(g2 / (V(1.0f) + g2)));
+			V capacity = V(p.fCapacity) * tilt * speed * Min(V(1.0f), d1 * V(1.0f / p.fMaxDepth));
+
+			V sed = Load<V>(s + i);
+			V diff = capacity - sed;
+			V amount = Select(diff > V(0.0f), V(p.fDissolve) * diff, V(p.fDeposit) * diff);
+			Store(bOut + i, Load<V>(b + i) - amount);
+			Store(s + i, sed + amount);
+			Store(d + i, d1 * V(1.0f - p.fEvaporation * p.fTimeStep) + V(p.fRain * p.fTimeStep));
+		}
+	};
+
+	// Works out how much material slides from each texel to each neighbor that's too far below it
+	struct SlideKernel {
+		const float *b;
+		float *slide[4];
+		int nPitch;
+		float fTalus, fRate;
+
+		template <class V> void apply(int i) const {
+			V zero(0.0f), talus(fTalus);
+			V h = Load<V>(b + i);
+			V t = Max(zero, h - Load<V>(b + i - nPitch) - talus);
+			V r = Max(zero, h - Load<V>(b + i + 1) - talus);
+			V bt = Max(zero, h - Load<V>(b + i + nPitch) - talus);
+			V l = Max(zero, h - Load<V>(b + i - 1) - talus);
+			// Move half of the biggest excess (so the two texels don't swap places), split by how steep each slope is
+			V scale = Max(Max(t, r), Max(bt, l)) * V(0.5f * fRate) / Max(V(1e-6f), t + r + bt + l);
+			Store(slide[TopEdge] + i, t * scale);
+			Store(slide[RightEdge] + i, r * scale);
+			Store(slide[BottomEdge] + i, bt * scale);
+			Store(slide[LeftEdge] + i, l * scale);
+		}
+	};
+
+	struct ApplySlideKernel {
+		const float *slide[4];
+		float *b;
+		int nPitch;
+
+		template <class V> void apply(int i) const {
+			V in = Load<V>(slide[RightEdge] + i - 1) + Load<V>(slide[LeftEdge] + i + 1) + Load<V>(slide[BottomEdge] + i - nPitch) + Load<V>(slide[TopEdge] + i + nPitch);
+			V out = Load<V>(slide[TopEdge] + i) + Load<V>(slide[RightEdge] + i) + Load<V>(slide[BottomEdge] + i) + Load<V>(slide[LeftEdge] + i);
+			Store(b + i, Load<V>(b + i) + in - out);
+		}
+	};
+}
+
+void Erosion::init(const VK::PixelBuffer<float> *pFaces, int nHeight)
+{
+	m_nWidth = pFaces[0].getWidth();
+	m_terrain.create(m_nWidth, 1);
+	m_terrain.read(pFaces, nHeight);
+	m_water.create(m_nWidth, 1);
+	m_sediment.create(m_nWidth, 1);
+	m_temp.create(m_nWidth, 1);
+	for(int i = 0; i < 4; i++) {
+		m_flux[i].create(m_nWidth, 1);
+		m_slide[i] = CubeGrid<float>();
+	}
+}
+
+template <class F> void Erosion::forEachTile(F fn)
+{
+	// Each tile is a band of rows in one face, so each thread works on contiguous memory
+	int nBands = (m_nWidth + TileRows - 1) / TileRows;
+	VK::Thread::Pool::GetDefault().run(FaceCount * nBands, [&](int nTile) {
+		int nFace = nTile / nBands, y = (nTile % nBands) * TileRows;
+		int nEnd = VK::Math::Min(y + TileRows, m_nWidth);
+		for(; y < nEnd; y++) {
+			int i = m_terrain.index(nFace, 0, y);
+			fn(i, i + m_nWidth);
+		}
+	});
+}
+
+void Erosion::hydraulic(int nIterations)
+{
+	for(int nIteration = 0; nIteration < nIterations; nIteration++) {
+		FluxKernel flux;
+		flux.b = m_terrain.data();
+		flux.d = m_water.data();
+		for(int n = 0; n < 4; n++)
+			flux.f[n] = m_flux[n].data();
+		flux.nPitch = m_terrain.getPitch();
+		flux.fPipe = m_params.fPipe;
+		flux.fTimeStep = m_params.fTimeStep;
+		forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, flux); });
+		exchange(m_flux);
+
+		SedimentKernel sediment;
+		sediment.d = m_water.data();
+		sediment.s = m_sediment.data();
+		for(int n = 0; n < 4; n++)
+			sediment.f[n] = m_flux[n].data();
+		sediment.sOut = m_temp.data();
+		sediment.nPitch = m_terrain.getPitch();
+		sediment.fTimeStep = m_params.fTimeStep;
+		forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, sediment); });
+		m_sediment.swap(m_temp);
+
+		// The terrain is written to a separate buffer because neighbors read it for the slope
+		WaterKernel water;
+		water.b = m_terrain.data();
+		for(int n = 0; n < 4; n++)
+			water.f[n] = m_flux[n].data();
+		water.bOut = m_temp.data();
+		water.d = m_water.data();
+		water.s = m_sediment.data();
+		water.nPitch = m_terrain.getPitch();
+		water.p = m_params;
+		forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, water); });
+		m_terrain.swap(m_temp);
+		m_terrain.exchange();
+		m_water.exchange();
+		m_sediment.exchange();
+	}
+}
+
+void Erosion::thermal(int nIterations)
+{
+	for(int n = 0; n < 4; n++) {
+		if(m_slide[n].getWidth() != m_nWidth)
+			m_slide[n].create(m_nWidth, 1);
+	}
+
+	for(int nIteration = 0; nIteration < nIterations; nIteration++) {
+		SlideKernel slide;
+		slide.b = m_terrain.data();
+		for(int n = 0; n < 4; n++)
+			slide.slide[n] = m_slide[n].data();
+		slide.nPitch = m_terrain.getPitch();
+		slide.fTalus = m_params.fTalus;
+		slide.fRate = VK::Math::Min(1.0f, m_params.fThermalRate * m_params.fTimeStep);
+		forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, slide); });
+		exchange(m_slide);
+
+		ApplySlideKernel apply;
+		for(int n = 0; n < 4; n++)
+			apply.slide[n] = m_slide[n].data();
+		apply.b = m_terrain.data();
+		apply.nPitch = m_terrain.getPitch();
+		forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, apply); });
+		m_terrain.exchange();
+	}
+}
+
+double Erosion::benchmark(int nIterations)
+{
+	double t = VK::Timer::Time();
+	hydraulic(nIterations);
+	double tHydraulic = VK::Timer::Time() - t;
+	thermal(nIterations);
+	double tThermal = VK::Timer::Time() - t - tHydraulic;
+	double dTexels = (double)FaceCount * m_nWidth * m_nWidth * nIterations;
+	VKLogInfo("Erosion::benchmark - %d iterations on %d texels: hydraulic %lf seconds (%.1lf million texels per second), thermal %lf seconds (%.1lf million texels per second)",
+		nIterations, FaceCount * m_nWidth * m_nWidth, tHydraulic, dTexels / tHydraulic * 1e-6, tThermal, dTexels / tThermal * 1e-6);
+	return nIterations > 0 ? (tHydraulic + tThermal) / nIterations : 0.0;
+}
+
+void Erosion::write(VK::PixelBuffer<float> *pFaces, int nHeight, int nWater) const
+{
+	m_terrain.write(pFaces, nHeight);
+	if(nWater >= 0)
+		m_water.write(pFaces, nWater);
+}
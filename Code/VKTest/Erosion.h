@@ -0,0 +1,79 @@
+// Erosion.h
+//
+#ifndef __Erosion_h__
+#define __Erosion_h__
+
+#include "CubeGrid.h"
+
+/// Erodes the six faces of a cube-mapped height map (the "procedural details" stage in main.cpp).
+///
+/// Hydraulic erosion uses the virtual pipe model from Mei et al., "Fast Hydraulic Erosion Simulation
+/// and Visualization on GPU". Each texel stores terrain height, water height, suspended sediment,
+/// and the outflow of water through 4 virtual pipes to its neighbors. Each iteration rains, moves
+/// water through the pipes, computes the water's velocity, dissolves or deposits sediment based on
+/// how much the water can carry, and evaporates some water. Sediment moves through the same pipes as
+/// the water that carries it, so terrain + sediment is conserved.
+/// Thermal erosion moves material down any slope that is steeper than the talus angle.
+///
+/// Every field is a CubeGrid with a 1-texel halo, so every kernel is a branch-free stencil over
+/// contiguous rows (run 4 texels at a time with SIMD). Faces are split into bands of rows that are run
+/// in parallel, and the halos are exchanged between passes. Flux values are directions, so they are
+/// rotated into the orientation of the face they're copied to.
+class Erosion
+{
+public:
+	struct Params {
+		float fTimeStep;		///< The amount of time simulated by each iteration
+		float fRain;			///< The amount of water added to each texel per unit of time
+		float fEvaporation;		///< The fraction of water that evaporates per unit of time
+		float fPipe;			///< Gravity * pipe cross-section / pipe length (controls how fast water flows)
+		float fCapacity;		///< How much sediment the water can carry (scaled by its speed and the slope)
+		float fDissolve;		///< The fraction of the unused capacity that gets dissolved per iteration
+		float fDeposit;			///< The fraction of the extra sediment that gets deposited per iteration
+		float fMinTilt;			///< The minimum slope used to calculate capacity (so flat areas still erode)
+		float fMaxDepth;		///< Water shallower than this carries less sediment (so a film of rain can't carve canyons)
+		float fTalus;			///< The height difference between neighbors beyond which thermal erosion kicks in
+		float fThermalRate;		///< The fraction of the excess height moved per unit of time by thermal erosion
+
+		Params() : fTimeStep(0.05f), fRain(0.01f), fEvaporation(0.1f), fPipe(1.0f), fCapacity(1.0f), fDissolve(0.3f), fDeposit(0.3f), fMinTilt(0.05f), fMaxDepth(0.01f), fTalus(0.05f), fThermalRate(1.0f) {}
+	};
+
+protected:
+	enum { TileRows = 32 };
+
+	Params m_params;
+	int m_nWidth;							///< The number of texels on each side of a face (including the shared edges)
+	CubeGrid<float> m_terrain, m_water, m_sediment, m_temp;
+	CubeGrid<float> m_flux[4];				///< Outflow through each pipe, in edge order (top, right, bottom, left)
+	CubeGrid<float> m_slide[4];				///< Material sliding to each neighbor during thermal erosion
+
+	void exchange(CubeGrid<float> *pChannels) {
+		CubeGrid<float> *p[4] = { &pChannels[0], &pChannels[1], &pChannels[2], &pChannels[3] };
+		CubeGrid<float>::exchange(p);
+	}
+	template <class F> void forEachTile(F fn);
+
+public:
+	Erosion() : m_nWidth(0) {}
+
+	Params &getParams() { return m_params; }
+	int getWidth() const { return m_nWidth; }
+
+	/// Initializes the terrain from one channel of the six face height maps and clears the water and sediment.
+	void init(const VK::PixelBuffer<float> *pFaces, int nHeight);
+
+	/// Runs nIterations of hydraulic erosion.
+	void hydraulic(int nIterations);
+
+	/// Runs nIterations of thermal erosion.
+	void thermal(int nIterations);
+
+	/// Runs nIterations of hydraulic and thermal erosion and logs how long they took.
+	/// \return The average number of seconds per iteration
+	double benchmark(int nIterations);
+
+	/// Writes the eroded terrain (and optionally the water height) to the six face height maps.
+	void write(VK::PixelBuffer<float> *pFaces, int nHeight, int nWater=-1) const;
+};
+
+#endif
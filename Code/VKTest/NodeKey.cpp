@@ -0,0 +1,84 @@
+// NodeKey.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "NodeKey.h"
+
+#include <random>
+
+namespace {
+	// Gets the two corners of a node's edge as 3D vectors (which match exactly for nodes on either side of a cube edge)
+	void GetEdge(const NodeKey &key, uint8_t nEdge, VK::ivec3 &a, VK::ivec3 &b) {
+		int x, y, w;
+		key.getCoordinates(x, y, w);
+		int x1 = nEdge == RightEdge ? x + w : x, y1 = nEdge == BottomEdge ? y + w : y;
+		int x2 = nEdge == LeftEdge ? x : x + w, y2 = nEdge == TopEdge ? y : y + w;
+		a = CubeFace::GetPlanetaryVector(key.getFace(), x1, y1, CubeFace::MaxCoord);
+		b = CubeFace::GetPlanetaryVector(key.getFace(), x2, y2, CubeFace::MaxCoord);
+	}
+
+	inline bool Equal(const VK::ivec3 &a, const VK::ivec3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+
+	// Checks that n is key's neighbor across nEdge, that nReturnEdge leads back, and that the two nodes share an edge
+	bool CheckNeighbor(const NodeKey &key, uint8_t nEdge) {
+		uint8_t nReturnEdge;
+		NodeKey n = key.neighbor(nEdge, &nReturnEdge);
+		if(n.getLevel() != key.getLevel() || n == key || n.neighbor(nReturnEdge) != key)
+			return false;
+		if(key.getLevel() > 24)
+			return true; // getCoordinates() can't go this deep
+		VK::ivec3 a1, b1, a2, b2;
+		GetEdge(key, nEdge, a1, b1);
+		GetEdge(n, nReturnEdge, a2, b2);
+		return (Equal(a1, a2) && Equal(b1, b2)) || (Equal(a1, b2) && Equal(b1, a2));
+	}
+}
+
+bool NodeKey::Test()
+{
+	int nErrors = 0;
+
+	// Every node along every face edge (24 transitions in all) at a range of levels
+	const uint8_t nLevels[] = { 0, 1, 2, 3, 6, 10, 24 };
+	for(int l = 0; l < (int)(sizeof(nLevels) / sizeof(nLevels[0])); l++) {
+		uint8_t nLevel = nLevels[l];
+		uint32_t w = (1u << nLevel) - 1, nSamples = VK::Math::Min(w, 64u);
+		for(uint8_t nFace = 0; nFace < FaceCount; nFace++) {
+			for(uint8_t nEdge = 0; nEdge < 4; nEdge++) {
+				for(uint32_t i = 0; i <= nSamples; i++) {
+					uint32_t a = nSamples ? (uint32_t)((uint64_t)w * i / nSamples) : 0;
+					uint32_t x = nEdge == LeftEdge ? 0 : nEdge == RightEdge ? w : a;
+					uint32_t y = nEdge == TopEdge ? 0 : nEdge == BottomEdge ? w : a;
+					NodeKey key(nFace, nLevel, x, y);
+					if(!CheckNeighbor(key, nEdge) || key.neighbor(nEdge).getFace() != CubeFace::NeighborFace(nFace, nEdge)) {
+						VKLogError("NodeKey::Test - Failed crossing edge %d of face %d at level %d (%u, %u)", nEdge, nFace, nLevel, x, y);
+						nErrors++;
+					}
+				}
+			}
+		}
+	}
+
+	// Random nodes for the rest
+	std::mt19937 gen(12345);
+	for(int i = 0; i < 100000; i++) {
+		uint8_t nFace = (uint8_t)(gen() % FaceCount), nLevel = (uint8_t)(gen() % MaxLevel);
+		uint32_t nMask = (1u << nLevel) - 1, x = gen() & nMask, y = gen() & nMask;
+		NodeKey key(nFace, nLevel, x, y);
+		bool bOK = key.getFace() == nFace && key.getLevel() == nLevel && key.getX() == x && key.getY() == y;
+		for(int n = 0; n < 4; n++) {
+			NodeKey child = key.child(n);
+			bOK = bOK && child.parent() == key && child.getChildIndex() == n && child.isInside(key) && !key.isInside(child);
+			bOK = bOK && child.getX() == x * 2 + (n & 1) && child.getY() == y * 2 + (n >> 1);
+		}
+		for(uint8_t nEdge = 0; nEdge < 4; nEdge++)
+			bOK = bOK && CheckNeighbor(key, nEdge);
+		if(!bOK) {
+			VKLogError("NodeKey::Test - Failed on face %d at level %d (%u, %u)", nFace, nLevel, x, y);
+			nErrors++;
+		}
+	}
+
+	VKLogInfo("NodeKey::Test - %d errors", nErrors);
+	return nErrors == 0;
+}
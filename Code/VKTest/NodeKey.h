@@ -0,0 +1,161 @@
+// NodeKey.h
+//
+#ifndef __NodeKey_h__
+#define __NodeKey_h__
+
+#include "CubeFace.h"
+
+/// A compact 64-bit address for a node in the planet's quad-trees (one quad-tree per cube face).
+/// The top 3 bits hold the face, the next 5 bits hold the level, and the low 56 bits hold the
+/// node's x and y (within its level) interleaved into a Morton code, with x in the even bits and y
+/// in the odd bits. A node at level L is one of 2^L x 2^L squares that tile its face (nodes don't
+/// share edges the way texels do), with (0, 0) in the top-left corner like the face coordinates.
+///
+/// Finding a node's parent or children is just a shift. Finding a neighbor at the same level is
+/// done on the Morton code directly (adding 1 to only the x or y bits), unless the neighbor is
+/// in another face. In that case the node is mapped across the edge with CubeFace::CrossEdge.
+///
+/// Keys sort by face, then level, then Morton order, and NodeKey::Hash makes them usable as keys
+/// in std::unordered_map (for caching, streaming, and indexing tiles).
+class NodeKey
+{
+public:
+	enum { MaxLevel = 28 };		///< The highest level that fits (2 bits of Morton code per level)
+
+protected:
+	static const uint64_t MortonMask = 0x00FFFFFFFFFFFFFFull;
+	static const uint64_t XMask = 0x0055555555555555ull;
+	static const uint64_t YMask = 0x00AAAAAAAAAAAAAAull;
+
+	uint64_t m_nKey;
+
+	explicit NodeKey(uint64_t nKey) : m_nKey(nKey) {}
+	NodeKey(uint8_t nFace, uint8_t nLevel, uint64_t nMorton) : m_nKey(((uint64_t)nFace << 61) | ((uint64_t)nLevel << 56) | nMorton) {}
+
+	uint64_t morton() const { return m_nKey & MortonMask; }
+
+public:
+	/// Spreads the low 28 bits of n out into the even bits of a 64-bit int
+	static uint64_t Spread(uint32_t n) {
+		uint64_t x = n & 0x0FFFFFFF;
+		x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+		x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+		x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		x = (x | (x << 2)) & 0x3333333333333333ull;
+		x = (x | (x << 1)) & 0x5555555555555555ull;
+		return x;
+	}
+
+	/// Gathers the even bits of a 64-bit int back into a 32-bit int (the inverse of Spread)
+	static uint32_t Compact(uint64_t x) {
+		x &= 0x5555555555555555ull;
+		x = (x | (x >> 1)) & 0x3333333333333333ull;
+		x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+		x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+		x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+		x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+		return (uint32_t)x;
+	}
+
+	/// A hash functor for std::unordered_map and friends (the key bits are mixed so nearby nodes spread out)
+	struct Hash {
+		size_t operator()(const NodeKey &key) const {
+			uint64_t x = key.m_nKey;
+			x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+			x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+			return (size_t)(x ^ (x >> 31));
+		}
+	};
+
+	/// Creates an invalid key
+	NodeKey() : m_nKey(~0ull) {}
+
+	/// Creates the key for a node.
+	/// \param nFace The cube face (0-5)
+	/// \param nLevel The level in the quad-tree (0 is the whole face, up to MaxLevel)
+	/// \param x The node's column in its level (0 to 2^nLevel - 1)
+	/// \param y The node's row in its level (0 to 2^nLevel - 1)
+	NodeKey(uint8_t nFace, uint8_t nLevel, uint32_t x, uint32_t y) : m_nKey(((uint64_t)nFace << 61) | ((uint64_t)nLevel << 56) | Spread(x) | (Spread(y) << 1)) {}
+
+	/// Creates the key for the node at nLevel containing a point in CubeFace's integer face coordinates
+	/// (0 to CubeFace::MaxCoord, which limits nLevel to 24).
+	static NodeKey FromCoordinates(uint8_t nFace, uint8_t nLevel, int x, int y) {
+		int nMax = (1 << nLevel) - 1, nShift = 24 - nLevel;
+		return NodeKey(nFace, nLevel, (uint32_t)VK::Math::Min(x >> nShift, nMax), (uint32_t)VK::Math::Min(y >> nShift, nMax));
+	}
+
+	bool isValid() const { return m_nKey != ~0ull; }
+	uint64_t getKey() const { return m_nKey; }
+	uint8_t getFace() const { return (uint8_t)(m_nKey >> 61); }
+	uint8_t getLevel() const { return (uint8_t)((m_nKey >> 56) & 0x1F); }
+	uint32_t getX() const { return Compact(morton()); }
+	uint32_t getY() const { return Compact(morton() >> 1); }
+
+	/// Returns the top-left corner of this node in CubeFace's integer face coordinates, and its width (levels 0-24 only)
+	void getCoordinates(int &x, int &y, int &nWidth) const {
+		int nShift = 24 - getLevel();
+		x = (int)getX() << nShift;
+		y = (int)getY() << nShift;
+		nWidth = 1 << nShift;
+	}
+
+	bool operator==(const NodeKey &key) const { return m_nKey == key.m_nKey; }
+	bool operator!=(const NodeKey &key) const { return m_nKey != key.m_nKey; }
+	bool operator<(const NodeKey &key) const { return m_nKey < key.m_nKey; }
+
+	/// Returns the node one level up that contains this one (the same node at level 0)
+	NodeKey parent() const {
+		uint8_t nLevel = getLevel();
+		return nLevel == 0 ? *this : NodeKey(getFace(), nLevel - 1, morton() >> 2);
+	}
+
+	/// Returns one of the 4 nodes one level down (bit 0 of n is x and bit 1 is y, so 0 is the top-left child)
+	NodeKey child(int n) const { return NodeKey(getFace(), getLevel() + 1, (morton() << 2) | (uint64_t)(n & 3)); }
+
+	/// Returns which child of its parent this node is (the inverse of child())
+	int getChildIndex() const { return (int)(m_nKey & 3); }
+
+	/// Returns true if this node is key or one of its descendants
+	bool isInside(const NodeKey &key) const {
+		int nLevels = getLevel() - key.getLevel();
+		return nLevels >= 0 && getFace() == key.getFace() && (morton() >> (nLevels * 2)) == key.morton();
+	}
+
+	/// Returns the neighboring node at the same level across one of this node's edges,
+	/// which may be in another face.
+	/// \param nEdge The edge to cross (TopEdge, RightEdge, BottomEdge, or LeftEdge)
+	/// \param pReturnEdge (Out, optional) Set to the neighbor's edge that leads back to this node
+	NodeKey neighbor(uint8_t nEdge, uint8_t *pReturnEdge=NULL) const {
+		uint64_t m = morton(), mx = m & XMask, my = m & YMask;
+		uint8_t nLevel = getLevel();
+		uint64_t nLevelMask = (1ull << (nLevel * 2)) - 1;
+		bool bInside;
+		switch(nEdge) {
+			case TopEdge:		bInside = my != 0; my = (my - 1) & YMask; break;
+			case BottomEdge:	bInside = (my & nLevelMask) != (YMask & nLevelMask); my = ((my | XMask) + 1) & YMask; break;
+			case LeftEdge:		bInside = mx != 0; mx = (mx - 1) & XMask; break;
+			default:			bInside = (mx & nLevelMask) != (XMask & nLevelMask); mx = ((mx | YMask) + 1) & XMask; break;
+		}
+		if(bInside) {
+			if(pReturnEdge)
+				*pReturnEdge = (uint8_t)((nEdge + 2) & 3);
+			return NodeKey(getFace(), nLevel, mx | my);
+		}
+
+		// Cross over to the neighboring face
+		uint8_t nFace = getFace();
+		int x = (int)getX(), y = (int)getY();
+		if(pReturnEdge)
+			*pReturnEdge = CubeFace::NeighborEdge(nFace, nEdge);
+		CubeFace::CrossEdge((1 << nLevel) - 1, nEdge, nFace, x, y);
+		return NodeKey(nFace, nLevel, (uint32_t)x, (uint32_t)y);
+	}
+
+	/// Checks parent/child/neighbor lookups at several levels, including every node along all 24 face edges
+	/// (crossing each one and coming back, and making sure the nodes on both sides really touch).
+	/// Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+};
+
+#endif
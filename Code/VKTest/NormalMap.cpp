@@ -0,0 +1,287 @@
+// NormalMap.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "../VKContext/VKSIMD.h"
+#include "NormalMap.h"
+
+#include <random>
+
+using VK::SIMD::Load;
+using VK::SIMD::Store;
+using VK::SIMD::Sqrt;
+using VK::SIMD::Select;
+
+namespace {
+	// Finds the normal at each texel from the positions of its 4 neighbors on the planet
+	struct NormalKernel {
+		const float *d[3], *h;
+		float *n[3];
+		int nPitch;
+		float fRadius, fScale;
+
+		template <class V> void apply(int i) const {
+			V r(fRadius), s(fScale);
+			V rLeft = r + s * Load<V>(h + i - 1), rRight = r + s * Load<V>(h + i + 1);
+			V rUp = r + s * Load<V>(h + i - nPitch), rDown = r + s * Load<V>(h + i + nPitch);
+			V ux = Load<V>(d[0] + i + 1) * rRight - Load<V>(d[0] + i - 1) * rLeft;
+			V uy = Load<V>(d[1] + i + 1) * rRight - Load<V>(d[1] + i - 1) * rLeft;
+			V uz = Load<V>(d[2] + i + 1) * rRight - Load<V>(d[2] + i - 1) * rLeft;
+			V vx = Load<V>(d[0] + i + nPitch) * rDown - Load<V>(d[0] + i - nPitch) * rUp;
+			V vy = Load<V>(d[1] + i + nPitch) * rDown - Load<V>(d[1] + i - nPitch) * rUp;
+			V vz = Load<V>(d[2] + i + nPitch) * rDown - Load<V>(d[2] + i - nPitch) * rUp;
+			V nx = uy * vz - uz * vy;
+			V ny = uz * vx - ux * vz;
+			V nz = ux * vy - uy * vx;
+
+			// The faces aren't all oriented the same way, so flip the normals that point into the planet
+			V up = nx * Load<V>(d[0] + i) + ny * Load<V>(d[1] + i) + nz * Load<V>(d[2] + i);
+			V scale = Select(up < V(0.0f), V(-1.0f), V(1.0f)) / Sqrt(nx * nx + ny * ny + nz * nz);
+			Store(n[0] + i, nx * scale);
+			Store(n[1] + i, ny * scale);
+			Store(n[2] + i, nz * scale);
+		}
+	};
+
+	inline uint8_t PackUnorm8(float f) { return (uint8_t)VK::Math::Clamp((int)(f * 127.5f + 128.0f), 0, 255); }
+	inline int16_t PackSnorm16(float f) { return (int16_t)VK::Math::Clamp((int)floorf(f * 32767.0f + 0.5f), -32767, 32767); }
+}
+
+template <class F> void NormalMap::forEachTile(F fn)
+{
+	// Each tile is a band of rows in one face, so each thread works on contiguous memory
+	int nBands = (m_nWidth + TileRows - 1) / TileRows;
+	VK::Thread::Pool::GetDefault().run(FaceCount * nBands, [&](int nTile) {
+		int nFace = nTile / nBands, y = (nTile % nBands) * TileRows;
+		int nEnd = VK::Math::Min(y + TileRows, m_nWidth);
+		for(; y < nEnd; y++) {
+			int i = m_height.index(nFace, 0, y);
+			fn(i, i + m_nWidth);
+		}
+	});
+}
+
+void NormalMap::build(const VK::PixelBuffer<float> *pFaces, int nHeight, float fRadius, float fScale)
+{
+	int nWidth = pFaces[0].getWidth();
+	if(nWidth != m_nWidth) {
+		m_nWidth = nWidth;
+		for(int n = 0; n < 3; n++) {
+			m_dir[n].create(nWidth, 1);
+			m_normal[n].create(nWidth, 1);
+		}
+		m_height.create(nWidth, 1);
+		VK::Thread::ParallelFor(0, FaceCount * nWidth, [&](int nRow) {
+			int nFace = nRow / nWidth, y = nRow % nWidth;
+			std::vector<VK::vec3> row(nWidth);
+			CubeFace::GetDirections((uint8_t)nFace, nWidth, y, &row[0]);
+			for(int n = 0; n < 3; n++) {
+				float *p = &m_dir[n](nFace, 0, y);
+				for(int x = 0; x < nWidth; x++)
+					p[x] = row[x][n];
+			}
+		});
+		for(int n = 0; n < 3; n++)
+			m_dir[n].exchange();
+	}
+	m_height.read(pFaces, nHeight);
+
+	NormalKernel kernel;
+	for(int n = 0; n < 3; n++) {
+		kernel.d[n] = m_dir[n].data();
+		kernel.n[n] = m_normal[n].data();
+	}
+	kernel.h = m_height.data();
+	kernel.nPitch = m_height.getPitch();
+	kernel.fRadius = fRadius;
+	kernel.fScale = fScale;
+	forEachTile([&](int nStart, int nEnd) { VK::SIMD::ForEach(nStart, nEnd, kernel); });
+	for(int n = 0; n < 3; n++)
+		m_normal[n].exchange();
+}
+
+void NormalMap::pack(int nFace, Format f, void *pDest) const
+{
+	VK::Thread::ParallelFor(0, m_nWidth, [&](int y) {
+		int i = m_normal[0].index(nFace, 0, y);
+		const float *px = &m_normal[0][i], *py = &m_normal[1][i], *pz = &m_normal[2][i];
+		if(f == RGBA8) {
+			uint8_t *p = (uint8_t *)pDest + (size_t)y * m_nWidth * 4;
+			for(int x = 0; x < m_nWidth; x++, p += 4) {
+				p[0] = PackUnorm8(px[x]);
+				p[1] = PackUnorm8(py[x]);
+				p[2] = PackUnorm8(pz[x]);
+				p[3] = 255;
+			}
+		} else {
+			int16_t *p = (int16_t *)pDest + (size_t)y * m_nWidth * 4;
+			for(int x = 0; x < m_nWidth; x++, p += 4) {
+				p[0] = PackSnorm16(px[x]);
+				p[1] = PackSnorm16(py[x]);
+				p[2] = PackSnorm16(pz[x]);
+				p[3] = 32767;
+			}
+		}
+	});
+}
+
+bool NormalMap::Test()
+{
+	const int Width = 65; // Not a multiple of 4, so the end of each row runs through the scalar kernel
+	const int w = Width - 1;
+	const float Radius = 1.0f, Scale = 0.05f;
+	int nErrors = 0;
+
+	std::vector<VK::vec3> dir(FaceCount * Width * Width);
+	for(int face = 0; face < FaceCount; face++) {
+		for(int y = 0; y < Width; y++)
+			CubeFace::GetDirections((uint8_t)face, Width, y, &dir[(face * Width + y) * Width]);
+	}
+
+	VK::PixelBuffer<float> pb[FaceCount];
+	for(int face = 0; face < FaceCount; face++) {
+		pb[face].create(Width, Width, 1, 2);
+		pb[face] = 0;
+	}
+
+	// A flat planet's normals have to point straight out
+	NormalMap normals;
+	normals.build(pb, 1, Radius, Scale);
+	float fWorst = 1.0f;
+	for(int face = 0; face < FaceCount; face++) {
+		for(int y = 0; y < Width; y++) {
+			for(int x = 0; x < Width; x++)
+				fWorst = VK::Math::Min(fWorst, normals.getNormal(face, x, y) | dir[(face * Width + y) * Width + x]);
+		}
+	}
+	if(fWorst < 0.9999f) {
+		VKLogError("NormalMap::Test - A flat planet has a normal %f away from straight up", fWorst);
+		nErrors++;
+	}
+
+	// Now a bumpy one (height in channel 0)
+	for(int face = 0; face < FaceCount; face++) {
+		for(int y = 0; y < Width; y++) {
+			for(int x = 0; x < Width; x++) {
+				const VK::vec3 &v = dir[(face * Width + y) * Width + x];
+				*pb[face](x, y) = sinf(v.x * 7.0f) * cosf(v.y * 5.0f) + sinf(v.z * 11.0f);
+			}
+		}
+	}
+	normals.build(pb, 0, Radius, Scale);
+
+	// Every copy of a shared edge texel has to have exactly the same normal
+	int nSeams = 0;
+	for(uint8_t face = 0; face < FaceCount; face++) {
+		for(uint8_t nEdge = 0; nEdge < 4; nEdge++) {
+			for(int a = 0; a < Width; a++) {
+				int x = nEdge == LeftEdge ? 0 : nEdge == RightEdge ? w : a;
+				int y = nEdge == TopEdge ? 0 : nEdge == BottomEdge ? w : a;
+				uint8_t f = face;
+				int x2 = x, y2 = y;
+				CubeFace::CrossEdge(w, nEdge, f, x2, y2, 0);
+				VK::vec3 n1 = normals.getNormal(face, x, y), n2 = normals.getNormal(f, x2, y2);
+				if(n1.x != n2.x || n1.y != n2.y || n1.z != n2.z)
+					nSeams++;
+			}
+		}
+	}
+	if(nSeams) {
+		VKLogError("NormalMap::Test - %d shared edge texels have different normals in each face", nSeams);
+		nErrors++;
+	}
+
+	// Check it against a simple version that finds the neighbors one at a time (except at the cube corners,
+	// where the face that owns the corner takes its differences between different neighbors)
+	int nMismatches = 0;
+	for(int face = 0; face < FaceCount; face++) {
+		for(int y = 0; y < Width; y++) {
+			for(int x = 0; x < Width; x++) {
+				if((x == 0 || x == w) && (y == 0 || y == w))
+					continue;
+				VK::vec3 p[4];
+				const int dx[4] = { -1, 1, 0, 0 }, dy[4] = { 0, 0, -1, 1 };
+				for(int i = 0; i < 4; i++) {
+					uint8_t f = (uint8_t)face;
+					int nx = x + dx[i], ny = y + dy[i];
+					CubeFace::AdjustCoords(w, f, nx, ny);
+					p[i] = dir[(f * Width + ny) * Width + nx] * (Radius + Scale * *pb[f](nx, ny));
+				}
+				const VK::vec3 &d = dir[(face * Width + y) * Width + x];
+				VK::vec3 n = (p[1] - p[0]).cross(p[3] - p[2]).normalize();
+				if((n | d) < 0)
+					n = -n;
+				if((n | normals.getNormal(face, x, y)) < 0.99999f)
+					nMismatches++;
+			}
+		}
+	}
+	if(nMismatches) {
+		VKLogError("NormalMap::Test - %d normals don't match the simple version", nMismatches);
+		nErrors++;
+	}
+
+	// Unpack both formats and make sure they're within half a step of the normals
+	std::vector<uint8_t> rgba8(Width * Width * GetTexelSize(RGBA8));
+	std::vector<int16_t> rgba16(Width * Width * 4);
+	float fError8 = 0.0f, fError16 = 0.0f;
+	for(int face = 0; face < FaceCount; face++) {
+		normals.pack(face, RGBA8, &rgba8[0]);
+		normals.pack(face, RGBA16, &rgba16[0]);
+		for(int y = 0; y < Width; y++) {
+			for(int x = 0; x < Width; x++) {
+				VK::vec3 n = normals.getNormal(face, x, y);
+				const uint8_t *p8 = &rgba8[(y * Width + x) * 4];
+				const int16_t *p16 = &rgba16[(y * Width + x) * 4];
+				for(int i = 0; i < 3; i++) {
+					fError8 = VK::Math::Max(fError8, VK::Math::Abs(p8[i] / 255.0f * 2.0f - 1.0f - n[i]));
+					fError16 = VK::Math::Max(fError16, VK::Math::Abs(p16[i] / 32767.0f - n[i]));
+				}
+			}
+		}
+	}
+	if(fError8 > 1.01f / 255.0f || fError16 > 0.51f / 32767.0f) {
+		VKLogError("NormalMap::Test - Packing is off by %f (8-bit) and %f (16-bit)", fError8, fError16);
+		nErrors++;
+	}
+
+	VKLogInfo("NormalMap::Test - %d errors", nErrors);
+	return nErrors == 0;
+}
+
+void NormalMap::Benchmark(int nWidth)
+{
+	std::mt19937 gen(12345);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	VK::PixelBuffer<float> pb[FaceCount];
+	for(int face = 0; face < FaceCount; face++) {
+		pb[face].create(nWidth, nWidth, 1, 1);
+		float *p = pb[face][0];
+		for(int i = 0; i < pb[face].getNumPixels(); i++)
+			p[i] = random(gen);
+	}
+
+	// The first build also works out the directions
+	NormalMap normals;
+	double t = VK::Timer::Time();
+	normals.build(pb, 0, 1.0f, 0.01f);
+	double tFirst = VK::Timer::Time() - t;
+	t = VK::Timer::Time();
+	normals.build(pb, 0, 1.0f, 0.01f);
+	double tBuild = VK::Timer::Time() - t;
+
+	std::vector<uint8_t> data((size_t)nWidth * nWidth * GetTexelSize(RGBA16));
+	t = VK::Timer::Time();
+	for(int face = 0; face < FaceCount; face++)
+		normals.pack(face, RGBA8, &data[0]);
+	double tPack8 = VK::Timer::Time() - t;
+	t = VK::Timer::Time();
+	for(int face = 0; face < FaceCount; face++)
+		normals.pack(face, RGBA16, &data[0]);
+	double tPack16 = VK::Timer::Time() - t;
+
+	double dTexels = (double)FaceCount * nWidth * nWidth;
+	VKLogInfo("NormalMap::Benchmark - %d texels: first build %lf seconds, build %lf seconds (%.1lf million texels per second), pack 8-bit %lf seconds, 16-bit %lf seconds",
+		FaceCount * nWidth * nWidth, tFirst, tBuild, dTexels / tBuild * 1e-6, tPack8, tPack16);
+}
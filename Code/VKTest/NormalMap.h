@@ -0,0 +1,73 @@
+// NormalMap.h
+//
+#ifndef __NormalMap_h__
+#define __NormalMap_h__
+
+#include "CubeGrid.h"
+
+/// Bakes surface normals from the six faces of a cube-mapped height map, so a shader can read one
+/// normal instead of sampling the height several times per pixel.
+///
+/// Each texel's position on the planet is its direction scaled by (fRadius + height * fScale), and
+/// its normal is the cross product of the central differences between its neighbors' positions in x
+/// and y. The directions and heights are CubeGrids with a 1-texel halo, so the neighbors across a seam
+/// come from the next face (just like Erosion), and the kernel runs 4 texels at a time with SIMD over
+/// bands of rows in parallel. Afterwards the normals are exchanged too, so every copy of a shared edge
+/// texel gets the normal from the face that owns it (the differences at a cube corner, where 3 faces
+/// meet, are taken between different neighbors in each face), and the seams match exactly.
+///
+/// pack() converts a face to 8-bit unsigned or 16-bit signed normalized texels, ready to upload as
+/// VK_FORMAT_R8G8B8A8_UNORM or VK_FORMAT_R16G16B16A16_SNORM.
+class NormalMap
+{
+public:
+	enum Format {
+		RGBA8,		///< xyz * 0.5 + 0.5 in 8-bit unsigned normalized channels (a = 1)
+		RGBA16		///< xyz in 16-bit signed normalized channels (a = 1)
+	};
+
+protected:
+	enum { TileRows = 32 };
+
+	int m_nWidth;					///< The number of texels on each side of a face (including the shared edges)
+	CubeGrid<float> m_dir[3];		///< The direction through each texel (x, y, and z), which only changes with the width
+	CubeGrid<float> m_height;
+	CubeGrid<float> m_normal[3];	///< The normal at each texel (x, y, and z)
+
+	template <class F> void forEachTile(F fn);
+
+public:
+	NormalMap() : m_nWidth(0) {}
+
+	int getWidth() const { return m_nWidth; }
+	static int GetTexelSize(Format f) { return f == RGBA8 ? 4 : 8; }
+
+	/// Builds the normals for one channel of the six face height maps.
+	/// \param pFaces The 6 faces of the height map
+	/// \param nHeight The channel that holds the height
+	/// \param fRadius The radius of the planet
+	/// \param fScale What to multiply each height by to get its distance above fRadius
+	void build(const VK::PixelBuffer<float> *pFaces, int nHeight, float fRadius, float fScale);
+
+	VK::vec3 getNormal(int nFace, int x, int y) const {
+		int i = m_normal[0].index(nFace, x, y);
+		return VK::vec3(m_normal[0][i], m_normal[1][i], m_normal[2][i]);
+	}
+
+	/// Packs one face of normals for upload.
+	/// \param nFace The face to pack
+	/// \param f The format to pack it in
+	/// \param pDest (Out) getWidth() * getWidth() texels of GetTexelSize(f) bytes each, row by row
+	void pack(int nFace, Format f, void *pDest) const;
+
+	/// Checks the normals of a flat planet, the seams, and a bumpy planet against a simple version that
+	/// finds each neighbor with CubeFace::AdjustCoords, as well as both packed formats.
+	/// Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+
+	/// Times build() and pack() on random heights and logs the results (i.e. "VKTest.exe -benchmark").
+	static void Benchmark(int nWidth);
+};
+
+#endif
@@ -0,0 +1,308 @@
+// PageCache.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "PageCache.h"
+
+#include <algorithm>
+#include <random>
+
+void PageCache::init(int nPages, int nPageBytes)
+{
+	m_page.resize(nPages);
+	m_nStack.resize(nPages);
+	for(int i = 0; i < nPages; i++) {
+		m_page[i].key = PageKey();
+		m_page[i].nPrev = m_page[i].nNext = NoPage;
+		m_page[i].nFrame = 0;
+		m_page[i].fPriority = 0.0f;
+		m_nStack[i] = nPages - 1 - i; // Hand out layer 0 first
+	}
+	m_map.clear();
+	m_request.clear();
+	m_load.clear();
+	m_nHead = m_nTail = NoPage;
+	m_nFrame = 0;
+	m_nPageBytes = nPageBytes;
+}
+
+void PageCache::unlink(int n)
+{
+	Page &p = m_page[n];
+	if(p.nPrev != NoPage)
+		m_page[p.nPrev].nNext = p.nNext;
+	else
+		m_nHead = p.nNext;
+	if(p.nNext != NoPage)
+		m_page[p.nNext].nPrev = p.nPrev;
+	else
+		m_nTail = p.nPrev;
+	p.nPrev = p.nNext = NoPage;
+}
+
+void PageCache::pushFront(int n)
+{
+	Page &p = m_page[n];
+	p.nPrev = NoPage;
+	p.nNext = m_nHead;
+	if(m_nHead != NoPage)
+		m_page[m_nHead].nPrev = n;
+	else
+		m_nTail = n;
+	m_nHead = n;
+}
+
+int PageCache::evict(float fPriority)
+{
+	if(!m_nStack.empty()) {
+		int n = m_nStack.back();
+		m_nStack.pop_back();
+		return n;
+	}
+
+	// The tail of the LRU list has gone the longest without being used. If even that was used this frame,
+	// they all were, so give up the one that matters least (but only if it matters less than the new one).
+	int n = m_nTail;
+	if(n == NoPage)
+		return NoPage;
+	if(m_page[n].nFrame == m_nFrame) {
+		n = NoPage;
+		float fLowest = fPriority;
+		for(int i = m_nHead; i != NoPage; i = m_page[i].nNext) {
+			if(m_page[i].fPriority < fLowest) {
+				n = i;
+				fLowest = m_page[i].fPriority;
+			}
+		}
+		if(n == NoPage)
+			return NoPage;
+	}
+
+	m_map.erase(m_page[n].key);
+	m_page[n].key = PageKey();
+	unlink(n);
+	return n;
+}
+
+void PageCache::request(const PageKey &key, float fPriority)
+{
+	PageMap::const_iterator it = m_map.find(key);
+	if(it == m_map.end()) {
+		Request r = { key, fPriority };
+		m_request.push_back(r);
+		return;
+	}
+
+	Page &p = m_page[it->second];
+	if(p.nFrame != m_nFrame || p.fPriority < fPriority)
+		p.fPriority = fPriority;
+	touch(it->second, m_nFrame);
+}
+
+int PageCache::update(int nMaxBytes, PageSource *pSource)
+{
+	// The pages that matter most go first (and a planet's coarse levels matter more than its fine ones,
+	// so the pages everything else falls back to get loaded before the pages that fall back to them)
+	std::sort(m_request.begin(), m_request.end(), [](const Request &a, const Request &b) { return a.fPriority > b.fPriority; });
+	int nMaxLoads = VK::Math::Max(1, nMaxBytes / VK::Math::Max(1, m_nPageBytes));
+	for(size_t i = 0; i < m_request.size() && (int)m_load.size() < nMaxLoads; i++) {
+		const Request &r = m_request[i];
+		if(m_map.find(r.key) != m_map.end())
+			continue; // It was requested more than once
+		if(pSource && !pSource->isReady(r.key))
+			continue; // Try again once it's ready (its ancestors stand in for it until then)
+
+		int n = evict(r.fPriority);
+		if(n == NoPage)
+			break; // Nothing is left that matters less than this (or anything after it)
+		Page &p = m_page[n];
+		p.key = r.key;
+		p.fPriority = r.fPriority;
+		p.nFrame = m_nFrame;
+		pushFront(n);
+		m_map[r.key] = n;
+		Load load = { r.key, n };
+		m_load.push_back(load);
+	}
+	return (int)m_load.size();
+}
+
+int PageCache::find(PageKey &key)
+{
+	for(;;) {
+		PageMap::const_iterator it = m_map.find(key);
+		if(it != m_map.end()) {
+			touch(it->second, m_nFrame);
+			return it->second;
+		}
+		if(key.node.getLevel() == 0)
+			return NoPage;
+		key = key.parent();
+	}
+}
+
+namespace {
+	// A slow, simple version of PageCache to check it against (a list of pages, searched every time)
+	class Model {
+	public:
+		struct Page {
+			PageKey key;
+			uint64_t nTick;		// When it was last used (higher is more recent)
+			uint32_t nFrame;
+			float fPriority;
+		};
+		struct Request {
+			PageKey key;
+			float fPriority;
+		};
+		std::vector<Page> pages;
+		std::vector<Request> requests;
+		int nCapacity;
+		uint64_t nTick;
+		uint32_t nFrame;
+
+		Model(int nCapacity) : nCapacity(nCapacity), nTick(0), nFrame(0) {}
+
+		int find(const PageKey &key) const {
+			for(int i = 0; i < (int)pages.size(); i++)
+				if(pages[i].key == key)
+					return i;
+			return -1;
+		}
+		void begin() { nFrame++; requests.clear(); }
+		void request(const PageKey &key, float fPriority) {
+			int i = find(key);
+			if(i < 0) {
+				Request r = { key, fPriority };
+				requests.push_back(r);
+			} else {
+				if(pages[i].nFrame != nFrame || pages[i].fPriority < fPriority)
+					pages[i].fPriority = fPriority;
+				pages[i].nTick = ++nTick;
+				pages[i].nFrame = nFrame;
+			}
+		}
+		void update(int nMaxLoads, std::vector<PageKey> &loads, PageSource *pSource) {
+			std::sort(requests.begin(), requests.end(), [](const Request &a, const Request &b) { return a.fPriority > b.fPriority; });
+			for(size_t r = 0; r < requests.size() && (int)loads.size() < nMaxLoads; r++) {
+				if(find(requests[r].key) >= 0)
+					continue;
+				if(pSource && !pSource->isReady(requests[r].key))
+					continue;
+				if((int)pages.size() == nCapacity) {
+					// Evict the least recently used page that wasn't used this frame, or else the lowest-priority one
+					int n = -1;
+					for(int i = 0; i < (int)pages.size(); i++)
+						if(pages[i].nFrame != nFrame && (n < 0 || pages[i].nTick < pages[n].nTick))
+							n = i;
+					if(n < 0) {
+						for(int i = 0; i < (int)pages.size(); i++)
+							if(pages[i].fPriority < requests[r].fPriority && (n < 0 || pages[i].fPriority < pages[n].fPriority))
+								n = i;
+					}
+					if(n < 0)
+						break;
+					pages.erase(pages.begin() + n);
+				}
+				Page p = { requests[r].key, ++nTick, nFrame, requests[r].fPriority };
+				pages.push_back(p);
+				loads.push_back(requests[r].key);
+			}
+		}
+		PageKey findNearest(PageKey key) {
+			for(;;) {
+				int i = find(key);
+				if(i >= 0) {
+					pages[i].nTick = ++nTick;
+					pages[i].nFrame = nFrame;
+					return key;
+				}
+				if(key.node.getLevel() == 0)
+					return PageKey();
+				key = key.parent();
+			}
+		}
+	};
+
+	// A source that's only ready with some of the pages each frame (the same ones for both the cache and the model)
+	struct RandomSource : public PageSource {
+		uint32_t nFrame, nSeed;
+		virtual bool isReady(const PageKey &key) {
+			uint32_t n = ((uint32_t)PageKey::Hash()(key) ^ (nFrame * 0x9E3779B9u) ^ nSeed) * 0x85EBCA6Bu;
+			return (n >> 29) != 0; // About 7 in 8
+		}
+	};
+}
+
+bool PageCache::Test()
+{
+	const int PageBytes = 1000;
+	std::mt19937 gen(12345);
+	std::uniform_real_distribution<float> priority(0.0f, 1.0f);
+	int nErrors = 0, nLoads = 0, nFinds = 0;
+	for(int nRun = 0; nRun < 200; nRun++) {
+		int nCapacity = 1 + (int)(gen() % 40);
+		PageCache cache;
+		cache.init(nCapacity, PageBytes);
+		Model model(nCapacity);
+
+		// Draw the pages from a small set of planets and levels, so the same pages come up again and again
+		int nMaxLevel = 1 + (int)(gen() % 4);
+		RandomSource source;
+		source.nSeed = gen();
+		bool bSource = (nRun & 1) != 0;
+		bool bOK = true;
+		for(int nFrame = 0; bOK && nFrame < 100; nFrame++) {
+			cache.begin();
+			model.begin();
+			int nRequests = (int)(gen() % 30);
+			std::vector<PageKey> requested;
+			for(int i = 0; i < nRequests; i++) {
+				uint8_t nLevel = (uint8_t)(gen() % (nMaxLevel + 1));
+				uint32_t nMask = (1u << nLevel) - 1;
+				PageKey key((int)(gen() % 3), NodeKey((uint8_t)(gen() % FaceCount), nLevel, gen() & nMask, gen() & nMask));
+				float f = priority(gen);
+				cache.request(key, f);
+				model.request(key, f);
+				requested.push_back(key);
+			}
+
+			// It has to load the same pages as the model, in priority order, within budget, and into layers nothing else is in
+			int nBytes = (int)(gen() % (6 * PageBytes));
+			std::vector<PageKey> loads;
+			source.nFrame = nFrame;
+			model.update(VK::Math::Max(1, nBytes / PageBytes), loads, bSource ? &source : NULL);
+			int nCount = cache.update(nBytes, bSource ? &source : NULL);
+			const std::vector<Load> &l = cache.getLoads();
+			bOK = nCount == (int)loads.size() && nCount == (int)l.size() && nCount * PageBytes <= VK::Math::Max(nBytes, PageBytes);
+			for(int i = 0; bOK && i < nCount; i++) {
+				bOK = l[i].key == loads[i] && l[i].nPage >= 0 && l[i].nPage < nCapacity && (!bSource || source.isReady(l[i].key));
+				for(int j = 0; bOK && j < i; j++)
+					bOK = l[j].nPage != l[i].nPage;
+			}
+			bOK = bOK && cache.size() == (int)model.pages.size() && cache.size() <= cache.capacity();
+			for(int i = 0; bOK && i < (int)model.pages.size(); i++) {
+				PageKey key = model.pages[i].key;
+				PageMap::const_iterator it = cache.m_map.find(key);
+				bOK = it != cache.m_map.end() && cache.m_page[it->second].key == key;
+			}
+			nLoads += nCount;
+
+			// Finding a page has to land on the same ancestor as the model, in a layer that really holds it
+			for(int i = 0; bOK && i < (int)requested.size(); i++) {
+				PageKey key = requested[i], expected = model.findNearest(key);
+				int n = cache.find(key);
+				bOK = expected.isValid() ? (key == expected && n != NoPage && cache.m_page[n].key == key) : n == NoPage;
+				nFinds++;
+			}
+		}
+		if(!bOK) {
+			if(nErrors < 10)
+				VKLogError("PageCache::Test - Failed on run %d (%d pages)", nRun, nCapacity);
+			nErrors++;
+		}
+	}
+
+	VKLogInfo("PageCache::Test - %d errors (%d loads, %d finds)", nErrors, nLoads, nFinds);
+	return nErrors == 0;
+}
@@ -0,0 +1,140 @@
+// PageCache.h
+//
+#ifndef __PageCache_h__
+#define __PageCache_h__
+
+#include "NodeKey.h"
+
+#include <vector>
+#include <unordered_map>
+
+/// The address of a height map page: one node in one planet's quad-trees
+struct PageKey {
+	NodeKey node;	///< The node the page covers
+	int nPlanet;	///< The planet (or moon) it belongs to
+
+	PageKey() : nPlanet(-1) {}
+	PageKey(int nPlanet, const NodeKey &node) : node(node), nPlanet(nPlanet) {}
+
+	bool isValid() const { return nPlanet >= 0 && node.isValid(); }
+	bool operator==(const PageKey &key) const { return node == key.node && nPlanet == key.nPlanet; }
+	bool operator!=(const PageKey &key) const { return !operator==(key); }
+
+	/// Returns the page one level up that covers this one (the same page at level 0)
+	PageKey parent() const { return PageKey(nPlanet, node.parent()); }
+
+	/// A hash functor for std::unordered_map
+	struct Hash {
+		size_t operator()(const PageKey &key) const { return NodeKey::Hash()(key.node) ^ ((size_t)key.nPlanet * 0x9E3779B9u); }
+	};
+};
+
+/// Where a PageCache's pages come from, if they can't all be made on the spot (i.e. when they're read from disk)
+struct PageSource {
+	/// Returns true if the page can be filled in now. If not, the source should start fetching it (update() skips it this frame).
+	virtual bool isReady(const PageKey &key) = 0;
+};
+
+/// Keeps track of which height map pages are in which layers of a texture array (like a page table
+/// in virtual texturing). Nothing here touches Vulkan. The caller uploads the pages it's told to.
+///
+/// Each frame, call begin(), then request() every page the LOD selector wants to draw with, with a
+/// priority for how much it matters (PlanetSystem uses how big the node looks on screen). Then call
+/// update() with the most bytes to upload this frame. It hands out layers for the missing pages in
+/// priority order, and the caller fills them in from getLoads(). Free layers go first. After that,
+/// the least recently used page gets evicted, as long as it wasn't used this frame. If they were all
+/// used this frame, the lowest-priority one gets evicted, but only for a page that matters more.
+/// If update() is given a PageSource, it skips any page the source isn't ready with (without
+/// counting it against the budget), so a page only takes a layer once it can be filled in.
+/// Last, call find() for each page to draw with. It falls back to the nearest ancestor that's
+/// loaded, so a missing page is drawn with less detail instead of not at all.
+///
+/// So the detail is bounded by the layers in the texture array (GPU memory) and the upload budget,
+/// not by how many levels PlanetLOD uses.
+class PageCache
+{
+public:
+	static const int NoPage = -1;
+
+	/// A page update() assigned to a layer. The caller needs to upload it before drawing.
+	struct Load {
+		PageKey key;	///< The page to upload
+		int nPage;		///< The layer to upload it to
+	};
+
+protected:
+	/// One layer of the texture array
+	struct Page {
+		PageKey key;		///< The page in it (invalid if it's free)
+		int nPrev, nNext;	///< Links in the LRU list (the most recently used is at the head)
+		uint32_t nFrame;	///< The last frame it was requested or found
+		float fPriority;	///< Its priority the last time it was requested
+	};
+
+	/// A page that was requested this frame but isn't loaded
+	struct Request {
+		PageKey key;
+		float fPriority;
+	};
+
+	typedef std::unordered_map<PageKey, int, PageKey::Hash> PageMap;
+
+	std::vector<Page> m_page;
+	std::vector<int> m_nStack;			///< A stack of free layers
+	PageMap m_map;						///< Maps each loaded page to its layer
+	std::vector<Request> m_request;		///< The missing pages requested this frame
+	std::vector<Load> m_load;			///< The pages update() assigned this frame
+	int m_nHead, m_nTail;				///< The ends of the LRU list
+	uint32_t m_nFrame;
+	int m_nPageBytes;
+
+	void unlink(int n);
+	void pushFront(int n);
+	void touch(int n, uint32_t nFrame) { unlink(n); pushFront(n); m_page[n].nFrame = nFrame; }
+
+	/// Picks a layer to put a page with priority fPriority in (NoPage if none can be spared)
+	int evict(float fPriority);
+
+public:
+	PageCache() : m_nHead(NoPage), m_nTail(NoPage), m_nFrame(0), m_nPageBytes(0) {}
+
+	/// Empties the cache and sets its size.
+	/// \param nPages The number of layers in the texture array
+	/// \param nPageBytes The size of one page (for update's budget)
+	void init(int nPages, int nPageBytes);
+
+	int capacity() const { return (int)m_page.size(); }
+	int size() const { return (int)m_map.size(); }
+
+	/// Starts a new frame (clears the requests and loads from the last one)
+	void begin() {
+		m_nFrame++;
+		m_request.clear();
+		m_load.clear();
+	}
+
+	/// Asks for a page this frame. If it's loaded, it's marked as used (so it won't be evicted for a page that
+	/// matters less). If not, update() may load it. It's fine to ask for the same page more than once.
+	void request(const PageKey &key, float fPriority);
+
+	/// Assigns layers to the missing pages in priority order.
+	/// \param nMaxBytes The most bytes to upload this frame (one page always fits, so it can't stall)
+	/// \param pSource (Optional) Where the pages come from. Pages it isn't ready with are left for a later frame.
+	/// \return The number of pages to upload (see getLoads())
+	int update(int nMaxBytes, PageSource *pSource=NULL);
+
+	/// Returns the pages assigned by update() this frame, in priority order
+	const std::vector<Load> &getLoads() const { return m_load; }
+
+	/// Finds the layer for a page, or for its nearest loaded ancestor, and marks it as used.
+	/// \param key The page to look for (set to the page that was found)
+	/// \return The layer, or NoPage if nothing from the page up to level 0 is loaded
+	int find(PageKey &key);
+
+	/// Runs random requests through the cache against a simple model of it, and checks residency,
+	/// priority order, the upload budget, the eviction order, and skipping pages a source isn't ready with. Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+};
+
+#endif
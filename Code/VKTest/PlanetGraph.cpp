@@ -0,0 +1,641 @@
+// PlanetGraph.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "../VKContext/VKGeometry.h"
+#include "../VKContext/VKNoise.h"
+#include "../VKContext/VKDatabase.h"
+#include "PlanetGraph.h"
+#include "PlateSimulation.h"
+#include "Erosion.h"
+#include "RiverNetwork.h"
+
+#include <random>
+
+namespace {
+	// Assigns each texel to the nearest plate center (a Voronoi cell), with a little noise added to each position to avoid
+	// perfectly straight plate edges. The plate goes in w.
+	class PlatesStage : public PlanetGraph::Stage {
+	protected:
+		VK::Noise m_noise;
+
+	public:
+		virtual const char *getName() const { return "plates"; }
+		virtual bool isLocal() const { return true; }
+
+		// Only the plates that could be nearest to some texel in the tile matter. The noise moves a direction by at most
+		// 2 * 0.25 * sqrt(3) / 4 (each gradient is a unit vector, so the noise is at most sqrt(3)), so a plate can only
+		// win if it's within 2 * (fRadius + that) of the distance to the plate nearest the tile's center.
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {
+			const float Margin = 0.4f;
+			f.add(params.nNoiseSeed);
+			float fMin = 1e+10f;
+			for(size_t i = 0; i < params.plates.size(); i++)
+				fMin = VK::Math::Min(fMin, params.plates[i].dist(pTile->vCenter));
+			float fMax = fMin + 2.0f * (pTile->fRadius + Margin);
+			for(size_t i = 0; i < params.plates.size(); i++) {
+				if(params.plates[i].dist(pTile->vCenter) <= fMax) {
+					f.add((int)i);
+					f.add(params.plates[i]);
+				}
+			}
+		}
+
+		virtual void begin(const PlanetParams &params) { m_noise.init(3, params.nNoiseSeed); }
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			int nWidth = pFaces[0].getWidth();
+			std::vector<VK::vec3> row(nWidth);
+			for(int y = pTile->y0; y < pTile->y1; y++) {
+				VK::vec4 *pv = (VK::vec4 *)pFaces[pTile->nFace](0, y);
+				CubeFace::GetDirections(pTile->nFace, nWidth, y, &row[0]);
+				for(int x = pTile->x0; x < pTile->x1; x++) {
+					float dist = 1e+10f;
+					pv[x].w = -1;
+					VK::vec3 v = row[x] * 4.0;
+					v += m_noise.noise(&v.x) * 0.25f;
+					v = v.normalize();
+					for(size_t i = 0; i < params.plates.size(); i++) {
+						float d = params.plates[i].dist2(v);
+						if(d < dist) {
+							dist = d;
+							pv[x].w = (float)i;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	// Raises the side of each fault plane its normal points to by 1, and lowers the other side by 1
+	class FaultsStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "faults"; }
+		virtual bool isLocal() const { return true; }
+
+		// A plane that misses the tile only matters by which side of it the tile is on
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {
+			for(size_t i = 0; i < params.faults.size(); i++) {
+				VK::Plane plane(params.faults[i], 0.0f);
+				float d = plane.distance(pTile->vCenter);
+				if(VK::Math::Abs(d) > pTile->fRadius)
+					f.add((int8_t)(d > 0 ? 1 : -1));
+				else
+					f.add(params.faults[i]);
+			}
+		}
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			int nWidth = pFaces[0].getWidth();
+			std::vector<VK::vec3> row(nWidth);
+			for(size_t i = 0; i < params.faults.size(); i++) {
+				VK::Plane plane(params.faults[i], 0.0f);
+				for(int y = pTile->y0; y < pTile->y1; y++) {
+					VK::vec4 *pv = (VK::vec4 *)pFaces[pTile->nFace](0, y);
+					CubeFace::GetDirections(pTile->nFace, nWidth, y, &row[0]);
+					for(int x = pTile->x0; x < pTile->x1; x++)
+						pv[x].x += plane.distance(row[x]) > 0 ? 1.0f : -1.0f;
+				}
+			}
+		}
+	};
+
+	// Lowers everything so most of the planet is just above sea level
+	class SeaLevelStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "sea level"; }
+		virtual bool isLocal() const { return false; }
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {}
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			int nTexels = pFaces[0].getNumPixels();
+			float total = 0;
+			for(int face = 0; face < FaceCount; face++) {
+				VK::vec4 *pv = (VK::vec4 *)pFaces[face][0];
+				for(int n = 0; n < nTexels; n++)
+					total += pv[n].x;
+			}
+			float avg = ((total / (nTexels * FaceCount)) * 0.9f);
+			for(int face = 0; face < FaceCount; face++) {
+				VK::vec4 *pv = (VK::vec4 *)pFaces[face][0];
+				for(int n = 0; n < nTexels; n++)
+					pv[n].x -= avg;
+			}
+		}
+	};
+
+	// Runs the plate tectonics simulation for params.nTectonicsSteps steps
+	class TectonicsStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "tectonics"; }
+		virtual bool isLocal() const { return false; }
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {
+			f.add(params.nTectonicsSteps);
+			if(params.nTectonicsSteps > 0) {
+				f.add((int)params.plates.size());
+				f.add(params.nNoiseSeed);
+			}
+		}
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			if(params.nTectonicsSteps <= 0)
+				return;
+			PlateSimulation tectonics;
+			tectonics.init(pFaces, 0, 3, (int)params.plates.size(), params.nNoiseSeed);
+			tectonics.benchmark(params.nTectonicsSteps);
+			tectonics.write(pFaces, 0, 3);
+		}
+	};
+
+	// Erodes the heights for params.nErosionSteps iterations
+	class ErosionStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "erosion"; }
+		virtual bool isLocal() const { return false; }
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const { f.add(params.nErosionSteps); }
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			if(params.nErosionSteps <= 0)
+				return;
+			Erosion erosion;
+			erosion.init(pFaces, 0);
+			erosion.benchmark(params.nErosionSteps);
+			erosion.write(pFaces, 0);
+		}
+	};
+
+	// Flood fills each land mass above sea level with its own index (starting at 1) in y
+	class LandMassStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "land masses"; }
+		virtual bool isLocal() const { return false; }
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {}
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			int nWidth = pFaces[0].getWidth();
+			typedef std::vector<VK::ivec3> CoastLine;
+			typedef std::vector<CoastLine> LandMasses;
+			LandMasses land;
+			for(int face = 0; face < FaceCount; face++) {
+				for(int y = 0; y < nWidth; y++) {
+					for(int x = 0; x < nWidth; x++) {
+						VK::vec4 *pv = (VK::vec4 *)pFaces[face](x, y);
+						float h = pv->x; // The height of this point
+						float l = pv->y; // The land mass index already assigned to this point
+						if(h > 0 && l == 0) {
+							land.push_back(CoastLine());
+							pv->y = l = (float)land.size();
+							CoastLine &coast = land.back();
+							CoastLine stack;
+							stack.push_back(VK::ivec3(x, y, face));
+							while(!stack.empty()) {
+								CoastLine next_stack;
+								while(!stack.empty()) {
+									bool land_locked = true;
+									VK::ivec3 current = stack.back();
+									stack.pop_back();
+									VK::ivec3 v[8] = {
+										VK::ivec3(current.x - 1, current.y, current.z), // W
+										VK::ivec3(current.x + 1, current.y, current.z), // E
+										VK::ivec3(current.x, current.y - 1, current.z), // S
+										VK::ivec3(current.x, current.y + 1, current.z), // N
+										VK::ivec3(current.x - 1, current.y - 1, current.z), // SW
+										VK::ivec3(current.x - 1, current.y + 1, current.z), // NW
+										VK::ivec3(current.x + 1, current.y - 1, current.z), // SE
+										VK::ivec3(current.x + 1, current.y + 1, current.z), // NE
+									};
+									for(int i = 0; i < 8; i++) {
+										uint8_t nFace = v[i].z;
+										CubeFace::AdjustCoords(nWidth - 1, nFace, v[i].x, v[i].y);
+										v[i].z = nFace;
+										VK::vec4 *pn = (VK::vec4 *)pFaces[v[i].z](v[i].x, v[i].y);
+										if(pn->x > 0) {
+											if(pn->y == 0) {
+												pn->y = l;
+												next_stack.push_back(v[i]);
+											}
+										} else
+											land_locked = false;
+									}
+									if(!land_locked)
+										coast.push_back(current);
+								}
+								next_stack.swap(stack);
+							}
+						}
+					}
+				}
+			}
+			VKLogInfo("PlanetGraph - %d land masses", (int)land.size());
+		}
+	};
+
+	// Builds the river drainage network and stores it in z for the renderer
+	class RiversStage : public PlanetGraph::Stage {
+	public:
+		virtual const char *getName() const { return "rivers"; }
+		virtual bool isLocal() const { return false; }
+		virtual void hash(const PlanetParams &params, const PlanetGraph::Tile *pTile, Fingerprint &f) const {}
+
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const PlanetGraph::Tile *pTile) {
+			RiverNetwork rivers;
+			rivers.build(pFaces, 0, 0.0f);
+			rivers.writeDrainage(pFaces, 2);
+		}
+	};
+}
+
+PlanetParams PlanetParams::Random(int nWidth, uint32_t nSeed, int nPlates, int nFaults)
+{
+	std::mt19937 gen(nSeed);
+	std::uniform_real_distribution<float> real_random(-1, 1);
+	PlanetParams params;
+	params.nWidth = nWidth;
+	params.nNoiseSeed = nSeed;
+	params.nTectonicsSteps = 0;
+	params.nErosionSteps = 0;
+
+	// Generate random centers of "plates" (which will be treated like Voronoi cells)
+	std::vector<VK::vec3> &plates = params.plates, push(nPlates);
+	for(int i = 0; i < nPlates; i++)
+		plates.push_back(VK::vec3(real_random(gen), real_random(gen), real_random(gen)).normalize());
+
+	// Run a number of passes to push the centers apart to try to keep them fairly evenly spaced.
+	for(int pass = 0; pass < 100; pass++) {
+		for(int i = 0; i < nPlates; i++)
+			push[i].x = push[i].y = push[i].z = 0;
+		for(int i = 0; i < nPlates; i++) {
+			for(int j = 0; j < nPlates; j++) {
+				if(j == i)
+					continue;
+				float dist2 = plates[i].dist2(plates[j]);
+				if(dist2 < 0.01f) // Set a min on dist2 to keep the push vector from going to inf
+					dist2 = 0.01f;
+				push[i] += (plates[i] - plates[j]) / dist2;
+			}
+		}
+		for(int i = 0; i < nPlates; i++) {
+			push[i] *= 0.01f / push[i].mag();
+			plates[i] = (plates[i] + push[i]).normalize();
+		}
+	}
+
+	for(int i = 0; i < nFaults; i++)
+		params.faults.push_back(VK::vec3(real_random(gen), real_random(gen), real_random(gen)).normalize());
+	return params;
+}
+
+PlanetGraph::~PlanetGraph()
+{
+	for(size_t i = 0; i < m_stages.size(); i++)
+		delete m_stages[i];
+}
+
+void PlanetGraph::add(Stage *pStage)
+{
+	m_stages.push_back(pStage);
+	Stats stats = {0, 0};
+	m_stats.push_back(stats);
+}
+
+void PlanetGraph::addDefaultStages()
+{
+	add(new PlatesStage);
+	add(new FaultsStage);
+	add(new SeaLevelStage);
+	add(new TectonicsStage);
+	add(new ErosionStage);
+	add(new LandMassStage);
+	add(new RiversStage);
+}
+
+void PlanetGraph::initTiles(int nWidth)
+{
+	if(nWidth == m_nWidth)
+		return;
+	m_nWidth = nWidth;
+	m_tiles.resize(TileCount);
+	std::vector<VK::vec3> row(nWidth);
+	for(int face = 0; face < FaceCount; face++) {
+		for(int ty = 0; ty < TilesPerEdge; ty++) {
+			for(int tx = 0; tx < TilesPerEdge; tx++) {
+				Tile &t = m_tiles[(face * TilesPerEdge + ty) * TilesPerEdge + tx];
+				t.nFace = (uint8_t)face;
+				t.x0 = nWidth * tx / TilesPerEdge;
+				t.x1 = nWidth * (tx + 1) / TilesPerEdge;
+				t.y0 = nWidth * ty / TilesPerEdge;
+				t.y1 = nWidth * (ty + 1) / TilesPerEdge;
+				VK::dvec3 v = CubeFace::GetPlanetaryVector(t.nFace, 0.5 * (t.x0 + t.x1 - 1) / (nWidth - 1), 0.5 * (t.y0 + t.y1 - 1) / (nWidth - 1));
+				t.vCenter = VK::vec3((float)v.x, (float)v.y, (float)v.z).normalize();
+
+				// Measured against the same directions the stages use, with a little extra for rounding
+				float fRadius = 0.0f;
+				for(int y = t.y0; y < t.y1; y++) {
+					CubeFace::GetDirections(t.nFace, nWidth, y, &row[0]);
+					for(int x = t.x0; x < t.x1; x++)
+						fRadius = VK::Math::Max(fRadius, row[x].dist(t.vCenter));
+				}
+				t.fRadius = fRadius * 1.001f + 1e-5f;
+			}
+		}
+	}
+}
+
+void PlanetGraph::hashStage(int nStage, const PlanetParams &params, const std::vector<uint64_t> &upstream, std::vector<uint64_t> &hashes) const
+{
+	const Stage *pStage = m_stages[nStage];
+	hashes.resize(TileCount);
+	if(pStage->isLocal()) {
+		for(int t = 0; t < TileCount; t++) {
+			Fingerprint f;
+			f.add(pStage->getName());
+			pStage->hash(params, &m_tiles[t], f);
+			f.add(upstream[t]);
+			hashes[t] = f.get();
+		}
+	} else {
+		Fingerprint f;
+		f.add(pStage->getName());
+		pStage->hash(params, NULL, f);
+		for(int t = 0; t < TileCount; t++)
+			f.add(upstream[t]);
+		for(int t = 0; t < TileCount; t++)
+			hashes[t] = f.get();
+	}
+}
+
+void PlanetGraph::store(int nStage, int nTile, uint64_t nHash, const VK::PixelBuffer<float> *pFaces)
+{
+	const Tile &t = m_tiles[nTile];
+	Entry &e = m_cache[Key(nStage, nTile)];
+	e.nHash = nHash;
+	e.data.resize((t.x1 - t.x0) * (t.y1 - t.y0) * 4);
+	float *pDest = &e.data[0];
+	for(int y = t.y0; y < t.y1; y++) {
+		memcpy(pDest, pFaces[t.nFace](t.x0, y), (t.x1 - t.x0) * 4 * sizeof(float));
+		pDest += (t.x1 - t.x0) * 4;
+	}
+}
+
+bool PlanetGraph::restore(int nStage, int nTile, uint64_t nHash, VK::PixelBuffer<float> *pFaces) const
+{
+	const Tile &t = m_tiles[nTile];
+	std::unordered_map<uint64_t, Entry>::const_iterator it = m_cache.find(Key(nStage, nTile));
+	if(it == m_cache.end() || it->second.nHash != nHash || (int)it->second.data.size() != (t.x1 - t.x0) * (t.y1 - t.y0) * 4)
+		return false;
+	const float *pSrc = &it->second.data[0];
+	for(int y = t.y0; y < t.y1; y++) {
+		memcpy(pFaces[t.nFace](t.x0, y), pSrc, (t.x1 - t.x0) * 4 * sizeof(float));
+		pSrc += (t.x1 - t.x0) * 4;
+	}
+	return true;
+}
+
+bool PlanetGraph::open(const VK::Path &path)
+{
+	m_db.close();
+	if(!m_db.open(path))
+		return false;
+	if(!m_db.exec("CREATE TABLE IF NOT EXISTS stage_tile (stage TEXT, tile INTEGER, hash INTEGER, data BLOB, PRIMARY KEY(stage, tile));")) {
+		m_db.close();
+		return false;
+	}
+
+	int nLoaded = 0;
+	VK::DB::Statement select(&m_db, "SELECT tile, hash, data FROM stage_tile WHERE stage=?", false);
+	for(int s = 0; s < (int)m_stages.size(); s++) {
+		select.bind(1, m_stages[s]->getName());
+		while(select.next()) {
+			int nTile = select.getInt(0);
+			int nBytes = 0;
+			const void *pData = select.getBlob(2, nBytes);
+			if(nTile < 0 || nTile >= TileCount || !pData)
+				continue;
+			Entry &e = m_cache[Key(s, nTile)];
+			e.nHash = (uint64_t)select.getInt64(1);
+			e.data.resize(nBytes / sizeof(float));
+			memcpy(&e.data[0], pData, e.data.size() * sizeof(float));
+			nLoaded++;
+		}
+		select.reset();
+	}
+	VKLogInfo("PlanetGraph::open - Loaded %d cached tiles from %s", nLoaded, path.c_str());
+	return true;
+}
+
+void PlanetGraph::clear()
+{
+	m_cache.clear();
+	if(m_db.isOpen())
+		m_db.exec("DELETE FROM stage_tile;");
+}
+
+bool PlanetGraph::save(const std::vector<uint64_t> &keys)
+{
+	if(!m_db.isOpen() || keys.empty())
+		return true;
+	bool bOK = true;
+	m_db.beginTransaction();
+	{
+		VK::DB::Statement insert(&m_db, "INSERT OR REPLACE INTO stage_tile VALUES (?, ?, ?, ?)", false);
+		for(size_t i = 0; i < keys.size(); i++) {
+			const Entry &e = m_cache[keys[i]];
+			insert.bind(1, m_stages[(int)(keys[i] >> 32)]->getName());
+			insert.bind(2, (int)(uint32_t)keys[i]);
+			insert.bind(3, e.nHash);
+			insert.bindBlob(4, &e.data[0], (int)(e.data.size() * sizeof(float)));
+			bOK = insert.exec() && bOK;
+		}
+	}
+	if(bOK)
+		m_db.commitTransaction();
+	else
+		m_db.rollbackTransaction();
+	return bOK;
+}
+
+uint64_t PlanetGraph::getHash(const PlanetParams &params)
+{
+	initTiles(params.nWidth);
+	std::vector<uint64_t> upstream(TileCount), hashes;
+	for(int t = 0; t < TileCount; t++) {
+		Fingerprint f;
+		f.add(params.nWidth);
+		f.add(t);
+		upstream[t] = f.get();
+	}
+	for(int s = 0; s < (int)m_stages.size(); s++) {
+		hashStage(s, params, upstream, hashes);
+		upstream.swap(hashes);
+	}
+
+	Fingerprint f;
+	for(int t = 0; t < TileCount; t++)
+		f.add(upstream[t]);
+	return f.get();
+}
+
+uint64_t PlanetGraph::run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces)
+{
+	double dStart = VK::Timer::Time();
+	initTiles(params.nWidth);
+	for(int face = 0; face < FaceCount; face++) {
+		pFaces[face].create(params.nWidth, params.nWidth, 1, 4);
+		pFaces[face] = 0;
+	}
+
+	// Before the first stage, a tile's hash only has to say which tile it is (they all start at 0)
+	std::vector<uint64_t> upstream(TileCount), hashes, keys;
+	for(int t = 0; t < TileCount; t++) {
+		Fingerprint f;
+		f.add(params.nWidth);
+		f.add(t);
+		upstream[t] = f.get();
+	}
+
+	for(int s = 0; s < (int)m_stages.size(); s++) {
+		Stage *pStage = m_stages[s];
+		Stats &stats = m_stats[s];
+		hashStage(s, params, upstream, hashes);
+
+		// Every tile that isn't up to date has to be run. A global stage can't run on part of the planet, so it's all or nothing.
+		std::vector<int> dirty;
+		for(int t = 0; t < TileCount; t++) {
+			if(!restore(s, t, hashes[t], pFaces))
+				dirty.push_back(t);
+		}
+		if(!dirty.empty() && !pStage->isLocal()) {
+			dirty.clear();
+			for(int t = 0; t < TileCount; t++)
+				dirty.push_back(t);
+		}
+
+		stats.nRun = (int)dirty.size();
+		stats.nCached = TileCount - stats.nRun;
+		if(!dirty.empty()) {
+			if(pStage->isLocal()) {
+				pStage->begin(params);
+				VK::Thread::ParallelFor(0, (int)dirty.size(), [&](int i) {
+					pStage->run(params, pFaces, &m_tiles[dirty[i]]);
+				}, 1);
+			} else {
+				pStage->run(params, pFaces, NULL);
+			}
+			for(size_t i = 0; i < dirty.size(); i++) {
+				store(s, dirty[i], hashes[dirty[i]], pFaces);
+				keys.push_back(Key(s, dirty[i]));
+			}
+		}
+		upstream.swap(hashes);
+	}
+	if(!save(keys))
+		VKLogError("PlanetGraph::run - Failed to save the cache to %s", m_db.getPath().c_str());
+
+	std::string str;
+	for(int s = 0; s < (int)m_stages.size(); s++) {
+		char sz[64];
+		sprintf(sz, "%s%s %d/%d", s ? ", " : "", m_stages[s]->getName(), m_stats[s].nRun, TileCount);
+		str += sz;
+	}
+	VKLogInfo("PlanetGraph::run - Ran %s in %.2f seconds", str.c_str(), VK::Timer::Time() - dStart);
+
+	Fingerprint f;
+	for(int t = 0; t < TileCount; t++)
+		f.add(upstream[t]);
+	return f.get();
+}
+
+bool PlanetGraph::Test()
+{
+	const int Width = 33;
+	int nErrors = 0;
+	PlanetParams params = PlanetParams::Random(Width, 12345, 10, 10);
+	VK::PixelBuffer<float> pb[FaceCount], fresh[FaceCount];
+
+	// Compares the last run against a run from scratch, texel for texel
+	auto check = [&](const char *pszWhat) {
+		PlanetGraph scratch;
+		scratch.addDefaultStages();
+		scratch.run(params, fresh);
+		for(int face = 0; face < FaceCount; face++) {
+			if(memcmp(pb[face][0], fresh[face][0], pb[face].getBufferSize()) != 0) {
+				VKLogError("PlanetGraph::Test - %s: face %d doesn't match a run from scratch", pszWhat, face);
+				nErrors++;
+			}
+		}
+	};
+
+	PlanetGraph graph;
+	graph.addDefaultStages();
+	uint64_t nHash = graph.run(params, pb);
+	if(nHash != graph.getHash(params)) {
+		VKLogError("PlanetGraph::Test - run() and getHash() return different hashes");
+		nErrors++;
+	}
+
+	// Nothing changed, so nothing should run
+	if(graph.run(params, pb) != nHash) {
+		VKLogError("PlanetGraph::Test - The hash changed when nothing else did");
+		nErrors++;
+	}
+	for(int s = 0; s < graph.getStageCount(); s++) {
+		if(graph.getStats(s).nRun != 0) {
+			VKLogError("PlanetGraph::Test - Nothing changed, but %s ran on %d tiles", graph.getStage(s)->getName(), graph.getStats(s).nRun);
+			nErrors++;
+		}
+	}
+	check("unchanged");
+
+	// Nudge one plate or one fault plane at a time. Only the tiles near it (or the tiles a plane cuts through) should run again.
+	std::mt19937 gen(54321);
+	std::uniform_real_distribution<float> real_random(-1, 1);
+	for(int nTest = 0; nTest < 8; nTest++) {
+		int nStage = nTest & 1;
+		std::vector<VK::vec3> &v = nStage ? params.faults : params.plates;
+		int i = (int)(gen() % v.size());
+		v[i] = (v[i] + VK::vec3(real_random(gen), real_random(gen), real_random(gen)) * 0.05f).normalize();
+		if(graph.run(params, pb) == nHash) {
+			VKLogError("PlanetGraph::Test - The hash didn't change after moving %s %d", nStage ? "fault" : "plate", i);
+			nErrors++;
+		}
+		nHash = graph.getHash(params);
+		const Stats &stats = graph.getStats(nStage);
+		if(stats.nRun == 0 || stats.nRun == TileCount) {
+			VKLogError("PlanetGraph::Test - Moving %s %d made %s run on %d of %d tiles", nStage ? "fault" : "plate", i, graph.getStage(nStage)->getName(), stats.nRun, TileCount);
+			nErrors++;
+		}
+		check(nStage ? "moved a fault" : "moved a plate");
+	}
+
+	// A new graph with the same database should start where the last one left off
+	VK::Path path = VK::Path::Root() + "PlanetGraph.test.db";
+	if(path.exists())
+		path.del();
+	{
+		PlanetGraph saved;
+		saved.addDefaultStages();
+		if(!saved.open(path)) {
+			VKLogError("PlanetGraph::Test - Failed to open %s", path.c_str());
+			nErrors++;
+		}
+		saved.run(params, pb);
+	}
+	{
+		PlanetGraph loaded;
+		loaded.addDefaultStages();
+		loaded.open(path);
+		loaded.run(params, pb);
+		for(int s = 0; s < loaded.getStageCount(); s++) {
+			if(loaded.getStats(s).nRun != 0) {
+				VKLogError("PlanetGraph::Test - %s ran on %d tiles after loading the cache", loaded.getStage(s)->getName(), loaded.getStats(s).nRun);
+				nErrors++;
+			}
+		}
+		check("loaded");
+	}
+	path.del();
+
+	VKLogInfo("PlanetGraph::Test - %d errors", nErrors);
+	return nErrors == 0;
+}
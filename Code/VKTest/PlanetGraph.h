@@ -0,0 +1,151 @@
+// PlanetGraph.h
+//
+#ifndef __PlanetGraph_h__
+#define __PlanetGraph_h__
+
+#include "CubeFace.h"
+
+#include <unordered_map>
+
+/// A 64-bit FNV-1a hash, built up one value at a time
+class Fingerprint
+{
+protected:
+	uint64_t m_n;
+
+public:
+	Fingerprint() : m_n(14695981039346656037ull) {}
+	void add(const void *p, size_t nBytes) {
+		const uint8_t *pb = (const uint8_t *)p;
+		for(size_t i = 0; i < nBytes; i++)
+			m_n = (m_n ^ pb[i]) * 1099511628211ull;
+	}
+	void add(const char *psz) { add(psz, strlen(psz) + 1); }
+	template <class T> void add(const T &t) { add(&t, sizeof(T)); }
+	uint64_t get() const { return m_n; }
+};
+
+/// Everything that goes into generating a planet. The random parts (the plates and fault planes) are drawn
+/// up front by Random(), so changing one of them doesn't reshuffle the rest.
+struct PlanetParams {
+	int nWidth;						///< The number of texels on each side of a face (including the shared edges)
+	uint32_t nNoiseSeed;			///< Seeds the noise that roughens the plate edges (and the plate simulation)
+	std::vector<VK::vec3> plates;	///< The centers of the plates (unit vectors)
+	std::vector<VK::vec3> faults;	///< The normals of the fault planes through the center (the side they point to is raised)
+	int nTectonicsSteps;			///< The number of plate tectonics steps to run (0 for none)
+	int nErosionSteps;				///< The number of erosion iterations to run (0 for none)
+
+	/// Draws nPlates plate centers (pushed apart to keep them fairly evenly spaced) and nFaults fault planes from nSeed
+	static PlanetParams Random(int nWidth, uint32_t nSeed, int nPlates, int nFaults);
+};
+
+/// Generates a planet's height map as a graph of stages, and only redoes what a change in PlanetParams affects.
+///
+/// Each face is cut into TilesPerEdge x TilesPerEdge tiles, and every stage's output is cached per tile along
+/// with a hash of everything that went into it. A local stage only reads and writes the texels in a tile, so
+/// it hashes just the parameters that can matter to that tile (i.e. only the plates near it, or only whether
+/// it's above or below a fault plane unless the plane cuts through it), plus the tile's hash from the stage
+/// before. Only the tiles whose hashes changed are run again. A global stage (like the flood fills and
+/// simulations) needs the whole planet, so it hashes its parameters and every tile from the stage before, and
+/// runs again if any of them changed. Either way, a stage that's up to date is just copied from the cache,
+/// and a change flows down to every later stage it touches through the hashes.
+///
+/// The cache can be kept in a SQLite database, so it survives from one run to the next.
+class PlanetGraph
+{
+public:
+	static const int TilesPerEdge = 4;
+	static const int TileCount = FaceCount * TilesPerEdge * TilesPerEdge;
+
+	/// A rectangle of texels in one face
+	struct Tile {
+		uint8_t nFace;
+		int x0, y0, x1, y1;		///< The texels in it are [x0, x1) x [y0, y1)
+		VK::vec3 vCenter;		///< The direction through its middle
+		float fRadius;			///< The greatest distance from vCenter to the direction through any of its texels
+	};
+
+	/// One step in generating a planet
+	class Stage {
+	public:
+		virtual ~Stage() {}
+		virtual const char *getName() const = 0;
+
+		/// Returns true if the stage only reads and writes the texels in a tile, so a tile can be redone on its own
+		virtual bool isLocal() const = 0;
+
+		/// Hashes the parameters the stage reads that can change a tile (local stages), or the whole planet (pTile is NULL)
+		virtual void hash(const PlanetParams &params, const Tile *pTile, Fingerprint &f) const = 0;
+
+		/// Called once before a local stage runs on any tiles (from one thread)
+		virtual void begin(const PlanetParams &params) {}
+
+		/// Runs the stage on one tile (local stages, possibly from several threads at once), or on the whole planet (pTile is NULL)
+		virtual void run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces, const Tile *pTile) = 0;
+	};
+
+	/// How much one stage had to do in the last run()
+	struct Stats {
+		int nRun;		///< The tiles it ran on (TileCount for a global stage that ran)
+		int nCached;	///< The tiles it copied from the cache
+	};
+
+protected:
+	/// One stage's output for one tile
+	struct Entry {
+		uint64_t nHash;
+		std::vector<float> data;
+	};
+
+	std::vector<Stage *> m_stages;
+	std::vector<Stats> m_stats;
+	std::vector<Tile> m_tiles;
+	int m_nWidth;
+	std::unordered_map<uint64_t, Entry> m_cache;	///< Keyed by (stage << 32) | tile
+	VK::DB::Connection m_db;
+
+	void initTiles(int nWidth);
+	void hashStage(int nStage, const PlanetParams &params, const std::vector<uint64_t> &upstream, std::vector<uint64_t> &hashes) const;
+	void store(int nStage, int nTile, uint64_t nHash, const VK::PixelBuffer<float> *pFaces);
+	bool restore(int nStage, int nTile, uint64_t nHash, VK::PixelBuffer<float> *pFaces) const;
+	bool save(const std::vector<uint64_t> &keys);
+	static uint64_t Key(int nStage, int nTile) { return ((uint64_t)nStage << 32) | (uint32_t)nTile; }
+
+public:
+	PlanetGraph() : m_nWidth(0), m_db(false) {}
+	~PlanetGraph();
+
+	/// Adds a stage to the end of the graph (the graph deletes it)
+	void add(Stage *pStage);
+
+	/// Adds the stages main.cpp has always generated planets with: plates, fault planes, sea level, plate tectonics,
+	/// erosion, land masses, and rivers
+	void addDefaultStages();
+
+	/// Keeps the cache in a SQLite database (and loads what's already in it for the stages added so far)
+	bool open(const VK::Path &path);
+
+	/// Empties the cache (and the database, if one is open), so the next run() starts from scratch
+	void clear();
+
+	/// Returns the hash of the planet run() would generate (without generating it)
+	uint64_t getHash(const PlanetParams &params);
+
+	/// Generates a planet, only running the stages (and tiles) whose inputs changed since they were cached
+	/// \param params What to generate
+	/// \param pFaces (Out) An array of 6 pixel buffers (created as nWidth x nWidth with 4 channels)
+	/// \return The planet's hash (see getHash())
+	uint64_t run(const PlanetParams &params, VK::PixelBuffer<float> *pFaces);
+
+	int getStageCount() const { return (int)m_stages.size(); }
+	const Stage *getStage(int n) const { return m_stages[n]; }
+	const Stats &getStats(int n) const { return m_stats[n]; }
+
+	/// Changes one plate and one fault at a time on a small planet, and checks that every incremental run matches
+	/// a run from scratch exactly while redoing only part of the local stages (and nothing when nothing changed).
+	/// Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+};
+
+#endif
@@ -0,0 +1,189 @@
+// PlanetLOD.cpp
+//
+// The selection code only needs the math headers (not Vulkan). Test() and Benchmark() are in PlanetLODTest.cpp,
+// which is built into VKTest and into the PlanetTest console app (see Code/PlanetTest).
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "../VKContext/VKMath.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKGeometry.h"
+#include "PlanetLOD.h"
+
+VK::vec4 PlanetLOD::GetHole(const VK::ivec2 &iPos, int nLevel)
+{
+	// When the camera is directly over the center of a face, all holes in parent nodes for rendering child nodes are centered.
+	// Imagine the leaf moving 1 quad to the right. None of the parent nodes move. The hole inside its parent shifts right 1.
+	// Imagine the leaf moving to to the right again, causing the parent to shift right 1. This puts the hole for the leaf
+	// node back to the center of its parent, and the hole in the grand-parent has to shift right 1 for the parent node.
+	// So for most levels, the hole is always either dead center or off by 1 in any direction (N, S, E, W, NE, SE, SW, NW).
+	// However, level 0 doesn't move, so the hole in it for level 1 can move ANYWHERE within its parent. It can even go off
+	// the edge of the cube face (it needs to be rendered on the neighboring face to avoid cracks in the mesh).
+	int xoff = 0, yoff = 0;
+	if(nLevel == 1) {
+		xoff = iPos.x - NodeHalf;
+		yoff = iPos.y - NodeHalf;
+	} else {
+		xoff = (iPos.x & 1) == 0 ? 0 : iPos.x > 0 ? 1 : -1;
+		yoff = (iPos.y & 1) == 0 ? 0 : iPos.y > 0 ? 1 : -1;
+	}
+
+	// The hole is based on vertex position, which goes from (0,0) in the NW corner to (64, 64) in the SE corner
+	return VK::vec4((float)(NodeFourth + xoff), (float)(NodeFourth + yoff), (float)(3 * NodeFourth + xoff), (float)(3 * NodeFourth + yoff));
+}
+
+bool PlanetLOD::IsVisible(const View &view, uint8_t nFace, const VK::vec4 &vCorners)
+{
+	// Only the part inside the face gets drawn (the geometry shader discards the rest)
+	float x0 = VK::Math::Clamp(vCorners.x, 0.0f, 1.0f), y0 = VK::Math::Clamp(vCorners.y, 0.0f, 1.0f);
+	float x1 = VK::Math::Clamp(vCorners.z, 0.0f, 1.0f), y1 = VK::Math::Clamp(vCorners.w, 0.0f, 1.0f);
+	if(x0 >= x1 || y0 >= y1)
+		return false;
+	if(!view.pFrustum && view.fHorizon >= VK::PI_FLOAT)
+		return true;
+
+	// The edges of a patch are great circles, so no part of it is farther from its middle than its corners are
+	VK::ivec3 vCoords[5] = {
+		VK::ivec3(CubeFace::to_i(0.5 * (x0 + x1)), CubeFace::to_i(0.5 * (y0 + y1)), nFace),
+		VK::ivec3(CubeFace::to_i(x0), CubeFace::to_i(y0), nFace), VK::ivec3(CubeFace::to_i(x1), CubeFace::to_i(y0), nFace),
+		VK::ivec3(CubeFace::to_i(x0), CubeFace::to_i(y1), nFace), VK::ivec3(CubeFace::to_i(x1), CubeFace::to_i(y1), nFace)
+	};
+	VK::dvec3 v[5];
+	CubeFace::GetPlanetaryVectors(vCoords, v, 5);
+	double dChord2 = 0.0;
+	for(int i = 1; i < 5; i++)
+		dChord2 = VK::Math::Max(dChord2, (v[i] - v[0]).mag2());
+	float fChord = (float)sqrt(dChord2);
+	VK::vec3 vCenter((float)v[0].x, (float)v[0].y, (float)v[0].z);
+
+	if(view.pFrustum && !view.pFrustum->isInFrustum(vCenter, fChord + view.fMaxHeight))
+		return false;
+	if(view.fHorizon < VK::PI_FLOAT) {
+		// Compare angles around the planet's center (the chord to the farthest corner spans 2*asin(chord/2))
+		float fAngle = acosf(VK::Math::Clamp(vCenter | view.vDirection, -1.0f, 1.0f));
+		if(fAngle - 2.0f * asinf(VK::Math::Min(1.0f, fChord * 0.5f)) > view.fHorizon)
+			return false;
+	}
+	return true;
+}
+
+int PlanetLOD::Select(const VK::vec3 &vCamera, VK::PlanetFaceData *pData, const VK::Frustum *pFrustum, float fMaxHeight, int nMaxLevel)
+{
+	// Only the direction matters for finding the face coordinates (and it keeps to_i from overflowing far from the planet)
+	float fMag = vCamera.mag();
+	VK::vec3 v = fMag > 0.0f ? vCamera / fMag : VK::vec3(0, 0, 1);
+	int ix, iy; // (0,0) = NW corner and (1<<24, 1<<24) = SE corner
+	uint8_t front = CubeFace::GetFaceCoordinates(CubeFace::to_i(v), ix, iy);
+	double dx = CubeFace::to_f(ix), dy = CubeFace::to_f(iy); // (0,0) = NW corner and (1,1) = SE corner
+	float dist = fMag - 1.0f;
+	VK::ivec2 frontPos((int)(dx * MaxScale), (int)(dy * MaxScale)); // Cast to fixed-precision int based on max depth
+
+	// From a camera at distance d, the unit sphere's horizon is acos(1/d) away from the point below it,
+	// and a mountain of height h can poke up from behind it as far as another acos(1/(1+h)).
+	View view;
+	view.pFrustum = pFrustum;
+	view.vDirection = v;
+	view.fMaxHeight = VK::Math::Max(0.0f, fMaxHeight);
+	view.fHorizon = VK::PI_FLOAT;
+	if(fMaxHeight >= 0.0f && fMag >= 1.0f)
+		view.fHorizon = acosf(1.0f / fMag) + acosf(1.0f / (1.0f + fMaxHeight));
+	static const VK::vec4 WholeFace(0, 0, 1, 1);
+
+	int instance = 0;
+	uint8_t neighborLevels[MaxLevels] = { 0 };
+	pData[instance].vHole = VK::vec4(-1, -1, -1, -1); // Instance 0 is the lowest level, so it has no hole.
+	bool bFront = IsVisible(view, front, WholeFace);
+	for(int level = MaxLevels - 1, factor = 1; level > 0; level--, factor <<= 1) {
+		float f = 1.0f * powf(0.5f, (float)level);
+		if(level > nMaxLevel || dist > f*2.0f)
+			continue;
+
+		VK::ivec2 iPos = frontPos / factor;
+		VK::vec4 vCorners = GetCorners(iPos, f);
+
+		// Set bit flag for which neighbors have to render levels deeper than level 0 (whether this one is culled or not)
+		if(vCorners.x < -0.001f)
+			neighborLevels[level] |= 1 << LeftEdge;
+		if(vCorners.y < -0.001f)
+			neighborLevels[level] |= 1 << TopEdge;
+		if(vCorners.z > 1.001f)
+			neighborLevels[level] |= 1 << RightEdge;
+		if(vCorners.w > 1.001f)
+			neighborLevels[level] |= 1 << BottomEdge;
+
+		// We use calculations from each child node to calculate the hole for its parent node.
+		// If the child is culled, its parent still gets the hole (it's out of sight too) in the same instance.
+		if(bFront && IsVisible(view, front, vCorners)) {
+			pData[instance].iFace = VK::ivec4(front, level, 0, 0);
+			pData[instance].vCorners = vCorners;
+			++instance;
+		}
+		pData[instance].vHole = GetHole(iPos, level);
+	}
+	if(bFront) {
+		pData[instance].iFace = VK::ivec4(front, 0, 0, 0);
+		pData[instance].vCorners = WholeFace; // Level 0 never moves. It always goes from (0,0) to (1,1)
+		++instance;
+	}
+
+	// In addition to the face beneath the camera, we need to render its 4 neighbors. We do not need to render the opposite face.
+	// In theory from some angles we can get away with rendering 3 neighbor faces instead of 4, but the performance savings may
+	// not be enough to justify the added complexity.
+	uint8_t neighborFace[4];
+	VK::ivec2 neighborPos[4];
+	for(int edge = 0; edge < 4; edge++) {
+		neighborFace[edge] = front;
+		double x = dx, y = dy;
+		CubeFace::GetNeighborCoordinates(edge, neighborFace[edge], x, y);
+		neighborPos[edge] = VK::ivec2((int)(x * MaxScale), (int)(y * MaxScale)); // Cast to fixed-precision int based on max depth
+	}
+
+	for(int edge = 0; edge < 4; edge++) {
+		uint8_t face = neighborFace[edge];
+		if(!IsVisible(view, face, WholeFace))
+			continue; // None of its levels can be seen either
+
+		pData[instance].vHole = VK::vec4(-1, -1, -1, -1); // The lowest level (or leaf) of any neighboring face has no hole in the middle
+		for(int level = MaxLevels - 1, factor = 1; level > 0; level--, factor <<= 1) {
+			if((neighborLevels[level] & (1 << edge)) == 0)
+				continue;
+
+			float f = 1.0f * powf(0.5f, (float)level);
+			VK::ivec2 iPos = neighborPos[edge] / factor;
+
+			// Check to see if any other neighbor is also rendering this level.
+			// If so and it comes closer to the center of that face, we need to extend it farther
+			// out on this face to avoid cracks in the mesh at the corners where 3 cube faces meet.
+			for(int edge2 = 0; edge2 < 4; edge2++) {
+				if(edge2 == edge || (neighborLevels[level] & (1 << edge2)) == 0)
+					continue;
+				const int Mid = MaxScale / factor / 2;
+				VK::ivec2 iPos2 = neighborPos[edge2] / factor;
+				int ox = VK::Math::Abs(Mid - iPos.x); // Find how far outside the current face x is
+				int oy = VK::Math::Abs(Mid - iPos.y); // Find how far outside the current face y is
+				int ox2 = VK::Math::Abs(Mid - iPos2.x); // Do the same for this neighbor
+				int oy2 = VK::Math::Abs(Mid - iPos2.y); // Do the same for this neighbor
+				int max2 = VK::Math::Max(ox2, oy2);
+				if(ox > oy && max2 < ox) {
+					iPos.x -= iPos.x > Mid ? (ox - max2) : (max2 - ox);
+				} else if(oy > ox && max2 < oy) {
+					iPos.y -= iPos.y > Mid ? (oy - max2) : (max2 - oy);
+				}
+			}
+
+			VK::vec4 vCorners = GetCorners(iPos, f);
+			if(IsVisible(view, face, vCorners)) {
+				pData[instance].iFace = VK::ivec4(face, level, 0, 0);
+				pData[instance].vCorners = vCorners;
+				++instance;
+			}
+			pData[instance].vHole = GetHole(iPos, level);
+		}
+
+		// Finally we finish up level 0 for this neighbor face
+		pData[instance].iFace = VK::ivec4(face, 0, 0, 0);
+		pData[instance].vCorners = WholeFace; // Level 0 never moves. It always goes from (0,0) to (1,1)
+		++instance;
+	}
+	return instance;
+}
@@ -0,0 +1,80 @@
+// PlanetLOD.h
+//
+#ifndef __PlanetLOD_h__
+#define __PlanetLOD_h__
+
+#include "CubeFace.h"
+
+/// Picks the clipmap patches to draw for one planet from the camera's position.
+/// Each patch is a NodeWidth x NodeWidth grid of quads drawn as one instance of the PlanetFace
+/// technique, and is described by a PlanetFaceData (its face and level, its corners in face
+/// coordinates, and the hole left in it for the next level down). The face beneath the camera
+/// gets a stack of nested levels centered on the camera, with level 0 covering the whole face.
+/// Its 4 neighbors get just enough levels to keep the mesh from cracking along the face edges.
+///
+/// Patches that can't be seen are skipped before they're written: anything outside the view
+/// frustum, or entirely beyond the planet's horizon (which is most of the sphere close to the
+/// surface). Each patch is tested with a sphere that bounds it (and its terrain), and a whole
+/// face is tested before any of its levels. Culling a patch only drops its instance. The holes
+/// still line up because a hidden child always leaves its hole in a parent that's drawn.
+///
+/// This has nothing to do with Vulkan. It writes into a caller-supplied array and never
+/// allocates, so it's cheap enough to run for every planet (or moon) in view every frame.
+class PlanetLOD
+{
+public:
+	static const int MaxLevels = MAX_LEVELS;			///< More than 16 levels experiences precision problems in shaders
+	static const int NodeWidth = 128;					///< The number of quads on each side of a patch
+	static const int NodeHalf = NodeWidth / 2;			///< This value is used a lot
+	static const int NodeFourth = NodeWidth / 4;		///< This value is used a lot
+	static const int MaxInstances = MaxLevels * 5;		///< The most patches Select() can return (all levels in 5 faces)
+
+protected:
+	/// The smallest step the bottom level can shift by, in fixed-point face coordinates:
+	/// If level 0 has 64x64 quads and there are 16 levels, the bottom level has (64<<15) x (64<<15) quads.
+	/// However, x and y values go from -1.0 to 1.0, so divide by 2 to get 32 on each side of 0.0.
+	/// Then divide by 2 again because we can't shift by 1 quad. We have to shift by 1 parent quad (a block of 2x2 in the child).
+	static const int MaxScale = NodeWidth << (MaxLevels - 2);
+
+	/// Returns a patch's corners in face coordinates from its center (in fixed-point coordinates at its level)
+	static VK::vec4 GetCorners(const VK::ivec2 &iPos, float f) {
+		return VK::vec4(((float)(iPos.x - NodeFourth) / NodeHalf)*f, ((float)(iPos.y - NodeFourth) / NodeHalf)*f, ((float)(iPos.x + NodeFourth) / NodeHalf)*f, ((float)(iPos.y + NodeFourth) / NodeHalf)*f);
+	}
+
+	/// Returns the hole a patch leaves in its parent, in the parent's vertex coordinates (0 to NodeWidth)
+	static VK::vec4 GetHole(const VK::ivec2 &iPos, int nLevel);
+
+	/// What Select() uses to decide whether a patch can be seen
+	struct View {
+		const VK::Frustum *pFrustum;	///< The view frustum in planet space (NULL to skip frustum culling)
+		VK::vec3 vDirection;			///< The direction from the planet's center to the camera
+		float fHorizon;					///< The angle from vDirection past which nothing can be seen (PI or more to skip horizon culling)
+		float fMaxHeight;				///< The highest (or lowest) the terrain can go, in planet radii
+	};
+
+	/// Returns false if no part of a patch (clipped to its face) can be seen
+	static bool IsVisible(const View &view, uint8_t nFace, const VK::vec4 &vCorners);
+
+public:
+	/// Fills pData with the patches to draw, in order from the deepest level of the face beneath the camera
+	/// to level 0 of its last neighbor. Each patch's vHole is where the patch before it goes (or -1 if it has no hole).
+	/// \param vCamera The camera position relative to the planet's center, in planet radii (so the surface is at 1.0)
+	/// \param pData (Out) An array of at least MaxInstances
+	/// \param pFrustum The view frustum in the same space as vCamera (NULL to skip frustum culling)
+	/// \param fMaxHeight The highest (and lowest) the terrain goes from the surface, in planet radii
+	/// (a negative value skips horizon culling)
+	/// \param nMaxLevel The deepest level to use, to draw the planet with less detail than it would get from here (0 to MaxLevels-1)
+	/// \return The number of patches written to pData
+	static int Select(const VK::vec3 &vCamera, VK::PlanetFaceData *pData, const VK::Frustum *pFrustum=NULL, float fMaxHeight=-1.0f, int nMaxLevel=MaxLevels-1);
+
+	/// Runs Select() from a lot of random camera positions, checks that every patch's corners line up
+	/// with the hole in the patch after it, checks that culling only drops patches that really can't
+	/// be seen, and logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+
+	/// Times Select() for nCount random camera positions and logs the results (i.e. "VKTest.exe -benchmark")
+	static void Benchmark(int nCount);
+};
+
+#endif
@@ -0,0 +1,142 @@
+// PlanetLODTest.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKGeometry.h"
+#include "PlanetLOD.h"
+
+#include <random>
+
+namespace {
+	// Returns a random camera position, mostly close to the surface where the most levels get used
+	VK::vec3 RandomCamera(std::mt19937 &gen) {
+		std::uniform_real_distribution<float> dir(-1.0f, 1.0f), height(-6.0f, 1.0f);
+		VK::vec3 v;
+		do {
+			v = VK::vec3(dir(gen), dir(gen), dir(gen));
+		} while(v.mag2() < 0.01f || v.mag2() > 1.0f);
+		return v * ((1.0f + powf(2.0f, height(gen))) / v.mag());
+	}
+
+	// Returns a frustum for a camera at vCamera looking in a random direction (mostly toward the planet)
+	VK::Frustum RandomFrustum(std::mt19937 &gen, const VK::vec3 &vCamera) {
+		std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+		VK::vec3 vView = (VK::vec3(dir(gen), dir(gen), dir(gen)) - vCamera.normalize()).normalize();
+		VK::vec3 vRight = (vView ^ (VK::Math::Abs(vView.y) < 0.9f ? VK::vec3(0, 1, 0) : VK::vec3(1, 0, 0))).normalize();
+		VK::vec3 vUp = vRight ^ vView;
+		VK::Frustum frustum;
+		frustum.init(VK::mat4::Perspective(45.0f, 1.5f, 0.001f, 100.0f), VK::mat4::View(vCamera, vView, vUp, vRight), VK::mat4::Identity());
+		return frustum;
+	}
+
+	// Returns true if any of a grid of points on a patch (clipped to its face) can be seen from vCamera,
+	// either on the surface or fHeight above it
+	bool CanSee(const VK::Frustum &frustum, const VK::vec3 &vCamera, const VK::PlanetFaceData &d, float fHeight) {
+		const int Samples = 9;
+		float x0 = VK::Math::Clamp(d.vCorners.x, 0.0f, 1.0f), y0 = VK::Math::Clamp(d.vCorners.y, 0.0f, 1.0f);
+		float x1 = VK::Math::Clamp(d.vCorners.z, 0.0f, 1.0f), y1 = VK::Math::Clamp(d.vCorners.w, 0.0f, 1.0f);
+		for(int j = 0; j < Samples; j++) {
+			for(int i = 0; i < Samples; i++) {
+				VK::dvec3 v = CubeFace::GetPlanetaryVector((uint8_t)d.iFace.x, x0 + (x1 - x0) * i / (Samples - 1), y0 + (y1 - y0) * j / (Samples - 1));
+				for(int k = 0; k < 2; k++) {
+					VK::vec3 q = VK::vec3((float)v.x, (float)v.y, (float)v.z) * (k ? 1.0f + fHeight : 1.0f);
+					if(!frustum.isInFrustum(q, 0.0f))
+						continue;
+					// It's hidden if the line from the camera passes through the planet on the way
+					VK::vec3 vRay = q - vCamera;
+					float t = VK::Math::Clamp(-(vCamera | vRay) / vRay.mag2(), 0.0f, 1.0f);
+					if((vCamera + vRay * t).mag2() >= 0.9999f)
+						return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	inline bool Equal(const VK::vec4 &a, const VK::vec4 &b) { return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w; }
+}
+
+bool PlanetLOD::Test()
+{
+	const float MaxHeight = 0.01f;
+	int nErrors = 0, nTotal = 0, nDrawn = 0;
+	std::mt19937 gen(12345);
+	VK::PlanetFaceData data[MaxInstances];
+	for(int i = 0; i < 100000; i++) {
+		VK::vec3 vCamera = RandomCamera(gen);
+		int nCount = Select(vCamera, data);
+		bool bOK = nCount >= 5 && nCount <= MaxInstances;
+		int nFaces = 0;
+		for(int n = 0; bOK && n < nCount; n++) {
+			const VK::PlanetFaceData &d = data[n];
+			bOK = d.iFace.x >= 0 && d.iFace.x < FaceCount && d.iFace.y >= 0 && d.iFace.y < MaxLevels;
+			if(d.iFace.y == 0) {
+				// Level 0 always covers the whole face and ends each face's run of patches
+				bOK = bOK && d.vCorners.x == 0.0f && d.vCorners.y == 0.0f && d.vCorners.z == 1.0f && d.vCorners.w == 1.0f;
+				nFaces++;
+			}
+			if(n == 0 || data[n - 1].iFace.y == 0) {
+				bOK = bOK && d.vHole.x == -1.0f; // The first patch in each face has no hole
+				continue;
+			}
+
+			// The patch before this one is its child, and has to fit exactly in the hole in this one
+			const VK::PlanetFaceData &c = data[n - 1];
+			float w = (d.vCorners.z - d.vCorners.x) / NodeWidth;
+			bOK = bOK && c.iFace.x == d.iFace.x && c.iFace.y > d.iFace.y;
+			bOK = bOK && VK::Math::Abs(d.vCorners.x + d.vHole.x * w - c.vCorners.x) < 1e-5f && VK::Math::Abs(d.vCorners.y + d.vHole.y * w - c.vCorners.y) < 1e-5f;
+			bOK = bOK && VK::Math::Abs(d.vCorners.x + d.vHole.z * w - c.vCorners.z) < 1e-5f && VK::Math::Abs(d.vCorners.y + d.vHole.w * w - c.vCorners.w) < 1e-5f;
+		}
+		bOK = bOK && nFaces == 5 && data[nCount - 1].iFace.y == 0;
+
+		// Cull against a random view. The patches that are left (and their holes) can't change,
+		// and none of the patches that were dropped can have any part of them in sight.
+		VK::Frustum frustum = RandomFrustum(gen, vCamera);
+		VK::PlanetFaceData culled[MaxInstances];
+		int nCulled = Select(vCamera, culled, &frustum, MaxHeight), m = 0;
+		for(int n = 0; bOK && n < nCount; n++) {
+			if(m < nCulled && culled[m].iFace.x == data[n].iFace.x && culled[m].iFace.y == data[n].iFace.y) {
+				bOK = Equal(culled[m].vCorners, data[n].vCorners) && Equal(culled[m].vHole, data[n].vHole);
+				m++;
+			} else
+				bOK = !CanSee(frustum, vCamera, data[n], MaxHeight);
+		}
+		bOK = bOK && m == nCulled;
+		nTotal += nCount;
+		nDrawn += nCulled;
+		if(!bOK) {
+			if(nErrors < 10)
+				VKLogError("PlanetLOD::Test - Failed with the camera at (%f, %f, %f)", vCamera.x, vCamera.y, vCamera.z);
+			nErrors++;
+		}
+	}
+
+	VKLogInfo("PlanetLOD::Test - %d errors (culling kept %.1lf%% of the patches)", nErrors, 100.0 * nDrawn / nTotal);
+	return nErrors == 0;
+}
+
+void PlanetLOD::Benchmark(int nCount)
+{
+	std::mt19937 gen(12345);
+	const int CameraCount = 1024;
+	VK::vec3 vCamera[CameraCount];
+	VK::Frustum frustum[CameraCount];
+	for(int i = 0; i < CameraCount; i++) {
+		vCamera[i] = RandomCamera(gen);
+		frustum[i] = RandomFrustum(gen, vCamera[i]);
+	}
+
+	// Time it without culling and then with it
+	VK::PlanetFaceData data[MaxInstances];
+	for(int nPass = 0; nPass < 2; nPass++) {
+		int nPatches = 0;
+		double t = VK::Timer::Time();
+		for(int i = 0; i < nCount; i++) {
+			int n = i & (CameraCount - 1);
+			nPatches += nPass ? Select(vCamera[n], data, &frustum[n], 0.01f) : Select(vCamera[n], data);
+		}
+		t = VK::Timer::Time() - t;
+		VKLogInfo("PlanetLOD::Benchmark - %d selections %s in %lf seconds (%.2lf microseconds each, %.1lf patches on average)",
+			nCount, nPass ? "with culling" : "without culling", t, t * 1e6 / nCount, (double)nPatches / nCount);
+	}
+}
@@ -0,0 +1,331 @@
+// PlanetSystem.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKGeometry.h"
+#include "PlanetSystem.h"
+
+#include <random>
+
+namespace {
+	// Returns the deepest level in a list of patches
+	int GetDeepest(const VK::PlanetFaceData *pData, int nCount) {
+		int nDeepest = 0;
+		for(int i = 0; i < nCount; i++)
+			nDeepest = VK::Math::Max(nDeepest, pData[i].iFace.y);
+		return nDeepest;
+	}
+
+	// Gets the 2x2 nodes at a patch's level that the part of it inside its face can touch, starting at the top-left.
+	// The PlanetFace vertex shader splits the patch at the first node edge past its top-left corner, so if it doesn't
+	// reach the next node over, that side repeats the node before it (which covers the patch's edge too).
+	void GetPageNodes(const VK::PlanetFaceData &d, NodeKey nodes[4]) {
+		uint8_t nLevel = (uint8_t)d.iFace.y;
+		float fScale = ldexpf(1.0f, nLevel);
+		float x0 = VK::Math::Clamp(d.vCorners.x, 0.0f, 1.0f) * fScale, y0 = VK::Math::Clamp(d.vCorners.y, 0.0f, 1.0f) * fScale;
+		float x1 = VK::Math::Clamp(d.vCorners.z, 0.0f, 1.0f) * fScale, y1 = VK::Math::Clamp(d.vCorners.w, 0.0f, 1.0f) * fScale;
+		uint32_t nMax = (1u << nLevel) - 1;
+		uint32_t ix = VK::Math::Min((uint32_t)x0, nMax), iy = VK::Math::Min((uint32_t)y0, nMax);
+		uint32_t ix2 = x1 > (float)(ix + 1) ? ix + 1 : ix, iy2 = y1 > (float)(iy + 1) ? iy + 1 : iy;
+		for(int q = 0; q < 4; q++)
+			nodes[q] = NodeKey((uint8_t)d.iFace.x, nLevel, (q & 1) ? ix2 : ix, (q & 2) ? iy2 : iy);
+	}
+}
+
+void PlanetSystem::reselect(Selection &s, const VK::vec3 &vCamera)
+{
+	const Body &b = m_body[s.nBody];
+	s.nCount = PlanetLOD::Select((vCamera - b.vPosition) / b.fRadius, s.data, &s.frustum, b.fMaxHeight, s.nMaxLevel);
+	s.nMaxLevel = GetDeepest(s.data, s.nCount);
+}
+
+int PlanetSystem::select(const VK::vec3 &vCamera, const VK::mat4 &mProj, const VK::mat4 &mView, int nMaxPatches, VK::PlanetData *pPlanets, VK::PlanetFaceData *pPatches, int *pPlanetCount, Visible *pVisible)
+{
+	nMaxPatches = VK::Math::Min(nMaxPatches, (int)MaxPatches);
+	VK::Frustum frustum;
+	frustum.init(mProj, mView, VK::mat4::Identity());
+
+	// Run every planet in view through PlanetLOD at full detail, and sort them by how big they look
+	int nVisible = 0, nTotal = 0;
+	for(int i = 0; i < m_nBodies; i++) {
+		const Body &b = m_body[i];
+		if(!frustum.isInFrustum(b.vPosition, b.fRadius * (1.0f + b.fMaxHeight)))
+			continue;
+		Selection &s = m_selection[nVisible];
+		s.nBody = i;
+		s.fScale = b.fRadius / VK::Math::Max(vCamera.dist(b.vPosition), b.fRadius);
+		s.nMaxLevel = PlanetLOD::MaxLevels - 1;
+		s.frustum.init(mProj, mView, VK::mat4::ScaleTranslate(VK::vec3(b.fRadius, b.fRadius, b.fRadius), b.vPosition));
+		reselect(s, vCamera);
+		if(s.nCount == 0)
+			continue; // It's all below its horizon or outside the frustum
+
+		int n = nVisible;
+		for(; n > 0 && m_selection[m_nOrder[n - 1]].fScale < s.fScale; n--)
+			m_nOrder[n] = m_nOrder[n - 1];
+		m_nOrder[n] = nVisible++;
+		nTotal += s.nCount;
+	}
+
+	// Take away one level at a time from the planet whose deepest patches look the smallest until it all fits
+	while(nTotal > nMaxPatches) {
+		Selection *pWorst = NULL;
+		float fWorst = 0.0f;
+		for(int n = 0; n < nVisible; n++) {
+			Selection &s = m_selection[m_nOrder[n]];
+			float fDetail = ldexpf(s.fScale, -s.nMaxLevel);
+			if(s.nMaxLevel > 0 && (!pWorst || fDetail < fWorst)) {
+				pWorst = &s;
+				fWorst = fDetail;
+			}
+		}
+		if(!pWorst)
+			break;
+		nTotal -= pWorst->nCount;
+		pWorst->nMaxLevel--;
+		reselect(*pWorst, vCamera);
+		nTotal += pWorst->nCount;
+	}
+
+	// If every planet is down to level 0 and it still doesn't fit, drop the ones that look the smallest
+	while(nTotal > nMaxPatches)
+		nTotal -= m_selection[m_nOrder[--nVisible]].nCount;
+
+	// Pack them all together, nearest-looking first
+	int nPatches = 0;
+	for(int n = 0; n < nVisible; n++) {
+		const Selection &s = m_selection[m_nOrder[n]];
+		const Body &b = m_body[s.nBody];
+		pPlanets[n].vPosition = VK::vec4(b.vPosition, b.fRadius);
+		if(pVisible) {
+			pVisible[n].nBody = s.nBody;
+			pVisible[n].fScale = s.fScale;
+		}
+		for(int i = 0; i < s.nCount; i++, nPatches++) {
+			pPatches[nPatches] = s.data[i];
+			pPatches[nPatches].iFace.z = n;
+		}
+	}
+	if(pPlanetCount)
+		*pPlanetCount = nVisible;
+	return nPatches;
+}
+
+void PlanetSystem::requestPages(PageCache &cache, const Visible *pVisible, const VK::PlanetFaceData *pPatches, int nPatches)
+{
+	NodeKey nodes[4];
+	for(int i = 0; i < nPatches; i++) {
+		const VK::PlanetFaceData &d = pPatches[i];
+		const Visible &s = pVisible[d.iFace.z];
+		float fPriority = ldexpf(s.fScale, -d.iFace.y);
+		GetPageNodes(d, nodes);
+		for(int q = 0; q < 4; q++) {
+			if(q == 0 || nodes[q] != nodes[q - 1])
+				cache.request(PageKey(s.nBody, nodes[q]), fPriority);
+		}
+	}
+}
+
+void PlanetSystem::resolvePages(PageCache &cache, const Visible *pVisible, VK::PlanetFaceData *pPatches, int nPatches)
+{
+	NodeKey nodes[4];
+	for(int i = 0; i < nPatches; i++) {
+		VK::PlanetFaceData &d = pPatches[i];
+		GetPageNodes(d, nodes);
+		for(int q = 0; q < 4; q++) {
+			PageKey key(pVisible[d.iFace.z].nBody, nodes[q]);
+			int nPage = cache.find(key);
+			if(nPage == PageCache::NoPage) {
+				d.vPage[q] = VK::vec4(0.0f, 0.0f, 1.0f, -1.0f);
+				continue;
+			}
+			float fScale = ldexpf(1.0f, key.node.getLevel());
+			d.vPage[q] = VK::vec4(key.node.getX() / fScale, key.node.getY() / fScale, fScale, (float)nPage);
+		}
+	}
+}
+
+namespace {
+	// Returns a camera near a random body in a system looking in a random direction (or toward the middle of the system if bCenter is set)
+	void RandomCamera(std::mt19937 &gen, const PlanetSystem &system, VK::vec3 &vCamera, VK::mat4 &mView, bool bCenter=false) {
+		std::uniform_real_distribution<float> dir(-1.0f, 1.0f), height(-6.0f, 3.0f);
+		const PlanetSystem::Body &b = system[(int)(gen() % system.size())];
+		VK::vec3 vUp = VK::vec3(dir(gen), dir(gen), dir(gen)).normalize();
+		vCamera = b.vPosition + vUp * (b.fRadius * (1.0f + powf(2.0f, height(gen))));
+		VK::vec3 vView = bCenter ? (-vCamera).normalize() : (VK::vec3(dir(gen), dir(gen), dir(gen)) - vUp).normalize();
+		VK::vec3 vRight = (vView ^ (VK::Math::Abs(vView.y) < 0.9f ? VK::vec3(0, 1, 0) : VK::vec3(1, 0, 0))).normalize();
+		mView = VK::mat4::View(vCamera, vView, vRight ^ vView, vRight);
+	}
+
+	// Fills a system with random planets and moons, and returns a random camera in it
+	void RandomScene(std::mt19937 &gen, PlanetSystem &system, int nPlanets, VK::vec3 &vCamera, VK::mat4 &mView, bool bCenter=false) {
+		std::uniform_real_distribution<float> pos(-50.0f, 50.0f), radius(0.2f, 3.0f);
+		system.clear();
+		for(int i = 0; i < nPlanets; i++)
+			system.add(VK::vec3(pos(gen), pos(gen), pos(gen)), radius(gen), 0.01f);
+		RandomCamera(gen, system, vCamera, mView, bCenter);
+	}
+
+	inline bool Equal(const VK::vec4 &a, const VK::vec4 &b) { return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w; }
+
+	// Returns true if a grid of vertices in each patch (the ones inside its face) all land inside the page the PlanetFace
+	// vertex shader picks for them, and that page is no deeper than the patch (and just as deep if bFull is set)
+	bool CheckPages(const VK::PlanetFaceData *pPatches, int nPatches, bool bFull) {
+		const int Step = PlanetLOD::NodeWidth / 16;
+		for(int n = 0; n < nPatches; n++) {
+			const VK::PlanetFaceData &d = pPatches[n];
+			float fScale = ldexpf(1.0f, d.iFace.y);
+			float sx = (floorf(VK::Math::Clamp(d.vCorners.x, 0.0f, 1.0f) * fScale) + 1.0f) / fScale;
+			float sy = (floorf(VK::Math::Clamp(d.vCorners.y, 0.0f, 1.0f) * fScale) + 1.0f) / fScale;
+			for(int j = 0; j <= PlanetLOD::NodeWidth; j += Step) {
+				for(int i = 0; i <= PlanetLOD::NodeWidth; i += Step) {
+					float x = (d.vCorners.z - d.vCorners.x) * ((float)i / PlanetLOD::NodeWidth) + d.vCorners.x;
+					float y = (d.vCorners.w - d.vCorners.y) * ((float)j / PlanetLOD::NodeWidth) + d.vCorners.y;
+					if(x < 0.0f || y < 0.0f || x > 1.0f || y > 1.0f)
+						continue;
+					const VK::vec4 &p = d.vPage[(x >= sx ? 1 : 0) + (y >= sy ? 2 : 0)];
+					if(p.w < 0.0f) {
+						if(bFull)
+							return false;
+						continue;
+					}
+					float u = (x - p.x) * p.z, v = (y - p.y) * p.z;
+					if(u < -1e-4f || v < -1e-4f || u > 1.0001f || v > 1.0001f || p.z > fScale || (bFull && p.z != fScale))
+						return false;
+				}
+			}
+		}
+		return true;
+	}
+}
+
+bool PlanetSystem::Test()
+{
+	const int Budgets[] = { MaxPatches, 400, 150, 60, 20, 5 };
+	const int BudgetCount = sizeof(Budgets) / sizeof(Budgets[0]);
+	const VK::mat4 mProj = VK::mat4::Perspective(45.0f, 1.5f, 0.001f, 1000.0f);
+	PlanetSystem *pSystem = new PlanetSystem;
+	VK::PlanetData planets[MaxPlanets];
+	Visible visible[MaxPlanets];
+	VK::PlanetFaceData *pPatches = new VK::PlanetFaceData[MaxPatches];
+	VK::PlanetFaceData data[PlanetLOD::MaxInstances];
+	PageCache cache;
+
+	int nErrors = 0;
+	std::mt19937 gen(12345);
+	for(int i = 0; i < 2000; i++) {
+		VK::vec3 vCamera;
+		VK::mat4 mView;
+		RandomScene(gen, *pSystem, 1 + (int)(gen() % MaxPlanets), vCamera, mView);
+
+		bool bOK = true;
+		int nLastCount[MaxPlanets];
+		for(int nBudget = 0; bOK && nBudget < BudgetCount; nBudget++) {
+			int nPlanets, nPatches = pSystem->select(vCamera, mProj, mView, Budgets[nBudget], planets, pPatches, &nPlanets, visible);
+			bOK = nPatches <= Budgets[nBudget] && nPlanets <= pSystem->size();
+
+			int nCount[MaxPlanets] = { 0 };
+			for(int n = 0; bOK && n < nPatches; n++) {
+				bOK = pPatches[n].iFace.z >= 0 && pPatches[n].iFace.z < nPlanets;
+				if(bOK)
+					nCount[pSystem->m_selection[pSystem->m_nOrder[pPatches[n].iFace.z]].nBody]++;
+			}
+			for(int n = 0; bOK && n < nPlanets; n++) {
+				const Selection &s = pSystem->m_selection[pSystem->m_nOrder[n]];
+				const Body &b = (*pSystem)[s.nBody];
+				bOK = Equal(planets[n].vPosition, VK::vec4(b.vPosition, b.fRadius)) && nCount[s.nBody] == s.nCount;
+				bOK = bOK && visible[n].nBody == s.nBody && visible[n].fScale == s.fScale;
+			}
+
+			if(nBudget == 0) {
+				// With no limit, each planet gets exactly what PlanetLOD picks for it
+				for(int n = 0, nPatch = 0; bOK && n < nPlanets; n++) {
+					const Selection &s = pSystem->m_selection[pSystem->m_nOrder[n]];
+					const Body &b = (*pSystem)[s.nBody];
+					int nCount = PlanetLOD::Select((vCamera - b.vPosition) / b.fRadius, data, &s.frustum, b.fMaxHeight);
+					for(int j = 0; bOK && j < nCount; j++, nPatch++)
+						bOK = pPatches[nPatch].iFace.x == data[j].iFace.x && pPatches[nPatch].iFace.y == data[j].iFace.y && Equal(pPatches[nPatch].vCorners, data[j].vCorners);
+				}
+
+				// Every vertex has to land in the page it's drawn with, when the cache can hold every page and when
+				// it can only hold a few (so most of them fall back to an ancestor)
+				for(int nPass = 0; bOK && nPass < 2; nPass++) {
+					cache.init(nPass ? 8 : 4 * MaxPatches, 1);
+					for(int nFrame = 0; nFrame < (nPass ? 3 : 1); nFrame++) {
+						cache.begin();
+						requestPages(cache, visible, pPatches, nPatches);
+						cache.update(nPass ? 1 : 4 * MaxPatches);
+						resolvePages(cache, visible, pPatches, nPatches);
+					}
+					bOK = CheckPages(pPatches, nPatches, nPass == 0);
+				}
+			} else {
+				// A smaller budget can only take patches away from a planet
+				for(int n = 0; bOK && n < pSystem->size(); n++)
+					bOK = nCount[n] <= nLastCount[n];
+			}
+			memcpy(nLastCount, nCount, sizeof(nCount));
+		}
+		if(!bOK) {
+			if(nErrors < 10)
+				VKLogError("PlanetSystem::Test - Failed on scene %d", i);
+			nErrors++;
+		}
+	}
+
+	delete[] pPatches;
+	delete pSystem;
+	VKLogInfo("PlanetSystem::Test - %d errors", nErrors);
+	return nErrors == 0;
+}
+
+void PlanetSystem::Benchmark(int nPlanets, int nCount)
+{
+	nPlanets = VK::Math::Max(1, VK::Math::Min(nPlanets, (int)MaxPlanets));
+	const VK::mat4 mProj = VK::mat4::Perspective(45.0f, 1.5f, 0.001f, 1000.0f);
+	PlanetSystem *pSystem = new PlanetSystem;
+	VK::PlanetData planets[MaxPlanets];
+	Visible visible[MaxPlanets];
+	VK::PlanetFaceData *pPatches = new VK::PlanetFaceData[MaxPatches];
+
+	std::mt19937 gen(12345);
+	VK::vec3 vCamera;
+	VK::mat4 mView;
+	RandomScene(gen, *pSystem, nPlanets, vCamera, mView, true);
+
+	// Time it with no limit and then with half the patches it wants (so it has to take detail away)
+	int nBudget = MaxPatches;
+	for(int n = 0; n < 2; n++) {
+		int nVisible = 0, nPatches = 0;
+		double t = VK::Timer::Time();
+		for(int i = 0; i < nCount; i++)
+			nPatches = pSystem->select(vCamera, mProj, mView, nBudget, planets, pPatches, &nVisible);
+		t = VK::Timer::Time() - t;
+		VKLogInfo("PlanetSystem::Benchmark - %d planets (%d visible) with a budget of %d patches: %d patches in %.2lf microseconds",
+			nPlanets, nVisible, nBudget, nPatches, t * 1e6 / nCount);
+		nBudget = nPatches / 2;
+	}
+
+	// Then time a frame of paging on top of that. The camera jumps back and forth between two places, so the
+	// cache keeps evicting the pages from one to load the pages from the other.
+	VK::vec3 vCamera2;
+	VK::mat4 mView2;
+	RandomCamera(gen, *pSystem, vCamera2, mView2, true);
+	PageCache cache;
+	cache.init(64, 1);
+	int nPatches = 0, nLoads = 0;
+	double t = VK::Timer::Time();
+	for(int i = 0; i < nCount; i++) {
+		nPatches = pSystem->select((i & 1) ? vCamera2 : vCamera, mProj, (i & 1) ? mView2 : mView, MaxPatches, planets, pPatches, NULL, visible);
+		cache.begin();
+		requestPages(cache, visible, pPatches, nPatches);
+		nLoads += cache.update(8);
+		resolvePages(cache, visible, pPatches, nPatches);
+	}
+	t = VK::Timer::Time() - t;
+	VKLogInfo("PlanetSystem::Benchmark - Selecting and paging %d patches with %d pages: %.2lf microseconds (%.1lf loads per frame)",
+		nPatches, cache.capacity(), t * 1e6 / nCount, (double)nLoads / nCount);
+
+	delete[] pPatches;
+	delete pSystem;
+}
@@ -0,0 +1,116 @@
+// PlanetSystem.h
+//
+#ifndef __PlanetSystem_h__
+#define __PlanetSystem_h__
+
+#include "PlanetLOD.h"
+#include "PageCache.h"
+
+/// Picks the clipmap patches to draw for every planet (and moon) in a scene, and packs them into
+/// one array of PlanetData and one array of PlanetFaceData, so they can all be drawn with a single
+/// instanced draw call (each patch's iFace.z says which planet it belongs to).
+///
+/// Planets outside the view frustum are skipped, and each one left is run through PlanetLOD with
+/// its own frustum and horizon culling. If the patches add up to more than the budget, detail is
+/// taken away one level at a time from the planet whose deepest patches look smallest on screen
+/// (its radius over its distance, halved for each level), so distant bodies lose detail first.
+/// If every planet is down to level 0 and it still doesn't fit, the smallest-looking planets are
+/// dropped. Like PlanetLOD, this never allocates (everything is sized for MaxPlanets).
+///
+/// The height maps come in pages (one node of a planet's quad-trees each) from a PageCache. After
+/// select(), requestPages() asks for the pages the patches need, and once the cache has loaded what
+/// it can, resolvePages() points each patch at them (or at the nearest ancestors that are loaded).
+/// Both take the Visible array select() filled in, so another select() in between can't change them.
+class PlanetSystem
+{
+public:
+	static const int MaxPlanets = MAX_PLANETS;
+	static const int MaxPatches = MAX_PATCHES;
+
+	/// A planet or moon
+	struct Body {
+		VK::vec3 vPosition;		///< The position of its center
+		float fRadius;			///< Its radius
+		float fMaxHeight;		///< The highest (or lowest) its terrain goes from the surface, in planet radii
+	};
+
+	/// A planet select() picked patches for (one for each PlanetData it writes, in the same order)
+	struct Visible {
+		int nBody;				///< The index of the body
+		float fScale;			///< Its radius over its distance from the camera (how big it looks)
+	};
+
+protected:
+	/// The working state for one visible planet in select()
+	struct Selection {
+		int nBody;				///< The index of the body in m_body
+		float fScale;			///< Its radius over its distance from the camera (how big it looks)
+		int nMaxLevel;			///< The deepest level it's allowed to use
+		int nCount;				///< The number of patches in data
+		VK::Frustum frustum;	///< The view frustum in its space
+		VK::PlanetFaceData data[PlanetLOD::MaxInstances];
+	};
+
+	Body m_body[MaxPlanets];
+	int m_nBodies;
+	Selection m_selection[MaxPlanets];
+	int m_nOrder[MaxPlanets];	///< The visible planets in m_selection, nearest-looking first
+
+	void reselect(Selection &s, const VK::vec3 &vCamera);
+
+public:
+	PlanetSystem() : m_nBodies(0) {}
+
+	void clear() { m_nBodies = 0; }
+	int size() const { return m_nBodies; }
+	      Body &operator[](int n)		{ return m_body[n]; }
+	const Body &operator[](int n) const	{ return m_body[n]; }
+
+	/// Adds a planet or moon.
+	/// \return The index of the new body
+	int add(const VK::vec3 &vPosition, float fRadius, float fMaxHeight=0.0f) {
+		if(m_nBodies >= MaxPlanets)
+			VKLogException("PlanetSystem::add - Too many planets (%d)", m_nBodies);
+		Body &b = m_body[m_nBodies];
+		b.vPosition = vPosition;
+		b.fRadius = fRadius;
+		b.fMaxHeight = fMaxHeight;
+		return m_nBodies++;
+	}
+
+	/// Picks the patches to draw for every body this frame.
+	/// \param vCamera The camera position
+	/// \param mProj The projection matrix
+	/// \param mView The view matrix
+	/// \param nMaxPatches The most patches to return in total (up to MaxPatches). Each patch has the same number of vertices,
+	/// so this is also the vertex budget.
+	/// \param pPlanets (Out) An array of at least MaxPlanets for the planets that have patches to draw
+	/// \param pPatches (Out) An array of at least nMaxPatches for the patches of all the planets in pPlanets
+	/// \param pPlanetCount (Out, optional) Set to the number of planets written to pPlanets
+	/// \param pVisible (Out, optional) An array of at least MaxPlanets for which body each planet in pPlanets is
+	/// (only needed to page the patches in with requestPages() and resolvePages())
+	/// \return The number of patches written to pPatches
+	int select(const VK::vec3 &vCamera, const VK::mat4 &mProj, const VK::mat4 &mView, int nMaxPatches, VK::PlanetData *pPlanets, VK::PlanetFaceData *pPatches, int *pPlanetCount=NULL, Visible *pVisible=NULL);
+
+	/// Requests the height map pages for patches from select(). Each patch can straddle 2x2 nodes at its level, and each
+	/// node is requested with how big it looks (the same measure select() uses to take detail away).
+	/// \param cache The cache to request them from (call cache.begin() first, and cache.update() after).
+	/// Each page's PageKey::nPlanet is the index of its body.
+	/// \param pVisible The planets select() filled in along with the patches
+	static void requestPages(PageCache &cache, const Visible *pVisible, const VK::PlanetFaceData *pPatches, int nPatches);
+
+	/// Fills in each patch's vPage from the cache, using the nearest loaded ancestor for any node that isn't loaded
+	static void resolvePages(PageCache &cache, const Visible *pVisible, VK::PlanetFaceData *pPatches, int nPatches);
+
+	/// Runs select() on random scenes with a range of budgets and checks that it stays in budget, matches
+	/// PlanetLOD when the budget is big enough, takes detail away from distant bodies first, and gives
+	/// every vertex a page that covers it.
+	/// Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+
+	/// Times select() (and paging with a small cache) on a random scene with nPlanets bodies and logs the results (i.e. "VKTest.exe -benchmark")
+	static void Benchmark(int nPlanets, int nCount);
+};
+
+#endif
@@ -0,0 +1,210 @@
+// PlateSimulation.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKTransform.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "PlateSimulation.h"
+
+#include <random>
+
+const float PlateSimulation::MantleDensity = 3.3f;
+const float PlateSimulation::ContinentalDensity = 2.7f;
+const float PlateSimulation::OceanicDensity = 3.0f;
+
+namespace {
+	// Converts a height to the crust mass that floats at that height (the inverse of getHeight)
+	inline float HeightToMass(float fHeight, float fDensity) {
+		return fHeight * fDensity / (1.0f - fDensity / PlateSimulation::MantleDensity);
+	}
+}
+
+void PlateSimulation::init(const VK::PixelBuffer<float> *pFaces, int nHeight, int nPlate, int nPlates, unsigned int nSeed, float fSpeed)
+{
+	if(nPlates < 1 || nPlates > MaxPlates)
+		VKLogException("PlateSimulation::init - Invalid number of plates (%d)", nPlates);
+
+	m_nWidth = pFaces[0].getWidth();
+	m_nCells = FaceCount * m_nWidth * m_nWidth;
+	m_nCurrent = 0;
+	m_nSteps = 0;
+	m_fTime = 0.0f;
+	for(int i = 0; i < 2; i++) {
+		m_fMass[i].resize(m_nCells);
+		m_fDensity[i].resize(m_nCells);
+		m_fAge[i].resize(m_nCells);
+		m_nPlate[i].resize(m_nCells);
+	}
+
+	// Shift everything up so the lowest point has a crust thickness of 1
+	float fMin = 0.0f;
+	for(int nFace = 0; nFace < FaceCount; nFace++) {
+		const VK::PixelBuffer<float> &pb = pFaces[nFace];
+		for(int n = 0; n < pb.getNumPixels(); n++)
+			fMin = VK::Math::Min(fMin, pb[n][nHeight]);
+	}
+	m_fSeaLevel = 1.0f - fMin;
+
+	const int w = m_nWidth - 1;
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		const VK::PixelBuffer<float> &pb = pFaces[nFace];
+		for(int x = 0; x < m_nWidth; x++) {
+			int n = index(nFace, x, y);
+			const float *pSrc = pb(x, y);
+			m_fDensity[0][n] = pSrc[nHeight] > 0.0f ? ContinentalDensity : OceanicDensity;
+			m_fMass[0][n] = HeightToMass(pSrc[nHeight] + m_fSeaLevel, m_fDensity[0][n]);
+			m_fAge[0][n] = 0.0f;
+			m_nPlate[0][n] = (uint8_t)VK::Math::Clamp((int)pSrc[nPlate], 0, nPlates - 1);
+		}
+	});
+
+	// Give each plate a random Euler pole and speed
+	if(fSpeed <= 0.0f)
+		fSpeed = 1.0f / (3.0f * w);
+	std::mt19937 gen(nSeed);
+	std::normal_distribution<float> axis(0.0f, 1.0f);
+	std::uniform_real_distribution<float> speed(0.5f, 1.5f);
+	m_plates.resize(nPlates);
+	for(int i = 0; i < nPlates; i++) {
+		m_plates[i].vAxis = VK::vec3(axis(gen), axis(gen), axis(gen)).normalize();
+		m_plates[i].fSpeed = fSpeed * speed(gen);
+		m_plates[i].fAngle = 0.0f;
+	}
+}
+
+int PlateSimulation::lookup(const VK::vec3 &v) const
+{
+	// This is the same face selection and projection as CubeFace::GetFaceCoordinates, rounded to the nearest texel
+	int nFace;
+	float ax = VK::Math::Abs(v.x), ay = VK::Math::Abs(v.y), az = VK::Math::Abs(v.z);
+	float sc, tc, ma;
+	if(ax > ay && ax > az) {
+		ma = ax;
+		sc = v.x > 0 ? -v.z : v.z;
+		tc = -v.y;
+		nFace = v.x > 0 ? RightFace : LeftFace;
+	} else if(ay > az) {
+		ma = ay;
+		sc = v.x;
+		tc = v.y > 0 ? v.z : -v.z;
+		nFace = v.y > 0 ? TopFace : BottomFace;
+	} else {
+		ma = az;
+		sc = v.z > 0 ? v.x : -v.x;
+		tc = -v.y;
+		nFace = v.z > 0 ? FrontFace : BackFace;
+	}
+	const int w = m_nWidth - 1;
+#if CubeProjection == TangentProjection
+	sc = (float)CubeFace::Unwarp((double)(sc / ma));
+	tc = (float)CubeFace::Unwarp((double)(tc / ma));
+	ma = 1.0f;
+#endif
+	float f = 0.5f * w / ma;
+	int x = VK::Math::Clamp((int)((sc * f) + 0.5f * w + 0.5f), 0, w);
+	int y = VK::Math::Clamp((int)((tc * f) + 0.5f * w + 0.5f), 0, w);
+	return index(nFace, x, y);
+}
+
+void PlateSimulation::step(float fTime)
+{
+	const int nPlates = (int)m_plates.size();
+	const int nNext = m_nCurrent ^ 1;
+	const float *pMass = &m_fMass[m_nCurrent][0], *pDensity = &m_fDensity[m_nCurrent][0], *pAge = &m_fAge[m_nCurrent][0];
+	const uint8_t *pPlate = &m_nPlate[m_nCurrent][0];
+	float *pNextMass = &m_fMass[nNext][0], *pNextDensity = &m_fDensity[nNext][0], *pNextAge = &m_fAge[nNext][0];
+	uint8_t *pNextPlate = &m_nPlate[nNext][0];
+
+	// A plate only moves once it has rotated far enough to shift its crust by a texel at the center of a face
+	// (texels near the corners are smaller, so they shift farther). Build the matrices that rotate each plate
+	// that's moving back to where it was.
+	const float fTexel = 2.0f / (m_nWidth - 1);
+	bool bMoving[MaxPlates];
+	VK::mat3 mBack[MaxPlates];
+	for(int p = 0; p < nPlates; p++) {
+		Plate &plate = m_plates[p];
+		plate.fAngle += plate.fSpeed * fTime;
+		bMoving[p] = plate.fAngle >= fTexel;
+		if(bMoving[p]) {
+			VK::quat q;
+			q.setAxisAngle(plate.vAxis, -plate.fAngle);
+			mBack[p] = VK::mat3(q);
+			plate.fAngle = 0.0f;
+		}
+	}
+	const float fRiftMass = HeightToMass(m_fSeaLevel * 0.5f, OceanicDensity);
+
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		// GetDirections gives texels on a shared edge exactly the same vector in both faces, so seams stay in sync
+		static thread_local std::vector<VK::vec3> vRow;
+		vRow.resize(m_nWidth);
+		CubeFace::GetDirections((uint8_t)nFace, m_nWidth, y, &vRow[0]);
+		for(int x = 0, n = index(nFace, 0, y); x < m_nWidth; x++, n++) {
+			const VK::vec3 &v = vRow[x];
+			int nTop = -1;
+			float fMass = 0.0f, fDensity = 0.0f, fAge = 0.0f, fOther = 0.0f;
+			for(int p = 0; p < nPlates; p++) {
+				int nSrc = n;
+				if(bMoving[p]) {
+					const VK::mat3 &m = mBack[p];
+					nSrc = lookup(m.v[0] * v.x + m.v[1] * v.y + m.v[2] * v.z);
+				}
+				if(pPlate[nSrc] != p)
+					continue; // Plate p didn't move anything into this texel
+				if(nTop < 0 || pDensity[nSrc] < fDensity) {
+					fOther += fMass;
+					nTop = p;
+					fMass = pMass[nSrc];
+					fDensity = pDensity[nSrc];
+					fAge = pAge[nSrc];
+				} else
+					fOther += pMass[nSrc];
+			}
+
+			if(nTop < 0) {
+				// The plates are pulling apart here, so new oceanic crust fills the rift
+				pNextPlate[n] = pPlate[n];
+				pNextMass[n] = fRiftMass;
+				pNextDensity[n] = OceanicDensity;
+				pNextAge[n] = 0.0f;
+			} else {
+				pNextPlate[n] = (uint8_t)nTop;
+				pNextMass[n] = fMass + fOther * m_fAccretion;
+				pNextDensity[n] = fDensity;
+				pNextAge[n] = fOther > 0.0f ? 0.0f : fAge + fTime;
+			}
+		}
+	});
+
+	m_nCurrent = nNext;
+	m_nSteps++;
+	m_fTime += fTime;
+}
+
+double PlateSimulation::benchmark(int nSteps, float fTime)
+{
+	double t = VK::Timer::Time();
+	for(int i = 0; i < nSteps; i++)
+		step(fTime);
+	t = VK::Timer::Time() - t;
+	double dStep = nSteps > 0 ? t / nSteps : 0.0;
+	VKLogInfo("PlateSimulation::benchmark - %d steps on %d texels in %lf seconds (%lf seconds per step, %.1lf million texels per second)",
+		nSteps, m_nCells, t, dStep, dStep > 0 ? m_nCells / dStep * 1e-6 : 0.0);
+	return dStep;
+}
+
+void PlateSimulation::write(VK::PixelBuffer<float> *pFaces, int nHeight, int nPlate) const
+{
+	const uint8_t *pPlate = getPlates();
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		VK::PixelBuffer<float> &pb = pFaces[nFace];
+		for(int x = 0; x < m_nWidth; x++) {
+			int n = index(nFace, x, y);
+			float *pDest = pb(x, y);
+			pDest[nHeight] = getHeight(n);
+			pDest[nPlate] = (float)pPlate[n];
+		}
+	});
+}
@@ -0,0 +1,99 @@
+// PlateSimulation.h
+//
+#ifndef __PlateSimulation_h__
+#define __PlateSimulation_h__
+
+#include "CubeFace.h"
+
+/// Simulates plate tectonics on a low-res cube-mapped grid (see the notes at the top of main.cpp).
+/// Each texel stores the crust mass, density, age (time since its mass last changed), and the
+/// plate it belongs to. Each channel is stored in its own array (structure of arrays) so a pass
+/// only streams the channels it needs, and every channel is double-buffered so a step can read
+/// the previous state while worker threads write the next one.
+///
+/// Each plate rotates around its own Euler pole. A step finds where the crust at each texel came
+/// from by rotating its direction backward for each plate that could have moved into it, which
+/// makes crossing a cube face edge no different from moving within a face:
+/// - If one plate moved into the texel, its crust is simply carried along.
+/// - If several did, the lightest crust stays on top and part of the rest is added to it
+///   (subduction adds a little volcanic mass, continental collisions build mountains).
+/// - If none did, the plates are pulling apart and new oceanic crust forms in the rift.
+/// Crust is always snapped to the nearest texel, so a plate that moves less than a texel per
+/// step would never go anywhere. Instead, each plate saves up its rotation until it's enough to
+/// shift its crust by about a texel. Plates that aren't moving in a step cost almost nothing.
+class PlateSimulation
+{
+public:
+	enum { MaxPlates = 32 };
+
+	/// The density of the mantle and the two types of crust (g/cm^3)
+	static const float MantleDensity, ContinentalDensity, OceanicDensity;
+
+	struct Plate {
+		VK::vec3 vAxis;			///< The Euler pole this plate rotates around
+		float fSpeed;			///< The angular speed of the plate (radians per unit of time)
+		float fAngle;			///< The rotation that hasn't been applied to the grid yet (radians)
+	};
+
+protected:
+	int m_nWidth;							///< The number of texels on each side of a face (including the shared edges)
+	int m_nCells;							///< The number of texels in all 6 faces
+	int m_nCurrent;							///< The index of the buffer holding the current state (0 or 1)
+	uint64_t m_nSteps;						///< The number of steps run so far
+	float m_fTime;							///< The amount of time simulated so far
+	float m_fSeaLevel;						///< The offset used to convert crust mass to height
+	float m_fAccretion;						///< The fraction of colliding crust mass added to the plate on top
+
+	std::vector<Plate> m_plates;
+	std::vector<float> m_fMass[2];			///< The crust mass at each texel (thickness * density)
+	std::vector<float> m_fDensity[2];		///< The crust density at each texel
+	std::vector<float> m_fAge[2];			///< The time since the crust mass at each texel last changed
+	std::vector<uint8_t> m_nPlate[2];		///< The plate each texel belongs to
+
+	int index(int nFace, int x, int y) const { return (nFace * m_nWidth + y) * m_nWidth + x; }
+	int lookup(const VK::vec3 &v) const;
+
+public:
+	PlateSimulation() : m_nWidth(0), m_nCells(0), m_nCurrent(0), m_nSteps(0), m_fTime(0.0f), m_fSeaLevel(0.0f), m_fAccretion(0.25f) {}
+
+	/// Initializes the simulation from the six face height maps.
+	/// Texels above 0 start out as continental crust and the rest as oceanic crust.
+	/// \param pFaces An array of 6 pixel buffers of the same (square) size
+	/// \param nHeight The channel containing the height
+	/// \param nPlate The channel containing the plate number (0 to nPlates-1)
+	/// \param nPlates The number of plates (up to MaxPlates)
+	/// \param nSeed Seeds the random Euler poles and speeds of the plates
+	/// \param fSpeed The average angular speed of the plates (0 picks about a sixth of a texel per unit of time)
+	void init(const VK::PixelBuffer<float> *pFaces, int nHeight, int nPlate, int nPlates, unsigned int nSeed, float fSpeed=0.0f);
+
+	/// Advances the simulation by fTime.
+	void step(float fTime=1.0f);
+
+	/// Runs nSteps steps and logs how long they took.
+	/// \return The average number of seconds per step
+	double benchmark(int nSteps, float fTime=1.0f);
+
+	/// Writes the current height and plate number to the six face height maps.
+	void write(VK::PixelBuffer<float> *pFaces, int nHeight, int nPlate) const;
+
+	int getWidth() const { return m_nWidth; }
+	uint64_t getSteps() const { return m_nSteps; }
+	float getTime() const { return m_fTime; }
+	int getPlateCount() const { return (int)m_plates.size(); }
+	Plate &getPlate(int nPlate) { return m_plates[nPlate]; }
+	void setAccretion(float f) { m_fAccretion = f; }
+
+	// Read-only access to the current state (indexed by (face * width + y) * width + x)
+	const float *getMass() const { return &m_fMass[m_nCurrent][0]; }
+	const float *getDensity() const { return &m_fDensity[m_nCurrent][0]; }
+	const float *getAge() const { return &m_fAge[m_nCurrent][0]; }
+	const uint8_t *getPlates() const { return &m_nPlate[m_nCurrent][0]; }
+
+	/// Returns the height of the crust at a texel (its buoyancy in the mantle relative to sea level)
+	float getHeight(int nCell) const {
+		float fMass = m_fMass[m_nCurrent][nCell], fDensity = m_fDensity[m_nCurrent][nCell];
+		return fMass / fDensity * (1.0f - fDensity / MantleDensity) - m_fSeaLevel;
+	}
+};
+
+#endif
@@ -0,0 +1,230 @@
+// RiverNetwork.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "RiverNetwork.h"
+
+#include <queue>
+#include <atomic>
+#include <functional>
+
+namespace {
+	// The 8 neighbors of a cell, starting with the 4 that share an edge with it
+	const int NeighborX[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+	const int NeighborY[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+}
+
+void RiverNetwork::build(const VK::PixelBuffer<float> *pFaces, int nChannel, float fSeaLevel)
+{
+	double t = VK::Timer::Time();
+	m_nWidth = pFaces[0].getWidth();
+	m_nCells = FaceCount * m_nWidth * m_nWidth;
+	m_fSeaLevel = fSeaLevel;
+
+	std::vector<float> fHeight(m_nCells);
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		const VK::PixelBuffer<float> &pb = pFaces[nFace];
+		const float *pSrc = pb(0, y) + nChannel;
+		float *pDest = &fHeight[index(nFace, 0, y)];
+		for(int x = 0; x < m_nWidth; x++, pSrc += pb.getChannels())
+			pDest[x] = *pSrc;
+	});
+
+	initCanonical();
+	double tFill = VK::Timer::Time();
+	fill(fHeight);
+	double tAccumulate = VK::Timer::Time();
+	accumulate();
+	VKLogInfo("RiverNetwork::build - %d cells, max flow %.0f, fill %lf seconds, accumulate %lf seconds, total %lf seconds",
+		m_nCells, m_fMaxFlow, tAccumulate - tFill, VK::Timer::Time() - tAccumulate, VK::Timer::Time() - t);
+}
+
+void RiverNetwork::initCanonical()
+{
+	// Texels on a shared edge exist in 2 faces (3 at the corners). The one in the lowest face
+	// represents them all, and every face sharing that point is one edge away from the others.
+	const int w = m_nWidth - 1;
+	m_nCanonical.resize(m_nCells);
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		uint8_t nFace = (uint8_t)(nRow / m_nWidth);
+		int y = nRow % m_nWidth;
+		for(int x = 0; x < m_nWidth; x++) {
+			int nCell = index(nFace, x, y);
+			int nMin = nCell;
+			for(uint8_t nEdge = 0; nEdge < 4; nEdge++) {
+				if((nEdge == TopEdge && y != 0) || (nEdge == BottomEdge && y != w) || (nEdge == LeftEdge && x != 0) || (nEdge == RightEdge && x != w))
+					continue;
+				uint8_t f = nFace;
+				int nx = x, ny = y;
+				CubeFace::CrossEdge(w, nEdge, f, nx, ny);
+				nMin = VK::Math::Min(nMin, index(f, nx, ny));
+			}
+			m_nCanonical[nCell] = nMin;
+		}
+	});
+}
+
+int RiverNetwork::getNeighbors(int nCell, int *pNeighbors) const
+{
+	uint8_t nFace;
+	int x, y;
+	getCoordinates(nCell, nFace, x, y);
+	const int w = m_nWidth - 1;
+	int n = 0;
+	if(x > 0 && x < w && y > 0 && y < w) {
+		// Interior texels can use constant offsets, but their neighbors may still be on an edge
+		for(int i = 0; i < 8; i++)
+			pNeighbors[n++] = m_nCanonical[nCell + NeighborY[i] * m_nWidth + NeighborX[i]];
+		return n;
+	}
+
+	// Edge texels have to look across the edge into neighboring faces. Where 3 faces meet there
+	// are no diagonal neighbors, so AdjustCoords can return the same cell more than once.
+	for(int i = 0; i < 8; i++) {
+		uint8_t f = nFace;
+		int nx = x + NeighborX[i], ny = y + NeighborY[i];
+		CubeFace::AdjustCoords(w, f, nx, ny);
+		int nNeighbor = m_nCanonical[index(f, nx, ny)];
+		bool bDuplicate = nNeighbor == nCell;
+		for(int j = 0; j < n && !bDuplicate; j++)
+			bDuplicate = pNeighbors[j] == nNeighbor;
+		if(!bDuplicate)
+			pNeighbors[n++] = nNeighbor;
+	}
+	return n;
+}
+
+void RiverNetwork::fill(const std::vector<float> &fHeight)
+{
+	typedef std::pair<float, int> Node;
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node> > open;
+	std::queue<int> pit;
+	std::vector<uint8_t> bClosed(m_nCells, 0);
+	m_fFilled = fHeight;
+	m_nReceiver.assign(m_nCells, NoReceiver);
+
+	// The ocean is already "filled", so it's closed from the start. Only the coast needs to go in the
+	// queue because the flood can't reach the rest of the ocean without going through it.
+	int nNeighbors[8];
+	int nLowest = -1;
+	for(int i = 0; i < m_nCells; i++) {
+		if(m_nCanonical[i] != i)
+			bClosed[i] = 1; // Duplicate edge texels are never part of the network
+		else if(fHeight[i] <= m_fSeaLevel)
+			bClosed[i] = 1;
+		else if(nLowest < 0 || fHeight[i] < fHeight[nLowest])
+			nLowest = i;
+	}
+	bool bOcean = false;
+	for(int i = 0; i < m_nCells; i++) {
+		if(m_nCanonical[i] != i || fHeight[i] > m_fSeaLevel)
+			continue;
+		bOcean = true;
+		int n = getNeighbors(i, nNeighbors);
+		for(int j = 0; j < n; j++) {
+			if(!bClosed[nNeighbors[j]]) {
+				open.push(Node(fHeight[i], i));
+				break;
+			}
+		}
+	}
+	if(!bOcean && nLowest >= 0) {
+		// Without an ocean, everything drains into the lowest point on the planet
+		bClosed[nLowest] = 1;
+		open.push(Node(fHeight[nLowest], nLowest));
+	}
+
+	while(!open.empty() || !pit.empty()) {
+		int nCell;
+		if(!pit.empty()) {
+			nCell = pit.front();
+			pit.pop();
+		} else {
+			nCell = open.top().second;
+			open.pop();
+		}
+
+		float fSpill = m_fFilled[nCell];
+		int n = getNeighbors(nCell, nNeighbors);
+		for(int j = 0; j < n; j++) {
+			int nNeighbor = nNeighbors[j];
+			if(bClosed[nNeighbor])
+				continue;
+			bClosed[nNeighbor] = 1;
+			m_nReceiver[nNeighbor] = nCell;
+			if(fHeight[nNeighbor] <= fSpill) {
+				// This neighbor is in a depression (or a flat), so it fills up to the spill height
+				m_fFilled[nNeighbor] = fSpill;
+				pit.push(nNeighbor);
+			} else
+				open.push(Node(fHeight[nNeighbor], nNeighbor));
+		}
+	}
+}
+
+void RiverNetwork::accumulate()
+{
+	// Each cell starts with its own area (1 texel) and waits for every cell that drains into it.
+	// The areas are summed as integers so the totals don't depend on which order the threads add
+	// them in (a float stops counting every texel past 2^24), and only converted to float at the end.
+	std::vector<std::atomic<uint32_t> > nFlow(m_nCells);
+	std::vector<std::atomic<int> > nPending(m_nCells);
+	std::vector<uint8_t> bSource(m_nCells);
+	VK::Thread::ParallelFor(0, m_nCells, [&](int i) {
+		nFlow[i].store(m_nCanonical[i] == i ? 1 : 0, std::memory_order_relaxed);
+		nPending[i].store(0, std::memory_order_relaxed);
+	}, 4096);
+	VK::Thread::ParallelFor(0, m_nCells, [&](int i) {
+		if(m_nReceiver[i] != NoReceiver)
+			nPending[m_nReceiver[i]].fetch_add(1, std::memory_order_relaxed);
+	}, 4096);
+	VK::Thread::ParallelFor(0, m_nCells, [&](int i) {
+		bSource[i] = m_nCanonical[i] == i && nPending[i].load(std::memory_order_relaxed) == 0;
+	}, 4096);
+
+	// Walk downstream from each source. The thread that delivers the last incoming flow to a
+	// receiver carries on down the river, so each cell is visited exactly once.
+	VK::Thread::ParallelFor(0, m_nCells, [&](int i) {
+		if(!bSource[i])
+			return;
+		for(int nCell = i; m_nReceiver[nCell] != NoReceiver; ) {
+			int nReceiver = m_nReceiver[nCell];
+			nFlow[nReceiver].fetch_add(nFlow[nCell].load());
+			if(nPending[nReceiver].fetch_sub(1) != 1)
+				break;
+			nCell = nReceiver;
+		}
+	}, 4096);
+
+	m_fFlow.resize(m_nCells);
+	m_fMaxFlow = 0.0f;
+	for(int i = 0; i < m_nCells; i++) {
+		m_fFlow[i] = (float)nFlow[i].load(std::memory_order_relaxed);
+		m_fMaxFlow = VK::Math::Max(m_fMaxFlow, m_fFlow[i]);
+	}
+}
+
+void RiverNetwork::writeDrainage(VK::PixelBuffer<float> *pFaces, int nChannel) const
+{
+	float fScale = m_fMaxFlow > 1.0f ? 1.0f / logf(m_fMaxFlow) : 0.0f;
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		VK::PixelBuffer<float> &pb = pFaces[nFace];
+		float *pDest = pb(0, y) + nChannel;
+		for(int x = 0; x < m_nWidth; x++, pDest += pb.getChannels())
+			*pDest = logf(m_fFlow[m_nCanonical[index(nFace, x, y)]]) * fScale;
+	});
+}
+
+void RiverNetwork::writeFilled(VK::PixelBuffer<float> *pFaces, int nChannel) const
+{
+	VK::Thread::ParallelFor(0, FaceCount * m_nWidth, [&](int nRow) {
+		int nFace = nRow / m_nWidth, y = nRow % m_nWidth;
+		VK::PixelBuffer<float> &pb = pFaces[nFace];
+		float *pDest = pb(0, y) + nChannel;
+		for(int x = 0; x < m_nWidth; x++, pDest += pb.getChannels())
+			*pDest = m_fFilled[m_nCanonical[index(nFace, x, y)]];
+	});
+}
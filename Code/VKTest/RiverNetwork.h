@@ -0,0 +1,83 @@
+// RiverNetwork.h
+//
+#ifndef __RiverNetwork_h__
+#define __RiverNetwork_h__
+
+#include "CubeFace.h"
+
+/// Builds a river drainage network over the six faces of a cube-mapped height map.
+/// The faces are treated as one seamless grid: texels on a shared edge are the same
+/// point on the sphere, so each one is mapped to a single "canonical" cell, and
+/// neighbors that fall off the edge of a face are found with CubeFace::AdjustCoords.
+///
+/// Building the network takes three steps:
+/// 1) Depressions are filled using a priority-flood (Barnes et al., "Priority-Flood:
+///    An Optimal Depression-Filling and Watershed-Labeling Algorithm"), starting from
+///    the ocean and working uphill. Each cell's receiver (flow direction) is set to the
+///    cell that flooded it, so every land cell ends up with a downhill path to the sea.
+/// 2) Flat areas and filled pits are handled with a plain FIFO queue instead of the
+///    heap (the "improved" variant), which keeps it close to O(n) on real terrain and
+///    makes rivers flow across flats toward the outlet that reached them first.
+/// 3) Flow accumulation (the drainage area above each cell) is computed in parallel
+///    by walking down from the cells nothing drains into, handing each receiver off to
+///    whichever thread delivers its last incoming flow.
+class RiverNetwork
+{
+public:
+	enum { NoReceiver = -1 };
+
+protected:
+	int m_nWidth;						///< The number of texels on each side of a face (including the shared edges)
+	int m_nCells;						///< The number of texels in all 6 faces (including duplicate edge texels)
+	float m_fSeaLevel;					///< Cells at or below this height drain into the ocean
+	float m_fMaxFlow;					///< The largest flow accumulation value in the network
+
+	std::vector<int> m_nCanonical;		///< Maps every texel to the cell that represents it (shared edges map to one cell)
+	std::vector<int> m_nReceiver;		///< The cell each cell drains into (or NoReceiver for ocean and sinks)
+	std::vector<float> m_fFilled;		///< The height of each cell after filling depressions
+	std::vector<float> m_fFlow;			///< The number of cells that drain through each cell (including itself)
+
+	int index(int nFace, int x, int y) const { return (nFace * m_nWidth + y) * m_nWidth + x; }
+	int getNeighbors(int nCell, int *pNeighbors) const;
+	void initCanonical();
+	void fill(const std::vector<float> &fHeight);
+	void accumulate();
+
+public:
+	RiverNetwork() : m_nWidth(0), m_nCells(0), m_fSeaLevel(0.0f), m_fMaxFlow(0.0f) {}
+
+	/// Builds the drainage network from one channel of the six face height maps.
+	/// \param pFaces An array of 6 pixel buffers of the same (square) size
+	/// \param nChannel The channel containing the height
+	/// \param fSeaLevel Cells at or below this height are treated as ocean
+	void build(const VK::PixelBuffer<float> *pFaces, int nChannel=0, float fSeaLevel=0.0f);
+
+	/// Writes the drainage channel the renderer reads to one channel of the six face height maps.
+	/// The value is the log of each cell's flow accumulation scaled to a 0..1 range, so small
+	/// streams are visible and the biggest river mouths end up at 1.
+	void writeDrainage(VK::PixelBuffer<float> *pFaces, int nChannel) const;
+
+	/// Writes the depression-filled height to one channel of the six face height maps.
+	void writeFilled(VK::PixelBuffer<float> *pFaces, int nChannel) const;
+
+	int getWidth() const { return m_nWidth; }
+	int getCellCount() const { return m_nCells; }
+	float getMaxFlow() const { return m_fMaxFlow; }
+
+	/// Returns the cell that represents the specified texel (texels on a shared edge all return the same cell).
+	int getCell(int nFace, int x, int y) const { return m_nCanonical[index(nFace, x, y)]; }
+	/// Returns the cell the specified cell drains into (or NoReceiver).
+	int getReceiver(int nCell) const { return m_nReceiver[nCell]; }
+	/// Returns the height of the specified cell after filling depressions.
+	float getFilled(int nCell) const { return m_fFilled[nCell]; }
+	/// Returns the number of cells that drain through the specified cell (including itself).
+	float getFlow(int nCell) const { return m_fFlow[nCell]; }
+	/// Converts a cell index back to face coordinates.
+	void getCoordinates(int nCell, uint8_t &nFace, int &x, int &y) const {
+		x = nCell % m_nWidth;
+		y = (nCell / m_nWidth) % m_nWidth;
+		nFace = (uint8_t)(nCell / (m_nWidth * m_nWidth));
+	}
+};
+
+#endif
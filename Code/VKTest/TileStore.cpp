@@ -0,0 +1,532 @@
+// TileStore.cpp
+//
+#include "../VKContext/VKCore.h"
+#include "../VKContext/VKVector.h"
+#include "../VKContext/VKPixelBuffer.h"
+#include "../VKContext/VKDatabase.h"
+#include "TileStore.h"
+#include "../zlib/zlib.h"
+
+#include <random>
+#include <chrono>
+
+namespace {
+	// Resamples a square vec4-per-texel grid (or the first nChannels of one) into a tile, starting at texel (x0, y0)
+	// and stepping dStep texels at a time. Heights and drainage (x and z) are interpolated, and land mass and plate
+	// ids (y and w) are taken from the nearest texel.
+	void Resample(const float *pSrc, int nWidth, int nChannels, double x0, double y0, double dStep, float *pDest) {
+		for(int j = 0; j < TileStore::TileWidth; j++) {
+			double fy = y0 + dStep * j;
+			int iy = VK::Math::Clamp((int)fy, 0, nWidth - 2);
+			float ty = (float)(fy - iy);
+			int ny = iy + (ty >= 0.5f ? 1 : 0);
+			for(int i = 0; i < TileStore::TileWidth; i++) {
+				double fx = x0 + dStep * i;
+				int ix = VK::Math::Clamp((int)fx, 0, nWidth - 2);
+				float tx = (float)(fx - ix);
+				int nx = ix + (tx >= 0.5f ? 1 : 0);
+				const float *p00 = pSrc + (iy * nWidth + ix) * nChannels, *p10 = p00 + nChannels;
+				const float *p01 = p00 + nWidth * nChannels, *p11 = p01 + nChannels;
+				const float *pNearest = pSrc + (ny * nWidth + nx) * nChannels;
+				for(int c = 0; c < 4; c++) {
+					if(c >= nChannels) {
+						*pDest++ = 0.0f;
+					} else if(c == 1 || c == 3) {
+						*pDest++ = pNearest[c];
+					} else {
+						// (In this form, a texel that lands exactly on a source texel comes out exactly, even on the far edges)
+						float top = p00[c] * (1.0f - tx) + p10[c] * tx, bottom = p01[c] * (1.0f - tx) + p11[c] * tx;
+						*pDest++ = top * (1.0f - ty) + bottom * ty;
+					}
+				}
+			}
+		}
+	}
+
+	// Filters a tile's 4 children (in NodeKey::child() order) down into it. Each texel lines up with every other
+	// texel of its children. The ones along the tile's edges are only filtered along the edge, so they come out the
+	// same as in the neighboring tile, which shares those texels.
+	void Downsample(const float *pChild[4], float *pDest) {
+		const int w = TileStore::TileWidth - 1;
+		auto texel = [&](int x, int y) -> const float * {
+			int cx = x > w ? 1 : 0, cy = y > w ? 1 : 0;
+			return pChild[cx + 2 * cy] + ((y - cy * w) * TileStore::TileWidth + (x - cx * w)) * 4;
+		};
+		for(int j = 0; j <= w; j++) {
+			int y = j * 2, dy = (j > 0 && j < w) ? 1 : 0;
+			for(int i = 0; i <= w; i++) {
+				int x = i * 2, dx = (i > 0 && i < w) ? 1 : 0;
+				const float *p = texel(x, y);
+				float sum[2] = { 0.0f, 0.0f }, fWeight = 0.0f;
+				for(int v = -dy; v <= dy; v++) {
+					for(int u = -dx; u <= dx; u++) {
+						float f = (float)((2 - u * u) * (2 - v * v));
+						const float *q = texel(x + u, y + v);
+						sum[0] += q[0] * f;
+						sum[1] += q[2] * f;
+						fWeight += f;
+					}
+				}
+				*pDest++ = sum[0] / fWeight;
+				*pDest++ = p[1];
+				*pDest++ = sum[1] / fWeight;
+				*pDest++ = p[3];
+			}
+		}
+	}
+
+	// Writes a tile and everything under it to the tile table, depth first, so only a few tiles per level are in memory at once
+	struct Writer {
+		const VK::PixelBuffer<float> *pbHeight;
+		int nDeepest;
+		VK::DB::Statement *pInsert;
+		std::mutex *pMutex;
+		bool bOK;
+
+		void write(const NodeKey &key, float *pDest) {
+			if(key.getLevel() == nDeepest) {
+				const VK::PixelBuffer<float> &pb = pbHeight[key.getFace()];
+				double dStep = (double)(pb.getWidth() - 1) / ((TileStore::TileWidth - 1) << nDeepest);
+				Resample(pb[0], pb.getWidth(), pb.getChannels(), key.getX() * dStep * (TileStore::TileWidth - 1), key.getY() * dStep * (TileStore::TileWidth - 1), dStep, pDest);
+			} else {
+				std::vector<float> children(TileStore::TileFloats * 4);
+				const float *pChild[4];
+				for(int n = 0; n < 4; n++) {
+					pChild[n] = &children[TileStore::TileFloats * n];
+					write(key.child(n), &children[TileStore::TileFloats * n]);
+				}
+				Downsample(pChild, pDest);
+			}
+
+			uLongf nBytes = compressBound(TileStore::TileFloats * sizeof(float));
+			std::vector<Bytef> blob(nBytes);
+			if(compress2(&blob[0], &nBytes, (const Bytef *)pDest, TileStore::TileFloats * sizeof(float), Z_BEST_SPEED) != Z_OK) {
+				bOK = false;
+				return;
+			}
+			std::lock_guard<std::mutex> lock(*pMutex);
+			pInsert->bind(1, (int)key.getFace());
+			pInsert->bind(2, (int)key.getLevel());
+			pInsert->bind(3, key.getX());
+			pInsert->bind(4, key.getY());
+			pInsert->bindBlob(5, &blob[0], (int)nBytes);
+			bOK = pInsert->exec() && bOK;
+		}
+	};
+}
+
+bool TileStore::Write(const VK::Path &path, const VK::PixelBuffer<float> *pbHeight, uint64_t nSourceHash)
+{
+	double dStart = VK::Timer::Time();
+	int nWidth = pbHeight[0].getWidth();
+	int nLevels = 1;
+	while(((TileWidth - 1) << (nLevels - 1)) < nWidth - 1)
+		nLevels++;
+
+	float fMaxHeight = 0.0f;
+	for(int face = 0; face < FaceCount; face++) {
+		const float *p = pbHeight[face][0];
+		for(int n = 0; n < pbHeight[face].getNumPixels(); n++)
+			fMaxHeight = VK::Math::Max(fMaxHeight, VK::Math::Abs(p[n * pbHeight[face].getChannels()]));
+	}
+
+	VK::Path p = path;
+	if(p.exists())
+		p.del();
+	VK::DB::Connection db(false);
+	if(!db.open(path))
+		return false;
+	if(!db.exec("CREATE TABLE tile (face INTEGER, level INTEGER, x INTEGER, y INTEGER, data BLOB, PRIMARY KEY(face, level, x, y));"
+				"CREATE TABLE meta (key TEXT PRIMARY KEY, value);"))
+		return false;
+
+	bool bOK = true;
+	db.beginTransaction();
+	{
+		VK::DB::Statement meta(&db, "INSERT INTO meta VALUES (?, ?)", false);
+		meta.bind(1, "source_width"); meta.bind(2, nWidth); bOK = meta.exec() && bOK;
+		meta.bind(1, "tile_width"); meta.bind(2, (int)TileWidth); bOK = meta.exec() && bOK;
+		meta.bind(1, "levels"); meta.bind(2, nLevels); bOK = meta.exec() && bOK;
+		meta.bind(1, "max_height"); meta.bind(2, (double)fMaxHeight); bOK = meta.exec() && bOK;
+		meta.bind(1, "source_hash"); meta.bind(2, nSourceHash); bOK = meta.exec() && bOK;
+
+		// Each face builds (and compresses) its own pyramid, and they take turns writing
+		VK::DB::Statement insert(&db, "INSERT INTO tile VALUES (?, ?, ?, ?, ?)", false);
+		std::mutex mutex;
+		Writer writers[FaceCount];
+		VK::Thread::ParallelFor(0, FaceCount, [&](int face) {
+			Writer &w = writers[face];
+			w.pbHeight = pbHeight;
+			w.nDeepest = nLevels - 1;
+			w.pInsert = &insert;
+			w.pMutex = &mutex;
+			w.bOK = true;
+			std::vector<float> tile(TileFloats);
+			w.write(NodeKey((uint8_t)face, 0, 0u, 0u), &tile[0]);
+		}, 1);
+		for(int face = 0; face < FaceCount; face++)
+			bOK = writers[face].bOK && bOK;
+	}
+	if(bOK)
+		db.commitTransaction();
+	else
+		db.rollbackTransaction();
+
+	VKLogInfo("TileStore::Write - %s: %d levels from %dx%d faces in %.2f seconds", bOK ? "Wrote" : "Failed to write", nLevels, nWidth, nWidth, VK::Timer::Time() - dStart);
+	return bOK;
+}
+
+bool TileStore::open(const VK::Path &path, int nSourceWidth, uint64_t nSourceHash)
+{
+	close();
+	VK::Path p = path;
+	if(!p.exists())
+		return false;
+	{
+		VK::DB::Connection db(false);
+		if(!db.open(path, VK::DB::Connection::ReadOnly))
+			return false;
+		int nWidth = db.getInt("SELECT value FROM meta WHERE key='source_width'", 0);
+		int nTileWidth = db.getInt("SELECT value FROM meta WHERE key='tile_width'", 0);
+		int nLevels = db.getInt("SELECT value FROM meta WHERE key='levels'", 0);
+		if(nTileWidth != TileWidth || nLevels <= 0 || nLevels > 25 || (nSourceWidth > 0 && nWidth != nSourceWidth)) {
+			VKLogInfo("TileStore::open - %s was written from %dx%d faces with %d texel tiles (needs to be rewritten)", path.c_str(), nWidth, nWidth, nTileWidth);
+			return false;
+		}
+		if(nSourceHash && (uint64_t)db.getInt64("SELECT value FROM meta WHERE key='source_hash'", 0) != nSourceHash) {
+			VKLogInfo("TileStore::open - %s was written from a different planet (needs to be rewritten)", path.c_str());
+			return false;
+		}
+		m_nLevels = nLevels;
+		m_fMaxHeight = (float)db.getDouble("SELECT value FROM meta WHERE key='max_height'", 0.0);
+	}
+	m_path = path;
+	m_thread = std::thread(&TileStore::loop, this);
+	return true;
+}
+
+void TileStore::close()
+{
+	if(m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bQuit = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+	}
+	m_bQuit = false;
+	m_nLevels = 0;
+	m_tile.clear();
+	m_demand.clear();
+	m_prefetch.clear();
+	m_asked.clear();
+	m_queue.clear();
+	m_done.clear();
+	m_loading = NodeKey();
+}
+
+void TileStore::loop()
+{
+	// SQLite connections shouldn't be shared between threads, so the loader has its own
+	VK::DB::Connection db(false);
+	if(!db.open(m_path, VK::DB::Connection::ReadOnly)) {
+		VKLogError("TileStore - The loader failed to open %s", m_path.c_str());
+		return;
+	}
+	VK::DB::Statement select(&db, "SELECT data FROM tile WHERE face=? AND level=? AND x=? AND y=?", false);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for(;;) {
+		m_cv.wait(lock, [&] { return m_bQuit || !m_queue.empty(); });
+		if(m_bQuit)
+			return;
+		NodeKey key = m_loading = m_queue.back();
+		m_queue.pop_back();
+		lock.unlock();
+
+		// A tile that's missing or won't decompress is left flat (and logged), so it doesn't get asked for forever
+		std::vector<float> data(TileFloats, 0.0f);
+		select.bind(1, (int)key.getFace());
+		select.bind(2, (int)key.getLevel());
+		select.bind(3, key.getX());
+		select.bind(4, key.getY());
+		if(select.next()) {
+			int nBytes = 0;
+			const void *pBlob = select.getBlob(0, nBytes);
+			uLongf nSize = TileFloats * sizeof(float);
+			if(!pBlob || uncompress((Bytef *)&data[0], &nSize, (const Bytef *)pBlob, (uLong)nBytes) != Z_OK || nSize != TileFloats * sizeof(float))
+				VKLogError("TileStore - Tile %d/%d/%u/%u is corrupt", key.getFace(), key.getLevel(), key.getX(), key.getY());
+		} else {
+			VKLogError("TileStore - Tile %d/%d/%u/%u is missing", key.getFace(), key.getLevel(), key.getX(), key.getY());
+		}
+		select.reset();
+
+		lock.lock();
+		m_done.push_back(std::make_pair(key, std::vector<float>()));
+		m_done.back().second.swap(data);
+		m_loading = NodeKey();
+		m_nLoads++;
+	}
+}
+
+TileStore::Tile *TileStore::get(const NodeKey &key)
+{
+	TileMap::iterator it = m_tile.find(key);
+	if(it == m_tile.end())
+		return NULL;
+	it->second.nFrame = m_nFrame;
+	return &it->second;
+}
+
+bool TileStore::isReady(const PageKey &key)
+{
+	NodeKey tile = getTileKey(key.node);
+	if(get(tile))
+		return true;
+	if(m_asked.insert(tile).second)
+		m_demand.push_back(tile);
+	return false;
+}
+
+void TileStore::prefetch(const NodeKey &key)
+{
+	NodeKey tile = getTileKey(key);
+	if(m_tile.find(tile) == m_tile.end() && m_asked.insert(tile).second)
+		m_prefetch.push_back(tile);
+}
+
+const float *TileStore::find(const NodeKey &key)
+{
+	Tile *pTile = get(getTileKey(key));
+	return pTile ? &pTile->data[0] : NULL;
+}
+
+bool TileStore::fillPage(const NodeKey &key, float *pDest)
+{
+	NodeKey tile = getTileKey(key);
+	const float *pSrc = find(tile);
+	if(!pSrc)
+		return false;
+	if(tile == key) {
+		memcpy(pDest, pSrc, TileFloats * sizeof(float));
+		return true;
+	}
+
+	// The node is somewhere inside its tile, so stretch that part of the tile over the page
+	int x, y, w, tx, ty, tw;
+	key.getCoordinates(x, y, w);
+	tile.getCoordinates(tx, ty, tw);
+	double dScale = (double)(TileWidth - 1) / tw;
+	Resample(pSrc, TileWidth, 4, (x - tx) * dScale, (y - ty) * dScale, (double)w / tw, pDest);
+	return true;
+}
+
+void TileStore::update()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(size_t i = 0; i < m_done.size(); i++) {
+			Tile &t = m_tile[m_done[i].first];
+			t.data.swap(m_done[i].second);
+			t.nFrame = m_nFrame;
+		}
+		m_done.clear();
+
+		// The loader takes them from the back, so the prefetches go in first and the most important demand goes in last
+		// (anything it's loading now or just loaded is left out, so nothing gets loaded twice)
+		m_queue.clear();
+		for(size_t i = m_prefetch.size(); i-- > 0; ) {
+			if(m_prefetch[i] != m_loading && m_tile.find(m_prefetch[i]) == m_tile.end())
+				m_queue.push_back(m_prefetch[i]);
+		}
+		for(size_t i = m_demand.size(); i-- > 0; ) {
+			if(m_demand[i] != m_loading && m_tile.find(m_demand[i]) == m_tile.end())
+				m_queue.push_back(m_demand[i]);
+		}
+	}
+	m_cv.notify_one();
+	m_demand.clear();
+	m_prefetch.clear();
+	m_asked.clear();
+
+	// Throw out the least recently used tiles (but not any used this frame, since they may still be in the pages)
+	if((int)m_tile.size() > m_nMaxTiles) {
+		std::vector<std::pair<uint32_t, NodeKey> > lru;
+		for(TileMap::const_iterator it = m_tile.begin(); it != m_tile.end(); it++) {
+			if(it->second.nFrame != m_nFrame)
+				lru.push_back(std::make_pair(it->second.nFrame, it->first));
+		}
+		size_t nEvict = VK::Math::Min(m_tile.size() - (size_t)m_nMaxTiles, lru.size());
+		std::nth_element(lru.begin(), lru.begin() + nEvict, lru.end());
+		for(size_t i = 0; i < nEvict; i++)
+			m_tile.erase(lru[i].second);
+	}
+	m_nFrame++;
+}
+
+bool TileStore::Test()
+{
+	// Two levels, with the deepest one lined up texel for texel with the height map, so every texel can be checked exactly
+	const int Width = (TileWidth - 1) * 2 + 1;
+	std::mt19937 gen(12345);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	VK::PixelBuffer<float> pbHeight[FaceCount];
+	float fMaxHeight = 0.0f;
+	for(int face = 0; face < FaceCount; face++) {
+		pbHeight[face].create(Width, Width, 1, 4);
+		float *p = pbHeight[face][0];
+		for(int n = 0; n < Width * Width; n++, p += 4) {
+			p[0] = random(gen);
+			p[1] = (float)(gen() % 8);
+			p[2] = random(gen);
+			p[3] = (float)(gen() % 10);
+			fMaxHeight = VK::Math::Max(fMaxHeight, VK::Math::Abs(p[0]));
+		}
+	}
+
+	// The high bit is set to make sure the hash survives being stored as a signed integer
+	const uint64_t SourceHash = 0xfedcba9876543210ull;
+	VK::Path path = VK::Path::Root() + "TileStore.test.db";
+	if(!Write(path, pbHeight, SourceHash)) {
+		VKLogError("TileStore::Test - Failed to write %s", path.c_str());
+		return false;
+	}
+
+	int nErrors = 0;
+	TileStore store;
+	if(!store.open(path, Width, SourceHash) || store.getLevels() != 2 || store.getMaxHeight() != fMaxHeight) {
+		VKLogError("TileStore::Test - Failed to open %s (%d levels)", path.c_str(), store.getLevels());
+		nErrors++;
+	}
+
+	// Ask for every tile every frame (like a PageCache would) until they're all loaded
+	std::vector<NodeKey> keys;
+	for(int face = 0; face < FaceCount; face++) {
+		for(int nLevel = 0; nLevel < 2; nLevel++) {
+			for(uint32_t y = 0; y < (1u << nLevel); y++)
+				for(uint32_t x = 0; x < (1u << nLevel); x++)
+					keys.push_back(NodeKey((uint8_t)face, (uint8_t)nLevel, x, y));
+		}
+	}
+	double dStart = VK::Timer::Time();
+	int nFrames = 0;
+	for(bool bDone = false; !bDone && VK::Timer::Time() - dStart < 30.0; nFrames++) {
+		bDone = true;
+		for(size_t i = 0; i < keys.size(); i++)
+			bDone = store.isReady(PageKey(0, keys[i])) && bDone;
+		store.update();
+		if(!bDone)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if(store.getLoadCount() != (int)keys.size()) {
+		VKLogError("TileStore::Test - Loaded %d tiles (expected %d)", store.getLoadCount(), (int)keys.size());
+		nErrors++;
+	}
+
+	// The deepest level has to match the height map exactly, and the level above it has to be filtered down from it
+	const int w = TileWidth - 1;
+	for(size_t k = 0; k < keys.size(); k++) {
+		const NodeKey &key = keys[k];
+		const VK::PixelBuffer<float> &pb = pbHeight[key.getFace()];
+		const float *pTile = store.find(key);
+		bool bOK = pTile != NULL;
+		for(int j = 0; bOK && j <= w; j++) {
+			for(int i = 0; bOK && i <= w; i++) {
+				const float *p = pTile + (j * TileWidth + i) * 4;
+				if(key.getLevel() == 1) {
+					const float *q = pb(key.getX() * w + i, key.getY() * w + j);
+					bOK = p[0] == q[0] && p[1] == q[1] && p[2] == q[2] && p[3] == q[3];
+				} else {
+					int dx = (i > 0 && i < w) ? 1 : 0, dy = (j > 0 && j < w) ? 1 : 0;
+					float sum[2] = { 0.0f, 0.0f }, fWeight = 0.0f;
+					for(int v = -dy; v <= dy; v++) {
+						for(int u = -dx; u <= dx; u++) {
+							float f = (float)((2 - u * u) * (2 - v * v));
+							const float *q = pb(i * 2 + u, j * 2 + v);
+							sum[0] += q[0] * f;
+							sum[1] += q[2] * f;
+							fWeight += f;
+						}
+					}
+					const float *q = pb(i * 2, j * 2);
+					bOK = VK::Math::Abs(p[0] - sum[0] / fWeight) < 1e-5f && VK::Math::Abs(p[2] - sum[1] / fWeight) < 1e-5f && p[1] == q[1] && p[3] == q[3];
+				}
+			}
+		}
+		if(!bOK) {
+			if(nErrors < 10)
+				VKLogError("TileStore::Test - Tile %d/%d/%u/%u doesn't match", key.getFace(), key.getLevel(), key.getX(), key.getY());
+			nErrors++;
+		}
+	}
+
+	// Pages deeper than the pyramid have to be interpolated from the height map
+	std::vector<float> page(TileFloats);
+	for(int n = 0; n < 100; n++) {
+		uint8_t nFace = (uint8_t)(gen() % FaceCount), nLevel = (uint8_t)(2 + gen() % 6);
+		NodeKey key(nFace, nLevel, (uint32_t)(gen() & ((1u << nLevel) - 1)), (uint32_t)(gen() & ((1u << nLevel) - 1)));
+		int x, y, nWidth;
+		key.getCoordinates(x, y, nWidth);
+		const VK::PixelBuffer<float> &pb = pbHeight[nFace];
+		bool bOK = store.fillPage(key, &page[0]);
+		for(int j = 0; bOK && j <= w; j += 8) {
+			for(int i = 0; bOK && i <= w; i += 8) {
+				double fx = (x + (double)nWidth * i / w) * (Width - 1) / CubeFace::MaxCoord, fy = (y + (double)nWidth * j / w) * (Width - 1) / CubeFace::MaxCoord;
+				int ix = VK::Math::Min((int)fx, Width - 2), iy = VK::Math::Min((int)fy, Width - 2);
+				float tx = (float)(fx - ix), ty = (float)(fy - iy);
+				for(int c = 0; bOK && c < 4; c += 2) {
+					float top = pb(ix, iy)[c] + (pb(ix + 1, iy)[c] - pb(ix, iy)[c]) * tx;
+					float bottom = pb(ix, iy + 1)[c] + (pb(ix + 1, iy + 1)[c] - pb(ix, iy + 1)[c]) * tx;
+					bOK = VK::Math::Abs(page[(j * TileWidth + i) * 4 + c] - (top + (bottom - top) * ty)) < 1e-4f;
+				}
+			}
+		}
+		if(!bOK) {
+			if(nErrors < 10)
+				VKLogError("TileStore::Test - Page %d/%d/%u/%u doesn't match", nFace, nLevel, key.getX(), key.getY());
+			nErrors++;
+		}
+	}
+
+	// Shrinking the cache has to throw out what wasn't used this frame, and a prefetch has to load a tile (once)
+	store.setMaxTiles(4);
+	store.update(); // Ends the frame the checks above used the tiles in
+	store.update();
+	if(store.getTileCount() > 4) {
+		VKLogError("TileStore::Test - %d tiles are still in memory (expected 4)", store.getTileCount());
+		nErrors++;
+	}
+	NodeKey evicted;
+	for(size_t k = 0; k < keys.size() && !evicted.isValid(); k++) {
+		if(!store.find(keys[k]))
+			evicted = keys[k];
+	}
+	int nLoads = store.getLoadCount();
+	dStart = VK::Timer::Time();
+	while(!store.find(evicted) && VK::Timer::Time() - dStart < 30.0) {
+		store.prefetch(evicted);
+		store.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if(!store.find(evicted) || store.getLoadCount() != nLoads + 1) {
+		VKLogError("TileStore::Test - Prefetching took %d loads (expected 1)", store.getLoadCount() - nLoads);
+		nErrors++;
+	}
+
+	// A store written from a different size of height map (or a different planet) has to be rejected (so it gets written again)
+	TileStore other;
+	if(other.open(path, Width + 2)) {
+		VKLogError("TileStore::Test - Opened a store written from %dx%d faces as %dx%d", Width, Width, Width + 2, Width + 2);
+		nErrors++;
+	}
+	if(other.open(path, Width, SourceHash + 1)) {
+		VKLogError("TileStore::Test - Opened a store written with a different source hash");
+		nErrors++;
+	}
+
+	store.close();
+	path.del();
+	VKLogInfo("TileStore::Test - %d errors (%d tiles loaded in %d frames)", nErrors, (int)keys.size(), nFrames);
+	return nErrors == 0;
+}
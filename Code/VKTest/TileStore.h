@@ -0,0 +1,133 @@
+// TileStore.h
+//
+#ifndef __TileStore_h__
+#define __TileStore_h__
+
+#include "NodeKey.h"
+#include "PageCache.h"
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/// Saves a planet's height map to a SQLite database as a pyramid of tiles, and streams them back in
+/// on a background thread, so the planet only has to be generated once and only the tiles in view
+/// ever get read from disk.
+///
+/// Each tile is one quad-tree node (the same nodes PageCache pages cover), TileWidth x TileWidth
+/// vec4 texels with the border texels shared with its neighbors, compressed with zlib and keyed by
+/// (face, level, x, y). The deepest level is the first one with at least as many texels as the
+/// height map it was written from, and each level above it is filtered down from the one below
+/// (heights and drainage get a [1 2 1] filter, and land mass and plate ids are point sampled,
+/// since blending ids makes no sense). Nodes deeper than that are resampled from their ancestor.
+///
+/// Each frame, the PageCache asks isReady() about the pages it wants to load (in priority order),
+/// and anything that isn't in memory goes on the loader's list. prefetch() adds tiles to load after
+/// those, if there's time (i.e. the tiles around where the camera is heading). Then update() picks
+/// up the tiles the loader finished, hands it the new list, and throws out the least recently used
+/// tiles if there are too many in memory.
+class TileStore : public PageSource
+{
+public:
+	static const int TileWidth = PAGE_WIDTH;
+	static const int TileFloats = TileWidth * TileWidth * 4;
+
+protected:
+	/// A tile in memory
+	struct Tile {
+		std::vector<float> data;	///< TileFloats floats (vec4 texels, row by row)
+		uint32_t nFrame;			///< The last frame it was used
+	};
+	typedef std::unordered_map<NodeKey, Tile, NodeKey::Hash> TileMap;
+	typedef std::unordered_set<NodeKey, NodeKey::Hash> KeySet;
+
+	VK::Path m_path;
+	int m_nLevels;					///< The number of levels in the pyramid (0 if it isn't open)
+	float m_fMaxHeight;				///< The biggest absolute height in the height map
+
+	// Only touched by the main thread
+	TileMap m_tile;					///< The tiles in memory
+	int m_nMaxTiles;
+	uint32_t m_nFrame;
+	std::vector<NodeKey> m_demand;	///< The missing tiles asked for this frame, most important first
+	std::vector<NodeKey> m_prefetch;///< The missing tiles to load after those
+	KeySet m_asked;					///< Everything in m_demand and m_prefetch (so nothing goes in twice)
+
+	// Shared with the loader thread (guarded by m_mutex)
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<NodeKey> m_queue;	///< The tiles for the loader to load (it takes them from the back)
+	NodeKey m_loading;				///< The tile it's loading now
+	std::vector<std::pair<NodeKey, std::vector<float> > > m_done;	///< The tiles it loaded that update() hasn't picked up
+	std::atomic<int> m_nLoads;
+	bool m_bQuit;
+
+	void loop();
+	Tile *get(const NodeKey &key);
+
+public:
+	TileStore() : m_nLevels(0), m_fMaxHeight(0.0f), m_nMaxTiles(256), m_nFrame(1), m_nLoads(0), m_bQuit(false) {}
+	~TileStore() { close(); }
+
+	/// Writes a height map to a new store (replacing any old one), with every level of the pyramid.
+	/// \param path The database file
+	/// \param pbHeight The 6 faces of the height map (square, at least 2x2, with up to 4 channels: height, land mass, drainage, and plate)
+	/// \param nSourceHash A hash of what the height map was generated from (i.e. PlanetGraph::getHash()), for open() to check
+	/// \return false if the database couldn't be written
+	static bool Write(const VK::Path &path, const VK::PixelBuffer<float> *pbHeight, uint64_t nSourceHash=0);
+
+	/// Opens a store and starts the loader thread.
+	/// \param path The database file
+	/// \param nSourceWidth The width of the height map it has to have been written from (0 for any)
+	/// \param nSourceHash The hash it has to have been written with (0 for any)
+	/// \return false if it's missing, or was written from a different height map or with a different tile width
+	/// (i.e. it needs to be generated and written again)
+	bool open(const VK::Path &path, int nSourceWidth=0, uint64_t nSourceHash=0);
+
+	/// Stops the loader thread and empties the tiles in memory
+	void close();
+
+	bool isOpen() const { return m_nLevels > 0; }
+	int getLevels() const { return m_nLevels; }
+	float getMaxHeight() const { return m_fMaxHeight; }
+	int getTileCount() const { return (int)m_tile.size(); }
+	int getLoadCount() const { return m_nLoads; }
+
+	/// Sets the most tiles to keep in memory (more can stay if they were used in the last frame)
+	void setMaxTiles(int n) { m_nMaxTiles = n; }
+
+	/// Returns the tile that holds the data for a node (the node itself, or its ancestor at the deepest level)
+	NodeKey getTileKey(const NodeKey &key) const {
+		NodeKey tile = key;
+		while(tile.getLevel() >= m_nLevels && tile.getLevel() > 0)
+			tile = tile.parent();
+		return tile;
+	}
+
+	/// Returns true if the tile for a page is in memory. If not, it's queued to be loaded (PageSource::isReady).
+	/// Every planet shares the same store for now, so this doesn't look at key.nPlanet.
+	virtual bool isReady(const PageKey &key);
+
+	/// Queues the tile for a node to be loaded after the tiles isReady() asked for this frame (if it isn't in memory)
+	void prefetch(const NodeKey &key);
+
+	/// Returns the texels of the tile for a node (see getTileKey()), or NULL if it isn't in memory
+	const float *find(const NodeKey &key);
+
+	/// Fills a PageCache page (TileWidth x TileWidth vec4 texels) for a node from its tile.
+	/// \return false if the tile isn't in memory (pDest is left alone)
+	bool fillPage(const NodeKey &key, float *pDest);
+
+	/// Ends a frame: picks up the tiles the loader finished, gives it this frame's tiles to load (the ones isReady()
+	/// asked for, then the prefetches), and throws out the least recently used tiles if there are too many.
+	void update();
+
+	/// Writes a small random height map to a temporary store, reads it all back through the loader thread, and checks
+	/// every level of the pyramid against the height map, as well as prefetching, eviction, and rejecting a store
+	/// written from a different size of height map or planet. Logs any failures (i.e. "VKTest.exe -test").
+	/// \return true if every check passed
+	static bool Test();
+};
+
+#endif
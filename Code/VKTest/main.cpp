@@ -10,11 +10,17 @@
 #include "../VKContext/VKFont.h"
 #include "../VKContext/VKManager.h"
 #include "../VKContext/VKGeometry.h"
-#include "../VKContext/VKNoise.h"
+#include "../VKContext/VKDatabase.h"
 
 #include "CubeFace.h"
+#include "NodeKey.h"
+#include "PlanetSystem.h"
+#include "TileStore.h"
+#include "PlanetGraph.h"
+#include "NormalMap.h"
 
 #include <random>
+#include <exception>
 
 /*
 * Plate tectonics (low res):
@@ -63,6 +69,7 @@ private:
 	VK::vec3 velocity;
 
 	double lastLogTime;
+	double lastWaitTime; // vk.getWaitTime() at lastLogTime
 	uint32_t frameCount;
 	float m_fFrameTime;
 	double m_dLastFrame;
@@ -71,24 +78,23 @@ private:
 	VK::RenderPass planetPass; // Render pass for updating the planet's height map
 	VK::RenderPass graphicsPass; // Render pass for drawing to the main framebuffer(s)
 	VK::RenderPass guiPass; // Render pass for swapping the main framebuffer to the main UI window
-	VK::Image depth, color, normal;
+	VK::Image depth, color, normal; // (color is only used with presentCopy, otherwise both passes draw straight into the swapchain image)
 
-	static const int MaxLevels = MAX_LEVELS; // More than 16 levels experiences precision problems in shaders
-	static const int MaxPlanets = 64 - MaxLevels; // This is the max number of planets/moons we can render in a single frame
-	static const int NodeWidth = 128; // 64x64 quads per level
+	static const int MaxLevels = PlanetLOD::MaxLevels;
+	static const int MaxPlanets = PlanetSystem::MaxPlanets; // This is the max number of planets/moons we can render in a single frame
+	static const int PatchBudget = 512; // The most patches (each with NodeWidth x NodeWidth quads) to draw in a frame for all planets
+	static const int NodeWidth = PlanetLOD::NodeWidth;
 	static const int NodeEdge = NodeWidth + 1; // 64x64 quads requires 65x65 vertices
-	static const int NodeHalf = NodeWidth / 2; // This value is used a lot
-	static const int NodeFourth = NodeWidth / 4; // This value is used a lot
 	static const int HeightMapFactor = 2; // For better normals, take 4 height samples per vertex
-	static const int HeightMapWidth = NodeWidth * HeightMapFactor + 1;
-	static const int HeightMapLayers = MaxPlanets + MaxLevels;
+	static const int HeightMapWidth = PAGE_WIDTH; // NodeWidth * HeightMapFactor + 1 (the PlanetFace shader needs it too)
+	static const int PageBytes = HeightMapWidth * HeightMapWidth * 4 * sizeof(float); // One page (quad-tree node) of the height map
+	static const int MaxPages = 2048; // The most height map pages to keep on the GPU (if there's memory for them)
+	static const int UploadBudget = 8 * PageBytes; // The most height map bytes to upload in a frame
+	static const int MaxTiles = 512; // The most height map tiles to keep in memory (see TileStore)
 
 	//enum Orientation { Leaf, Center, NorthEdge, SouthEdge, WestEdge, EastEdge, NWCorner, NECorner, SWCorner, SECorner, OrientationCount };
 	//static uint32_t m_nIndex[OrientationCount]; // A global array of offsets into an index buffer (one for each orientation)
 
-	static uint32_t m_nStack[HeightMapLayers]; // A global stack of unused height map indices (in the texture array)
-	static uint32_t m_nStackIndex; // A global index into the stack of unused height map indices
-
 	bool m_bUpdate;
 
 	/*
@@ -99,17 +105,25 @@ private:
 	};
 	Level m_level[6][MaxLevels]; // Tracks where each level is on this sphere
 	*/
-	VK::PlanetFaceData faceData[MAX_LEVELS * FaceCount];
-	VK::UniformBuffer faceBuffer;
+	VK::PlanetData planetData[MaxPlanets];
+	PlanetSystem::Visible planetVisible[MaxPlanets]; // Which body each planet in planetData is (for paging)
+	VK::PlanetFaceData faceData[PlanetSystem::MaxPatches];
+	VK::DynamicDescriptor faceDescriptor; // Points at planetData followed by faceData (as a storage buffer) in the manager's ring buffer
+	PageCache pages; // Tracks which height map pages are in which layers of iHeight
+	VK::PlanetData prefetchPlanets[MaxPlanets]; // The planets and patches where the camera is heading (for TileStore::prefetch)
+	VK::PlanetFaceData prefetchData[PlanetSystem::MaxPatches];
+	VK::BufferObject pageStaging[VK::Context::FramesInFlight]; // New pages are written here before they're copied to iHeight (one per frame in flight)
 
 	VkPipelineLayout sceneOnlyLayout, pipelineLayout;
 	VK::BufferObject vboClipmap, iboClipmap;
 
 public:
-	VK::PixelBuffer<float> pbHeight[6];
-	VK::ImageSampler iHeight, iHeightHost;
+	PlanetSystem planets; // Every planet and moon (each gets its own pages, but they're all filled from the same height map for now)
+	TileStore store; // The height map tiles the pages are filled from (streamed in from disk)
+	VK::ImageSampler iHeight; // A texture array of height map pages (see PageCache)
+	bool presentCopy; // Draw into color and copy it to the swapchain image, instead of drawing straight into the swapchain image
 
-	Window() {}
+	Window() : presentCopy(false) {}
 
 	virtual void onCreate() {
 		VK::Window::onCreate();
@@ -121,68 +135,53 @@ public:
 		// Corner with cracks position:
 		//camera.from_s("t[1.000000, q[-0.104479, -0.401035, -0.266681, 0.870136], v[-1.085328, 0.952729, 1.114721]]");
 
-		manager.init();
+		manager.init(sizeof(planetData) + sizeof(faceData) + 256); // Leave room in the ring buffer for the planets and patches
 		manager.setNear(0.001f);
 		manager.setFar(100.0f);
 		manager.loadFont(FONT_NAME);
 		manager.loadFX("VKTest.glfx");
 		manager.updateShaders();
 
-		faceBuffer.create(sizeof(faceData), manager.getDescriptorPool());
+		faceDescriptor.create(manager.getRingBuffer(), sizeof(planetData) + sizeof(faceData), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+
+		// Keep as many height map pages on the GPU as fit in a quarter of its memory (up to MaxPages and the layer limit)
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(vk, &props);
+		VkPhysicalDeviceMemoryProperties memory;
+		vkGetPhysicalDeviceMemoryProperties(vk, &memory);
+		VkDeviceSize heap = 0;
+		for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+			if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+				heap = VK::Math::Max(heap, memory.memoryHeaps[i].size);
+		}
+		int nPages = VK::Math::Min(MaxPages, (int)props.limits.maxImageArrayLayers);
+		nPages = VK::Math::Max(FaceCount, (int)VK::Math::Min((VkDeviceSize)nPages, heap / 4 / PageBytes));
+		pages.init(nPages, PageBytes);
+		VKLogInfo("Height map pages: %d (%d MB)", nPages, (int)((VkDeviceSize)nPages * PageBytes >> 20));
 
 		iHeight.createTexture(
 			VK_FORMAT_R32G32B32A32_SFLOAT,
 			VK_IMAGE_TILING_OPTIMAL, // Can't use linear with device-local texture arrays
 			VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			TestWidth, TestWidth, 1,
-			VK_IMAGE_LAYOUT_UNDEFINED, // Don't need to keep the contents of this when we change layouts
-			6
-		);
-		iHeightHost.createTexture(
-			VK_FORMAT_R32G32B32A32_SFLOAT,
-			VK_IMAGE_TILING_LINEAR,
-			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			TestWidth, TestWidth, 1,
-			VK_IMAGE_LAYOUT_PREINITIALIZED, // Need to keep the contents of this when we change layouts
-			1 // My ATI allowed 6 layers here, but not my nVidia
+			HeightMapWidth, HeightMapWidth, 1,
+			VK_IMAGE_LAYOUT_GENERAL, // The pages get filled in as they're needed
+			nPages
 		);
+		for (uint32_t i = 0; i < VK::Context::FramesInFlight; i++)
+			pageStaging[i].create(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, UploadBudget);
 
-#if 1 // Can't do this if it's not linear
-		iHeightHost.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_GENERAL);
-		iHeight.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-		uint8_t *data = NULL;
-		VkImageSubresource subres = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-		VkSubresourceLayout sublayout;
-		for (int face = 0; face < 6; face++) {
-			//subres.arrayLayer = face;
-			vkGetImageSubresourceLayout(vk, iHeightHost, &subres, &sublayout);
-			if (VK_SUCCESS == vkMapMemory(vk, iHeightHost, sublayout.offset, sublayout.size, 0, (void **)&data)) {
-				for (int y = 0; y < pbHeight[face].getHeight(); y++) {
-					float *src = pbHeight[face](0, y);
-					memcpy(data, src, pbHeight[face].getWidth() * pbHeight[face].getChannels() * 4);
-					data += sublayout.rowPitch;
-				}
-				vkUnmapMemory(vk, iHeightHost);
-			}
-			VK::ImageCopy copy_region(TestWidth, TestWidth);
-			copy_region.dstSubresource.baseArrayLayer = face;
-			iHeightHost.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-			vkCmdCopyImage(vk, iHeightHost, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, iHeight, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-			iHeightHost.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-			vk.flush();
-		}
-		iHeight.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-#endif
+		// The PlanetFace vertex shader scales the height by 0.01 twice (and every planet uses the same height map)
+		store.setMaxTiles(MaxTiles);
+		for (int i = 0; i < planets.size(); i++)
+			planets[i].fMaxHeight = store.getMaxHeight() * 0.0001f;
 
-		iHeight.createDescriptor(manager.getDescriptorPool());
+		iHeight.createDescriptor();
 		std::vector<VK::Image*> planetImages = { &iHeight };
 		planetPass.create(planetImages, NULL, VK_ATTACHMENT_LOAD_OP_LOAD);
 		VK::ShaderTechnique *pPlanet = manager.getTechnique("TweakPlanet");
 		if (pPlanet) {
-			VkDescriptorSetLayout layouts[] = { manager.getSceneBuffer() };
+			VkDescriptorSetLayout layouts[] = { manager.getSceneDescriptor() };
 			VK::PipelineLayoutCreateInfo pipelineLayoutInfo(layouts, 1);
 			VkPushConstantRange push_constant_ranges[1] = {};
 			push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -209,7 +208,7 @@ public:
 			}
 			y += 1.0f / NodeWidth;
 		}
-		vboClipmap.create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, sizeof(VK::vec4) * vertices.size());
+		vboClipmap.create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, sizeof(VK::vec4) * vertices.size(), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		vboClipmap.update(&vertices[0]);
 
 		// The top row skips odd edge vertices to avoid cracks in mesh at border with parent node
@@ -299,19 +298,18 @@ public:
 		indices.push_back(n - 1);
 		indices.push_back(n + NodeEdge);
 
-		iboClipmap.create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices.size()*sizeof(uint16_t));
+		iboClipmap.create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices.size()*sizeof(uint16_t), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 		iboClipmap.update(&indices[0]);
 
-		VkDescriptorSetLayout layouts[] = { manager.getSceneBuffer(), faceBuffer, iHeight };
+		VkDescriptorSetLayout layouts[] = { manager.getSceneDescriptor(), faceDescriptor, iHeight };
 		VK::PipelineLayoutCreateInfo pipelineLayoutInfo(layouts, 3);
 		vkCreatePipelineLayout(vk, &pipelineLayoutInfo, NULL, &pipelineLayout);
 	}
 
 	virtual void onDestroy() {
-		if (sceneOnlyLayout) {
-			vkDestroyPipelineLayout(vk, sceneOnlyLayout, NULL);
-			sceneOnlyLayout = NULL;
-		}
+		// The frames in flight may still be using any of this, so it's all destroyed once they're done with it
+		vk.deferDestroy(vkDestroyPipelineLayout, sceneOnlyLayout);
+		sceneOnlyLayout = NULL;
 
 		manager.cleanup();
 		guiPass.destroy();
@@ -321,16 +319,15 @@ public:
 		color.destroy();
 		normal.destroy();
 
-		iHeightHost.destroy();
+		for (uint32_t i = 0; i < VK::Context::FramesInFlight; i++)
+			pageStaging[i].destroy();
 		iHeight.destroy();
 
-		if (pipelineLayout) {
-			vkDestroyPipelineLayout(vk, pipelineLayout, NULL);
-			pipelineLayout = NULL;
-		}
+		vk.deferDestroy(vkDestroyPipelineLayout, pipelineLayout);
+		pipelineLayout = NULL;
 		iboClipmap.destroy();
 		vboClipmap.destroy();
-		faceBuffer.destroy();
+		faceDescriptor.destroy();
 		manager.destroy();
 	}
 
@@ -338,7 +335,8 @@ public:
 		double t = VK::Timer::Time();
 		VK::Window::onSize(nWidth, nHeight);
 
-		// Destroy everything that relies on the swapchain
+		// Destroy everything that relies on the swapchain (it's all deferred until the frames in flight are done with it,
+		// so there's no need to wait for the GPU to go idle)
 		manager.cleanup();
 		guiPass.destroy();
 		graphicsPass.destroy();
@@ -351,18 +349,23 @@ public:
 
 		// Rebuild everything that relies on the swapchain
 		depth.createDepth(nWidth, nHeight);
-		color.createTexture(vk.getSurfaceFormat().format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nWidth, nHeight, 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		normal.createTexture(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nWidth, nHeight, 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-		color.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-		normal.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-		std::vector<VK::Image*> graphicsImages = { &color, &normal };
-		graphicsPass.create(graphicsImages, &depth, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR);
-
-		// The gui pass only writes to the primary color buffer (some techniques use the depth buffer)
-		std::vector<VK::Image*> guiImages = { &color };
-		guiPass.create(guiImages, &depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_LOAD_OP_LOAD);
+		if (presentCopy) {
+			color.createTexture(vk.getSurfaceFormat().format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, nWidth, nHeight, 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+			std::vector<VK::Image*> graphicsImages = { &color, &normal };
+			graphicsPass.create(graphicsImages, &depth, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+			// The gui pass only writes to the primary color buffer (some techniques use the depth buffer)
+			std::vector<VK::Image*> guiImages = { &color };
+			guiPass.create(guiImages, &depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_LOAD_OP_LOAD);
+		} else {
+			// The same passes, with the swapchain image in place of color (the gui pass leaves it ready to present)
+			std::vector<VK::Image*> graphicsImages = { &normal };
+			graphicsPass.createSwapchain(graphicsImages, &depth, false, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR);
+			std::vector<VK::Image*> guiImages;
+			guiPass.createSwapchain(guiImages, &depth, true, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_LOAD_OP_LOAD);
+		}
 
 		manager.reinit(guiPass, nWidth, nHeight);
 		//VK::ShaderTechnique *pPlanet = manager.getTechnique("TweakPlanet");
@@ -374,218 +377,55 @@ public:
 			pPlanetFace->buildPipeline(graphicsPass, pipelineLayout);
 
 		lastLogTime = VK::Timer::Time();
+		lastWaitTime = vk.getWaitTime();
 		frameCount = 0;
 		m_fFrameTime = 0.0f;
 		m_dLastFrame = lastLogTime;
 		VKLogNotice("onSize - %lf seconds", VK::Timer::Time() - t);
+		vk.getAllocator().logStats();
+		vk.getDescriptors().logStats();
 	}
 
-	virtual void onIdle() {
-		// Get the current time and the amount of time it took to draw the previous frame
-		double dNow = VK::Timer::Time();
-		m_fFrameTime = (float)(dNow - m_dLastFrame);
-		m_dLastFrame = dNow;
-
-		// Update the camera position
-		//manager.update(1.0f);
-		updateCamera();
-		manager.setViewMatrix(camera.viewMatrix()); //camera.relativeViewMatrix();
-
-		// Determine the patches we need to draw for the planet
-		VK::vec3 v = camera.pos - VK::vec3(0, 0, 0); // Camera pos relative to planet (currently at origin)
-		int ix, iy; // (0,0) = NW corner and (1<<24, 1<<24) = SE corner
-		int front = CubeFace::GetFaceCoordinates(CubeFace::to_i(v), ix, iy);
-		double dx = CubeFace::to_f(ix), dy = CubeFace::to_f(iy); // (0,0) = NW corner and (1,1) = SE corner
-		float dist = camera.pos.mag() - 1.0f;
-
-		// Calculate the smallest delta needed to shift the bottom level:
-		// If level 0 has 64x64 quads and there are 16 levels, the bottom level has (64<<15) x (64<<15) quads.
-		// However, x and y values go from -1.0 to 1.0, so divide by 2 to get 32 on each side of 0.0.
-		// Then divide by 2 again because we can't shift by 1 quad. We have to shift by 1 parent quad (a block of 2x2 in the child).
-		const int MaxScale = NodeWidth << (MaxLevels - 2);
-		VK::ivec2 frontPos((int)(dx * MaxScale), (int)(dy * MaxScale)); // Cast to fixed-precision int based on max depth
-
-		int instance = 0;
-		int levels = MaxLevels;
-		uint8_t neighborLevels[MaxLevels] = { 0 };
-		faceData[instance].vHole = VK::vec4(-1, -1, -1, -1); // Instance 0 is the lowest level, so it has no hole.
-		for (int level = levels - 1, factor = 1; level > 0; level--, factor <<= 1) {
-			float f = 1.0f * powf(0.5f, (float)level);
-			VK::ivec2 iPos = frontPos / factor;
-			faceData[instance].iFace = VK::ivec4(front, level, 0, 0);
-			faceData[instance].vCorners = VK::vec4(((float)(iPos.x - NodeFourth) / NodeHalf)*f, ((float)(iPos.y - NodeFourth) / NodeHalf)*f, ((float)(iPos.x + NodeFourth) / NodeHalf)*f, ((float)(iPos.y + NodeFourth) / NodeHalf)*f);
-
-			if (dist > f*2.0f)
-				continue;
-
-			// Set bit flag for which neighbors have to render levels deeper than level 0
-			if (faceData[instance].vCorners.x < -0.001f)
-				neighborLevels[level] |= 1 << LeftEdge;
-			if (faceData[instance].vCorners.y < -0.001f)
-				neighborLevels[level] |= 1 << TopEdge;
-			if (faceData[instance].vCorners.z > 1.001f)
-				neighborLevels[level] |= 1 << RightEdge;
-			if (faceData[instance].vCorners.w > 1.001f)
-				neighborLevels[level] |= 1 << BottomEdge;
-
-			// When the camera is directly over the center of a face, all holes in parent nodes for rendering child nodes are centered.
-			// Imagine the leaf moving 1 quad to the right. None of the parent nodes move. The hole inside its parent shifts right 1.
-			// Imagine the leaf moving to to the right again, causing the parent to shift right 1. This puts the hole for the leaf
-			// node back to the center of its parent, and the hole in the grand-parent has to shift right 1 for the parent node.
-			// So for most levels, the hole is always either dead center or off by 1 in any direction (N, S, E, W, NE, SE, SW, NW).
-			// However, level 0 doesn't move, so the hole in it for level 1 can move ANYWHERE within its parent. It can even go off
-			// the edge of the cube face (it needs to be rendered on the neighboring face to avoid cracks in the mesh).
-			int xoff = 0, yoff = 0;
-			if (level == 1) {
-				xoff = iPos.x - NodeHalf;
-				yoff = iPos.y - NodeHalf;
-			} else {
-				xoff = (iPos.x & 1) == 0 ? 0 : iPos.x > 0 ? 1 : -1;
-				yoff = (iPos.y & 1) == 0 ? 0 : iPos.y > 0 ? 1 : -1;
-			}
-
-			// We use calculations from each child node to calculate the hole for its parent node
-			// The hole is based on vertex position, which goes from (0,0) in the NW corner to (64, 64) in the SE corner
-			faceData[++instance].vHole = VK::vec4((float)(NodeFourth + xoff), (float)(NodeFourth + yoff), (float)(3 * NodeFourth + xoff), (float)(3 * NodeFourth + yoff));
-		}
-		faceData[instance].iFace = VK::ivec4(front, 0, 0, 0);
-		faceData[instance].vCorners = VK::vec4(0, 0, 1, 1); // Level 0 never moves. It always goes from (0,0) to (1,1)
-		++instance;
-
-		// In addition to the face beneath the camera, we need to render its 4 neighbors. We do not need to render the opposite face.
-		// In theory from some angles we can get away with rendering 3 neighbor faces instead of 4, but the performance savings may
-		// not be enough to justify the added complexity.
-		uint8_t neighborFace[4];
-		VK::ivec2 neighborPos[4];
-		for (int edge = 0; edge < 4; edge++) {
-			neighborFace[edge] = front;
-			double x = dx, y = dy;
-			CubeFace::GetNeighborCoordinates(edge, neighborFace[edge], x, y);
-			neighborPos[edge] = VK::ivec2((int)(x * MaxScale), (int)(y * MaxScale)); // Cast to fixed-precision int based on max depth
-		}
-
-		for (int edge = 0; edge < 4; edge++) {
-			uint8_t face = neighborFace[edge];
-
-			faceData[instance].vHole = VK::vec4(-1, -1, -1, -1); // The lowest level (or leaf) of any neighboring face has no hole in the middle
-			for (int level = MaxLevels - 1, factor = 1; level > 0; level--, factor <<= 1) {
-				if ((neighborLevels[level] & (1 << edge)) == 0)
-					continue;
-
-				float f = 1.0f * powf(0.5f, (float)level);
-				VK::ivec2 iPos = neighborPos[edge] / factor;
-				VK::vec4 test = VK::vec4(((float)(iPos.x - NodeFourth) / NodeHalf)*f, ((float)(iPos.y - NodeFourth) / NodeHalf)*f, ((float)(iPos.x + NodeFourth) / NodeHalf)*f, ((float)(iPos.y + NodeFourth) / NodeHalf)*f);
-
-				// Check to see if any other neighbor is also rendering this level.
-				// If so and it comes closer to the center of that face, we need to extend it farther
-				// out on this face to avoid cracks in the mesh at the corners where 3 cube faces meet.
-				for (int edge2 = 0; edge2 < 4; edge2++) {
-					if (edge2 == edge || (neighborLevels[level] & (1 << edge2)) == 0)
-						continue;
-					const int Mid = MaxScale / factor / 2;
-					VK::ivec2 iPos2 = neighborPos[edge2] / factor;
-					int ox = VK::Math::Abs(Mid - iPos.x); // Find how far outside the current face x is
-					int oy = VK::Math::Abs(Mid - iPos.y); // Find how far outside the current face y is
-					int ox2 = VK::Math::Abs(Mid - iPos2.x); // Do the same for this neighbor
-					int oy2 = VK::Math::Abs(Mid - iPos2.y); // Do the same for this neighbor
-					int max2 = VK::Math::Max(ox2, oy2);
-					if (ox > oy && max2 < ox) {
-						iPos.x -= iPos.x > Mid ? (ox - max2) : (max2 - ox);
-					} else if (oy > ox && max2 < oy) {
-						iPos.y -= iPos.y > Mid ? (oy - max2) : (max2 - oy);
-					}
-					test = VK::vec4(((float)(iPos.x - NodeFourth) / NodeHalf)*f, ((float)(iPos.y - NodeFourth) / NodeHalf)*f, ((float)(iPos.x + NodeFourth) / NodeHalf)*f, ((float)(iPos.y + NodeFourth) / NodeHalf)*f);
-				}
-
-				// Yes, I know copy+paste code is bad
-				int xoff = 0, yoff = 0;
-				if (level == 1) {
-					xoff = iPos.x - NodeHalf;
-					yoff = iPos.y - NodeHalf;
-				} else {
-					xoff = (iPos.x & 1) == 0 ? 0 : iPos.x > 0 ? 1 : -1;
-					yoff = (iPos.y & 1) == 0 ? 0 : iPos.y > 0 ? 1 : -1;
-				}
-				faceData[instance].iFace = VK::ivec4(face, level, 0, 0);
-				faceData[instance].vCorners = test;
-				faceData[++instance].vHole = VK::vec4((float)(NodeFourth + xoff), (float)(NodeFourth + yoff), (float)(3 * NodeFourth + xoff), (float)(3 * NodeFourth + yoff));
-			}
-
-			// Finally we finish up level 0 for this neighbor face
-			faceData[instance].iFace = VK::ivec4(face, 0, 0, 0);
-			faceData[instance].vCorners = VK::vec4(0, 0, 1, 1); // Level 0 never moves. It always goes from (0,0) to (1,1)
-			++instance;
-		}
-
-		color.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-		normal.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-		VK::ShaderTechnique *p;
-
-/*
-		if (m_bUpdate && (p = manager.getTechnique("TweakPlanet")) != NULL) {
-			VK::Plane plane;
-			VK::vec3 normal(real_random(gen), real_random(gen), real_random(gen));
-			float f = real_random(gen);
-			plane.init(normal.normalize(), f * 0.5f);
-			VK::vec4 v(plane.normal, plane.constant);
-			vkCmdPushConstants(vk, sceneOnlyLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 16, &v);
-			
-			VK::Viewport viewport((float)TestWidth, (float)TestWidth);
-			VK::Rect2D scissor(TestWidth, TestWidth);
-			VK::RenderPassBeginInfo planetBegin(planetPass, planetPass, scissor);
-			vkCmdBeginRenderPass(vk, &planetBegin, VK_SUBPASS_CONTENTS_INLINE);
-			vkCmdSetScissor(vk, 0, 1, &scissor);
-			vkCmdSetViewport(vk, 0, 1, &viewport);
-
-			VkDescriptorSet descriptorSets[] = { manager.getSceneBuffer() };
-			vkCmdBindDescriptorSets(vk, VK_PIPELINE_BIND_POINT_GRAPHICS, sceneOnlyLayout, 0, 1, descriptorSets, 0, NULL);
-			vkCmdBindPipeline(vk, VK_PIPELINE_BIND_POINT_GRAPHICS, *p);
-			vkCmdDraw(vk, 6, 1, 0, 0);
-			vkCmdEndRenderPass(vk);
-		}
-*/
-		vk.flush();
-
-		std::vector<VkClearValue> clearValues = { { 0.0f, 0.1f, 0.0f, 0.0f },{ 0.0f, 0.0f, 0.0f, 0.0f },{ 1.0f, 0 } };
-
-		VkCommandBuffer cmd;
-		VK::CommandBufferAllocateInfo bufferInfo(vk, 1);
-		VK::CommandBufferBeginInfo cmdBeginInfo(0);
-		vkAllocateCommandBuffers(vk, &bufferInfo, &cmd);
-		vkBeginCommandBuffer(cmd, &cmdBeginInfo);
-
+	// Records the planet pass into a secondary command buffer (on whichever thread the pool runs it on)
+	VkCommandBuffer recordPlanets(int planetCount, int instance) {
+		VkCommandBuffer cmd = vk.beginSecondary(graphicsPass, graphicsPass);
 		VK::Viewport viewport(m_nWidth, m_nHeight);
 		VK::Rect2D scissor(m_nWidth, m_nHeight);
 		vkCmdSetScissor(cmd, 0, 1, &scissor);
 		vkCmdSetViewport(cmd, 0, 1, &viewport);
 
-		VK::RenderPassBeginInfo graphicsBegin(graphicsPass, graphicsPass, scissor, &clearValues);
-		vkCmdBeginRenderPass(cmd, &graphicsBegin, VK_SUBPASS_CONTENTS_INLINE);
-
-		if (p = manager.getTechnique("PlanetFace")) {
+		VK::ShaderTechnique *p = manager.getTechnique("PlanetFace");
+		if (p) {
 			VkDeviceSize offsets[1] = { 0 };
 			VkBuffer buffers[] = { vboClipmap };
 			vkCmdBindVertexBuffers(cmd, 0, 1, buffers, offsets);
 			vkCmdBindIndexBuffer(cmd, iboClipmap, 0, VK_INDEX_TYPE_UINT16);
 
-			VkDescriptorSet descriptorSets[] = { manager.getSceneBuffer(), faceBuffer, iHeight };
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, 0, NULL);
+			uint32_t nFaceOffset = 0;
+			uint8_t *pFaces = manager.getRingBuffer().allocate(sizeof(planetData) + sizeof(faceData), nFaceOffset);
+			memcpy(pFaces, planetData, sizeof(VK::PlanetData) * planetCount);
+			memcpy(pFaces + sizeof(planetData), faceData, sizeof(VK::PlanetFaceData) * instance);
+			VkDescriptorSet descriptorSets[] = { manager.getSceneDescriptor(), faceDescriptor, iHeight };
+			uint32_t dynamicOffsets[] = { manager.getSceneOffset(), nFaceOffset }; // One for each dynamic buffer, in set order
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, 2, dynamicOffsets);
 
 			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, *p);
 			vkCmdDrawIndexed(cmd, iboClipmap.getSize() / sizeof(uint16_t), instance, 0, 0, 0);
-			faceBuffer.update(faceData, 0, sizeof(VK::PlanetFaceData) * instance);
 		}
+		vkEndCommandBuffer(cmd);
+		return cmd;
+	}
 
-		vkCmdEndRenderPass(cmd);
-
-		VK::RenderPassBeginInfo guiBegin(guiPass, guiPass, scissor, NULL);
-		vkCmdBeginRenderPass(cmd, &guiBegin, VK_SUBPASS_CONTENTS_INLINE);
+	// Records the GUI and text into a secondary command buffer (the manager batches them, so they're recorded together)
+	VkCommandBuffer recordGUI(const char *text) {
+		VkCommandBuffer cmd = vk.beginSecondary(guiPass, guiPass);
+		VK::Viewport viewport(m_nWidth, m_nHeight);
+		VK::Rect2D scissor(m_nWidth, m_nHeight);
+		vkCmdSetScissor(cmd, 0, 1, &scissor);
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
 
 		manager.begin(cmd);
 
-		static char text[256] = { 0 };
-
 		VK::GUIData gui;
 
 		//gui.vGUIRect = VK::vec4(0, 0, m_nWidth, m_nHeight);
@@ -614,19 +454,116 @@ public:
 		//manager.addText(cmd, "arial1", "This is a test of the emergency broadcast system! If this had been a real emergency...", VK::vec2(5, 5), VK::vec4(0.8f, 0.8f, 0.8f, 1), 8.5f, VK::Font::AlignXLeft, VK::Font::AlignYBottom);
 
 		manager.end();
+		vkEndCommandBuffer(cmd);
+		return cmd;
+	}
 
+	virtual void onIdle() {
+		// Get the current time and the amount of time it took to draw the previous frame
+		double dNow = VK::Timer::Time();
+		m_fFrameTime = (float)(dNow - m_dLastFrame);
+		m_dLastFrame = dNow;
+
+		// Update the camera position
+		//manager.update(1.0f);
+		updateCamera();
+		VK::mat4 mView = camera.viewMatrix();
+		manager.setViewMatrix(mView); //camera.relativeViewMatrix();
+
+		// Determine the patches we need to draw for every planet, skipping the ones that are off-screen or below the horizon
+		int planetCount = 0;
+		int instance = planets.select(camera.pos, manager.getProjectionMatrix(), mView, PatchBudget, planetData, faceData, &planetCount, planetVisible);
+
+		// Upload the height map pages they need that aren't loaded yet (the ones that matter most first, up to the budget,
+		// and only once their tiles are in memory), then point each patch at its pages (or at the nearest ancestors that are loaded)
+		pages.begin();
+		PlanetSystem::requestPages(pages, planetVisible, faceData, instance);
+		if (pages.update(UploadBudget, &store) > 0)
+			uploadPages();
+		PlanetSystem::resolvePages(pages, planetVisible, faceData, instance);
+
+		// Load the tiles where the camera is heading after the ones it needs now, then hand the tile requests to the loader thread
+		if (velocity.mag() > 0.0f) {
+			const float PrefetchSeconds = 1.0f; // How far ahead to look
+			VK::Transform<float> ahead = camera;
+			ahead.translate(velocity * PrefetchSeconds);
+			int count = planets.select(ahead.pos, manager.getProjectionMatrix(), ahead.viewMatrix(), PatchBudget, prefetchPlanets, prefetchData);
+			for (int i = 0; i < count; i++) {
+				const VK::PlanetFaceData &d = prefetchData[i];
+				float x = VK::Math::Clamp((d.vCorners.x + d.vCorners.z) * 0.5f, 0.0f, 1.0f), y = VK::Math::Clamp((d.vCorners.y + d.vCorners.w) * 0.5f, 0.0f, 1.0f);
+				store.prefetch(NodeKey::FromCoordinates((uint8_t)d.iFace.x, (uint8_t)d.iFace.y, (int)(x * CubeFace::MaxCoord), (int)(y * CubeFace::MaxCoord)));
+			}
+		}
+		store.update();
+
+		if (presentCopy) {
+			VK::Barrier().image(color, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL).image(normal, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL).record(vk);
+		} else if (!vk.acquire()) {
+			vk.present(); // There's no swapchain image to draw into (i.e. it's out of date), but the uploads still need to be submitted
+			return;
+		}
+
+		static char text[256] = { 0 };
+		VkCommandBuffer cmd = vk; // This frame's command buffer (present() submits it)
+
+/*
+		if (m_bUpdate && (p = manager.getTechnique("TweakPlanet")) != NULL) {
+			VK::Plane plane;
+			VK::vec3 normal(real_random(gen), real_random(gen), real_random(gen));
+			float f = real_random(gen);
+			plane.init(normal.normalize(), f * 0.5f);
+			VK::vec4 v(plane.normal, plane.constant);
+			vkCmdPushConstants(vk, sceneOnlyLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 16, &v);
+			
+			VK::Viewport viewport((float)TestWidth, (float)TestWidth);
+			VK::Rect2D scissor(TestWidth, TestWidth);
+			VK::RenderPassBeginInfo planetBegin(planetPass, planetPass, scissor);
+			vkCmdBeginRenderPass(vk, &planetBegin, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetScissor(vk, 0, 1, &scissor);
+			vkCmdSetViewport(vk, 0, 1, &viewport);
+
+			VkDescriptorSet descriptorSets[] = { manager.getSceneDescriptor() };
+			uint32_t offsets[] = { manager.getSceneOffset() };
+			vkCmdBindDescriptorSets(vk, VK_PIPELINE_BIND_POINT_GRAPHICS, sceneOnlyLayout, 0, 1, descriptorSets, 1, offsets);
+			vkCmdBindPipeline(vk, VK_PIPELINE_BIND_POINT_GRAPHICS, *p);
+			vkCmdDraw(vk, 6, 1, 0, 0);
+			vkCmdEndRenderPass(vk);
+		}
+*/
+		// The planet pass and the GUI pass are recorded into secondary command buffers on the thread pool at the same time,
+		// then this frame's command buffer runs them in order
+		VkCommandBuffer secondary[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+		std::exception_ptr exceptions[2];
+		VK::Thread::Pool::GetDefault().run(2, [&](int i) {
+			try {
+				secondary[i] = (i == 0) ? recordPlanets(planetCount, instance) : recordGUI(text);
+			} catch (...) {
+				exceptions[i] = std::current_exception(); // Rethrown on this thread below
+			}
+		});
+		for (int i = 0; i < 2; i++) {
+			if (exceptions[i])
+				std::rethrow_exception(exceptions[i]);
+		}
+
+		std::vector<VkClearValue> clearValues = { { 0.0f, 0.1f, 0.0f, 0.0f },{ 0.0f, 0.0f, 0.0f, 0.0f },{ 1.0f, 0 } };
+		VK::Rect2D scissor(m_nWidth, m_nHeight);
+		VK::RenderPassBeginInfo graphicsBegin(graphicsPass, graphicsPass, scissor, &clearValues);
+		vkCmdBeginRenderPass(cmd, &graphicsBegin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(cmd, 1, &secondary[0]);
 		vkCmdEndRenderPass(cmd);
-		vkEndCommandBuffer(cmd);
 
-		VK::SubmitInfo submitInfo(&cmd);
-		vkQueueSubmit(vk, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(vk);
-		vkDeviceWaitIdle(vk);
-		vkFreeCommandBuffers(vk, vk, 1, &cmd);
+		VK::RenderPassBeginInfo guiBegin(guiPass, guiPass, scissor, NULL);
+		vkCmdBeginRenderPass(cmd, &guiBegin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(cmd, 1, &secondary[1]);
+		vkCmdEndRenderPass(cmd);
 
-		color.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-		normal.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-		vk.present(color);
+		if (presentCopy) {
+			VK::Barrier().image(color, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL).image(normal, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL).record(vk);
+			vk.present(color);
+		} else {
+			vk.present();
+		}
 
 		++frameCount;
 		double t = VK::Timer::Time();
@@ -634,28 +571,29 @@ public:
 			//buttonState *= -1;
 
 			sprintf(text, "%u FPS", frameCount);
-			VKLogNotice("Frames per second: %u (save time %lf)", frameCount, (t - lastLogTime));
+			double dWait = vk.getWaitTime();
+			VKLogNotice("Frames per second: %u (save time %lf, waited %lf for the GPU)", frameCount, (t - lastLogTime), dWait - lastWaitTime);
 			lastLogTime = t;
+			lastWaitTime = dWait;
 
 #if 0
 			VK::Image staging;
 			staging.createTexture(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, m_nWidth, m_nHeight);
-			staging.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+			staging.setLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 			VK::ImageCopy copy_region(m_nWidth, m_nHeight);
 			vkCmdCopyImage(vk, color, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-			staging.setLayout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-			vk.flush(); // Wait for the copy command to complete before the staging texture goes out of scope!
+			staging.setLayout(VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+			vk.flush(true); // Wait for the copy command to complete before the staging texture goes out of scope!
 
 			VkImageSubresource subres = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
 			VkSubresourceLayout sublayout;
 			vkGetImageSubresourceLayout(vk, staging, &subres, &sublayout);
-			uint8_t *data = NULL;
-			if (VK_SUCCESS == vkMapMemory(vk, staging, 0, staging.getAllocationInfo().allocationSize, 0, (void **)&data)) {
+			uint8_t *data = staging.getAllocation().pData + sublayout.offset;
+			{
 				VK::PixelBuffer<uint8_t> pb;
 				pb.create(m_nWidth, m_nHeight, 1, 3);
 				uint8_t *bytes = new uint8_t[sublayout.rowPitch * m_nHeight];
 				memcpy(bytes, data, sublayout.rowPitch * m_nHeight);
-				vkUnmapMemory(vk, staging);
 
 				data = bytes;
 				for (uint16_t y = 0; y < pb.getHeight(); y++) {
@@ -680,6 +618,41 @@ public:
 		}
 	}
 
+	// Fills in the pages the cache just assigned and copies them to their layers in iHeight
+	// (on this frame's command buffer, so they're there before its draw, from this frame's staging buffer)
+	void uploadPages() {
+		VK::BufferObject &staging = pageStaging[vk.getFrameIndex()];
+		const std::vector<PageCache::Load> &loads = pages.getLoads();
+		std::vector<VkBufferImageCopy> regions(loads.size());
+		uint8_t *data = staging.getMappedData(); // Host-visible buffers stay mapped
+		for (size_t i = 0; i < loads.size(); i++) {
+			store.fillPage(loads[i].key.node, (float *)(data + i * PageBytes)); // The store said it was ready in pages.update()
+			VkBufferImageCopy &region = regions[i];
+			memset(&region, 0, sizeof(region));
+			region.bufferOffset = i * PageBytes;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.baseArrayLayer = loads[i].nPage;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent.width = region.imageExtent.height = HeightMapWidth;
+			region.imageExtent.depth = 1;
+		}
+
+		// Only the layers being replaced have to wait for the frames in flight to stop sampling them (the pages are
+		// sorted so neighboring layers share a barrier), and only the shaders that sample them wait for the copy
+		std::vector<uint32_t> layers(loads.size());
+		for (size_t i = 0; i < loads.size(); i++)
+			layers[i] = loads[i].nPage;
+		std::sort(layers.begin(), layers.end());
+		VK::Barrier barrier;
+		for (size_t i = 0; i < layers.size(); i++)
+			barrier.image(iHeight, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, 0, layers[i], 1);
+		barrier.record(vk);
+		vkCmdCopyBufferToImage(vk, staging, iHeight, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), &regions[0]);
+		for (size_t i = 0; i < layers.size(); i++)
+			barrier.image(iHeight, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, layers[i], 1);
+		barrier.record(vk);
+	}
+
 	virtual void onKeyDown(uint16_t nKey) {
 		VK::ShaderTechnique *p = NULL;
 		switch (nKey) {
@@ -689,6 +662,7 @@ public:
 			case 'P':
 				p = manager.getTechnique("PlanetFace");
 				if (p && p->isValid()) {
+					// The old pipeline is destroyed once the frames in flight are done with it
 					p->setFillMode(p->getFillMode() == VK_POLYGON_MODE_FILL ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL);
 					p->buildPipeline(graphicsPass, pipelineLayout);
 				}
@@ -744,175 +718,81 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine,
 	VK::Timer::Init();
 	VK::Logger logger;
 
-	VK::Noise noise;
-	noise.init(3, 12345);
-	std::vector<VK::vec3> vectors[6];
-	for (int face = 0; face < 6; face++) {
-		vectors[face].resize(TestWidth * TestWidth);
-		window.pbHeight[face].create(TestWidth, TestWidth, 1, 4);
-		window.pbHeight[face] = 0;
-		int n = 0;
-		float y = 0.0f; // y goes from top to bottom
-		for (int i = 0; i < TestWidth; i++) {
-			float yy = y*y;
-			float x = 0.0f; // x goes from left to right
-			for (int j = 0; j < TestWidth; j++) {
-				VK::dvec3 dVec = CubeFace::GetPlanetaryVector(face, x, y);
-				vectors[face][n++] = dVec.normalize();
-				x += 1.0f / (TestWidth - 1);
-			}
-			y += 1.0f / (TestWidth - 1);
-		}
-	}
-
-#define VORONOI_CELLS 10
-	// Generate random centers of "plates" (which will be treated like Voronoi cells)
-	VK::vec3 plates[VORONOI_CELLS], push[VORONOI_CELLS];
-	for (int i = 0; i < VORONOI_CELLS; i++)
-		plates[i] = VK::vec3(real_random(gen), real_random(gen), real_random(gen)).normalize();
-
-	// Run a number of passes to push the centers apart to try to keep them fairly evenly spaced.
-	for (int pass = 0; pass < 100; pass++) {
-		for (int i = 0; i < VORONOI_CELLS; i++)
-			push[i].x = push[i].y = push[i].z = 0;
-		for (int i = 0; i < VORONOI_CELLS; i++) {
-			for (int j = 0; j < VORONOI_CELLS; j++) {
-				if (j == i)
-					continue;
-				float dist2 = plates[i].dist2(plates[j]);
-				if (dist2 < 0.01f) // Set a min on dist2 to keep the push vector from going to inf
-					dist2 = 0.01f;
-				push[i] += (plates[i] - plates[j]) / dist2;
-			}
+	// Optionally check the batch CubeFace methods against the single versions and time them (i.e. "VKTest.exe -benchmark"),
+	// and/or run the self-checks (i.e. "VKTest.exe -test"). Either one exits when it's done (with 1 if any check failed),
+	// so they don't need a GPU and can be run from a script.
+	bool benchmark = strstr(pCmdLine, "-benchmark") != NULL, test = strstr(pCmdLine, "-test") != NULL;
+	if (benchmark || test) {
+		bool passed = true;
+		if (benchmark) {
+			passed &= CubeFace::Benchmark(1 << 22);
+			PlanetLOD::Benchmark(1 << 20);
+			PlanetSystem::Benchmark(48, 1 << 12);
+			NormalMap::Benchmark(513);
 		}
-		for (int i = 0; i < VORONOI_CELLS; i++) {
-			push[i] *= 0.01f / push[i].mag();
-			plates[i] = (plates[i] + push[i]).normalize();
+		if (test) {
+			passed &= NodeKey::Test();
+			passed &= PlanetLOD::Test();
+			passed &= PlanetSystem::Test();
+			passed &= PageCache::Test();
+			passed &= TileStore::Test();
+			passed &= PlanetGraph::Test();
+			passed &= NormalMap::Test();
+			passed &= VK::MemoryAllocator::Test();
 		}
+		if (!passed)
+			VKLogError("Some of the checks failed");
+		return passed ? 0 : 1;
 	}
 
-	// Find the "plate" each texel on the height map belongs to using Voronoi distance checks
-	for (int face = 0; face < 6; face++) {
-		VK::vec4 *pv = (VK::vec4 *)window.pbHeight[face][0];
-		for (int n = 0; n < TestWidth*TestWidth; n++) {
-			float dist = 1e+10f;
-			pv[n].w = -1;
-
-			// Add a little noise to each position to avoid perfectly straight plate edges
-			VK::vec3 v = vectors[face][n] * 4.0;
-			v += noise.noise(&v.x) * 0.25f;
-			v = v.normalize();
-			for (int i = 0; i < VORONOI_CELLS; i++) {
-				float d = plates[i].dist2(v);
-				if (d < dist) {
-					dist = d;
-					pv[n].w = (float)i;
-				}
-			}
+	// The planet is generated from a seed, the number of plates and faults, and the number of tectonics steps and erosion iterations
+	// (i.e. "VKTest.exe -seed 7 -plates 12 -faults 20 -tectonics 1000 -erosion 500").
+	const char *pszSeed = strstr(pCmdLine, "-seed"), *pszPlates = strstr(pCmdLine, "-plates"), *pszFaults = strstr(pCmdLine, "-faults");
+	const char *pszTectonics = strstr(pCmdLine, "-tectonics"), *pszErosion = strstr(pCmdLine, "-erosion");
+	PlanetParams params = PlanetParams::Random(TestWidth, pszSeed ? (uint32_t)atoi(pszSeed + 5) : 12345,
+		pszPlates ? VK::Math::Max(1, atoi(pszPlates + 7)) : 10, pszFaults ? atoi(pszFaults + 7) : 10);
+	params.nTectonicsSteps = pszTectonics ? atoi(pszTectonics + 10) : 0;
+	params.nErosionSteps = pszErosion ? atoi(pszErosion + 8) : 0;
+
+	// The planet only has to be generated once. After that, its tiles are streamed in from the store as they come into view.
+	// Generate it again if the store is missing or was written from different parameters, or if asked to (i.e. "VKTest.exe -regenerate").
+	// Each stage's output is cached per tile, so only the stages and tiles a changed parameter affects have to run again.
+	PlanetGraph graph;
+	graph.addDefaultStages();
+	uint64_t nPlanetHash = graph.getHash(params);
+	VK::Path storePath = VK::Path::Root() + "planet.db";
+	bool regenerate = strstr(pCmdLine, "-regenerate") != NULL;
+	if (regenerate || !window.store.open(storePath, TestWidth, nPlanetHash)) {
+		double t = VK::Timer::Time();
+		graph.open(VK::Path::Root() + "planet.cache.db");
+		if (regenerate)
+			graph.clear();
+		{
+			VK::PixelBuffer<float> pbHeight[6];
+			graph.run(params, pbHeight);
+			TileStore::Write(storePath, pbHeight, nPlanetHash);
 		}
+		VKLogInfo("Generated the planet in %.2f seconds", VK::Timer::Time() - t);
+		if (!window.store.open(storePath, TestWidth, nPlanetHash))
+			VKLogError("Failed to open %s (the planet will be flat)", storePath.c_str());
 	}
 
-	//srand(12345);
-	int up = 0, down = 0;
-	VK::Plane plane;
-	for (int i = 0; i < 10; i++) {
-		//VK::vec3 normal((rand() - RAND_MAX/2) / (float)RAND_MAX, (rand() - RAND_MAX / 2) / (float)RAND_MAX, (rand() - RAND_MAX / 2) / (float)RAND_MAX);
-		//float f = (rand() - RAND_MAX / 2) / (float)RAND_MAX;
-		VK::vec3 normal(real_random(gen), real_random(gen), real_random(gen));
-		float f = real_random(gen);
-
-		plane.init(normal.normalize(), 0);
-		for (int face = 0; face < 6; face++) {
-			VK::vec4 *pv = (VK::vec4 *)window.pbHeight[face][0];
-			for (int n = 0; n < TestWidth*TestWidth; n++) {
-				float d = plane.distance(vectors[face][n]);
-				if (d > 0) {
-					pv[n].x += 1;
-					++up;
-				} else {
-					pv[n].x -= 1;
-					++down;
-				}
-			}
-		}
-		if ((i % 1000) == 0) {
-			VKLogInfo("up(%d), down(%d)", up, down);
-			up = down = 0;
+	// The planet is at the origin with a radius of 1. Optionally scatter some moons around it (i.e. "VKTest.exe -moons 24").
+	window.planets.add(VK::vec3(0, 0, 0), 1.0f);
+	const char *pszMoons = strstr(pCmdLine, "-moons");
+	if (pszMoons) {
+		std::uniform_real_distribution<float> orbit(3.0f, 30.0f), size(0.05f, 0.3f);
+		int moons = VK::Math::Min(atoi(pszMoons + 6), PlanetSystem::MaxPlanets - 1);
+		for (int i = 0; i < moons; i++) {
+			VK::vec3 dir = VK::vec3(real_random(gen), real_random(gen), real_random(gen)).normalize();
+			window.planets.add(dir * orbit(gen), size(gen));
 		}
 	}
-
-	float total = 0;
-	for (int face = 0; face < 6; face++) {
-		VK::vec4 *pv = (VK::vec4 *)window.pbHeight[face][0];
-		for (int n = 0; n < TestWidth*TestWidth; n++)
-			total += pv[n].x;
-	}
-	float avg = ((total / (TestWidth*TestWidth * 6)) * 0.9f);
-	for (int face = 0; face < 6; face++) {
-		VK::vec4 *pv = (VK::vec4 *)window.pbHeight[face][0];
-		for (int n = 0; n < TestWidth*TestWidth; n++)
-			pv[n].x -= avg;
-	}
-
-	typedef std::vector<VK::ivec3> CoastLine;
-	typedef std::vector<CoastLine> LandMasses;
-	LandMasses land;
-	for (int face = 0; face < 6; face++) {
-		for (int y = 0; y < TestWidth; y++) {
-			for (int x = 0; x < TestWidth; x++) {
-				VK::vec4 *pv = (VK::vec4 *)window.pbHeight[face](x, y);
-				float h = pv->x; // The height of this point
-				float l = pv->y; // The land mass index already assigned to this point
-				if (h > 0 && l == 0) {
-					land.push_back(CoastLine());
-					pv->y = l = (float)land.size();
-					CoastLine &coast = land.back();
-					CoastLine stack;
-					stack.push_back(VK::ivec3(x, y, face));
-					while (!stack.empty()) {
-						CoastLine next_stack;
-
-						while (!stack.empty()) {
-							bool land_locked = true;
-							VK::ivec3 current = stack.back();
-							stack.pop_back();
-							VK::ivec3 v[8] = {
-								VK::ivec3(current.x - 1, current.y, current.z), // W
-								VK::ivec3(current.x + 1, current.y, current.z), // E
-								VK::ivec3(current.x, current.y - 1, current.z), // S
-								VK::ivec3(current.x, current.y + 1, current.z), // N
-								VK::ivec3(current.x - 1, current.y - 1, current.z), // SW
-								VK::ivec3(current.x - 1, current.y + 1, current.z), // NW
-								VK::ivec3(current.x + 1, current.y - 1, current.z), // SE
-								VK::ivec3(current.x + 1, current.y + 1, current.z), // NE
-							};
-							for (int i = 0; i < 8; i++) {
-								uint8_t nFace = v[i].z;
-								CubeFace::AdjustCoords(TestWidth - 1, nFace, v[i].x, v[i].y);
-								v[i].z = nFace;
-								VK::vec4 *pv = (VK::vec4 *)window.pbHeight[v[i].z](v[i].x, v[i].y);
-								if (pv->x > 0) {
-									if (pv->y == 0) {
-										pv->y = l;
-										next_stack.push_back(v[i]);
-									}
-								} else
-									land_locked = false;
-							}
-							if (!land_locked)
-								coast.push_back(current);
-						}
-						next_stack.swap(stack);
-					}
-
-				}
-			}
-		}
-	}
-
-	VKLogInfo("Final up(%d), down(%d), land masses(%d)", up, down, (int)land.size());
 	//exit(0);
 
+	// Both passes draw straight into the swapchain image, unless asked to draw into a separate color image and copy it (i.e. "VKTest.exe -copy")
+	window.presentCopy = strstr(pCmdLine, "-copy") != NULL;
+
 	try {
 		//VK::Profiler profiler("VKTest", 3);
 		VK::Context::Init();
@@ -920,6 +800,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine,
 		window.create(VK_API_VERSION_1_0, "VKTest", 800, 600, false);
 		window.Run();
 		window.destroy();
+		window.store.close();
 	} catch (const char *error) {
 		::MessageBox(NULL, error, "Aborting due to exception!", MB_OK);
 	}